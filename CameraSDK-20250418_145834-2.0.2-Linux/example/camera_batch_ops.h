@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CameraFileResult {
+    std::string path;
+    bool ok = false;
+    double ms = 0;
+};
+
+/**
+ * \brief deletes many camera files, normally with remove = [&](const std::string& path) { return cam->DeleteCameraFile(path); }.
+ * With the default window of 1 the files are deleted one after the other on the calling thread. A larger
+ * window calls remove from `window` threads at once, so that several requests are in flight on the session;
+ * this assumes remove is thread-safe, which the camera SDK does not document for one Camera, so it is opt-in.
+ * on_result (may be empty) is called once per file as soon as it is done, never concurrently.
+ * \return one result per path, in the same order
+ */
+inline std::vector<CameraFileResult> BatchDeleteCameraFiles(const std::vector<std::string>& paths,
+    const std::function<bool(const std::string& path)>& remove, int window = 1,
+    const std::function<void(const CameraFileResult& result)>& on_result = nullptr) {
+    std::vector<CameraFileResult> results(paths.size());
+    std::atomic<size_t> next{ 0 };
+    std::mutex result_mutex;
+    auto work = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            const auto start_time = std::chrono::steady_clock::now();
+            CameraFileResult& result = results[i];
+            result.path = paths[i];
+            result.ok = remove(paths[i]);
+            result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            if (on_result) {
+                std::lock_guard<std::mutex> lck(result_mutex);
+                on_result(result);
+            }
+        }
+    };
+
+    const size_t thread_count = std::min(paths.size(), static_cast<size_t>(std::max(1, window)));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; t++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "camera_http.h"
+
+struct CameraFileInfo {
+    std::string path;
+    // -1 when unknown
+    int64_t size = -1;
+    // last modification, unix seconds, -1 when unknown
+    int64_t mtime = -1;
+    // http status of the metadata request, 0 when the camera did not answer
+    int status = 0;
+};
+
+namespace camera_file_index_detail {
+    // "Sun, 06 Nov 1994 08:49:37 GMT", -1 if it can not be parsed
+    inline int64_t ParseHttpDate(const std::string& date) {
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        char month[4] = {};
+        std::tm tm{};
+        if (sscanf(date.c_str(), "%*3s, %d %3s %d %d:%d:%d", &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+            return -1;
+        }
+        const char* found = strstr(months, month);
+        if (!found || month[0] == 0) {
+            return -1;
+        }
+        tm.tm_mon = static_cast<int>(found - months) / 3;
+        tm.tm_year -= 1900;
+#ifdef WIN32
+        return static_cast<int64_t>(_mkgmtime(&tm));
+#else
+        return static_cast<int64_t>(timegm(&tm));
+#endif
+    }
+}
+
+/**
+ * \brief size and mtime of camera files with HEAD requests on one keep-alive connection to
+ * Camera::GetHttpBaseUrl(). Up to `window` requests are in flight before the first answer is read, so
+ * a thousand files cost a few round trips instead of a thousand. A dropped connection is reopened
+ * and the unanswered requests are sent again.
+ * \return one entry per path, in the same order
+ */
+inline std::vector<CameraFileInfo> StatCameraFiles(const std::string& base_url, const std::vector<std::string>& paths, int window = 32, int timeout_ms = 10000) {
+    std::vector<CameraFileInfo> infos(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        infos[i].path = paths[i];
+    }
+    HttpUrl url;
+    if (paths.empty() || !HttpUrl::Parse(base_url, url)) {
+        return infos;
+    }
+    HttpConnection connection(url.host, url.port, timeout_ms);
+    size_t sent = 0;
+    size_t received = 0;
+    int failures = 0;
+    while (received < paths.size() && failures < 3) {
+        if (!connection.IsConnected()) {
+            if (!connection.Connect()) {
+                break;
+            }
+            sent = received;
+        }
+        while (sent < paths.size() && sent - received < static_cast<size_t>(std::max(1, window))) {
+            if (!connection.SendRequest("HEAD", url.Target(paths[sent]))) {
+                break;
+            }
+            sent++;
+        }
+        HttpResponse response;
+        if (sent == received || !connection.ReadResponseHeader(response)) {
+            connection.Close();
+            failures++;
+            continue;
+        }
+        failures = 0;
+        CameraFileInfo& info = infos[received++];
+        info.status = response.status;
+        if (response.status == 200) {
+            info.size = response.content_length;
+            info.mtime = camera_file_index_detail::ParseHttpDate(response.Header("last-modified"));
+        }
+        if (!response.keep_alive) {
+            connection.Close();
+        }
+    }
+    return infos;
+}
+
+/**
+ * \class CameraFileIndex
+ * \brief A local copy of the camera's file list with size and mtime, persisted to a cache file.
+ * Update() takes a fresh GetCameraFilesList() result, finds the added and removed files in one pass
+ * and asks stat for the added ones, for the ones whose last stat failed and for the newest ones, which
+ * may still be growing while the camera records. A file whose size or mtime changed is logged again as
+ * added with its new metadata. Every change gets the next cursor value, so a consumer
+ * keeps the cursor of its last sync and ChangesSince(cursor) returns only what changed after it,
+ * O(changes) instead of O(files).
+ *
+ * The change log is compacted when it grows past twice the file count, a cursor older than the
+ * compaction gets a full listing with reset = true.
+ */
+class CameraFileIndex {
+public:
+    using StatFunction = std::function<std::vector<CameraFileInfo>(const std::vector<std::string>& paths)>;
+
+    struct Change {
+        // added, or its size or mtime changed
+        bool added;
+        // metadata of an added file, the last known one of a removed file
+        CameraFileInfo info;
+    };
+
+    struct ChangeSet {
+        uint64_t cursor = 0;
+        // the cursor was too old: changes lists every current file as added
+        bool reset = false;
+        std::vector<Change> changes;
+    };
+
+    explicit CameraFileIndex(const std::string& cache_path) : cache_path_(cache_path) {
+        Load();
+    }
+
+    size_t FileCount() const {
+        return files_.size();
+    }
+
+    /**
+     * \brief cursor after the latest change, pass it to ChangesSince() on the next sync
+     */
+    uint64_t Cursor() const {
+        return cursor_;
+    }
+
+    bool Lookup(const std::string& path, CameraFileInfo& info) const {
+        const auto it = files_.find(path);
+        if (it == files_.end()) {
+            return false;
+        }
+        info = it->second.info;
+        return true;
+    }
+
+    /**
+     * \brief applies a complete file list of the camera, stat (may be empty) is called once with the added files,
+     * the files without metadata and the files modified less than recent_s before the newest one
+     * \return the number of added, removed and changed files
+     */
+    size_t Update(const std::vector<std::string>& paths, const StatFunction& stat = nullptr, int64_t recent_s = 600) {
+        update_id_++;
+        std::vector<std::string> added;
+        std::vector<std::string> kept;
+        for (const auto& path : paths) {
+            auto it = files_.find(path);
+            if (it == files_.end()) {
+                added.push_back(path);
+            }
+            else if (it->second.seen != update_id_) {
+                it->second.seen = update_id_;
+                kept.push_back(path);
+            }
+        }
+
+        std::vector<std::string> removed;
+        for (const auto& file : files_) {
+            if (file.second.seen != update_id_) {
+                removed.push_back(file.first);
+            }
+        }
+        for (const auto& path : removed) {
+            AppendLog(path, false, files_[path].info);
+            files_.erase(path);
+        }
+
+        // mtimes are compared with the newest one on the camera's own clock, not with the host's
+        int64_t newest_mtime = -1;
+        for (const auto& file : files_) {
+            newest_mtime = std::max(newest_mtime, file.second.info.mtime);
+        }
+        std::vector<std::string> restat;
+        for (const auto& path : kept) {
+            const CameraFileInfo& info = files_[path].info;
+            if (info.status != 200 || info.size < 0 || (info.mtime >= 0 && info.mtime >= newest_mtime - recent_s)) {
+                restat.push_back(path);
+            }
+        }
+
+        std::vector<CameraFileInfo> infos;
+        if (stat && (!added.empty() || !restat.empty())) {
+            std::vector<std::string> stat_paths = added;
+            stat_paths.insert(stat_paths.end(), restat.begin(), restat.end());
+            infos = stat(stat_paths);
+        }
+        size_t changed = 0;
+        for (size_t i = 0; i < restat.size(); i++) {
+            if (added.size() + i >= infos.size() || infos[added.size() + i].status == 0) {
+                // the camera did not answer, the last metadata stays
+                continue;
+            }
+            CameraFileInfo info = infos[added.size() + i];
+            info.path = restat[i];
+            CameraFileInfo& current = files_[restat[i]].info;
+            if (info.status != current.status || info.size != current.size || info.mtime != current.mtime) {
+                current = info;
+                AppendLog(restat[i], true, info);
+                changed++;
+            }
+        }
+        for (size_t i = 0; i < added.size(); i++) {
+            if (files_.count(added[i])) {
+                // listed twice
+                continue;
+            }
+            Entry entry;
+            if (i < infos.size()) {
+                entry.info = infos[i];
+            }
+            entry.info.path = added[i];
+            entry.seen = update_id_;
+            AppendLog(added[i], true, entry.info);
+            files_[added[i]] = entry;
+        }
+        if (log_.size() > 2 * files_.size() + 1024) {
+            log_.clear();
+            log_base_ = cursor_;
+        }
+        return added.size() + removed.size() + changed;
+    }
+
+    ChangeSet ChangesSince(uint64_t cursor) const {
+        ChangeSet change_set;
+        change_set.cursor = cursor_;
+        if (cursor < log_base_ || cursor > cursor_) {
+            change_set.reset = true;
+            for (const auto& file : files_) {
+                change_set.changes.push_back(Change{ true, file.second.info });
+            }
+            return change_set;
+        }
+        // a file added and removed again after cursor is reported once, with its final state
+        std::unordered_map<std::string, size_t> positions;
+        auto it = std::lower_bound(log_.begin(), log_.end(), cursor + 1, [](const LogEntry& entry, uint64_t value) {
+            return entry.cursor < value;
+        });
+        for (; it != log_.end(); ++it) {
+            const auto position = positions.find(it->info.path);
+            if (position == positions.end()) {
+                positions[it->info.path] = change_set.changes.size();
+                change_set.changes.push_back(Change{ it->added, it->info });
+            }
+            else {
+                change_set.changes[position->second] = Change{ it->added, it->info };
+            }
+        }
+        return change_set;
+    }
+
+    /**
+     * \brief writes the cache file (tmp file, then rename)
+     */
+    bool Save() const {
+        const std::string tmp_path = cache_path_ + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::trunc);
+            out << "INSFILES1 " << cursor_ << " " << log_base_ << "\n";
+            for (const auto& file : files_) {
+                out << "F " << file.second.info.size << " " << file.second.info.mtime << " " << file.second.info.status << " " << file.first << "\n";
+            }
+            for (const auto& entry : log_) {
+                out << (entry.added ? "A " : "R ") << entry.cursor << " " << entry.info.size << " " << entry.info.mtime << " " << entry.info.status << " " << entry.info.path << "\n";
+            }
+            if (!out) {
+                return false;
+            }
+        }
+#ifdef WIN32
+        std::remove(cache_path_.c_str());
+#endif
+        return std::rename(tmp_path.c_str(), cache_path_.c_str()) == 0;
+    }
+
+private:
+    struct Entry {
+        CameraFileInfo info;
+        uint64_t seen = 0;
+    };
+
+    struct LogEntry {
+        uint64_t cursor;
+        bool added;
+        CameraFileInfo info;
+    };
+
+    void AppendLog(const std::string& path, bool added, const CameraFileInfo& info) {
+        LogEntry entry;
+        entry.cursor = ++cursor_;
+        entry.added = added;
+        entry.info = info;
+        entry.info.path = path;
+        log_.push_back(entry);
+    }
+
+    // the path is the rest of the line, it may contain spaces
+    static bool ReadInfo(std::istringstream& in, CameraFileInfo& info) {
+        if (!(in >> info.size >> info.mtime >> info.status)) {
+            return false;
+        }
+        in.get();
+        std::getline(in, info.path);
+        return !info.path.empty();
+    }
+
+    void Load() {
+        std::ifstream in(cache_path_);
+        std::string line;
+        std::string magic;
+        if (!std::getline(in, line) || !(std::istringstream(line) >> magic >> cursor_ >> log_base_) || magic != "INSFILES1") {
+            cursor_ = 0;
+            log_base_ = 0;
+            return;
+        }
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string type;
+            fields >> type;
+            if (type == "F") {
+                Entry entry;
+                if (ReadInfo(fields, entry.info)) {
+                    files_[entry.info.path] = entry;
+                }
+            }
+            else if (type == "A" || type == "R") {
+                LogEntry entry;
+                entry.added = type == "A";
+                if (fields >> entry.cursor && ReadInfo(fields, entry.info)) {
+                    log_.push_back(entry);
+                }
+            }
+        }
+    }
+
+    std::string cache_path_;
+    std::unordered_map<std::string, Entry> files_;
+    // ordered by cursor
+    std::vector<LogEntry> log_;
+    uint64_t cursor_ = 0;
+    // cursors below this were compacted away
+    uint64_t log_base_ = 0;
+    uint64_t update_id_ = 0;
+};
@@ -0,0 +1,447 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+/**
+ * A small HTTP/1.1 client for the camera's file server (Camera::GetHttpBaseUrl()), so file transfers
+ * and metadata requests can use keep-alive connections, Range requests and pipelining that the
+ * blocking per-file SDK calls do not expose. Plain http only, which is what the camera serves.
+ */
+namespace camera_http_detail {
+#ifdef WIN32
+    typedef SOCKET Socket;
+    const Socket kInvalidSocket = INVALID_SOCKET;
+
+    inline void CloseSocket(Socket socket) {
+        closesocket(socket);
+    }
+
+    inline void ShutdownSocket(Socket socket) {
+        shutdown(socket, SD_BOTH);
+    }
+
+    inline void InitSockets() {
+        static std::once_flag once;
+        std::call_once(once, []() {
+            WSADATA data;
+            WSAStartup(MAKEWORD(2, 2), &data);
+        });
+    }
+#else
+    typedef int Socket;
+    const Socket kInvalidSocket = -1;
+
+    inline void CloseSocket(Socket socket) {
+        close(socket);
+    }
+
+    inline void ShutdownSocket(Socket socket) {
+        shutdown(socket, SHUT_RDWR);
+    }
+
+    inline void InitSockets() {
+    }
+#endif
+
+    inline std::string ToLower(std::string value) {
+        std::transform(value.begin(), value.end(), value.begin(), [](char c) {
+            return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        });
+        return value;
+    }
+
+    inline std::string Trim(const std::string& value) {
+        const size_t begin = value.find_first_not_of(" \t");
+        if (begin == std::string::npos) {
+            return std::string();
+        }
+        const size_t end = value.find_last_not_of(" \t\r");
+        return value.substr(begin, end - begin + 1);
+    }
+}
+
+struct HttpUrl {
+    std::string host;
+    int port = 80;
+    // without a trailing '/'
+    std::string path;
+
+    /**
+     * \brief parses http://host[:port][/path]
+     */
+    static bool Parse(const std::string& url, HttpUrl& result) {
+        const std::string scheme = "http://";
+        if (url.compare(0, scheme.size(), scheme) != 0) {
+            return false;
+        }
+        const size_t host_begin = scheme.size();
+        const size_t path_begin = url.find('/', host_begin);
+        const std::string host_port = url.substr(host_begin, path_begin == std::string::npos ? std::string::npos : path_begin - host_begin);
+        const size_t colon = host_port.rfind(':');
+        result.host = host_port.substr(0, colon);
+        result.port = colon == std::string::npos ? 80 : std::atoi(host_port.c_str() + colon + 1);
+        result.path = path_begin == std::string::npos ? std::string() : url.substr(path_begin);
+        while (!result.path.empty() && result.path.back() == '/') {
+            result.path.pop_back();
+        }
+        return !result.host.empty() && result.port > 0;
+    }
+
+    /**
+     * \brief request target of a camera file path such as /DCIM/Camera01/VID_xxx.insv, percent-encoded
+     */
+    std::string Target(const std::string& file_path) const {
+        static const char hex[] = "0123456789ABCDEF";
+        HttpUrl absolute;
+        if (Parse(file_path, absolute)) {
+            // a full url of the same camera
+            const std::string absolute_path = absolute.path;
+            absolute.path.clear();
+            return absolute.Target(absolute_path);
+        }
+        std::string target = path;
+        if (file_path.empty() || file_path[0] != '/') {
+            target += '/';
+        }
+        for (const char c : file_path) {
+            const unsigned char u = static_cast<unsigned char>(c);
+            if (std::isalnum(u) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~') {
+                target += c;
+            }
+            else {
+                target += '%';
+                target += hex[u >> 4];
+                target += hex[u & 15];
+            }
+        }
+        return target;
+    }
+};
+
+struct HttpResponse {
+    int status = 0;
+    // header names in lower case
+    std::map<std::string, std::string> headers;
+    int64_t content_length = -1;
+    bool chunked = false;
+    bool keep_alive = true;
+
+    std::string Header(const std::string& name) const {
+        const auto it = headers.find(camera_http_detail::ToLower(name));
+        return it == headers.end() ? std::string() : it->second;
+    }
+
+    /**
+     * \brief parses "Content-Range: bytes first-last/total" or "bytes * /total" of a 206 or 416 response
+     */
+    bool ContentRange(int64_t& first, int64_t& last, int64_t& total) const {
+        const std::string range = Header("content-range");
+        const size_t slash = range.find('/');
+        if (range.compare(0, 6, "bytes ") != 0 || slash == std::string::npos) {
+            return false;
+        }
+        total = std::strtoll(range.c_str() + slash + 1, nullptr, 10);
+        const std::string span = range.substr(6, slash - 6);
+        const size_t dash = span.find('-');
+        if (dash == std::string::npos) {
+            first = -1;
+            last = -1;
+        }
+        else {
+            first = std::strtoll(span.c_str(), nullptr, 10);
+            last = std::strtoll(span.c_str() + dash + 1, nullptr, 10);
+        }
+        return total >= 0;
+    }
+};
+
+/**
+ * \class HttpConnection
+ * \brief One keep-alive connection. Requests may be sent ahead of their responses (pipelining), responses
+ * are read back in the same order. Not thread safe, except Shutdown() which interrupts a blocked call.
+ */
+class HttpConnection {
+public:
+    using BodySink = std::function<bool(const uint8_t* data, size_t size)>;
+
+    HttpConnection(const std::string& host, int port, int timeout_ms) : host_(host), port_(port), timeout_ms_(timeout_ms) {
+        camera_http_detail::InitSockets();
+    }
+
+    ~HttpConnection() {
+        Close();
+    }
+
+    HttpConnection(const HttpConnection&) = delete;
+    HttpConnection& operator=(const HttpConnection&) = delete;
+
+    bool IsConnected() const {
+        return socket_ != camera_http_detail::kInvalidSocket;
+    }
+
+    bool Connect() {
+        Close();
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &addresses) != 0) {
+            return false;
+        }
+        camera_http_detail::Socket socket = camera_http_detail::kInvalidSocket;
+        for (addrinfo* address = addresses; address; address = address->ai_next) {
+            socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (socket == camera_http_detail::kInvalidSocket) {
+                continue;
+            }
+            if (connect(socket, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0) {
+                break;
+            }
+            camera_http_detail::CloseSocket(socket);
+            socket = camera_http_detail::kInvalidSocket;
+        }
+        freeaddrinfo(addresses);
+        if (socket == camera_http_detail::kInvalidSocket) {
+            return false;
+        }
+
+#ifdef WIN32
+        const DWORD timeout = timeout_ms_;
+#else
+        timeval timeout{};
+        timeout.tv_sec = timeout_ms_ / 1000;
+        timeout.tv_usec = (timeout_ms_ % 1000) * 1000;
+#endif
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+        const int no_delay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+
+        std::lock_guard<std::mutex> lck(socket_mutex_);
+        socket_ = socket;
+        begin_ = end_ = 0;
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lck(socket_mutex_);
+        if (socket_ != camera_http_detail::kInvalidSocket) {
+            camera_http_detail::CloseSocket(socket_);
+            socket_ = camera_http_detail::kInvalidSocket;
+        }
+        begin_ = end_ = 0;
+    }
+
+    /**
+     * \brief wakes up a send or receive blocked in another thread, the connection fails from then on
+     */
+    void Shutdown() {
+        std::lock_guard<std::mutex> lck(socket_mutex_);
+        if (socket_ != camera_http_detail::kInvalidSocket) {
+            camera_http_detail::ShutdownSocket(socket_);
+        }
+    }
+
+    /**
+     * \param extra_headers complete header lines, each ending with \r\n
+     */
+    bool SendRequest(const std::string& method, const std::string& target, const std::string& extra_headers = std::string()) {
+        const std::string request = method + " " + target + " HTTP/1.1\r\n"
+            + "Host: " + host_ + ":" + std::to_string(port_) + "\r\n"
+            + "Connection: keep-alive\r\n"
+            + extra_headers + "\r\n";
+        return SendAll(request.data(), request.size());
+    }
+
+    bool ReadResponseHeader(HttpResponse& response) {
+        response = HttpResponse();
+        std::string line;
+        if (!ReadLine(line) || line.compare(0, 5, "HTTP/") != 0 || line.size() < 12) {
+            return false;
+        }
+        response.status = std::atoi(line.c_str() + 9);
+        response.keep_alive = line.compare(0, 8, "HTTP/1.0") != 0;
+        while (ReadLine(line)) {
+            if (line.empty()) {
+                const std::string connection = camera_http_detail::ToLower(response.Header("connection"));
+                if (connection == "close") {
+                    response.keep_alive = false;
+                }
+                else if (connection == "keep-alive") {
+                    response.keep_alive = true;
+                }
+                const std::string length = response.Header("content-length");
+                if (!length.empty()) {
+                    response.content_length = std::strtoll(length.c_str(), nullptr, 10);
+                }
+                response.chunked = camera_http_detail::ToLower(response.Header("transfer-encoding")).find("chunked") != std::string::npos;
+                return true;
+            }
+            const size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                response.headers[camera_http_detail::ToLower(line.substr(0, colon))] = camera_http_detail::Trim(line.substr(colon + 1));
+            }
+        }
+        return false;
+    }
+
+    /**
+     * \brief reads the body of a response to a GET into sink, sink returning false aborts the read.
+     * Never call it for HEAD responses, they have no body whatever Content-Length says.
+     */
+    bool ReadBody(const HttpResponse& response, const BodySink& sink) {
+        bool ok = false;
+        if (response.status == 204 || response.status == 304 || (response.status >= 100 && response.status < 200)) {
+            ok = true;
+        }
+        else if (response.chunked) {
+            ok = ReadChunkedBody(sink);
+        }
+        else if (response.content_length >= 0) {
+            ok = ReadExactly(response.content_length, sink);
+        }
+        else {
+            // no length: the body ends when the server closes the connection
+            while (Fill()) {
+                if (!sink(buffer_ + begin_, end_ - begin_)) {
+                    return false;
+                }
+                begin_ = end_;
+            }
+            Close();
+            return true;
+        }
+        if (!ok || !response.keep_alive) {
+            Close();
+        }
+        return ok;
+    }
+
+    bool DiscardBody(const HttpResponse& response) {
+        return ReadBody(response, [](const uint8_t*, size_t) {
+            return true;
+        });
+    }
+
+private:
+    bool SendAll(const char* data, size_t size) {
+        while (size > 0) {
+#ifdef WIN32
+            const int sent = send(socket_, data, static_cast<int>(std::min<size_t>(size, 1 << 30)), 0);
+#else
+            const ssize_t sent = send(socket_, data, size, MSG_NOSIGNAL);
+#endif
+            if (sent <= 0) {
+                Close();
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    // reads more data when the buffer is empty, false on error, timeout or end of stream
+    bool Fill() {
+        if (begin_ < end_) {
+            return true;
+        }
+        if (socket_ == camera_http_detail::kInvalidSocket) {
+            return false;
+        }
+        begin_ = end_ = 0;
+#ifdef WIN32
+        const int received = recv(socket_, reinterpret_cast<char*>(buffer_), static_cast<int>(sizeof(buffer_)), 0);
+#else
+        const ssize_t received = recv(socket_, buffer_, sizeof(buffer_), 0);
+#endif
+        if (received <= 0) {
+            return false;
+        }
+        end_ = static_cast<size_t>(received);
+        return true;
+    }
+
+    bool ReadLine(std::string& line) {
+        line.clear();
+        while (Fill()) {
+            const uint8_t* newline = static_cast<const uint8_t*>(memchr(buffer_ + begin_, '\n', end_ - begin_));
+            const size_t count = newline ? newline - (buffer_ + begin_) + 1 : end_ - begin_;
+            line.append(reinterpret_cast<const char*>(buffer_ + begin_), count);
+            begin_ += count;
+            if (newline) {
+                while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+                    line.pop_back();
+                }
+                return true;
+            }
+            if (line.size() > 64 * 1024) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool ReadExactly(int64_t size, const BodySink& sink) {
+        while (size > 0) {
+            if (!Fill()) {
+                return false;
+            }
+            const size_t count = static_cast<size_t>(std::min<int64_t>(size, end_ - begin_));
+            if (!sink(buffer_ + begin_, count)) {
+                return false;
+            }
+            begin_ += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool ReadChunkedBody(const BodySink& sink) {
+        std::string line;
+        while (ReadLine(line)) {
+            const int64_t size = std::strtoll(line.c_str(), nullptr, 16);
+            if (size <= 0) {
+                // trailers end with an empty line
+                while (ReadLine(line) && !line.empty()) {
+                }
+                return line.empty();
+            }
+            if (!ReadExactly(size, sink) || !ReadLine(line)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    std::string host_;
+    int port_;
+    int timeout_ms_;
+    std::mutex socket_mutex_;
+    camera_http_detail::Socket socket_ = camera_http_detail::kInvalidSocket;
+    uint8_t buffer_[64 * 1024];
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <camera/camera.h>
+#include <camera/device_discovery.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "download_manager.h"
+
+struct RigDevice {
+    std::string serial_number;
+    std::string camera_name;
+    ins_camera::CameraType camera_type;
+};
+
+struct RigResult {
+    std::string serial_number;
+    bool ok = false;
+    // the call did not return before the deadline, it keeps running on the device's worker
+    bool timed_out = false;
+    double ms = 0;
+    // operation output (urls, file counts) or the error
+    std::string detail;
+};
+
+namespace camera_rig_detail {
+    /**
+     * \brief one thread running the posted tasks in order
+     */
+    class Worker {
+    public:
+        Worker() : thread_(&Worker::Run, this) {
+        }
+
+        ~Worker() {
+            {
+                std::lock_guard<std::mutex> lck(mutex_);
+                stopped_ = true;
+                cond_.notify_all();
+            }
+            thread_.join();
+        }
+
+        void Post(const std::function<void()>& task) {
+            std::lock_guard<std::mutex> lck(mutex_);
+            tasks_.push_back(task);
+            cond_.notify_all();
+        }
+
+        // queued and running tasks
+        size_t Pending() const {
+            std::lock_guard<std::mutex> lck(mutex_);
+            return tasks_.size() + (running_ ? 1 : 0);
+        }
+
+    private:
+        void Run() {
+            std::unique_lock<std::mutex> lck(mutex_);
+            while (true) {
+                cond_.wait(lck, [&]() {
+                    return stopped_ || !tasks_.empty();
+                });
+                if (tasks_.empty()) {
+                    return;
+                }
+                auto task = tasks_.front();
+                tasks_.pop_front();
+                running_ = true;
+                lck.unlock();
+                task();
+                lck.lock();
+                running_ = false;
+            }
+        }
+
+        mutable std::mutex mutex_;
+        std::condition_variable cond_;
+        std::deque<std::function<void()>> tasks_;
+        bool running_ = false;
+        bool stopped_ = false;
+        std::thread thread_;
+    };
+}
+
+/**
+ * \class AsyncStreamDelegate
+ * \brief Copies the stream callbacks of one camera and replays them into another StreamDelegate on
+ * its own thread, so a slow consumer of one camera does not hold up the SDK thread that delivers the
+ * data of the others. When the consumer is max_pending callbacks behind, new callbacks are dropped and
+ * counted; a dropped video packet needs the decoder to wait for the next keyframe.
+ * The time a callback arrived is kept with it, the target reads it with ReplayReceivedNs().
+ */
+class AsyncStreamDelegate : public ins_camera::StreamDelegate {
+public:
+    AsyncStreamDelegate(const std::shared_ptr<ins_camera::StreamDelegate>& target, size_t max_pending = 512)
+        : target_(target), max_pending_(std::max<size_t>(1, max_pending)), thread_(&AsyncStreamDelegate::Run, this) {
+    }
+
+    virtual ~AsyncStreamDelegate() {
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            stopped_ = true;
+            cond_.notify_all();
+        }
+        thread_.join();
+    }
+
+    void OnAudioData(const uint8_t* data, size_t size, int64_t timestamp) override {
+        Item item;
+        item.type = Item::Audio;
+        item.timestamp = timestamp;
+        item.data.assign(data, data + size);
+        Push(item);
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t streamType, int stream_index) override {
+        Item item;
+        item.type = Item::Video;
+        item.timestamp = timestamp;
+        item.stream_type = streamType;
+        item.stream_index = stream_index;
+        item.data.assign(data, data + size);
+        Push(item);
+    }
+
+    void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
+        Item item;
+        item.type = Item::Gyro;
+        item.gyro = data;
+        Push(item);
+    }
+
+    void OnExposureData(const ins_camera::ExposureData& data) override {
+        Item item;
+        item.type = Item::Exposure;
+        item.exposure = data;
+        Push(item);
+    }
+
+    uint64_t Dropped() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return dropped_;
+    }
+
+    size_t MaxBacklog() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return max_backlog_;
+    }
+
+    /**
+     * \brief steady clock time in ns at which the callback now replayed on the calling thread reached
+     * the delegate, 0 outside of a replay. Lets the target stamp host arrival times without the queueing delay.
+     */
+    static int64_t ReplayReceivedNs() {
+        return ReplayState();
+    }
+
+private:
+    struct Item {
+        enum Type { Video, Audio, Gyro, Exposure } type;
+        int64_t timestamp = 0;
+        int64_t received_ns = 0;
+        uint8_t stream_type = 0;
+        int stream_index = 0;
+        std::vector<uint8_t> data;
+        std::vector<ins_camera::GyroData> gyro;
+        ins_camera::ExposureData exposure{};
+    };
+
+    static int64_t& ReplayState() {
+        static thread_local int64_t received_ns = 0;
+        return received_ns;
+    }
+
+    void Push(Item& item) {
+        item.received_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        std::lock_guard<std::mutex> lck(mutex_);
+        if (items_.size() >= max_pending_) {
+            dropped_++;
+            return;
+        }
+        items_.push_back(std::move(item));
+        max_backlog_ = std::max(max_backlog_, items_.size());
+        cond_.notify_all();
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lck(mutex_);
+        while (true) {
+            cond_.wait(lck, [&]() {
+                return stopped_ || !items_.empty();
+            });
+            if (stopped_) {
+                return;
+            }
+            Item item = std::move(items_.front());
+            items_.pop_front();
+            lck.unlock();
+            ReplayState() = item.received_ns;
+            switch (item.type) {
+            case Item::Video:
+                target_->OnVideoData(item.data.data(), item.data.size(), item.timestamp, item.stream_type, item.stream_index);
+                break;
+            case Item::Audio:
+                target_->OnAudioData(item.data.data(), item.data.size(), item.timestamp);
+                break;
+            case Item::Gyro:
+                target_->OnGyroData(item.gyro);
+                break;
+            case Item::Exposure:
+                target_->OnExposureData(item.exposure);
+                break;
+            }
+            ReplayState() = 0;
+            lck.lock();
+        }
+    }
+
+    std::shared_ptr<ins_camera::StreamDelegate> target_;
+    size_t max_pending_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Item> items_;
+    uint64_t dropped_ = 0;
+    size_t max_backlog_ = 0;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
+/**
+ * \class CameraRig
+ * \brief Opens every camera DeviceDiscovery finds and gives each one a worker thread that runs all
+ * of its control calls, in order. Fan-out operations post the call to every worker and wait until all
+ * of them answered or the deadline passed, so the rig costs the slowest camera instead of the sum, and
+ * a camera that hangs only delays itself: its result is reported as timed out while the call keeps
+ * running on its worker, later calls to that camera queue behind it.
+ * The latency of every call is kept per camera (GetLatency()) to find the slow one.
+ */
+class CameraRig {
+public:
+    using Operation = std::function<bool(ins_camera::Camera& camera, size_t index, std::string& detail)>;
+
+    struct Latency {
+        std::string serial_number;
+        uint64_t calls = 0;
+        uint64_t failures = 0;
+        double last_ms = 0;
+        double max_ms = 0;
+        double total_ms = 0;
+        std::string slowest_operation;
+    };
+
+    /**
+     * \param timeout_ms deadline of fan-out operations, <= 0 waits for every camera
+     */
+    explicit CameraRig(int timeout_ms = 30000) : timeout_ms_(timeout_ms) {
+    }
+
+    ~CameraRig() {
+        Close();
+    }
+
+    /**
+     * \brief discovers the cameras and opens them in parallel, cameras that fail to open are left out
+     * \return the number of open cameras
+     */
+    size_t Open() {
+        Close();
+        ins_camera::DeviceDiscovery discovery;
+        auto list = discovery.GetAvailableDevices();
+        std::vector<std::unique_ptr<Session>> sessions;
+        for (const auto& descriptor : list) {
+            std::unique_ptr<Session> session(new Session());
+            session->device.serial_number = descriptor.serial_number;
+            session->device.camera_name = descriptor.camera_name;
+            session->device.camera_type = descriptor.camera_type;
+            session->camera = std::make_shared<ins_camera::Camera>(descriptor.info);
+            sessions.push_back(std::move(session));
+        }
+        sessions_ = std::move(sessions);
+
+        // the connection info belongs to the descriptors, wait for every Open() before freeing them
+        const auto results = ForEach("Open", [](ins_camera::Camera& camera, size_t, std::string&) {
+            return camera.Open();
+        }, 0);
+        discovery.FreeDeviceDescriptors(list);
+
+        std::vector<std::unique_ptr<Session>> opened;
+        for (size_t i = 0; i < sessions_.size(); i++) {
+            if (results[i].ok) {
+                opened.push_back(std::move(sessions_[i]));
+            }
+        }
+        sessions_ = std::move(opened);
+        return sessions_.size();
+    }
+
+    /**
+     * \brief closes every camera, waits for the calls still running on the workers
+     */
+    void Close() {
+        for (auto& session : sessions_) {
+            auto camera = session->camera;
+            session->worker.Post([camera]() {
+                camera->Close();
+            });
+        }
+        sessions_.clear();
+    }
+
+    size_t Size() const {
+        return sessions_.size();
+    }
+
+    const RigDevice& Device(size_t index) const {
+        return sessions_[index]->device;
+    }
+
+    /**
+     * \brief the camera of one device, calls on it from other threads are not serialized with the worker
+     */
+    std::shared_ptr<ins_camera::Camera> GetCamera(size_t index) const {
+        return sessions_[index]->camera;
+    }
+
+    /**
+     * \brief runs operation on every camera's worker at once
+     * \param timeout_ms deadline, -1 uses the rig's timeout, 0 waits for every camera
+     * \return one result per camera, in device order
+     */
+    std::vector<RigResult> ForEach(const std::string& name, const Operation& operation, int timeout_ms = -1) {
+        struct State {
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::vector<RigResult> results;
+            std::vector<bool> done;
+            size_t remaining = 0;
+        };
+        auto state = std::make_shared<State>();
+        state->results.resize(sessions_.size());
+        state->done.resize(sessions_.size(), false);
+        state->remaining = sessions_.size();
+        for (size_t i = 0; i < sessions_.size(); i++) {
+            state->results[i].serial_number = sessions_[i]->device.serial_number;
+        }
+
+        for (size_t i = 0; i < sessions_.size(); i++) {
+            Session* session = sessions_[i].get();
+            auto camera = session->camera;
+            const auto post_time = std::chrono::steady_clock::now();
+            session->worker.Post([this, state, session, camera, operation, name, i, post_time]() {
+                std::string detail;
+                const bool ok = operation(*camera, i, detail);
+                // includes the wait behind earlier calls to this camera
+                const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - post_time).count();
+                RecordLatency(*session, name, ok, ms);
+
+                std::lock_guard<std::mutex> lck(state->mutex);
+                RigResult& result = state->results[i];
+                result.ok = ok;
+                result.ms = ms;
+                result.detail = detail;
+                state->done[i] = true;
+                state->remaining--;
+                state->cond.notify_all();
+            });
+        }
+
+        if (timeout_ms < 0) {
+            timeout_ms = timeout_ms_;
+        }
+        const auto start_time = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lck(state->mutex);
+        auto all_done = [&]() {
+            return state->remaining == 0;
+        };
+        if (timeout_ms <= 0) {
+            state->cond.wait(lck, all_done);
+        }
+        else if (!state->cond.wait_for(lck, std::chrono::milliseconds(timeout_ms), all_done)) {
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            for (size_t i = 0; i < state->results.size(); i++) {
+                if (!state->done[i]) {
+                    state->results[i].timed_out = true;
+                    state->results[i].ms = ms;
+                    state->results[i].detail = "timeout";
+                }
+            }
+        }
+        return state->results;
+    }
+
+    std::vector<RigResult> StartRecording() {
+        return ForEach("StartRecording", [](ins_camera::Camera& camera, size_t, std::string&) {
+            return camera.StartRecording();
+        });
+    }
+
+    /**
+     * \brief detail holds the recorded urls, separated by spaces
+     */
+    std::vector<RigResult> StopRecording() {
+        return ForEach("StopRecording", [](ins_camera::Camera& camera, size_t, std::string& detail) {
+            const auto url = camera.StopRecording();
+            if (url.Empty()) {
+                return false;
+            }
+            for (const auto& origin_url : url.OriginUrls()) {
+                detail += (detail.empty() ? "" : " ") + origin_url;
+            }
+            return true;
+        });
+    }
+
+    std::vector<RigResult> SyncLocalTime(uint64_t time) {
+        return ForEach("SyncLocalTimeToCamera", [time](ins_camera::Camera& camera, size_t, std::string&) {
+            return camera.SyncLocalTimeToCamera(time);
+        });
+    }
+
+    /**
+     * \brief downloads every file of every camera to dir/<serial>_<file name>, each camera with its
+     * own DownloadManager (DownloadCameraFile when the camera has no http server). Waits for every
+     * camera, a download is not cut by the rig timeout.
+     */
+    std::vector<RigResult> Download(const std::string& dir, const DownloadManager::Options& options) {
+        const std::string separator = (dir.empty() || dir.back() == '/' || dir.back() == '\\') ? "" : "/";
+        std::vector<std::string> prefixes;
+        for (const auto& session : sessions_) {
+            prefixes.push_back(dir + separator + session->device.serial_number + "_");
+        }
+        return ForEach("Download", [prefixes, options](ins_camera::Camera& camera, size_t index, std::string& detail) {
+            const auto files = camera.GetCameraFilesList();
+            const std::string& prefix = prefixes[index];
+            std::vector<std::string> fallback_files;
+            size_t downloaded = 0;
+            DownloadManager manager(camera.GetHttpBaseUrl(), options);
+            if (manager.IsValid()) {
+                for (const auto& file : files) {
+                    manager.Add(file, prefix + file.substr(file.find_last_of("/\\") + 1));
+                }
+                for (const auto& result : manager.Run()) {
+                    if (result.ok) {
+                        downloaded++;
+                    }
+                    else {
+                        fallback_files.push_back(result.remote_path);
+                    }
+                }
+            }
+            else {
+                fallback_files = files;
+            }
+            for (const auto& file : fallback_files) {
+                const std::string local_path = prefix + file.substr(file.find_last_of("/\\") + 1);
+                if (camera.DownloadCameraFile(file, local_path)) {
+                    // the partial download of the manager is stale now
+                    std::remove((local_path + ".part").c_str());
+                    std::remove((local_path + ".part.state").c_str());
+                    downloaded++;
+                }
+            }
+            detail = std::to_string(downloaded) + "/" + std::to_string(files.size()) + " files";
+            return downloaded == files.size();
+        }, 0);
+    }
+
+    /**
+     * \brief routes the stream callbacks of one camera through an AsyncStreamDelegate
+     */
+    std::shared_ptr<AsyncStreamDelegate> SetStreamDelegate(size_t index, const std::shared_ptr<ins_camera::StreamDelegate>& delegate, size_t max_pending = 512) {
+        auto async_delegate = std::make_shared<AsyncStreamDelegate>(delegate, max_pending);
+        std::shared_ptr<ins_camera::StreamDelegate> camera_delegate = async_delegate;
+        sessions_[index]->camera->SetStreamDelegate(camera_delegate);
+        return async_delegate;
+    }
+
+    /**
+     * \brief latency of the calls so far, one entry per camera in device order
+     */
+    std::vector<Latency> GetLatency() const {
+        std::lock_guard<std::mutex> lck(latency_mutex_);
+        std::vector<Latency> latency;
+        for (const auto& session : sessions_) {
+            latency.push_back(session->latency);
+        }
+        return latency;
+    }
+
+    /**
+     * \brief calls queued or running on a camera's worker, > 0 between fan-outs means a camera is stuck
+     */
+    size_t Pending(size_t index) const {
+        return sessions_[index]->worker.Pending();
+    }
+
+private:
+    struct Session {
+        RigDevice device;
+        std::shared_ptr<ins_camera::Camera> camera;
+        Latency latency;
+        // last member: joined first, the running call may still use the others
+        camera_rig_detail::Worker worker;
+    };
+
+    void RecordLatency(Session& session, const std::string& name, bool ok, double ms) {
+        std::lock_guard<std::mutex> lck(latency_mutex_);
+        Latency& latency = session.latency;
+        latency.serial_number = session.device.serial_number;
+        latency.calls++;
+        latency.failures += ok ? 0 : 1;
+        latency.last_ms = ms;
+        latency.total_ms += ms;
+        if (ms >= latency.max_ms) {
+            latency.max_ms = ms;
+            latency.slowest_operation = name;
+        }
+    }
+
+    int timeout_ms_;
+    mutable std::mutex latency_mutex_;
+    std::vector<std::unique_ptr<Session>> sessions_;
+};
@@ -0,0 +1,713 @@
+#pragma once
+
+#include <camera/camera.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace camera_sync_detail {
+    inline int64_t NowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // linear interpolation of a time series sorted by time, t inside its range
+    class Resampler {
+    public:
+        explicit Resampler(const std::vector<std::pair<int64_t, double>>& samples) : samples_(samples), pos_(0) {
+        }
+
+        // t must not decrease between calls
+        double At(int64_t t) {
+            while (pos_ + 2 < samples_.size() && samples_[pos_ + 1].first <= t) {
+                pos_++;
+            }
+            const auto& a = samples_[pos_];
+            const auto& b = samples_[pos_ + 1];
+            if (b.first == a.first) {
+                return b.second;
+            }
+            const double k = static_cast<double>(t - a.first) / static_cast<double>(b.first - a.first);
+            return a.second + (b.second - a.second) * std::max(0.0, std::min(1.0, k));
+        }
+
+    private:
+        const std::vector<std::pair<int64_t, double>>& samples_;
+        size_t pos_;
+    };
+}
+
+/**
+ * \class CameraClock
+ * \brief Maps the timestamps of one camera (OnVideoData timestamp, GetCameraMediaTime()) to the host
+ * steady clock: host_ns = offset + rate * camera_ns, rate - 1 being the drift of the camera crystal.
+ *
+ * Two kinds of samples are used:
+ * - arrivals: camera timestamp of a packet and the host time it arrived. The arrival is later than the
+ *   capture by a variable transport delay, so the fit follows the lower envelope of the samples (the
+ *   fastest packet of every part of the window), not their mean.
+ * - round trips: a camera time read between two host times (GetCameraMediaTime()). The camera time is
+ *   at the midpoint with an error of at most half the round trip; the fastest round trip fixes the
+ *   absolute offset that arrivals can not see (their minimum delay).
+ */
+class CameraClock {
+public:
+    explicit CameraClock(double ticks_per_second = 1000, size_t window = 1024)
+        : ns_per_tick_(1e9 / ticks_per_second), window_(std::max<size_t>(16, window)) {
+    }
+
+    void AddArrival(int64_t camera_time, int64_t host_ns) {
+        Add(arrivals_, camera_time, host_ns, 0);
+    }
+
+    void AddRoundTrip(int64_t camera_time, int64_t host_before_ns, int64_t host_after_ns) {
+        Add(round_trips_, camera_time, host_before_ns + (host_after_ns - host_before_ns) / 2, static_cast<double>(host_after_ns - host_before_ns));
+    }
+
+    bool Valid() const {
+        return valid_;
+    }
+
+    /**
+     * \brief camera_time may be fractional, in ticks
+     */
+    int64_t ToHost(double camera_time) const {
+        const double camera_ns = (camera_time - static_cast<double>(base_camera_time_)) * ns_per_tick_;
+        return base_host_ns_ + static_cast<int64_t>(std::llround(offset_ns_ + rate_ * camera_ns));
+    }
+
+    double ToCamera(int64_t host_ns) const {
+        return static_cast<double>(base_camera_time_) + (static_cast<double>(host_ns - base_host_ns_) - offset_ns_) / rate_ / ns_per_tick_;
+    }
+
+    // host ns per camera ns
+    double Rate() const {
+        return rate_;
+    }
+
+    /**
+     * \brief how much faster the camera clock runs than the host clock
+     */
+    double DriftPpm() const {
+        return (1 / rate_ - 1) * 1e6;
+    }
+
+    /**
+     * \brief half of the fastest round trip in the window, the bound of the absolute offset error;
+     * -1 without round trips
+     */
+    double RoundTripErrorNs() const {
+        double best = -1;
+        for (const auto& sample : round_trips_) {
+            if (best < 0 || sample.rtt_ns < best) {
+                best = sample.rtt_ns;
+            }
+        }
+        return best < 0 ? -1 : best / 2;
+    }
+
+private:
+    struct Sample {
+        // relative to the first sample, ns
+        double camera_ns;
+        double host_ns;
+        double rtt_ns;
+    };
+
+    void Add(std::deque<Sample>& samples, int64_t camera_time, int64_t host_ns, double rtt_ns) {
+        if (!has_base_) {
+            base_camera_time_ = camera_time;
+            base_host_ns_ = host_ns;
+            has_base_ = true;
+        }
+        Sample sample;
+        sample.camera_ns = static_cast<double>(camera_time - base_camera_time_) * ns_per_tick_;
+        sample.host_ns = static_cast<double>(host_ns - base_host_ns_);
+        sample.rtt_ns = rtt_ns;
+        samples.push_back(sample);
+        if (samples.size() > window_) {
+            samples.pop_front();
+        }
+        // refitting costs O(window), every 16th sample keeps it well under a microsecond per sample
+        if (!valid_ || ++since_fit_ >= 16) {
+            since_fit_ = 0;
+            Fit();
+        }
+    }
+
+    /**
+     * \brief the best sample of each of kBuckets equal parts of the camera time span: least delay for
+     * arrivals, shortest round trip for round trips
+     */
+    static std::vector<Sample> Envelope(const std::deque<Sample>& samples, bool round_trip) {
+        const size_t kBuckets = 16;
+        std::vector<Sample> best;
+        if (samples.empty()) {
+            return best;
+        }
+        double first = samples.front().camera_ns;
+        double last = first;
+        for (const auto& sample : samples) {
+            first = std::min(first, sample.camera_ns);
+            last = std::max(last, sample.camera_ns);
+        }
+        const double span = std::max(1.0, last - first);
+        std::vector<int> chosen(kBuckets, -1);
+        for (size_t i = 0; i < samples.size(); i++) {
+            const size_t bucket = std::min(kBuckets - 1, static_cast<size_t>((samples[i].camera_ns - first) / span * kBuckets));
+            const int current = chosen[bucket];
+            if (current < 0) {
+                chosen[bucket] = static_cast<int>(i);
+                continue;
+            }
+            const Sample& a = samples[i];
+            const Sample& b = samples[current];
+            const bool better = round_trip ? a.rtt_ns < b.rtt_ns : a.host_ns - a.camera_ns < b.host_ns - b.camera_ns;
+            if (better) {
+                chosen[bucket] = static_cast<int>(i);
+            }
+        }
+        for (const int index : chosen) {
+            if (index >= 0) {
+                best.push_back(samples[index]);
+            }
+        }
+        return best;
+    }
+
+    void Fit() {
+        const bool use_arrivals = !arrivals_.empty();
+        const std::vector<Sample> points = Envelope(use_arrivals ? arrivals_ : round_trips_, !use_arrivals);
+        if (points.empty()) {
+            return;
+        }
+        double rate = 1;
+        double mean_camera = 0;
+        double mean_host = 0;
+        for (const auto& point : points) {
+            mean_camera += point.camera_ns;
+            mean_host += point.host_ns;
+        }
+        mean_camera /= points.size();
+        mean_host /= points.size();
+        if (points.size() >= 2) {
+            double covariance = 0;
+            double variance = 0;
+            for (const auto& point : points) {
+                covariance += (point.camera_ns - mean_camera) * (point.host_ns - mean_host);
+                variance += (point.camera_ns - mean_camera) * (point.camera_ns - mean_camera);
+            }
+            // a few ms of samples say nothing about drift
+            if (variance > 0 && points.back().camera_ns - points.front().camera_ns > 1e9) {
+                rate = covariance / variance;
+            }
+        }
+        double offset = mean_host - rate * mean_camera;
+
+        if (use_arrivals && !round_trips_.empty()) {
+            // the arrival envelope still contains the minimum transport delay, the fastest round trip does not
+            const Sample* fastest = &round_trips_.front();
+            for (const auto& sample : round_trips_) {
+                if (sample.rtt_ns < fastest->rtt_ns) {
+                    fastest = &sample;
+                }
+            }
+            offset += fastest->host_ns - (offset + rate * fastest->camera_ns);
+        }
+        rate_ = rate;
+        offset_ns_ = offset;
+        valid_ = true;
+    }
+
+    double ns_per_tick_;
+    size_t window_;
+    std::deque<Sample> arrivals_;
+    std::deque<Sample> round_trips_;
+    bool has_base_ = false;
+    int64_t base_camera_time_ = 0;
+    int64_t base_host_ns_ = 0;
+    double rate_ = 1;
+    double offset_ns_ = 0;
+    bool valid_ = false;
+    size_t since_fit_ = 0;
+};
+
+struct GyroLag {
+    bool valid = false;
+    // other(t + lag_ns) matches reference(t)
+    double lag_ns = 0;
+    double correlation = 0;
+};
+
+/**
+ * \brief lag between two angular rate magnitude series of rigidly mounted cameras, (host ns, |w|)
+ * sorted by time. The magnitude does not depend on how a camera is mounted on the rig, so the series
+ * are resampled every step_ns, cross-correlated over +-max_lag_ns and the peak is refined with a
+ * parabola for a lag below step_ns. Invalid without enough overlap, motion or correlation.
+ */
+inline GyroLag EstimateGyroLag(const std::vector<std::pair<int64_t, double>>& reference,
+    const std::vector<std::pair<int64_t, double>>& other,
+    int64_t max_lag_ns, int64_t step_ns = 1000000, double min_correlation = 0.7) {
+    GyroLag result;
+    if (reference.size() < 2 || other.size() < 2 || step_ns <= 0) {
+        return result;
+    }
+    const int64_t lags = max_lag_ns / step_ns;
+    const int64_t start = std::max(reference.front().first, other.front().first + lags * step_ns);
+    const int64_t end = std::min(reference.back().first, other.back().first - lags * step_ns);
+    const int64_t count = end > start ? (end - start) / step_ns : 0;
+    if (count < 8 * (2 * lags + 1)) {
+        return result;
+    }
+
+    std::vector<double> a(static_cast<size_t>(count));
+    camera_sync_detail::Resampler reference_at(reference);
+    for (int64_t i = 0; i < count; i++) {
+        a[i] = reference_at.At(start + i * step_ns);
+    }
+    // other on the grid extended by the lag range on both sides
+    std::vector<double> b(static_cast<size_t>(count + 2 * lags));
+    camera_sync_detail::Resampler other_at(other);
+    for (int64_t i = 0; i < count + 2 * lags; i++) {
+        b[i] = other_at.At(start + (i - lags) * step_ns);
+    }
+
+    double mean_a = 0;
+    double variance_a = 0;
+    for (const double value : a) {
+        mean_a += value;
+    }
+    mean_a /= count;
+    for (double& value : a) {
+        value -= mean_a;
+        variance_a += value * value;
+    }
+    // a rig standing still has nothing to correlate: less than 0.05 rad/s of motion
+    if (variance_a / count < 0.05 * 0.05) {
+        return result;
+    }
+
+    std::vector<double> correlations(static_cast<size_t>(2 * lags + 1));
+    for (int64_t k = 0; k <= 2 * lags; k++) {
+        double sum = 0;
+        double sum_squares = 0;
+        double product = 0;
+        for (int64_t i = 0; i < count; i++) {
+            const double value = b[i + k];
+            sum += value;
+            sum_squares += value * value;
+            product += a[i] * value;
+        }
+        const double variance_b = sum_squares - sum * sum / count;
+        // a has zero mean, so product needs no correction for the mean of b
+        correlations[k] = variance_b > 0 ? product / std::sqrt(variance_a * variance_b) : 0;
+    }
+    const int64_t peak = std::max_element(correlations.begin(), correlations.end()) - correlations.begin();
+    result.correlation = correlations[peak];
+    if (peak == 0 || peak == 2 * lags || result.correlation < min_correlation) {
+        return result;
+    }
+    const double left = correlations[peak - 1];
+    const double right = correlations[peak + 1];
+    const double curvature = left - 2 * result.correlation + right;
+    const double delta = curvature < 0 ? 0.5 * (left - right) / curvature : 0;
+    result.lag_ns = (static_cast<double>(peak - lags) + delta) * step_ns;
+    result.valid = true;
+    return result;
+}
+
+/**
+ * \class FrameSynchronizer
+ * \brief Aligns the video frames of several cameras on one timeline and hands them out as bundles,
+ * one frame per camera. Each camera has a CameraClock fed by its packet arrivals and by
+ * GetCameraMediaTime() round trips (AddMediaTime()); with gyro_correlation the angular rate of rigidly
+ * mounted cameras is cross-correlated against camera 0 every second, which also removes the part of
+ * the offset no clock sample can see (a different capture-to-USB delay per camera).
+ *
+ * A bundle holds the earliest pending frame and the next frame of every other camera less than one
+ * frame interval after it, so free running cameras each contribute one frame and skew_ns is their
+ * phase difference; time_ns of every frame is on the common timeline for interpolating between them.
+ * It is emitted as soon as every camera has a frame past that window, or with the cameras that have
+ * not delivered yet left out once max_latency_ns passed since its first frame arrived, so a stalled
+ * camera delays bundles by at most max_latency_ns. Frames that arrive for an already emitted window
+ * are dropped as late.
+ *
+ * The bundle callback runs on the thread that completed the bundle (a StreamDelegate thread or
+ * Poll()), bundles are delivered one at a time and in order.
+ */
+class FrameSynchronizer {
+public:
+    struct Options {
+        // timestamps of OnVideoData, GetCameraMediaTime() and GyroData per second
+        double ticks_per_second = 1000;
+        int64_t frame_interval_ns = 33333333;
+        int64_t max_latency_ns = 100000000;
+        // only this stream of dual stream cameras is bundled
+        int stream_index = 0;
+        bool gyro_correlation = false;
+        int64_t gyro_window_ns = 4000000000LL;
+        int64_t max_gyro_lag_ns = 50000000;
+    };
+
+    struct Frame {
+        int64_t camera_timestamp = 0;
+        // on the rig timeline (host steady clock of camera 0's clock)
+        int64_t time_ns = 0;
+        int64_t arrival_ns = 0;
+        uint8_t stream_type = 0;
+        std::vector<uint8_t> data;
+    };
+
+    struct Bundle {
+        // mean time of the present frames
+        int64_t time_ns = 0;
+        // one per camera, frames[i] is valid only if present[i]
+        std::vector<bool> present;
+        std::vector<Frame> frames;
+        // spread of the present frames' times
+        int64_t skew_ns = 0;
+    };
+
+    struct Stats {
+        uint64_t bundles = 0;
+        uint64_t complete_bundles = 0;
+        uint64_t late_frames = 0;
+        int64_t max_skew_ns = 0;
+        // first arrival of a bundle to its emission
+        int64_t max_latency_ns = 0;
+        std::vector<double> drift_ppm;
+        // time subtracted from each camera after the gyro correlation
+        std::vector<double> gyro_correction_ns;
+        std::vector<double> gyro_correlation;
+    };
+
+    using BundleCallback = std::function<void(const Bundle& bundle)>;
+
+    FrameSynchronizer(size_t camera_count, const Options& options) : options_(options), cameras_(camera_count) {
+        for (auto& camera : cameras_) {
+            camera.clock = CameraClock(options_.ticks_per_second);
+        }
+    }
+
+    size_t CameraCount() const {
+        return cameras_.size();
+    }
+
+    void SetBundleCallback(const BundleCallback& callback) {
+        std::lock_guard<std::mutex> lck(emit_mutex_);
+        callback_ = callback;
+    }
+
+    /**
+     * \brief PreviewParam::gyro_timestamp of a camera: its gyro timestamps minus this are on the video clock
+     */
+    void SetGyroOffset(size_t camera, int64_t gyro_timestamp) {
+        std::lock_guard<std::mutex> lck(mutex_);
+        cameras_[camera].gyro_offset = gyro_timestamp;
+    }
+
+    /**
+     * \brief one GetCameraMediaTime() call and the host steady clock before and after it
+     */
+    void AddMediaTime(size_t camera, int64_t media_time, int64_t host_before_ns, int64_t host_after_ns) {
+        std::lock_guard<std::mutex> lck(mutex_);
+        cameras_[camera].clock.AddRoundTrip(media_time, host_before_ns, host_after_ns);
+    }
+
+    void AddVideo(size_t camera, const uint8_t* data, size_t size, int64_t timestamp, uint8_t stream_type, int stream_index, int64_t arrival_ns) {
+        if (stream_index != options_.stream_index) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            Camera& state = cameras_[camera];
+            state.clock.AddArrival(timestamp, arrival_ns);
+            latest_arrival_ns_ = std::max(latest_arrival_ns_, arrival_ns);
+
+            Frame frame;
+            frame.camera_timestamp = timestamp;
+            frame.time_ns = RigTime(camera, timestamp);
+            frame.arrival_ns = arrival_ns;
+            frame.stream_type = stream_type;
+            if (frame.time_ns < state.emitted_until_ns) {
+                stats_.late_frames++;
+                return;
+            }
+            frame.data.assign(data, data + size);
+            state.frames.push_back(std::move(frame));
+            Collect(latest_arrival_ns_, false);
+        }
+        Emit();
+    }
+
+    void AddGyro(size_t camera, const std::vector<ins_camera::GyroData>& data) {
+        if (data.empty() || !options_.gyro_correlation) {
+            return;
+        }
+        std::vector<std::pair<int64_t, double>> reference;
+        std::vector<std::pair<int64_t, double>> other;
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            Camera& state = cameras_[camera];
+            for (const auto& sample : data) {
+                GyroSample gyro_sample;
+                gyro_sample.time = sample.timestamp - state.gyro_offset;
+                gyro_sample.rate = std::sqrt(sample.gx * sample.gx + sample.gy * sample.gy + sample.gz * sample.gz);
+                state.gyro.push_back(gyro_sample);
+            }
+            if (!state.clock.Valid()) {
+                return;
+            }
+            const int64_t newest = state.clock.ToHost(static_cast<double>(state.gyro.back().time));
+            while (state.gyro.size() > 2 && newest - state.clock.ToHost(static_cast<double>(state.gyro.front().time)) > options_.gyro_window_ns) {
+                state.gyro.pop_front();
+            }
+            if (camera == 0 || !cameras_[0].clock.Valid() || newest - state.last_correlation_ns < 1000000000LL) {
+                return;
+            }
+            state.last_correlation_ns = newest;
+            reference = HostRates(cameras_[0]);
+            other = HostRates(state);
+        }
+
+        // outside the lock, the other cameras keep delivering
+        const GyroLag lag = EstimateGyroLag(reference, other, options_.max_gyro_lag_ns);
+        std::lock_guard<std::mutex> lck(mutex_);
+        Camera& state = cameras_[camera];
+        state.gyro_correlation = lag.correlation;
+        if (lag.valid) {
+            // the camera time that matches a camera 0 time, so later refits of this camera's offset
+            // (a faster round trip) do not move it away from camera 0 until the next correlation
+            const int64_t middle = reference[reference.size() / 2].first;
+            state.anchor_reference_time = cameras_[0].clock.ToCamera(middle);
+            state.anchor_time = state.clock.ToCamera(middle + static_cast<int64_t>(lag.lag_ns));
+            state.anchored = true;
+            state.gyro_correction_ns = lag.lag_ns;
+        }
+    }
+
+    /**
+     * \brief emits the bundles whose latency bound passed, call it periodically when a camera may stop delivering
+     */
+    void Poll(int64_t now_ns = camera_sync_detail::NowNs()) {
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            Collect(now_ns, false);
+        }
+        Emit();
+    }
+
+    /**
+     * \brief emits every pending frame, at the end of the stream
+     */
+    void Flush() {
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            Collect(latest_arrival_ns_, true);
+        }
+        Emit();
+    }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        Stats stats = stats_;
+        for (const auto& camera : cameras_) {
+            stats.drift_ppm.push_back(camera.clock.DriftPpm());
+            stats.gyro_correction_ns.push_back(camera.gyro_correction_ns);
+            stats.gyro_correlation.push_back(camera.gyro_correlation);
+        }
+        return stats;
+    }
+
+private:
+    struct GyroSample {
+        int64_t time;
+        double rate;
+    };
+
+    struct Camera {
+        CameraClock clock;
+        int64_t gyro_offset = 0;
+        double gyro_correction_ns = 0;
+        double gyro_correlation = 0;
+        bool anchored = false;
+        double anchor_time = 0;
+        double anchor_reference_time = 0;
+        int64_t last_correlation_ns = 0;
+        // frames before this belong to emitted bundles
+        int64_t emitted_until_ns = INT64_MIN;
+        std::deque<GyroSample> gyro;
+        std::deque<Frame> frames;
+    };
+
+    int64_t RigTime(size_t camera, int64_t timestamp) const {
+        const Camera& state = cameras_[camera];
+        if (!state.anchored) {
+            return state.clock.ToHost(static_cast<double>(timestamp));
+        }
+        const CameraClock& reference = cameras_[0].clock;
+        return reference.ToHost(state.anchor_reference_time + (timestamp - state.anchor_time) * state.clock.Rate() / reference.Rate());
+    }
+
+    static std::vector<std::pair<int64_t, double>> HostRates(const Camera& camera) {
+        std::vector<std::pair<int64_t, double>> rates;
+        rates.reserve(camera.gyro.size());
+        for (const auto& sample : camera.gyro) {
+            rates.push_back(std::make_pair(camera.clock.ToHost(static_cast<double>(sample.time)), sample.rate));
+        }
+        return rates;
+    }
+
+    // moves the finished bundles to ready_, with mutex_ held
+    void Collect(int64_t now_ns, bool flush) {
+        const int64_t interval = options_.frame_interval_ns;
+        while (true) {
+            int64_t start = 0;
+            bool any = false;
+            for (const auto& camera : cameras_) {
+                if (!camera.frames.empty() && (!any || camera.frames.front().time_ns < start)) {
+                    start = camera.frames.front().time_ns;
+                    any = true;
+                }
+            }
+            if (!any) {
+                return;
+            }
+
+            // a camera with no frame yet may still deliver one for this window
+            bool waiting = false;
+            int64_t first_arrival = now_ns;
+            for (const auto& camera : cameras_) {
+                if (camera.frames.empty()) {
+                    waiting = true;
+                }
+                else if (camera.frames.front().time_ns < start + interval) {
+                    first_arrival = std::min(first_arrival, camera.frames.front().arrival_ns);
+                }
+            }
+            if (waiting && !flush && now_ns - first_arrival < options_.max_latency_ns) {
+                return;
+            }
+
+            Bundle bundle;
+            bundle.present.resize(cameras_.size(), false);
+            bundle.frames.resize(cameras_.size());
+            int64_t earliest = 0;
+            int64_t latest = 0;
+            double sum = 0;
+            size_t present = 0;
+            for (size_t i = 0; i < cameras_.size(); i++) {
+                auto& frames = cameras_[i].frames;
+                if (frames.empty() || frames.front().time_ns >= start + interval) {
+                    // a frame that shows up later for this window is late
+                    cameras_[i].emitted_until_ns = std::max(cameras_[i].emitted_until_ns, start + interval);
+                    continue;
+                }
+                bundle.present[i] = true;
+                bundle.frames[i] = std::move(frames.front());
+                frames.pop_front();
+                const int64_t time = bundle.frames[i].time_ns;
+                cameras_[i].emitted_until_ns = time + interval / 2;
+                earliest = present == 0 ? time : std::min(earliest, time);
+                latest = present == 0 ? time : std::max(latest, time);
+                sum += static_cast<double>(time - start);
+                present++;
+            }
+            bundle.time_ns = start + static_cast<int64_t>(sum / present);
+            bundle.skew_ns = latest - earliest;
+
+            stats_.bundles++;
+            if (present == cameras_.size()) {
+                stats_.complete_bundles++;
+                stats_.max_skew_ns = std::max(stats_.max_skew_ns, bundle.skew_ns);
+            }
+            stats_.max_latency_ns = std::max(stats_.max_latency_ns, now_ns - first_arrival);
+            ready_.push_back(std::move(bundle));
+        }
+    }
+
+    // delivers ready_ in order, one thread at a time
+    void Emit() {
+        std::lock_guard<std::mutex> emit_lck(emit_mutex_);
+        while (true) {
+            Bundle bundle;
+            {
+                std::lock_guard<std::mutex> lck(mutex_);
+                if (ready_.empty()) {
+                    return;
+                }
+                bundle = std::move(ready_.front());
+                ready_.pop_front();
+            }
+            if (callback_) {
+                callback_(bundle);
+            }
+        }
+    }
+
+    Options options_;
+    mutable std::mutex mutex_;
+    std::vector<Camera> cameras_;
+    std::deque<Bundle> ready_;
+    int64_t latest_arrival_ns_ = 0;
+    Stats stats_;
+    std::mutex emit_mutex_;
+    BundleCallback callback_;
+};
+
+/**
+ * \class SyncStreamDelegate
+ * \brief Feeds one camera's stream into a FrameSynchronizer, stamping every packet with its host
+ * arrival time, and forwards it to next (may be empty).
+ * Behind a queue, arrival_clock returns the time the packet entered the queue (e.g.
+ * AsyncStreamDelegate::ReplayReceivedNs), 0 falls back to now.
+ */
+class SyncStreamDelegate : public ins_camera::StreamDelegate {
+public:
+    using ArrivalClock = std::function<int64_t()>;
+
+    SyncStreamDelegate(const std::shared_ptr<FrameSynchronizer>& sync, size_t camera, const std::shared_ptr<ins_camera::StreamDelegate>& next = nullptr,
+        const ArrivalClock& arrival_clock = nullptr)
+        : sync_(sync), camera_(camera), next_(next), arrival_clock_(arrival_clock) {
+    }
+
+    void OnAudioData(const uint8_t* data, size_t size, int64_t timestamp) override {
+        if (next_) {
+            next_->OnAudioData(data, size, timestamp);
+        }
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t streamType, int stream_index) override {
+        const int64_t arrival_ns = arrival_clock_ ? arrival_clock_() : 0;
+        sync_->AddVideo(camera_, data, size, timestamp, streamType, stream_index, arrival_ns != 0 ? arrival_ns : camera_sync_detail::NowNs());
+        if (next_) {
+            next_->OnVideoData(data, size, timestamp, streamType, stream_index);
+        }
+    }
+
+    void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
+        sync_->AddGyro(camera_, data);
+        if (next_) {
+            next_->OnGyroData(data);
+        }
+    }
+
+    void OnExposureData(const ins_camera::ExposureData& data) override {
+        if (next_) {
+            next_->OnExposureData(data);
+        }
+    }
+
+private:
+    std::shared_ptr<FrameSynchronizer> sync_;
+    size_t camera_;
+    std::shared_ptr<ins_camera::StreamDelegate> next_;
+    ArrivalClock arrival_clock_;
+};
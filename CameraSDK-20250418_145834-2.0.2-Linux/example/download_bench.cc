@@ -0,0 +1,104 @@
+#include <iostream>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "download_manager.h"
+
+const std::string helpstr =
+"{-help                   | default               | print this message                  }\n"
+"{-base_url               | None                  | http server of the camera (Camera::GetHttpBaseUrl()) or a local stand-in }\n"
+"{-files                  | None                  | remote file paths, separated by ','  }\n"
+"{-dir                    | .                     | local directory to download to      }\n"
+"{-threads                | 4                     | parallel connections                }\n"
+"{-chunk_mb               | 32                    | Range request size (MB)             }\n"
+"{-cancel_after_ms        | 0                     | cancel the run after this time, run again to resume }\n";
+
+std::vector<std::string> split(const std::string& s, char delimiter) {
+    std::vector<std::string> tokens;
+    std::string token;
+    std::istringstream tokenStream(s);
+
+    while (std::getline(tokenStream, token, delimiter)) {
+        tokens.push_back(token);
+    }
+
+    return tokens;
+}
+
+int main(int argc, char* argv[]) {
+    std::string base_url;
+    std::string files;
+    std::string dir = ".";
+    int cancel_after_ms = 0;
+    DownloadManager::Options options;
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-base_url") == std::string(argv[i])) {
+            base_url = argv[++i];
+        }
+        else if (std::string("-files") == std::string(argv[i])) {
+            files = argv[++i];
+        }
+        else if (std::string("-dir") == std::string(argv[i])) {
+            dir = argv[++i];
+        }
+        else if (std::string("-threads") == std::string(argv[i])) {
+            options.concurrency = atoi(argv[++i]);
+        }
+        else if (std::string("-chunk_mb") == std::string(argv[i])) {
+            options.chunk_size = static_cast<int64_t>(atof(argv[++i]) * 1024 * 1024);
+        }
+        else if (std::string("-cancel_after_ms") == std::string(argv[i])) {
+            cancel_after_ms = atoi(argv[++i]);
+        }
+        else if (std::string("-help") == std::string(argv[i])) {
+            std::cout << helpstr << std::endl;
+            return 0;
+        }
+    }
+
+    DownloadManager manager(base_url, options);
+    if (!manager.IsValid() || files.empty()) {
+        std::cout << helpstr << std::endl;
+        return -1;
+    }
+    for (const auto& file : split(files, ',')) {
+        const size_t slash = file.find_last_of('/');
+        manager.Add(file, dir + "/" + (slash == std::string::npos ? file : file.substr(slash + 1)));
+    }
+
+    std::thread canceler;
+    if (cancel_after_ms > 0) {
+        canceler = std::thread([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(cancel_after_ms));
+            manager.Cancel();
+        });
+    }
+    const auto results = manager.Run([](const DownloadManager::Progress& progress) {
+        std::cout << "\r" << progress.files_done << "/" << progress.files_total << " files, "
+            << progress.bytes_done / (1024 * 1024) << "/" << progress.bytes_total / (1024 * 1024) << "MB, "
+            << progress.mb_per_second << " MB/s" << std::flush;
+    }, 250);
+    std::cout << std::endl;
+    if (canceler.joinable()) {
+        canceler.join();
+    }
+
+    int failed = 0;
+    for (const auto& result : results) {
+        if (result.ok) {
+            std::cout << result.local_path << ": " << result.size << " bytes, resumed " << result.resumed_bytes
+                << ", " << result.seconds << "s" << std::endl;
+        }
+        else {
+            failed++;
+            std::cout << result.local_path << ": " << result.error << std::endl;
+        }
+    }
+    return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,648 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera_http.h"
+
+namespace download_manager_detail {
+    inline FILE* OpenFile(const std::string& path, const char* mode) {
+        FILE* fp = nullptr;
+#ifdef WIN32
+        if (fopen_s(&fp, path.c_str(), mode) != 0) {
+            fp = nullptr;
+        }
+#else
+        fp = fopen(path.c_str(), mode);
+#endif
+        return fp;
+    }
+
+    inline bool Seek(FILE* fp, int64_t offset) {
+#ifdef WIN32
+        return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+        return fseeko(fp, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    // -1 when the file does not exist
+    inline int64_t FileSize(const std::string& path) {
+        FILE* fp = OpenFile(path, "rb");
+        if (!fp) {
+            return -1;
+        }
+#ifdef WIN32
+        _fseeki64(fp, 0, SEEK_END);
+        const int64_t size = _ftelli64(fp);
+#else
+        fseeko(fp, 0, SEEK_END);
+        const int64_t size = ftello(fp);
+#endif
+        fclose(fp);
+        return size;
+    }
+
+    inline bool ReplaceFile(const std::string& from, const std::string& to) {
+#ifdef WIN32
+        std::remove(to.c_str());
+#endif
+        return std::rename(from.c_str(), to.c_str()) == 0;
+    }
+}
+
+/**
+ * \class DownloadManager
+ * \brief Downloads many camera files at once over the camera's http server (Camera::GetHttpBaseUrl()).
+ * Every file is split into chunk_size Range requests, the chunks of all files are shared by
+ * `concurrency` workers with one keep-alive connection each, so both many small files and one large
+ * .insv keep every connection busy.
+ *
+ * Data goes to <local>.part and the finished chunks to <local>.part.state, so a download stopped by
+ * Cancel(), a disconnect or a crash resumes from the finished chunks on the next Run(), also with another
+ * chunk_size. A partial <local> without .part (left by Camera::CancelDownload) is resumed from its size,
+ * and put back in place if the run does not get past it. A .part without a usable state has holes
+ * wherever chunks were still running, so it is downloaded again.
+ * A server without Range support gets one plain GET per file.
+ */
+class DownloadManager {
+public:
+    struct Options {
+        int concurrency = 4;
+        int64_t chunk_size = 32 * 1024 * 1024;
+        int timeout_ms = 10000;
+        // attempts per chunk after the first one
+        int retries = 3;
+    };
+
+    struct Result {
+        std::string remote_path;
+        std::string local_path;
+        bool ok = false;
+        int64_t size = 0;
+        // bytes already on disk from an earlier run
+        int64_t resumed_bytes = 0;
+        double seconds = 0;
+        std::string error;
+    };
+
+    struct Progress {
+        // bytes_total grows as the size of every file becomes known
+        int64_t bytes_done = 0;
+        int64_t bytes_total = 0;
+        int files_done = 0;
+        int files_failed = 0;
+        int files_total = 0;
+        double seconds = 0;
+        // transferred in this run, resumed bytes excluded
+        double mb_per_second = 0;
+    };
+
+    using ProgressCallback = std::function<void(const Progress& progress)>;
+
+    DownloadManager(const std::string& base_url, const Options& options) : options_(options) {
+        valid_ = HttpUrl::Parse(base_url, url_);
+        options_.concurrency = std::max(1, options_.concurrency);
+        options_.chunk_size = std::max<int64_t>(64 * 1024, options_.chunk_size);
+    }
+
+    ~DownloadManager() {
+        Cancel();
+    }
+
+    DownloadManager(const DownloadManager&) = delete;
+    DownloadManager& operator=(const DownloadManager&) = delete;
+
+    bool IsValid() const {
+        return valid_;
+    }
+
+    void Add(const std::string& remote_path, const std::string& local_path) {
+        std::unique_ptr<FileJob> file(new FileJob());
+        file->result.remote_path = remote_path;
+        file->result.local_path = local_path;
+        file->part_path = local_path + ".part";
+        file->state_path = local_path + ".part.state";
+        files_.push_back(std::move(file));
+    }
+
+    /**
+     * \brief downloads every added file, blocks until all of them are done, failed or canceled.
+     * progress is called from this thread every progress_interval_ms.
+     * \return one result per added file, in the order they were added
+     */
+    std::vector<Result> Run(const ProgressCallback& progress = nullptr, int progress_interval_ms = 1000) {
+        const auto start_time = std::chrono::steady_clock::now();
+        bytes_done_ = 0;
+        bytes_total_ = 0;
+        bytes_resumed_ = 0;
+        files_done_ = 0;
+        files_failed_ = 0;
+        {
+            std::lock_guard<std::mutex> lck(queue_mutex_);
+            in_flight_ = 0;
+            for (size_t i = 0; i < files_.size(); i++) {
+                Prepare(i);
+            }
+            // a Cancel() before Run() cancels this run
+            if (canceled_) {
+                queue_.clear();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        if (valid_) {
+            for (int i = 0; i < options_.concurrency; i++) {
+                workers.emplace_back(&DownloadManager::Work, this);
+            }
+        }
+        auto report = [&]() {
+            if (!progress) {
+                return;
+            }
+            Progress current;
+            current.bytes_done = bytes_done_;
+            current.bytes_total = bytes_total_;
+            current.files_done = files_done_;
+            current.files_failed = files_failed_;
+            current.files_total = static_cast<int>(files_.size());
+            current.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            current.mb_per_second = current.seconds > 0 ? (bytes_done_ - bytes_resumed_) / current.seconds / (1024 * 1024) : 0;
+            progress(current);
+        };
+        {
+            std::unique_lock<std::mutex> lck(queue_mutex_);
+            while (valid_ && !queue_cond_.wait_for(lck, std::chrono::milliseconds(progress_interval_ms), [this]() {
+                return queue_.empty() && in_flight_ == 0;
+            })) {
+                lck.unlock();
+                report();
+                lck.lock();
+            }
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        report();
+
+        std::lock_guard<std::mutex> lck(queue_mutex_);
+        std::vector<Result> results;
+        for (auto& file : files_) {
+            if (!file->finished && file->result.error.empty()) {
+                file->result.error = valid_ ? (canceled_ ? "canceled" : "incomplete") : "invalid base url";
+            }
+            if (!file->finished && file->adopted) {
+                // no chunk got past the adopted file, it goes back unchanged
+                if (download_manager_detail::ReplaceFile(file->part_path, file->result.local_path)) {
+                    std::remove(file->state_path.c_str());
+                }
+            }
+            results.push_back(file->result);
+        }
+        // the next Run() starts again
+        canceled_ = false;
+        return results;
+    }
+
+    /**
+     * \brief stops Run() as soon as possible, finished chunks are kept for the next Run().
+     * Called before Run(), the next Run() returns at once.
+     */
+    void Cancel() {
+        std::lock_guard<std::mutex> lck(queue_mutex_);
+        canceled_ = true;
+        queue_.clear();
+        for (auto connection : connections_) {
+            connection->Shutdown();
+        }
+        queue_cond_.notify_all();
+    }
+
+private:
+    struct FileJob {
+        std::string part_path;
+        std::string state_path;
+        std::mutex mutex;
+        int64_t total = -1;
+        // one entry per chunk once total is known
+        std::vector<uint8_t> done;
+        bool finished = false;
+        bool failed = false;
+        // the .part is a complete or partial <local> taken over by this run, nothing was written to it yet
+        bool adopted = false;
+        std::chrono::steady_clock::time_point start_time;
+        Result result;
+    };
+
+    struct Chunk {
+        size_t file;
+        int64_t index;
+        int attempt;
+        // the first request of a file of unknown size, its response tells the size
+        bool probe;
+        // first byte, a probe starts where a partial file ends
+        int64_t first;
+    };
+
+    // called with queue_mutex_ held, before the workers start
+    void Prepare(size_t index) {
+        using namespace download_manager_detail;
+        FileJob& file = *files_[index];
+        file.start_time = std::chrono::steady_clock::now();
+        if (file.finished) {
+            return;
+        }
+        file.failed = false;
+        file.adopted = false;
+        file.result.error.clear();
+        file.result.resumed_bytes = 0;
+        // a partial file left by Camera::CancelDownload, or one downloaded before, is verified by the probe.
+        // The prefix state keeps it a contiguous prefix if this run crashes before the probe.
+        const int64_t local_size = FileSize(file.result.local_path);
+        if (FileSize(file.part_path) < 0 && local_size >= 0) {
+            std::remove(file.state_path.c_str());
+            if (!ReplaceFile(file.result.local_path, file.part_path)) {
+                Fail(file, "can not rename " + file.result.local_path);
+                return;
+            }
+            if (!WriteState(file, "prefix " + std::to_string(local_size))) {
+                ReplaceFile(file.part_path, file.result.local_path);
+                Fail(file, "can not write " + file.state_path);
+                return;
+            }
+        }
+
+        int64_t prefix = -1;
+        if (LoadState(file, prefix)) {
+            int64_t resumed = 0;
+            for (size_t i = 0; i < file.done.size(); i++) {
+                if (file.done[i]) {
+                    resumed += ChunkLength(file, static_cast<int64_t>(i));
+                }
+                else {
+                    queue_.push_back(Chunk{ index, static_cast<int64_t>(i), 0, false, static_cast<int64_t>(i) * options_.chunk_size });
+                }
+            }
+            file.result.resumed_bytes = resumed;
+            bytes_done_ += resumed;
+            bytes_resumed_ += resumed;
+            bytes_total_ += file.total;
+            if (resumed == file.total) {
+                Finish(file);
+            }
+            return;
+        }
+
+        if (prefix >= 0) {
+            file.adopted = true;
+        }
+        else {
+            // the size of a .part written in chunks says nothing about which bytes it holds
+            std::remove(file.state_path.c_str());
+            FILE* fp = OpenFile(file.part_path, "wb");
+            if (!fp) {
+                Fail(file, "can not create " + file.part_path);
+                return;
+            }
+            fclose(fp);
+            prefix = 0;
+        }
+        // a partial file is continued where it ends, the probe fills up its last chunk
+        file.result.resumed_bytes = prefix;
+        bytes_done_ += prefix;
+        bytes_resumed_ += prefix;
+        queue_.push_back(Chunk{ index, prefix / options_.chunk_size, 0, true, prefix });
+    }
+
+    int64_t ChunkLength(const FileJob& file, int64_t index) const {
+        return std::min(options_.chunk_size, file.total - index * options_.chunk_size);
+    }
+
+    /**
+     * \brief read <local>.part.state, either "<total> <chunk_size> <done chunks>" or "prefix <size>" for an adopted file
+     * \return true for finished chunks, remapped onto options_.chunk_size; false with prefix set for a valid prefix state
+     */
+    bool LoadState(FileJob& file, int64_t& prefix) {
+        prefix = -1;
+        const int64_t part_size = download_manager_detail::FileSize(file.part_path);
+        std::ifstream in(file.state_path);
+        std::string first;
+        if (part_size < 0 || !(in >> first)) {
+            return false;
+        }
+        if (first == "prefix") {
+            int64_t size = -1;
+            if (in >> size && size >= 0 && size <= part_size) {
+                prefix = size;
+            }
+            return false;
+        }
+
+        int64_t total = -1;
+        int64_t chunk_size = 0;
+        std::string done;
+        std::istringstream total_text(first);
+        if (!(total_text >> total) || !(in >> chunk_size >> done) || total < 0 || chunk_size <= 0
+            || static_cast<int64_t>(done.size()) != (total + chunk_size - 1) / chunk_size) {
+            return false;
+        }
+        // a chunk of this run is done when every stored chunk it overlaps is
+        const int64_t chunks = (total + options_.chunk_size - 1) / options_.chunk_size;
+        file.total = total;
+        file.done.assign(static_cast<size_t>(chunks), 1);
+        for (size_t i = 0; i < done.size(); i++) {
+            if (done[i] != '1') {
+                const int64_t first_byte = static_cast<int64_t>(i) * chunk_size;
+                const int64_t last_byte = std::min(total, first_byte + chunk_size) - 1;
+                for (int64_t j = first_byte / options_.chunk_size; j <= last_byte / options_.chunk_size; j++) {
+                    file.done[static_cast<size_t>(j)] = 0;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool WriteState(const FileJob& file, const std::string& text) {
+        const std::string tmp_path = file.state_path + ".tmp";
+        bool ok = false;
+        {
+            std::ofstream out(tmp_path, std::ios::trunc);
+            out << text << std::endl;
+            out.close();
+            ok = !out.fail();
+        }
+        if (!ok || !download_manager_detail::ReplaceFile(tmp_path, file.state_path)) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // called with file.mutex held
+    bool SaveState(const FileJob& file) {
+        std::string text = std::to_string(file.total) + " " + std::to_string(options_.chunk_size) + " ";
+        for (const uint8_t done : file.done) {
+            text += done ? '1' : '0';
+        }
+        return WriteState(file, text);
+    }
+
+    // called with file.mutex held, or before the workers start
+    void Finish(FileJob& file) {
+        if (!download_manager_detail::ReplaceFile(file.part_path, file.result.local_path)) {
+            Fail(file, "can not rename " + file.part_path);
+            return;
+        }
+        std::remove(file.state_path.c_str());
+        file.finished = true;
+        file.result.ok = true;
+        file.result.size = file.total;
+        file.result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file.start_time).count();
+        files_done_++;
+    }
+
+    void Fail(FileJob& file, const std::string& error) {
+        if (file.failed) {
+            return;
+        }
+        file.failed = true;
+        file.result.error = error;
+        if (file.total < 0 && !file.adopted && download_manager_detail::FileSize(file.part_path) == 0) {
+            // nothing downloaded, do not leave an empty .part behind
+            std::remove(file.part_path.c_str());
+        }
+        file.result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file.start_time).count();
+        files_failed_++;
+    }
+
+    // called with file.mutex held, the size is known from the first response
+    bool SetTotal(FileJob& file, int64_t total, int64_t resume_offset, std::string& error) {
+        if (file.total >= 0) {
+            if (file.total != total) {
+                error = "file size changed on the camera";
+                return false;
+            }
+            return true;
+        }
+        if (resume_offset > total) {
+            error = "local file is larger than the camera file";
+            return false;
+        }
+        const int64_t chunks = (total + options_.chunk_size - 1) / options_.chunk_size;
+        file.total = total;
+        bytes_total_ += total;
+        file.done.assign(static_cast<size_t>(chunks), 0);
+        for (int64_t i = 0; i < chunks && (i + 1) * options_.chunk_size <= resume_offset; i++) {
+            file.done[i] = 1;
+        }
+        return true;
+    }
+
+    void Work() {
+        HttpConnection connection(url_.host, url_.port, options_.timeout_ms);
+        {
+            std::lock_guard<std::mutex> lck(queue_mutex_);
+            connections_.push_back(&connection);
+        }
+        Chunk chunk;
+        while (Pop(chunk)) {
+            FileJob& file = *files_[chunk.file];
+            std::string error;
+            std::vector<Chunk> next;
+            bool skip = false;
+            {
+                std::lock_guard<std::mutex> lck(file.mutex);
+                skip = file.failed || file.finished;
+            }
+            const bool ok = skip || Fetch(connection, chunk, next, error);
+            if (!ok) {
+                connection.Close();
+            }
+
+            std::lock_guard<std::mutex> lck(queue_mutex_);
+            if (!ok && !canceled_) {
+                if (chunk.attempt < options_.retries) {
+                    chunk.attempt++;
+                    queue_.push_back(chunk);
+                }
+                else {
+                    std::lock_guard<std::mutex> file_lck(file.mutex);
+                    Fail(file, error);
+                }
+            }
+            // the rest of a probed file goes first, so files complete one after another
+            if (!canceled_) {
+                queue_.insert(queue_.begin(), next.begin(), next.end());
+            }
+            in_flight_--;
+            queue_cond_.notify_all();
+        }
+        std::lock_guard<std::mutex> lck(queue_mutex_);
+        connections_.erase(std::find(connections_.begin(), connections_.end(), &connection));
+    }
+
+    bool Pop(Chunk& chunk) {
+        std::unique_lock<std::mutex> lck(queue_mutex_);
+        queue_cond_.wait(lck, [this]() {
+            return canceled_ || !queue_.empty() || in_flight_ == 0;
+        });
+        if (canceled_ || queue_.empty()) {
+            return false;
+        }
+        chunk = queue_.front();
+        queue_.pop_front();
+        in_flight_++;
+        return true;
+    }
+
+    bool Fetch(HttpConnection& connection, const Chunk& chunk, std::vector<Chunk>& next, std::string& error) {
+        FileJob& file = *files_[chunk.file];
+        const int64_t first = chunk.first;
+        int64_t last = (chunk.index + 1) * options_.chunk_size - 1;
+        {
+            std::lock_guard<std::mutex> lck(file.mutex);
+            if (file.total >= 0) {
+                last = std::min(last, file.total - 1);
+            }
+        }
+        if (!connection.IsConnected() && !connection.Connect()) {
+            error = "can not connect to " + url_.host;
+            return false;
+        }
+        const std::string range = "Range: bytes=" + std::to_string(first) + "-" + std::to_string(last) + "\r\n";
+        HttpResponse response;
+        if (!connection.SendRequest("GET", url_.Target(file.result.remote_path), range) || !connection.ReadResponseHeader(response)) {
+            error = "request failed";
+            return false;
+        }
+
+        int64_t range_first = 0;
+        int64_t range_last = -1;
+        int64_t total = -1;
+        if (response.status == 416 && chunk.probe && response.ContentRange(range_first, range_last, total)) {
+            // nothing left after the resumed part
+            connection.DiscardBody(response);
+            std::lock_guard<std::mutex> lck(file.mutex);
+            if (!SetTotal(file, total, chunk.first, error) || total != chunk.first) {
+                Fail(file, error.empty() ? "unexpected response 416" : error);
+                return true;
+            }
+            Finish(file);
+            return true;
+        }
+        if (response.status == 200 && chunk.probe) {
+            // no Range support, the whole file comes in this response
+            const int64_t resumed = file.result.resumed_bytes;
+            if (!Receive(connection, response, file, 0, response.content_length, error)) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lck(file.mutex);
+            bytes_done_ -= resumed;
+            bytes_resumed_ -= resumed;
+            file.result.resumed_bytes = 0;
+            file.total = response.content_length >= 0 ? response.content_length : download_manager_detail::FileSize(file.part_path);
+            bytes_total_ += file.total;
+            Finish(file);
+            return true;
+        }
+        if (response.status >= 400 && response.status != 416) {
+            // missing file or refused request, retrying will not help
+            connection.DiscardBody(response);
+            std::lock_guard<std::mutex> lck(file.mutex);
+            Fail(file, "http status " + std::to_string(response.status));
+            return true;
+        }
+        if (response.status != 206 || !response.ContentRange(range_first, range_last, total) || range_first != first
+            || (!chunk.probe && range_last != last)) {
+            error = "unexpected response " + std::to_string(response.status) + " " + response.Header("content-range");
+            connection.Close();
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lck(file.mutex);
+            if (!SetTotal(file, total, chunk.first, error)) {
+                connection.Close();
+                Fail(file, error);
+                return true;
+            }
+        }
+        if (!Receive(connection, response, file, first, range_last - range_first + 1, error)) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lck(file.mutex);
+        file.done[chunk.index] = 1;
+        file.adopted = false;
+        if (chunk.probe) {
+            for (int64_t i = chunk.index + 1; i < static_cast<int64_t>(file.done.size()); i++) {
+                next.push_back(Chunk{ chunk.file, i, 0, false, i * options_.chunk_size });
+            }
+        }
+        if (std::find(file.done.begin(), file.done.end(), 0) == file.done.end()) {
+            Finish(file);
+        }
+        else if (!SaveState(file)) {
+            Fail(file, "can not write " + file.state_path);
+        }
+        return true;
+    }
+
+    // writes the body at offset of the .part file, length -1 reads until the server closes
+    bool Receive(HttpConnection& connection, const HttpResponse& response, FileJob& file, int64_t offset, int64_t length, std::string& error) {
+        FILE* fp = download_manager_detail::OpenFile(file.part_path, "r+b");
+        if (!fp || !download_manager_detail::Seek(fp, offset)) {
+            if (fp) {
+                fclose(fp);
+            }
+            error = "can not write " + file.part_path;
+            return false;
+        }
+        int64_t received = 0;
+        const bool ok = connection.ReadBody(response, [&](const uint8_t* data, size_t size) {
+            if (fwrite(data, 1, size, fp) != size) {
+                return false;
+            }
+            received += size;
+            bytes_done_ += size;
+            return true;
+        });
+        const bool closed = fclose(fp) == 0;
+        if (!ok || !closed || (length >= 0 && received != length)) {
+            // the chunk is downloaded again, its bytes do not count twice
+            bytes_done_ -= received;
+            error = ok ? "can not write " + file.part_path : "connection lost";
+            return false;
+        }
+        return true;
+    }
+
+    Options options_;
+    HttpUrl url_;
+    bool valid_ = false;
+    std::vector<std::unique_ptr<FileJob>> files_;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cond_;
+    std::deque<Chunk> queue_;
+    int in_flight_ = 0;
+    bool canceled_ = false;
+    std::vector<HttpConnection*> connections_;
+
+    std::atomic<int64_t> bytes_done_{ 0 };
+    std::atomic<int64_t> bytes_total_{ 0 };
+    std::atomic<int64_t> bytes_resumed_{ 0 };
+    std::atomic<int> files_done_{ 0 };
+    std::atomic<int> files_failed_{ 0 };
+};
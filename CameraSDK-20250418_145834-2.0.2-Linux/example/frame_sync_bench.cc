@@ -0,0 +1,280 @@
+#include <iostream>
+#include <camera/camera.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "camera_sync.h"
+
+const std::string helpstr =
+"{-help                   | default               | print this message                  }\n"
+"{-cameras                | 4                     | cameras on the synthetic rig        }\n"
+"{-seconds                | 20                    | duration                            }\n"
+"{-fps                    | 30                    | frames per second of every camera   }\n"
+"{-drift_ppm              | 50                    | clock drift of a camera, up to +-   }\n"
+"{-delay_ms               | 30                    | capture to arrival delay            }\n"
+"{-delay_spread_ms        | 4                     | per camera extra delay, up to, no clock sample sees it }\n"
+"{-jitter_ms              | 5                     | mean of the random extra arrival delay }\n"
+"{-media_time             | 1                     | GetCameraMediaTime() round trips per second, 0 = none }\n"
+"{-gyro                   | 1                     | cross-correlate the gyro of the rigidly mounted cameras }\n"
+"{-stall                  | 0                     | 1: the last camera stops delivering halfway }\n"
+"{-max_latency_ms         | 100                   | bundle latency bound                }\n";
+
+namespace {
+    struct Event {
+        int64_t arrival_ns;
+        size_t camera;
+        // 0 video, 1 gyro batch, 2 media time
+        int type;
+        int64_t timestamp;
+        int64_t true_ns;
+        int64_t before_ns;
+        std::vector<ins_camera::GyroData> gyro;
+    };
+
+    struct SyntheticCamera {
+        // true time of camera time 0
+        int64_t boot_ns;
+        double rate;
+        int64_t delay_ns;
+        // axis order and sign of the mount
+        int axes[3];
+        double signs[3];
+
+        int64_t CameraMs(int64_t true_ns) const {
+            return static_cast<int64_t>(std::floor((true_ns - boot_ns) * rate / 1e6));
+        }
+
+        int64_t TrueNs(double camera_ns) const {
+            return boot_ns + static_cast<int64_t>(camera_ns / rate);
+        }
+    };
+
+    // smooth rig motion, rad/s per axis
+    struct Motion {
+        double amplitude[3][3];
+        double frequency[3][3];
+        double phase[3][3];
+
+        double At(int axis, int64_t true_ns) const {
+            const double t = true_ns / 1e9;
+            double value = 0;
+            for (int i = 0; i < 3; i++) {
+                value += amplitude[axis][i] * std::sin(2 * M_PI * frequency[axis][i] * t + phase[axis][i]);
+            }
+            return value;
+        }
+    };
+
+    double percentile(std::vector<double> values, double p) {
+        if (values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t camera_count = 4;
+    int seconds = 20;
+    int fps = 30;
+    double drift_ppm = 50;
+    double delay_ms = 30;
+    double delay_spread_ms = 4;
+    double jitter_ms = 5;
+    int media_time = 1;
+    bool stall = false;
+    FrameSynchronizer::Options options;
+    options.gyro_correlation = true;
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-cameras") == std::string(argv[i])) {
+            camera_count = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+        }
+        else if (std::string("-seconds") == std::string(argv[i])) {
+            seconds = atoi(argv[++i]);
+        }
+        else if (std::string("-fps") == std::string(argv[i])) {
+            fps = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-drift_ppm") == std::string(argv[i])) {
+            drift_ppm = atof(argv[++i]);
+        }
+        else if (std::string("-delay_ms") == std::string(argv[i])) {
+            delay_ms = atof(argv[++i]);
+        }
+        else if (std::string("-delay_spread_ms") == std::string(argv[i])) {
+            delay_spread_ms = atof(argv[++i]);
+        }
+        else if (std::string("-jitter_ms") == std::string(argv[i])) {
+            jitter_ms = atof(argv[++i]);
+        }
+        else if (std::string("-media_time") == std::string(argv[i])) {
+            media_time = atoi(argv[++i]);
+        }
+        else if (std::string("-gyro") == std::string(argv[i])) {
+            options.gyro_correlation = atoi(argv[++i]) != 0;
+        }
+        else if (std::string("-stall") == std::string(argv[i])) {
+            stall = atoi(argv[++i]) != 0;
+        }
+        else if (std::string("-max_latency_ms") == std::string(argv[i])) {
+            options.max_latency_ns = static_cast<int64_t>(atof(argv[++i]) * 1e6);
+        }
+        else if (std::string("-help") == std::string(argv[i])) {
+            std::cout << helpstr << std::endl;
+            return 0;
+        }
+    }
+    options.frame_interval_ns = 1000000000LL / fps;
+
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::exponential_distribution<double> jitter(1.0 / std::max(1e-3, jitter_ms));
+
+    Motion motion;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int i = 0; i < 3; i++) {
+            motion.amplitude[axis][i] = 0.2 + 0.8 * uniform(random);
+            motion.frequency[axis][i] = 0.3 + 4 * uniform(random);
+            motion.phase[axis][i] = 2 * M_PI * uniform(random);
+        }
+    }
+
+    // the host clock starts at 10 s, every camera booted at a different time before that
+    const int64_t start_ns = 10000000000LL;
+    std::vector<SyntheticCamera> cameras(camera_count);
+    std::vector<Event> events;
+    for (size_t c = 0; c < camera_count; c++) {
+        SyntheticCamera& camera = cameras[c];
+        camera.boot_ns = static_cast<int64_t>(uniform(random) * 5e9);
+        camera.rate = 1 + (2 * uniform(random) - 1) * drift_ppm * 1e-6;
+        camera.delay_ns = static_cast<int64_t>((delay_ms + uniform(random) * delay_spread_ms) * 1e6);
+        int axes[3] = { 0, 1, 2 };
+        std::shuffle(axes, axes + 3, random);
+        for (int axis = 0; axis < 3; axis++) {
+            camera.axes[axis] = axes[axis];
+            camera.signs[axis] = uniform(random) < 0.5 ? -1 : 1;
+        }
+        const int64_t end_ns = (stall && c + 1 == camera_count && camera_count > 1) ? start_ns + seconds * 500000000LL : start_ns + seconds * 1000000000LL;
+
+        // frames every interval of the camera's own clock, gyro at 1 kHz delivered with each frame
+        const double first_camera_ns = std::ceil((start_ns - camera.boot_ns) * camera.rate / options.frame_interval_ns) * options.frame_interval_ns;
+        double gyro_camera_ns = first_camera_ns;
+        int64_t last_arrival_ns = 0;
+        for (double camera_ns = first_camera_ns; camera.TrueNs(camera_ns) < end_ns; camera_ns += options.frame_interval_ns) {
+            const int64_t true_ns = camera.TrueNs(camera_ns);
+            Event frame{};
+            frame.camera = c;
+            frame.type = 0;
+            frame.true_ns = true_ns;
+            frame.timestamp = static_cast<int64_t>(camera_ns / 1e6);
+            // one USB pipe per camera: packets do not overtake each other
+            frame.arrival_ns = std::max(last_arrival_ns, true_ns + camera.delay_ns + static_cast<int64_t>(jitter(random) * 1e6));
+            last_arrival_ns = frame.arrival_ns;
+
+            Event gyro{};
+            gyro.camera = c;
+            gyro.type = 1;
+            gyro.arrival_ns = frame.arrival_ns;
+            for (; gyro_camera_ns <= camera_ns; gyro_camera_ns += 1e6) {
+                const int64_t sample_true_ns = camera.TrueNs(gyro_camera_ns);
+                double rates[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    rates[axis] = camera.signs[axis] * motion.At(camera.axes[axis], sample_true_ns) + 0.01 * (2 * uniform(random) - 1);
+                }
+                ins_camera::GyroData sample{};
+                sample.timestamp = static_cast<int64_t>(gyro_camera_ns / 1e6);
+                sample.gx = rates[0];
+                sample.gy = rates[1];
+                sample.gz = rates[2];
+                gyro.gyro.push_back(sample);
+            }
+            events.push_back(frame);
+            events.push_back(gyro);
+        }
+
+        for (int64_t host_ns = start_ns; media_time > 0 && host_ns < end_ns; host_ns += 1000000000LL / media_time) {
+            // request and answer take 0.5 to 2.5 ms each way
+            const int64_t up_ns = static_cast<int64_t>((0.5 + 2 * uniform(random)) * 1e6);
+            const int64_t down_ns = static_cast<int64_t>((0.5 + 2 * uniform(random)) * 1e6);
+            Event sample{};
+            sample.camera = c;
+            sample.type = 2;
+            sample.before_ns = host_ns;
+            sample.timestamp = camera.CameraMs(host_ns + up_ns);
+            sample.arrival_ns = host_ns + up_ns + down_ns;
+            events.push_back(sample);
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+        return a.arrival_ns < b.arrival_ns;
+    });
+
+    // error of every frame against camera 0 (or the first present camera), after 5 s of warm up
+    std::vector<double> errors_ms;
+    uint64_t partial_bundles = 0;
+    FrameSynchronizer sync(camera_count, options);
+    sync.SetBundleCallback([&](const FrameSynchronizer::Bundle& bundle) {
+        size_t reference = camera_count;
+        for (size_t c = 0; c < camera_count; c++) {
+            if (bundle.present[c]) {
+                reference = std::min(reference, c);
+            }
+        }
+        if (std::count(bundle.present.begin(), bundle.present.end(), true) != static_cast<long>(camera_count)) {
+            partial_bundles++;
+        }
+        int64_t true_ns[2] = {};
+        memcpy(&true_ns[0], bundle.frames[reference].data.data(), sizeof(int64_t));
+        if (true_ns[0] < start_ns + 5000000000LL) {
+            return;
+        }
+        const int64_t reference_error = bundle.frames[reference].time_ns - true_ns[0];
+        for (size_t c = reference + 1; c < camera_count; c++) {
+            if (bundle.present[c]) {
+                memcpy(&true_ns[1], bundle.frames[c].data.data(), sizeof(int64_t));
+                errors_ms.push_back(std::abs((bundle.frames[c].time_ns - true_ns[1]) - reference_error) / 1e6);
+            }
+        }
+    });
+    // Poll() every 5 ms as a consumer thread would
+    int64_t next_poll_ns = 0;
+    for (const auto& event : events) {
+        for (; next_poll_ns < event.arrival_ns; next_poll_ns += 5000000) {
+            if (next_poll_ns > 0) {
+                sync.Poll(next_poll_ns);
+            }
+        }
+        if (next_poll_ns == 0) {
+            next_poll_ns = event.arrival_ns;
+        }
+        if (event.type == 0) {
+            sync.AddVideo(event.camera, reinterpret_cast<const uint8_t*>(&event.true_ns), sizeof(event.true_ns), event.timestamp, 0, 0, event.arrival_ns);
+        }
+        else if (event.type == 1) {
+            sync.AddGyro(event.camera, event.gyro);
+        }
+        else {
+            sync.AddMediaTime(event.camera, event.timestamp, event.before_ns, event.arrival_ns);
+        }
+    }
+    sync.Flush();
+
+    const auto stats = sync.GetStats();
+    std::cout << "bundles = " << stats.bundles << "; complete = " << stats.complete_bundles << "; partial = " << partial_bundles
+        << "; late frames = " << stats.late_frames << "; max latency = " << stats.max_latency_ns / 1e6 << "ms" << std::endl;
+    std::cout << "alignment error (ms): p50 = " << percentile(errors_ms, 0.5) << "; p99 = " << percentile(errors_ms, 0.99)
+        << "; max = " << percentile(errors_ms, 1.0) << "; frame interval = " << options.frame_interval_ns / 1e6 << std::endl;
+    for (size_t c = 0; c < camera_count; c++) {
+        std::cout << "camera " << c << ": drift = " << (cameras[c].rate - 1) * 1e6 << "ppm, estimated " << stats.drift_ppm[c]
+            << "ppm; delay - camera 0 = " << (cameras[c].delay_ns - cameras[0].delay_ns) / 1e6
+            << "ms; gyro correction = " << stats.gyro_correction_ns[c] / 1e6 << "ms (correlation " << stats.gyro_correlation[c] << ")" << std::endl;
+    }
+    return 0;
+}
@@ -11,6 +11,13 @@
 #include <camera/photography_settings.h>
 #include <camera/device_discovery.h>
 
+#include "camera_batch_ops.h"
+#include "camera_file_index.h"
+#include "camera_rig.h"
+#include "camera_sync.h"
+#include "download_manager.h"
+#include "stream_capture.h"
+
 #ifdef _WIN32
 #include <io.h>
 #define ACCESS_FUNC _access
@@ -138,6 +145,201 @@ private:
     FILE* fp2 = nullptr;
 };
 
+int replayCapture(const std::string& capture_file, const ReplayCamera::Options& options) {
+    ReplayCamera replay(capture_file);
+    if (!replay.Open()) {
+        std::cerr << "failed to open capture " << capture_file << std::endl;
+        return -1;
+    }
+    std::cout << "replay " << capture_file << ": camera type:" << replay.GetPreviewParam().camera_name
+        << ";serial:" << replay.SerialNumber()
+        << ";duration:" << replay.CaptureDurationMs() << "ms" << std::endl;
+
+    // the recorded streams are written to ./01_<time>.h264 and ./02_<time>.h264 as in option 10
+    auto stream_delegate = std::make_shared<TestStreamDelegate>();
+    replay.SetStreamDelegate(stream_delegate);
+    stream_delegate->StartStream();
+    if (!replay.StartLiveStreaming(options)) {
+        std::cerr << "failed to start replay" << std::endl;
+        return -1;
+    }
+    replay.WaitForEnd();
+    replay.StopLiveStreaming();
+    stream_delegate->StopStream();
+    PrintReplayStats(replay.GetStats(), std::cout);
+    return 0;
+}
+
+void printRigResults(const std::string& name, const std::vector<RigResult>& results) {
+    for (const auto& result : results) {
+        std::cout << name << " " << result.serial_number << ": " << (result.ok ? "ok" : "failed")
+            << " " << result.ms << "ms";
+        if (!result.detail.empty()) {
+            std::cout << " " << result.detail;
+        }
+        std::cout << std::endl;
+    }
+}
+
+// preview on every camera of the rig, the frames bundled across cameras on one timeline.
+// the rig operations and delegates only hold shared state: an operation that timed out may still
+// run on its camera's worker after this returns.
+void syncPreview(CameraRig& rig, int seconds, bool gyro_correlation) {
+    FrameSynchronizer::Options options;
+    options.gyro_correlation = gyro_correlation;
+    auto sync = std::make_shared<FrameSynchronizer>(rig.Size(), options);
+    struct BundleTotals {
+        uint64_t bundles = 0;
+        int64_t skew_ns = 0;
+    };
+    auto totals = std::make_shared<BundleTotals>();
+    sync->SetBundleCallback([totals](const FrameSynchronizer::Bundle& bundle) {
+        totals->bundles++;
+        totals->skew_ns += bundle.skew_ns;
+    });
+    // the SDK thread only copies the packets, the synchronizer runs on each camera's replay thread and
+    // stamps them with the time they arrived rather than the time they were replayed
+    std::vector<std::shared_ptr<AsyncStreamDelegate>> async_delegates;
+    for (size_t i = 0; i < rig.Size(); i++) {
+        auto delegate = std::make_shared<SyncStreamDelegate>(sync, i, nullptr, &AsyncStreamDelegate::ReplayReceivedNs);
+        async_delegates.push_back(rig.SetStreamDelegate(i, delegate));
+    }
+
+    ins_camera::LiveStreamParam param;
+    param.video_resolution = ins_camera::VideoResolution::RES_3840_1920P30;
+    param.lrv_video_resulution = ins_camera::VideoResolution::RES_1440_720P30;
+    param.video_bitrate = 1024 * 1024 / 2;
+    param.enable_audio = false;
+    param.using_lrv = false;
+    printRigResults("start preview", rig.ForEach("StartLiveStreaming", [param, sync](ins_camera::Camera& camera, size_t index, std::string&) {
+        if (!camera.StartLiveStreaming(param)) {
+            return false;
+        }
+        sync->SetGyroOffset(index, camera.GetPreviewParam().gyro_timestamp);
+        return true;
+    }));
+
+    // one media time round trip per camera and second, Poll() in between for a camera that stops delivering
+    const auto end_time = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    auto next_media_time = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() < end_time) {
+        if (std::chrono::steady_clock::now() >= next_media_time) {
+            rig.ForEach("GetCameraMediaTime", [sync](ins_camera::Camera& camera, size_t index, std::string&) {
+                const int64_t before_ns = camera_sync_detail::NowNs();
+                const int64_t media_time = camera.GetCameraMediaTime();
+                sync->AddMediaTime(index, media_time, before_ns, camera_sync_detail::NowNs());
+                return true;
+            });
+            next_media_time += std::chrono::seconds(1);
+        }
+        sync->Poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    printRigResults("stop preview", rig.ForEach("StopLiveStreaming", [](ins_camera::Camera& camera, size_t, std::string&) {
+        return camera.StopLiveStreaming();
+    }));
+    for (size_t i = 0; i < rig.Size(); i++) {
+        std::shared_ptr<ins_camera::StreamDelegate> no_delegate;
+        rig.GetCamera(i)->SetStreamDelegate(no_delegate);
+    }
+    // stop the replay threads before the last bundles are flushed
+    std::vector<uint64_t> dropped;
+    for (const auto& async_delegate : async_delegates) {
+        dropped.push_back(async_delegate->Dropped());
+    }
+    async_delegates.clear();
+    sync->Flush();
+    const uint64_t bundles = totals->bundles;
+    const int64_t skew_ns = totals->skew_ns;
+
+    const auto stats = sync->GetStats();
+    std::cout << "bundles = " << stats.bundles << "; complete = " << stats.complete_bundles
+        << "; late frames = " << stats.late_frames << "; mean skew = " << (bundles > 0 ? skew_ns / 1e6 / bundles : 0)
+        << "ms; max latency = " << stats.max_latency_ns / 1e6 << "ms" << std::endl;
+    for (size_t i = 0; i < rig.Size(); i++) {
+        std::cout << rig.Device(i).serial_number << ": drift = " << stats.drift_ppm[i] << "ppm; dropped = " << dropped[i];
+        if (gyro_correlation) {
+            std::cout << "; gyro correction = " << stats.gyro_correction_ns[i] / 1e6 << "ms (correlation " << stats.gyro_correlation[i] << ")";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// every discovered camera at once, each one on its own worker thread
+int runRig(const DownloadManager::Options& download_options, int timeout_ms, bool sync_gyro) {
+    CameraRig rig(timeout_ms);
+    if (rig.Open() == 0) {
+        std::cerr << "no device opened." << std::endl;
+        return -1;
+    }
+    for (size_t i = 0; i < rig.Size(); i++) {
+        std::cout << "serial:" << rig.Device(i).serial_number << "\t"
+            << ";camera type:" << rig.Device(i).camera_name << std::endl;
+    }
+
+    std::cout << "Usage:" << std::endl;
+    std::cout << "1: start recording on all cameras" << std::endl;
+    std::cout << "2: stop recording on all cameras" << std::endl;
+    std::cout << "3: sync local time to all cameras" << std::endl;
+    std::cout << "4: download all files of all cameras" << std::endl;
+    std::cout << "5: latency per camera" << std::endl;
+    std::cout << "6: synchronized preview of all cameras" << std::endl;
+    std::cout << "0: exit" << std::endl;
+
+    int option = 0;
+    while (true) {
+        std::cout << "please enter index: ";
+        std::cin >> option;
+        if (option == 0) {
+            break;
+        }
+        if (option == 1) {
+            printRigResults("start recording", rig.StartRecording());
+        }
+        else if (option == 2) {
+            printRigResults("stop recording", rig.StopRecording());
+        }
+        else if (option == 3) {
+            time_t now = time(nullptr);
+            std::tm tm{};
+#ifdef WIN32
+            (void)(localtime_s(&tm, &now));
+            const time_t time_seconds = _mkgmtime(&tm);
+#else
+            localtime_r(&now, &tm);
+            const time_t time_seconds = timegm(&tm);
+#endif
+            printRigResults("sync time", rig.SyncLocalTime(time_seconds));
+        }
+        else if (option == 4) {
+            std::string dir;
+            std::cout << "please input dir to download: ";
+            std::cin >> dir;
+            printRigResults("download", rig.Download(dir, download_options));
+        }
+        else if (option == 5) {
+            const auto latencies = rig.GetLatency();
+            for (size_t i = 0; i < latencies.size(); i++) {
+                const auto& latency = latencies[i];
+                std::cout << latency.serial_number << ": calls = " << latency.calls << "; failures = " << latency.failures
+                    << "; last = " << latency.last_ms << "ms; avg = " << (latency.calls > 0 ? latency.total_ms / latency.calls : 0)
+                    << "ms; max = " << latency.max_ms << "ms (" << latency.slowest_operation << ")"
+                    << "; pending = " << rig.Pending(i) << std::endl;
+            }
+        }
+        else if (option == 6) {
+            int seconds = 10;
+            std::cout << "please input seconds: ";
+            std::cin >> seconds;
+            syncPreview(rig, seconds, sync_gyro);
+        }
+        else {
+            std::cout << "Invalid index" << std::endl;
+        }
+    }
+    return 0;
+}
+
 void signalHandle(int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
         std::cout << "signal handler: " << sig << std::endl;
@@ -153,6 +355,14 @@ int main(int argc, char* argv[]) {
 
     std::cout << "begin open camera" << std::endl;
     ins_camera::SetLogLevel(ins_camera::LogLevel::ERR);
+    bool record_capture = false;
+    std::string replay_file;
+    ReplayCamera::Options replay_options;
+    DownloadManager::Options download_options;
+    int delete_window = 1;
+    bool rig = false;
+    int rig_timeout_ms = 30000;
+    bool sync_gyro = false;
     for (int i = 1; i < argc; i++) {
         const std::string arg = argv[i];
         if (arg == std::string("--debug")) {
@@ -162,6 +372,45 @@ int main(int argc, char* argv[]) {
             const std::string log_file = argv[++i];
             ins_camera::SetLogPath(log_file);
         }
+        else if (arg == std::string("--record_capture")) {
+            record_capture = true;
+        }
+        else if (arg == std::string("--replay")) {
+            replay_file = argv[++i];
+        }
+        else if (arg == std::string("--replay_speed")) {
+            replay_options.speed = atof(argv[++i]);
+        }
+        else if (arg == std::string("--replay_loops")) {
+            replay_options.loops = atoi(argv[++i]);
+        }
+        else if (arg == std::string("--download_threads")) {
+            download_options.concurrency = atoi(argv[++i]);
+        }
+        else if (arg == std::string("--download_chunk_mb")) {
+            download_options.chunk_size = static_cast<int64_t>(atoi(argv[++i])) * 1024 * 1024;
+        }
+        else if (arg == std::string("--delete_window")) {
+            delete_window = atoi(argv[++i]);
+        }
+        else if (arg == std::string("--rig")) {
+            rig = true;
+        }
+        else if (arg == std::string("--rig_timeout_ms")) {
+            rig_timeout_ms = atoi(argv[++i]);
+        }
+        else if (arg == std::string("--sync_gyro")) {
+            sync_gyro = true;
+        }
+    }
+
+    // no camera needed: play a capture recorded with --record_capture into the stream delegate
+    if (!replay_file.empty()) {
+        return replayCapture(replay_file, replay_options);
+    }
+
+    if (rig) {
+        return runRig(download_options, rig_timeout_ms, sync_gyro);
     }
 
     ins_camera::DeviceDiscovery discovery;
@@ -191,6 +440,9 @@ int main(int argc, char* argv[]) {
 
     std::shared_ptr<ins_camera::StreamDelegate> delegate = std::make_shared<TestStreamDelegate>();
     cam->SetStreamDelegate(delegate);
+    std::shared_ptr<StreamRecorder> capture_recorder;
+    // file list of the previous option 40, kept across runs
+    CameraFileIndex file_index(std::string("./") + serial_number + std::string("_files.cache"));
 
     std::cout << "Succeed to open camera..." << std::endl;
 
@@ -229,6 +481,8 @@ int main(int argc, char* argv[]) {
     std::cout << "37: get media time from camera " << std::endl;
     std::cout << "38: Shutdown camera " << std::endl;
     std::cout << "39: Get camera log" << std::endl;
+    std::cout << "40: sync file list (changes since the last sync)" << std::endl;
+    std::cout << "41: get size and time of all files" << std::endl;
     std::cout << "0: exit" << std::endl;
 
     time_t now = time(nullptr);
@@ -259,7 +513,7 @@ int main(int argc, char* argv[]) {
     while (true) {
         std::cout << "please enter index: ";
         std::cin >> option;
-        if (option < 0 || option > 39) {
+        if (option < 0 || option > 41) {
             std::cout << "Invalid index" << std::endl;
             continue;
         }
@@ -513,6 +767,21 @@ int main(int argc, char* argv[]) {
                 stream_delegate->StartStream();
             }
 
+            if (record_capture) {
+                // everything the camera delivers is also saved for --replay
+                const std::string capture_file = std::string("./") + getCurrentTime() + std::string(".inscap");
+                capture_recorder = std::make_shared<StreamRecorder>(capture_file, cam->GetPreviewParam(), serial_number, delegate);
+                if (capture_recorder->IsOpen()) {
+                    std::shared_ptr<ins_camera::StreamDelegate> recorder_delegate = capture_recorder;
+                    cam->SetStreamDelegate(recorder_delegate);
+                    std::cout << "recording capture to " << capture_file << std::endl;
+                }
+                else {
+                    std::cerr << "failed to create file " << capture_file << std::endl;
+                    capture_recorder.reset();
+                }
+            }
+
             if (cam->StartLiveStreaming(param)) {
                 std::cout << "successfully started live stream" << std::endl;
             }
@@ -524,6 +793,13 @@ int main(int argc, char* argv[]) {
                 if (stream_delegate) {
                     stream_delegate->StopStream();
                 }
+                if (capture_recorder) {
+                    capture_recorder->Close();
+                    std::cout << "capture: " << capture_recorder->Records() << " records, "
+                        << capture_recorder->Bytes() / 1024 << "KB" << std::endl;
+                    cam->SetStreamDelegate(delegate);
+                    capture_recorder.reset();
+                }
                 std::cout << "success!" << std::endl;
             }
             else {
@@ -803,8 +1079,43 @@ int main(int argc, char* argv[]) {
                     file_to_save_dir.append("/");
                 }
 
+                // parallel Range downloads over the camera's http server, resumed from .part files
+                std::vector<std::string> fallback_files;
+                DownloadManager manager(cam->GetHttpBaseUrl(), download_options);
+                if (manager.IsValid()) {
+                    for (const auto& url : file_lists) {
+                        manager.Add(url, file_to_save_dir + GetFileName(url));
+                    }
+                    const auto start_time = std::chrono::steady_clock::now();
+                    const auto results = manager.Run([](const DownloadManager::Progress& progress) {
+                        std::cout << "\r";
+                        std::cout << "files = " << progress.files_done << "/" << progress.files_total
+                            << ", " << progress.bytes_done / (1024 * 1024) << "/" << progress.bytes_total / (1024 * 1024) << "MB"
+                            << ", " << progress.mb_per_second << "MB/s";
+                        std::cout << std::flush;
+                    });
+                    std::cout << std::endl;
+                    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+                    int64_t downloaded_bytes = 0;
+                    for (const auto& result : results) {
+                        if (result.ok) {
+                            downloaded_bytes += result.size - result.resumed_bytes;
+                            std::cout << "Download " << result.remote_path << " succeed!!!" << std::endl;
+                        }
+                        else {
+                            std::cout << "Download " << result.remote_path << " failed: " << result.error << std::endl;
+                            fallback_files.push_back(result.remote_path);
+                        }
+                    }
+                    std::cout << "downloaded " << downloaded_bytes / (1024 * 1024) << "MB in " << seconds << "s, "
+                        << (seconds > 0 ? downloaded_bytes / seconds / (1024 * 1024) : 0) << "MB/s" << std::endl;
+                }
+                else {
+                    fallback_files = file_lists;
+                }
+
                 int64_t current_progress = -1;
-                for (const auto& url : file_lists) {
+                for (const auto& url : fallback_files) {
                     std::cout << "Download url: " << url << std::endl;
                     const std::string file_name = GetFileName(url);
                     std::string save_path = file_to_save_dir + file_name;
@@ -819,6 +1130,8 @@ int main(int argc, char* argv[]) {
                     });
                     std::cout << std::endl;
                     if (ret) {
+                        std::remove((save_path + ".part").c_str());
+                        std::remove((save_path + ".part.state").c_str());
                         std::cout << "Download " << url << " succeed!!!" << std::endl;
                     }
                     else {
@@ -830,12 +1143,23 @@ int main(int argc, char* argv[]) {
 
         if (option == 31) {
             const auto file_list = cam->GetCameraFilesList();
-            for (const auto& file : file_list) {
-                const auto ret = cam->DeleteCameraFile(file);
-                if (ret) {
-                    std::cout << file << " Deletion succeed" << std::endl;
+            const auto start_time = std::chrono::steady_clock::now();
+            // one file after the other unless --delete_window asks for concurrent DeleteCameraFile calls
+            const auto results = BatchDeleteCameraFiles(file_list, [&](const std::string& file) {
+                return cam->DeleteCameraFile(file);
+            }, delete_window, [](const CameraFileResult& result) {
+                if (result.ok) {
+                    std::cout << result.path << " Deletion succeed" << std::endl;
                 }
-            }
+                else {
+                    std::cout << result.path << " Deletion failed" << std::endl;
+                }
+            });
+            const auto failed = std::count_if(results.begin(), results.end(), [](const CameraFileResult& result) {
+                return !result.ok;
+            });
+            std::cout << results.size() - failed << " deleted, " << failed << " failed in "
+                << std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count() << "s" << std::endl;
         }
 
         if (option == 32) {
@@ -1026,6 +1350,42 @@ int main(int argc, char* argv[]) {
                 std::cout << "Download " << log_save_path << " failed!!!" << std::endl;
             }
         }
+
+        if (option == 40) {
+            const uint64_t cursor = file_index.Cursor();
+            const std::string base_url = cam->GetHttpBaseUrl();
+            // new files, files without metadata and the newest ones (maybe still recording) are asked for size and time
+            file_index.Update(cam->GetCameraFilesList(), [&](const std::vector<std::string>& paths) {
+                return StatCameraFiles(base_url, paths);
+            });
+            const auto change_set = file_index.ChangesSince(cursor);
+            for (const auto& change : change_set.changes) {
+                std::cout << (change.added ? "+ " : "- ") << change.info.path;
+                if (change.added && change.info.size >= 0) {
+                    std::cout << " size:" << change.info.size << " mtime:" << change.info.mtime;
+                }
+                std::cout << std::endl;
+            }
+            std::cout << change_set.changes.size() << " changes, " << file_index.FileCount() << " files" << std::endl;
+            if (!file_index.Save()) {
+                std::cerr << "failed to save the file list cache" << std::endl;
+            }
+        }
+
+        if (option == 41) {
+            const auto infos = StatCameraFiles(cam->GetHttpBaseUrl(), cam->GetCameraFilesList());
+            int64_t total_size = 0;
+            for (const auto& info : infos) {
+                if (info.status == 200) {
+                    total_size += std::max<int64_t>(0, info.size);
+                    std::cout << info.path << " size:" << info.size << " mtime:" << info.mtime << std::endl;
+                }
+                else {
+                    std::cout << info.path << " failed, status:" << info.status << std::endl;
+                }
+            }
+            std::cout << infos.size() << " files, " << total_size / (1024 * 1024) << "MB" << std::endl;
+        }
     }
 
     cam->Close();
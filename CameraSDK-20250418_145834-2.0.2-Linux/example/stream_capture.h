@@ -0,0 +1,684 @@
+#pragma once
+
+#include <camera/camera.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Capture files (.inscap) hold what a camera delivered to its StreamDelegate during a preview:
+ * the H.264/H.265 packets of every stream_index, the gyro batches and the exposure data, each with the
+ * camera timestamp and the time it arrived on the host. ReplayCamera plays them back into any
+ * StreamDelegate, so stream consumers can be run and measured without a camera on USB.
+ *
+ * layout: "INSCAP01", byte order mark, PreviewParam and serial number, then records of
+ * RecordHeader followed by its payload (video/audio bytes, GyroData[] or one ExposureData).
+ */
+enum class CaptureRecordType : uint8_t {
+    Video = 1,
+    Audio = 2,
+    Gyro = 3,
+    Exposure = 4
+};
+
+namespace stream_capture_detail {
+    const char kMagic[8] = { 'I', 'N', 'S', 'C', 'A', 'P', '0', '1' };
+    const uint32_t kByteOrder = 0x01020304;
+
+    struct RecordHeader {
+        uint8_t type;
+        uint8_t stream_type;
+        uint8_t stream_index;
+        uint8_t reserved;
+        uint32_t size;
+        // host steady clock, relative to the first record of the capture
+        int64_t arrival_ns;
+        // camera timestamp of video and audio packets, first sample of gyro batches
+        int64_t timestamp;
+    };
+
+    inline bool WriteString(FILE* fp, const std::string& value) {
+        const uint32_t size = static_cast<uint32_t>(value.size());
+        return fwrite(&size, sizeof(size), 1, fp) == 1 && (size == 0 || fwrite(value.data(), size, 1, fp) == 1);
+    }
+
+    class Reader {
+    public:
+        Reader(const uint8_t* data, size_t size) : data_(data), size_(size), pos_(0) {
+        }
+
+        bool Read(void* value, size_t size) {
+            if (size > size_ - pos_) {
+                return false;
+            }
+            memcpy(value, data_ + pos_, size);
+            pos_ += size;
+            return true;
+        }
+
+        bool ReadString(std::string& value) {
+            uint32_t size = 0;
+            if (!Read(&size, sizeof(size)) || size > size_ - pos_) {
+                return false;
+            }
+            value.assign(reinterpret_cast<const char*>(data_ + pos_), size);
+            pos_ += size;
+            return true;
+        }
+
+        size_t Position() const {
+            return pos_;
+        }
+
+        void Skip(size_t size) {
+            pos_ += size;
+        }
+
+        size_t Remaining() const {
+            return size_ - pos_;
+        }
+
+    private:
+        const uint8_t* data_;
+        size_t size_;
+        size_t pos_;
+    };
+}
+
+/**
+ * \class CaptureWriter
+ * \brief Writes a capture file record by record. Not thread safe, see StreamRecorder.
+ */
+class CaptureWriter {
+public:
+    CaptureWriter() = default;
+
+    ~CaptureWriter() {
+        Close();
+    }
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    bool Open(const std::string& path, const ins_camera::PreviewParam& param, const std::string& serial_number) {
+        Close();
+#ifdef WIN32
+        if (fopen_s(&fp_, path.c_str(), "wb") != 0) {
+            fp_ = nullptr;
+        }
+#else
+        fp_ = fopen(path.c_str(), "wb");
+#endif
+        if (!fp_) {
+            return false;
+        }
+        using namespace stream_capture_detail;
+        const int32_t encode_type = static_cast<int32_t>(param.encode_type);
+        const uint32_t offset_count = static_cast<uint32_t>(param.offset.size());
+        bool ok = fwrite(kMagic, sizeof(kMagic), 1, fp_) == 1
+            && fwrite(&kByteOrder, sizeof(kByteOrder), 1, fp_) == 1
+            && WriteString(fp_, param.camera_name)
+            && WriteString(fp_, serial_number)
+            && fwrite(&encode_type, sizeof(encode_type), 1, fp_) == 1
+            && fwrite(&param.gyro_timestamp, sizeof(param.gyro_timestamp), 1, fp_) == 1
+            && fwrite(&param.crop_info, sizeof(param.crop_info), 1, fp_) == 1
+            && fwrite(&offset_count, sizeof(offset_count), 1, fp_) == 1;
+        for (const auto& offset : param.offset) {
+            ok = ok && WriteString(fp_, offset);
+        }
+        if (!ok) {
+            Close();
+        }
+        return ok;
+    }
+
+    bool IsOpen() const {
+        return fp_ != nullptr;
+    }
+
+    bool Write(CaptureRecordType type, uint8_t stream_type, int stream_index, int64_t arrival_ns, int64_t timestamp, const void* data, size_t size) {
+        if (!fp_) {
+            return false;
+        }
+        stream_capture_detail::RecordHeader header{};
+        header.type = static_cast<uint8_t>(type);
+        header.stream_type = stream_type;
+        header.stream_index = static_cast<uint8_t>(stream_index);
+        header.size = static_cast<uint32_t>(size);
+        header.arrival_ns = arrival_ns;
+        header.timestamp = timestamp;
+        if (fwrite(&header, sizeof(header), 1, fp_) != 1 || (size > 0 && fwrite(data, size, 1, fp_) != 1)) {
+            write_errors_++;
+            return false;
+        }
+        records_++;
+        bytes_ += sizeof(header) + size;
+        return true;
+    }
+
+    void Close() {
+        if (fp_) {
+            fclose(fp_);
+            fp_ = nullptr;
+        }
+    }
+
+    uint64_t Records() const {
+        return records_;
+    }
+
+    uint64_t Bytes() const {
+        return bytes_;
+    }
+
+    uint64_t WriteErrors() const {
+        return write_errors_;
+    }
+
+private:
+    FILE* fp_ = nullptr;
+    uint64_t records_ = 0;
+    uint64_t bytes_ = 0;
+    uint64_t write_errors_ = 0;
+};
+
+/**
+ * \class StreamRecorder
+ * \brief A StreamDelegate that records everything the camera delivers into a capture file and
+ * forwards it to another delegate. Set it on the camera in place of the forwarded delegate.
+ */
+class StreamRecorder : public ins_camera::StreamDelegate {
+public:
+    StreamRecorder(const std::string& path, const ins_camera::PreviewParam& param, const std::string& serial_number,
+        const std::shared_ptr<ins_camera::StreamDelegate>& forward) : forward_(forward) {
+        writer_.Open(path, param, serial_number);
+    }
+
+    virtual ~StreamRecorder() {
+        Close();
+    }
+
+    bool IsOpen() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return writer_.IsOpen();
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lck(mutex_);
+        writer_.Close();
+    }
+
+    uint64_t Records() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return writer_.Records();
+    }
+
+    uint64_t Bytes() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return writer_.Bytes();
+    }
+
+    void OnAudioData(const uint8_t* data, size_t size, int64_t timestamp) override {
+        Record(CaptureRecordType::Audio, 0, 0, timestamp, data, size);
+        if (forward_) {
+            forward_->OnAudioData(data, size, timestamp);
+        }
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t streamType, int stream_index) override {
+        Record(CaptureRecordType::Video, streamType, stream_index, timestamp, data, size);
+        if (forward_) {
+            forward_->OnVideoData(data, size, timestamp, streamType, stream_index);
+        }
+    }
+
+    void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
+        Record(CaptureRecordType::Gyro, 0, 0, data.empty() ? 0 : data.front().timestamp, data.data(), data.size() * sizeof(ins_camera::GyroData));
+        if (forward_) {
+            forward_->OnGyroData(data);
+        }
+    }
+
+    void OnExposureData(const ins_camera::ExposureData& data) override {
+        Record(CaptureRecordType::Exposure, 0, 0, 0, &data, sizeof(data));
+        if (forward_) {
+            forward_->OnExposureData(data);
+        }
+    }
+
+private:
+    void Record(CaptureRecordType type, uint8_t stream_type, int stream_index, int64_t timestamp, const void* data, size_t size) {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lck(mutex_);
+        if (!writer_.IsOpen()) {
+            return;
+        }
+        if (writer_.Records() == 0) {
+            start_time_ = now;
+        }
+        const int64_t arrival_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_time_).count();
+        writer_.Write(type, stream_type, stream_index, std::max<int64_t>(0, arrival_ns), timestamp, data, size);
+    }
+
+    std::shared_ptr<ins_camera::StreamDelegate> forward_;
+    mutable std::mutex mutex_;
+    CaptureWriter writer_;
+    std::chrono::steady_clock::time_point start_time_;
+};
+
+/**
+ * \class ReplayCamera
+ * \brief A stand-in for ins_camera::Camera that plays a capture file into a StreamDelegate.
+ * Records are delivered from one thread, like the SDK does, at their recorded arrival times divided
+ * by the speed (speed 0 delivers as fast as the delegate returns). Camera timestamps are passed
+ * through unchanged; later loops shift them by the capture span so they keep increasing.
+ * The whole capture is loaded by Open(), the replay itself never touches the disk.
+ */
+class ReplayCamera {
+public:
+    struct Options {
+        double speed = 1.0;
+        int loops = 1;
+    };
+
+    struct CallbackStats {
+        uint64_t calls = 0;
+        uint64_t bytes = 0;
+        double total_ms = 0;
+        double p50_ms = 0;
+        double p99_ms = 0;
+        double max_ms = 0;
+    };
+
+    struct Stats {
+        CallbackStats video;
+        CallbackStats audio;
+        CallbackStats gyro;
+        CallbackStats exposure;
+        uint64_t gyro_samples = 0;
+        // how late records were handed to the delegate, a slow delegate delays every later record
+        double max_lag_ms = 0;
+        double total_lag_ms = 0;
+        double elapsed_ms = 0;
+    };
+
+    explicit ReplayCamera(const std::string& path) : path_(path) {
+    }
+
+    ~ReplayCamera() {
+        Close();
+    }
+
+    ReplayCamera(const ReplayCamera&) = delete;
+    ReplayCamera& operator=(const ReplayCamera&) = delete;
+
+    bool Open() {
+        Close();
+        if (!Load()) {
+            records_.clear();
+            payload_.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void Close() {
+        StopLiveStreaming();
+        records_.clear();
+        payload_.clear();
+    }
+
+    const ins_camera::PreviewParam& GetPreviewParam() const {
+        return param_;
+    }
+
+    const std::string& SerialNumber() const {
+        return serial_number_;
+    }
+
+    size_t RecordCount() const {
+        return records_.size();
+    }
+
+    /**
+     * \brief recorded duration of one loop at speed 1
+     */
+    double CaptureDurationMs() const {
+        return loop_ns_ / 1e6;
+    }
+
+    void SetStreamDelegate(const std::shared_ptr<ins_camera::StreamDelegate>& delegate) {
+        delegate_ = delegate;
+    }
+
+    bool StartLiveStreaming(const Options& options) {
+        if (records_.empty() || !delegate_ || thread_.joinable()) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            stop_ = false;
+            streaming_ = true;
+            stats_ = Stats();
+            video_ms_.clear();
+            audio_ms_.clear();
+            gyro_ms_.clear();
+            exposure_ms_.clear();
+        }
+        thread_ = std::thread(&ReplayCamera::Run, this, options);
+        return true;
+    }
+
+    bool StopLiveStreaming() {
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            stop_ = true;
+            cond_.notify_all();
+        }
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        return true;
+    }
+
+    /**
+     * \brief blocks until every loop has been delivered or the replay was stopped
+     */
+    void WaitForEnd() {
+        std::unique_lock<std::mutex> lck(mutex_);
+        cond_.wait(lck, [this]() {
+            return !streaming_;
+        });
+    }
+
+    bool IsStreaming() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return streaming_;
+    }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        Stats stats = stats_;
+        Summarize(video_ms_, stats.video);
+        Summarize(audio_ms_, stats.audio);
+        Summarize(gyro_ms_, stats.gyro);
+        Summarize(exposure_ms_, stats.exposure);
+        return stats;
+    }
+
+private:
+    struct Record {
+        CaptureRecordType type;
+        uint8_t stream_type;
+        uint8_t stream_index;
+        int64_t arrival_ns;
+        int64_t timestamp;
+        size_t offset;
+        size_t size;
+    };
+
+    // what one more loop adds to the timestamps of a stream: first to last plus one average interval
+    template <typename T>
+    static T LoopSpan(T first, T last, uint64_t count) {
+        return count > 1 ? (last - first) + (last - first) / static_cast<T>(count - 1) : T(0);
+    }
+
+    bool Load() {
+        std::vector<uint8_t> file;
+        FILE* fp = nullptr;
+#ifdef WIN32
+        if (fopen_s(&fp, path_.c_str(), "rb") != 0) {
+            fp = nullptr;
+        }
+#else
+        fp = fopen(path_.c_str(), "rb");
+#endif
+        if (!fp) {
+            return false;
+        }
+        uint8_t chunk[64 * 1024];
+        size_t read = 0;
+        while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            file.insert(file.end(), chunk, chunk + read);
+        }
+        fclose(fp);
+
+        using namespace stream_capture_detail;
+        Reader reader(file.data(), file.size());
+        char magic[sizeof(kMagic)];
+        uint32_t byte_order = 0;
+        int32_t encode_type = 0;
+        uint32_t offset_count = 0;
+        if (!reader.Read(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0
+            || !reader.Read(&byte_order, sizeof(byte_order)) || byte_order != kByteOrder
+            || !reader.ReadString(param_.camera_name)
+            || !reader.ReadString(serial_number_)
+            || !reader.Read(&encode_type, sizeof(encode_type))
+            || !reader.Read(&param_.gyro_timestamp, sizeof(param_.gyro_timestamp))
+            || !reader.Read(&param_.crop_info, sizeof(param_.crop_info))
+            || !reader.Read(&offset_count, sizeof(offset_count))) {
+            return false;
+        }
+        param_.encode_type = static_cast<ins_camera::VideoEncodeType>(encode_type);
+        param_.offset.resize(offset_count);
+        for (auto& offset : param_.offset) {
+            if (!reader.ReadString(offset)) {
+                return false;
+            }
+        }
+
+        const size_t payload_start = reader.Position();
+        RecordHeader header{};
+        uint64_t video_count = 0, audio_count = 0, gyro_count = 0, exposure_count = 0;
+        int64_t first_video = 0, last_video = 0, first_audio = 0, last_audio = 0, first_gyro = 0, last_gyro = 0;
+        double first_exposure = 0, last_exposure = 0;
+        // a capture cut short by a crash keeps every complete record
+        while (reader.Read(&header, sizeof(header)) && header.size <= reader.Remaining()) {
+            Record record;
+            record.type = static_cast<CaptureRecordType>(header.type);
+            record.stream_type = header.stream_type;
+            record.stream_index = header.stream_index;
+            record.arrival_ns = header.arrival_ns;
+            record.timestamp = header.timestamp;
+            record.offset = reader.Position() - payload_start;
+            record.size = header.size;
+            const uint8_t* payload = file.data() + reader.Position();
+            reader.Skip(header.size);
+
+            if (record.type == CaptureRecordType::Video) {
+                first_video = video_count++ == 0 ? record.timestamp : first_video;
+                last_video = record.timestamp;
+            }
+            else if (record.type == CaptureRecordType::Audio) {
+                first_audio = audio_count++ == 0 ? record.timestamp : first_audio;
+                last_audio = record.timestamp;
+            }
+            else if (record.type == CaptureRecordType::Gyro) {
+                if (record.size % sizeof(ins_camera::GyroData) != 0) {
+                    continue;
+                }
+                const size_t samples = record.size / sizeof(ins_camera::GyroData);
+                for (size_t i = 0; i < samples; i++) {
+                    ins_camera::GyroData sample;
+                    memcpy(&sample, payload + i * sizeof(sample), sizeof(sample));
+                    first_gyro = gyro_count++ == 0 ? sample.timestamp : first_gyro;
+                    last_gyro = sample.timestamp;
+                }
+            }
+            else if (record.type == CaptureRecordType::Exposure) {
+                if (record.size != sizeof(ins_camera::ExposureData)) {
+                    continue;
+                }
+                ins_camera::ExposureData exposure;
+                memcpy(&exposure, payload, sizeof(exposure));
+                first_exposure = exposure_count++ == 0 ? exposure.timestamp : first_exposure;
+                last_exposure = exposure.timestamp;
+            }
+            else {
+                continue;
+            }
+            records_.push_back(record);
+        }
+        if (records_.empty()) {
+            return false;
+        }
+        payload_.assign(file.begin() + payload_start, file.end());
+
+        video_span_ = LoopSpan(first_video, last_video, video_count);
+        audio_span_ = LoopSpan(first_audio, last_audio, audio_count);
+        gyro_span_ = LoopSpan(first_gyro, last_gyro, gyro_count);
+        exposure_span_ = LoopSpan(first_exposure, last_exposure, exposure_count);
+        loop_ns_ = LoopSpan(records_.front().arrival_ns, records_.back().arrival_ns, records_.size());
+        return true;
+    }
+
+    static void Summarize(std::vector<double> durations_ms, CallbackStats& stats) {
+        if (durations_ms.empty()) {
+            return;
+        }
+        std::sort(durations_ms.begin(), durations_ms.end());
+        stats.p50_ms = durations_ms[durations_ms.size() / 2];
+        stats.p99_ms = durations_ms[std::min(durations_ms.size() - 1, durations_ms.size() * 99 / 100)];
+        stats.max_ms = durations_ms.back();
+    }
+
+    void Run(Options options) {
+        using namespace std::chrono;
+        std::vector<ins_camera::GyroData> gyro;
+        const auto start_time = steady_clock::now();
+        for (int loop = 0; loop < std::max(1, options.loops); loop++) {
+            for (const auto& record : records_) {
+                const int64_t arrival_ns = loop * loop_ns_ + record.arrival_ns;
+                const auto due = start_time + nanoseconds(options.speed > 0 ? static_cast<int64_t>(arrival_ns / options.speed) : 0);
+                {
+                    std::unique_lock<std::mutex> lck(mutex_);
+                    if (options.speed > 0) {
+                        cond_.wait_until(lck, due, [this]() {
+                            return stop_;
+                        });
+                    }
+                    if (stop_) {
+                        loop = options.loops;
+                        break;
+                    }
+                }
+
+                const auto begin = steady_clock::now();
+                const double lag_ms = options.speed > 0 ? duration_cast<duration<double, std::milli>>(begin - due).count() : 0;
+                const uint8_t* payload = payload_.data() + record.offset;
+                std::vector<double>* durations = nullptr;
+                CallbackStats* stats = nullptr;
+                if (record.type == CaptureRecordType::Video) {
+                    delegate_->OnVideoData(payload, record.size, record.timestamp + loop * video_span_, record.stream_type, record.stream_index);
+                    durations = &video_ms_;
+                    stats = &stats_.video;
+                }
+                else if (record.type == CaptureRecordType::Audio) {
+                    delegate_->OnAudioData(payload, record.size, record.timestamp + loop * audio_span_);
+                    durations = &audio_ms_;
+                    stats = &stats_.audio;
+                }
+                else if (record.type == CaptureRecordType::Gyro) {
+                    gyro.resize(record.size / sizeof(ins_camera::GyroData));
+                    if (!gyro.empty()) {
+                        memcpy(gyro.data(), payload, record.size);
+                    }
+                    for (auto& sample : gyro) {
+                        sample.timestamp += loop * gyro_span_;
+                    }
+                    delegate_->OnGyroData(gyro);
+                    durations = &gyro_ms_;
+                    stats = &stats_.gyro;
+                }
+                else {
+                    ins_camera::ExposureData exposure;
+                    memcpy(&exposure, payload, sizeof(exposure));
+                    exposure.timestamp += loop * exposure_span_;
+                    delegate_->OnExposureData(exposure);
+                    durations = &exposure_ms_;
+                    stats = &stats_.exposure;
+                }
+                const double callback_ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - begin).count();
+
+                std::lock_guard<std::mutex> lck(mutex_);
+                durations->push_back(callback_ms);
+                stats->calls++;
+                stats->bytes += record.size;
+                stats->total_ms += callback_ms;
+                if (record.type == CaptureRecordType::Gyro) {
+                    stats_.gyro_samples += gyro.size();
+                }
+                stats_.max_lag_ms = std::max(stats_.max_lag_ms, lag_ms);
+                stats_.total_lag_ms += std::max(0.0, lag_ms);
+            }
+        }
+        std::lock_guard<std::mutex> lck(mutex_);
+        stats_.elapsed_ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - start_time).count();
+        streaming_ = false;
+        cond_.notify_all();
+    }
+
+    std::string path_;
+    ins_camera::PreviewParam param_{};
+    std::string serial_number_;
+    std::vector<Record> records_;
+    std::vector<uint8_t> payload_;
+    int64_t loop_ns_ = 0;
+    int64_t video_span_ = 0;
+    int64_t audio_span_ = 0;
+    int64_t gyro_span_ = 0;
+    double exposure_span_ = 0;
+
+    std::shared_ptr<ins_camera::StreamDelegate> delegate_;
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_ = false;
+    bool streaming_ = false;
+    Stats stats_;
+    std::vector<double> video_ms_;
+    std::vector<double> audio_ms_;
+    std::vector<double> gyro_ms_;
+    std::vector<double> exposure_ms_;
+};
+
+inline void PrintReplayStats(const ReplayCamera::Stats& stats, std::ostream& out) {
+    const double seconds = stats.elapsed_ms > 0 ? stats.elapsed_ms / 1000 : 1;
+    const struct {
+        const char* name;
+        const ReplayCamera::CallbackStats& callback;
+    } callbacks[] = {
+        { "OnVideoData", stats.video },
+        { "OnAudioData", stats.audio },
+        { "OnGyroData", stats.gyro },
+        { "OnExposureData", stats.exposure },
+    };
+    out << "replayed in " << stats.elapsed_ms << "ms" << std::endl;
+    for (const auto& entry : callbacks) {
+        if (entry.callback.calls == 0) {
+            continue;
+        }
+        out << entry.name << ": " << entry.callback.calls << " calls, "
+            << entry.callback.calls / seconds << " calls/s, "
+            << entry.callback.bytes / seconds / (1024 * 1024) << " MB/s"
+            << ", p50 " << entry.callback.p50_ms << "ms"
+            << ", p99 " << entry.callback.p99_ms << "ms"
+            << ", max " << entry.callback.max_ms << "ms" << std::endl;
+    }
+    if (stats.gyro_samples > 0) {
+        out << "gyro samples: " << stats.gyro_samples << ", " << stats.gyro_samples / seconds << " samples/s" << std::endl;
+    }
+    const uint64_t calls = stats.video.calls + stats.audio.calls + stats.gyro.calls + stats.exposure.calls;
+    out << "delivery lag: max " << stats.max_lag_ms << "ms, mean " << (calls ? stats.total_lag_ms / calls : 0) << "ms" << std::endl;
+}
@@ -0,0 +1,200 @@
+#include <iostream>
+#include <camera/camera.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "stream_capture.h"
+
+const std::string helpstr =
+"{-help                   | default               | print this message                  }\n"
+"{-capture                | None                  | capture file (.inscap) to replay    }\n"
+"{-speed                  | 1                     | replay speed, 0 = as fast as the consumer returns }\n"
+"{-loops                  | 1                     | replay the capture this many times  }\n"
+"{-consumer               | copy                  | null: return at once, copy: copy every packet like a ring buffer }\n"
+"{-consumer_us            | 0                     | extra busy time per video packet (us), simulates a slow consumer }\n"
+"{-generate               | None                  | write a synthetic capture to this file and replay it }\n"
+"{-seconds                | 10                    | synthetic capture: duration         }\n"
+"{-fps                    | 30                    | synthetic capture: frames per second per stream }\n"
+"{-streams                | 2                     | synthetic capture: video streams (stream_index) }\n"
+"{-packet_kb              | 64                    | synthetic capture: video packet size (KB) }\n"
+"{-gyro_rate              | 1000                  | synthetic capture: gyro samples per second }\n";
+
+/**
+ * \brief consumer under test: measures nothing itself, ReplayCamera times every callback
+ */
+class BenchDelegate : public ins_camera::StreamDelegate {
+public:
+    BenchDelegate(bool copy, int busy_us) : copy_(copy), busy_us_(busy_us) {
+    }
+
+    void OnAudioData(const uint8_t* data, size_t size, int64_t timestamp) override {
+    }
+
+    void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t streamType, int stream_index) override {
+        if (copy_) {
+            packet_.assign(data, data + size);
+        }
+        if (busy_us_ > 0) {
+            const auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(busy_us_);
+            while (std::chrono::steady_clock::now() < until) {
+            }
+        }
+    }
+
+    void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
+        if (copy_) {
+            gyro_.assign(data.begin(), data.end());
+        }
+    }
+
+    void OnExposureData(const ins_camera::ExposureData& data) override {
+    }
+
+private:
+    bool copy_;
+    int busy_us_;
+    std::vector<uint8_t> packet_;
+    std::vector<ins_camera::GyroData> gyro_;
+};
+
+/**
+ * \brief H.264 sized packets (Annex B start code, an IDR every second), gyro batches and one exposure
+ * per frame, arriving on a perfect clock. Timestamps are in milliseconds.
+ */
+bool generateCapture(const std::string& path, int seconds, int fps, int streams, int packet_kb, int gyro_rate) {
+    ins_camera::PreviewParam param{};
+    param.camera_name = "Insta360 X4";
+    param.encode_type = ins_camera::VideoEncodeType::H264;
+    param.crop_info.src_width = 2880;
+    param.crop_info.src_height = 1440;
+    param.crop_info.dst_width = 2880;
+    param.crop_info.dst_height = 1440;
+    CaptureWriter writer;
+    if (!writer.Open(path, param, "SYNTHETIC")) {
+        return false;
+    }
+
+    std::vector<uint8_t> packet(static_cast<size_t>(packet_kb) * 1024);
+    for (size_t i = 4; i < packet.size(); i++) {
+        packet[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    packet[0] = 0;
+    packet[1] = 0;
+    packet[2] = 0;
+    packet[3] = 1;
+
+    const int frames = seconds * fps;
+    const int samples_per_frame = std::max(1, gyro_rate / fps);
+    std::vector<ins_camera::GyroData> gyro(samples_per_frame);
+    for (int frame = 0; frame < frames; frame++) {
+        const int64_t frame_ns = static_cast<int64_t>(frame) * 1000000000 / fps;
+        const int64_t timestamp_ms = frame_ns / 1000000;
+        packet[4] = frame % fps == 0 ? 0x65 : 0x41;
+        for (int stream = 0; stream < streams; stream++) {
+            writer.Write(CaptureRecordType::Video, 0, stream, frame_ns, timestamp_ms, packet.data(), packet.size());
+        }
+        for (int i = 0; i < samples_per_frame; i++) {
+            gyro[i].timestamp = (static_cast<int64_t>(frame) * samples_per_frame + i) * 1000 / (samples_per_frame * fps);
+            gyro[i].ax = 0;
+            gyro[i].ay = 0;
+            gyro[i].az = 1;
+            gyro[i].gx = 0.01 * i;
+            gyro[i].gy = 0;
+            gyro[i].gz = 0;
+        }
+        writer.Write(CaptureRecordType::Gyro, 0, 0, frame_ns, gyro[0].timestamp, gyro.data(), gyro.size() * sizeof(ins_camera::GyroData));
+        ins_camera::ExposureData exposure{};
+        exposure.timestamp = static_cast<double>(frame) / fps;
+        exposure.exposure_time = 1.0 / 120;
+        writer.Write(CaptureRecordType::Exposure, 0, 0, frame_ns, 0, &exposure, sizeof(exposure));
+    }
+    return writer.WriteErrors() == 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string capture;
+    std::string generate;
+    ReplayCamera::Options options;
+    std::string consumer = "copy";
+    int consumer_us = 0;
+    int seconds = 10;
+    int fps = 30;
+    int streams = 2;
+    int packet_kb = 64;
+    int gyro_rate = 1000;
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-capture") == std::string(argv[i])) {
+            capture = argv[++i];
+        }
+        else if (std::string("-speed") == std::string(argv[i])) {
+            options.speed = atof(argv[++i]);
+        }
+        else if (std::string("-loops") == std::string(argv[i])) {
+            options.loops = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-consumer") == std::string(argv[i])) {
+            consumer = argv[++i];
+        }
+        else if (std::string("-consumer_us") == std::string(argv[i])) {
+            consumer_us = atoi(argv[++i]);
+        }
+        else if (std::string("-generate") == std::string(argv[i])) {
+            generate = argv[++i];
+        }
+        else if (std::string("-seconds") == std::string(argv[i])) {
+            seconds = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-fps") == std::string(argv[i])) {
+            fps = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-streams") == std::string(argv[i])) {
+            streams = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-packet_kb") == std::string(argv[i])) {
+            packet_kb = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-gyro_rate") == std::string(argv[i])) {
+            gyro_rate = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-help") == std::string(argv[i])) {
+            std::cout << helpstr << std::endl;
+            return 0;
+        }
+    }
+
+    if (!generate.empty()) {
+        if (!generateCapture(generate, seconds, fps, streams, packet_kb, gyro_rate)) {
+            std::cerr << "failed to write " << generate << std::endl;
+            return -1;
+        }
+        capture = generate;
+    }
+    if (capture.empty()) {
+        std::cout << helpstr << std::endl;
+        return -1;
+    }
+
+    ReplayCamera camera(capture);
+    if (!camera.Open()) {
+        std::cerr << "failed to open capture " << capture << std::endl;
+        return -1;
+    }
+    std::cout << "capture: " << camera.GetPreviewParam().camera_name << " " << camera.SerialNumber()
+        << ", " << camera.RecordCount() << " records, " << camera.CaptureDurationMs() << "ms"
+        << "; speed = " << options.speed << ", loops = " << options.loops
+        << ", consumer = " << consumer << std::endl;
+
+    camera.SetStreamDelegate(std::make_shared<BenchDelegate>(consumer != std::string("null"), consumer_us));
+    if (!camera.StartLiveStreaming(options)) {
+        std::cerr << "failed to start replay" << std::endl;
+        return -1;
+    }
+    camera.WaitForEnd();
+    camera.StopLiveStreaming();
+    PrintReplayStats(camera.GetStats(), std::cout);
+    return 0;
+}
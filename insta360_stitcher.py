@@ -20,6 +20,7 @@ import sys
 import subprocess
 import argparse
 import json
+import socket
 from pathlib import Path
 
 # Configurazione paths SDK (modifica questi percorsi se necessario)
@@ -150,6 +151,82 @@ def run_stitcher(video_path, output_dir, algorithm, width, height):
         print(f"❌ Errore imprevisto: {e}")
         return False
 
+def run_service_stitcher(socket_path, video_path, output_dir, algorithm, width, height):
+    """
+    Invia il video a un main gia' avviato con -serve_socket, senza pagare l'avvio del processo e InitEnv.
+    Ritorna None se il servizio non risponde, cosi' il chiamante puo' avviare main come al solito.
+    """
+    fields = [
+        'STITCH', f'{os.getpid()}-{video_path.stem}',
+        f'inputs={video_path.absolute()}',
+        f'image_sequence_dir={output_dir.absolute()}',
+        f'output_size={width}x{height}',
+        f'stitch_type={ALGORITHMS[algorithm]}',
+        'progress=1'
+    ]
+    if algorithm in AI_MODELS:
+        fields.append(f'ai_stitching_model={AI_MODELS[algorithm]}')
+
+    try:
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        conn.connect(socket_path)
+    except OSError as e:
+        print(f"⚠️  Servizio {socket_path} non disponibile ({e}), avvio main")
+        return None
+
+    print(f"Avvio stitching tramite il servizio {socket_path}...")
+    with conn, conn.makefile('r', encoding='utf-8') as replies:
+        conn.sendall(('\t'.join(fields) + '\n').encode('utf-8'))
+        for line in replies:
+            reply = line.rstrip('\n').split('\t')
+            if reply[0] == 'PROGRESS':
+                print(f"\r{reply[2]}%", end='', flush=True)
+            elif reply[0] == 'ERROR':
+                print(f"❌ Errore del servizio: {' '.join(reply[2:])}")
+                return False
+            elif reply[0] == 'DONE':
+                print()
+                print(f"Tempi: {', '.join(reply[3:])}")
+                if reply[2] == 'succeeded':
+                    print(f"✅ Stitching completato con successo!")
+                    return True
+                print(f"❌ Errore durante lo stitching: {reply[2]}")
+                return False
+    print(f"❌ Il servizio ha chiuso la connessione")
+    return False
+
+def run_batch_stitcher(input_dir, output_dir, algorithm, width, height, workers):
+    """
+    Esegue lo stitching di tutte le foto (.insp/.jpg) di una cartella con un solo processo.
+    Gli ImageStitcher restano configurati tra una foto e l'altra, invece di avviare main per ogni file.
+    """
+    cmd = [
+        MAIN_EXECUTABLE,
+        '-input_dir', str(input_dir.absolute()),
+        '-output', str(output_dir.absolute()),
+        '-output_size', f'{width}x{height}',
+        '-stitch_type', ALGORITHMS[algorithm],
+        '-workers', str(workers)
+    ]
+
+    if algorithm in AI_MODELS:
+        cmd.extend(['-ai_stitching_model', AI_MODELS[algorithm]])
+        print(f"Usando modello AI: {AI_MODELS[algorithm]}")
+
+    env = os.environ.copy()
+    env['LD_LIBRARY_PATH'] = f"{CAMERA_SDK_LIB}:{MEDIA_SDK_LIB}"
+
+    print(f"Comando: {' '.join(cmd)}")
+    print(f"Avvio stitching batch...")
+
+    try:
+        subprocess.run(cmd, env=env, cwd=EXAMPLE_DIR, check=True, text=True, capture_output=False)
+        print(f"✅ Stitching completato con successo!")
+        return True
+    except subprocess.CalledProcessError as e:
+        print(f"❌ Errore durante lo stitching: {e}")
+        return False
+
 def main():
     parser = argparse.ArgumentParser(
         description='Insta360 Video Stitcher - Estrae frame equirettangolari da video .insv',
@@ -166,14 +243,20 @@ Esempi:
   python insta360_stitcher.py video.insv ./frames
   python insta360_stitcher.py video.insv ./frames dynamicstitch
   python insta360_stitcher.py /path/to/video.insv /path/to/output optflow
+  python insta360_stitcher.py /path/to/photos/ /path/to/output template --workers 4
+  python insta360_stitcher.py video.insv ./frames template --service /tmp/insta360_stitch.sock
         """
     )
     
-    parser.add_argument('input_video', help='Path del video Insta360 (.insv)')
+    parser.add_argument('input_video', help='Path del video Insta360 (.insv) o di una cartella di foto (.insp)')
     parser.add_argument('output_dir', help='Directory di output per i frame')
     parser.add_argument('algorithm', nargs='?', default='template',
                        choices=['template', 'dynamicstitch', 'optflow', 'aistitchv1', 'aistitchv2'],
                        help='Algoritmo di stitching (default: template)')
+    parser.add_argument('--workers', type=int, default=os.cpu_count() or 1,
+                       help='Stitcher paralleli per una cartella di foto (default: numero di CPU)')
+    parser.add_argument('--service', metavar='SOCKET',
+                       help='Socket di un main avviato con -serve_socket; senza risposta avvia main come al solito')
     
     args = parser.parse_args()
     
@@ -183,6 +266,21 @@ Esempi:
         print(f"❌ ERRORE: File video non trovato: {input_path}")
         sys.exit(1)
         
+    if input_path.is_dir():
+        if not validate_paths():
+            sys.exit(1)
+        output_path = Path(args.output_dir)
+        output_path.mkdir(parents=True, exist_ok=True)
+        photos = sorted(p for p in input_path.iterdir() if p.suffix.lower() in ['.insp', '.jpg'])
+        if not photos:
+            print(f"❌ ERRORE: Nessuna foto .insp/.jpg in {input_path}")
+            sys.exit(1)
+        width, height = get_video_resolution(photos[0])
+        print(f"📷 {len(photos)} foto, {args.workers} worker, output {width}x{height}")
+        if not run_batch_stitcher(input_path, output_path, args.algorithm, width, height, args.workers):
+            sys.exit(1)
+        return
+
     if not input_path.suffix.lower() in ['.insv', '.mp4']:
         print(f"⚠️  WARNING: File non è .insv, procedo comunque...")
     
@@ -209,7 +307,11 @@ Esempi:
     print(f"🎯 Algoritmo: {args.algorithm}")
     print(f"📐 Risoluzione output: {width}x{height}")
     
-    success = run_stitcher(input_path, output_path, args.algorithm, width, height)
+    success = None
+    if args.service:
+        success = run_service_stitcher(args.service, input_path, output_path, args.algorithm, width, height)
+    if success is None:
+        success = run_stitcher(input_path, output_path, args.algorithm, width, height)
     
     if success:
         # Conta frame generati
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+inline std::vector<std::string> split(const std::string& s, char delimiter) {
+    std::vector<std::string> tokens;
+    std::string token;
+    std::istringstream tokenStream(s);
+
+    while (std::getline(tokenStream, token, delimiter)) {
+        tokens.push_back(token);
+    }
+
+    return tokens;
+}
+
+/**
+ * \brief "1920x960,3840x1920" as sizes, entries that are not two positive numbers are left out
+ */
+inline std::vector<cv::Size> parseSizes(const std::string& sizes) {
+    std::vector<cv::Size> result;
+    for (const auto& size : split(sizes, ',')) {
+        auto res = split(size, 'x');
+        if (res.size() == 2 && std::atoi(res[0].c_str()) > 0 && std::atoi(res[1].c_str()) > 0) {
+            result.push_back(cv::Size(std::atoi(res[0].c_str()), std::atoi(res[1].c_str())));
+        }
+    }
+    return result;
+}
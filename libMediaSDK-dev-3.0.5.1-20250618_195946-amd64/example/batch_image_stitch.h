@@ -0,0 +1,251 @@
+#pragma once
+
+#include <ins_stitcher.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef WIN32
+#include <direct.h>
+#include <stdlib.h>
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#endif
+
+/**
+ * \brief list the files of dir whose suffix (case-insensitive, without dot) is in suffixes, sorted by name
+ */
+inline std::vector<std::string> ListFilesWithSuffix(const std::string& dir, const std::vector<std::string>& suffixes) {
+    std::vector<std::string> names;
+#ifdef WIN32
+    WIN32_FIND_DATAA find_data;
+    HANDLE handle = FindFirstFileA((dir + "\\*").c_str(), &find_data);
+    if (handle != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                names.push_back(find_data.cFileName);
+            }
+        } while (FindNextFileA(handle, &find_data));
+        FindClose(handle);
+    }
+#else
+    DIR* handle = opendir(dir.c_str());
+    if (handle) {
+        while (dirent* entry = readdir(handle)) {
+            if (entry->d_name[0] != '.') {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(handle);
+    }
+#endif
+
+    std::vector<std::string> files;
+    const std::string separator = (!dir.empty() && (dir.back() == '/' || dir.back() == '\\')) ? "" : "/";
+    for (const auto& name : names) {
+        const auto dot = name.find_last_of('.');
+        if (dot == std::string::npos) {
+            continue;
+        }
+        std::string suffix = name.substr(dot + 1);
+        std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+        if (std::find(suffixes.begin(), suffixes.end(), suffix) != suffixes.end()) {
+            files.push_back(dir + separator + name);
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+/**
+ * \brief the output name, <name>.jpg, of each input file. Inputs sharing a name (X.insp and X.jpg) keep their
+ * suffix instead (X_insp.jpg, X_jpg.jpg). Names are compared case-insensitively, for Windows and macOS outputs.
+ * \return false, with the clashing inputs in conflict, if two inputs still map to the same output
+ */
+inline bool BatchOutputNames(const std::vector<std::string>& files, std::vector<std::string>& names, std::string& conflict) {
+    auto lower = [](std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        return text;
+    };
+    std::vector<std::string> stems;
+    std::map<std::string, size_t> stem_count;
+    for (const auto& file : files) {
+        const auto begin = file.find_last_of("/\\") + 1;
+        const auto end = file.find_last_of('.');
+        stems.push_back(file.substr(begin, end - begin));
+        stem_count[lower(stems.back())]++;
+    }
+
+    names.clear();
+    std::map<std::string, std::string> used;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string name = stems[i] + ".jpg";
+        if (stem_count[lower(stems[i])] > 1) {
+            name = stems[i] + "_" + lower(files[i].substr(files[i].find_last_of('.') + 1)) + ".jpg";
+        }
+        const auto inserted = used.insert(std::make_pair(lower(name), files[i]));
+        if (!inserted.second) {
+            conflict = inserted.first->second + " and " + files[i] + " both map to " + name;
+            return false;
+        }
+        names.push_back(name);
+    }
+    return true;
+}
+
+/**
+ * \brief create dir and its missing parents, an existing directory is fine
+ * \return false if dir does not exist afterwards
+ */
+inline bool MakeDirectories(const std::string& dir) {
+    for (size_t end = dir.find_first_of("/\\", 1); ; end = dir.find_first_of("/\\", end + 1)) {
+        const std::string part = dir.substr(0, end);
+#ifdef WIN32
+        _mkdir(part.c_str());
+#else
+        mkdir(part.c_str(), 0755);
+#endif
+        if (end == std::string::npos) {
+            break;
+        }
+    }
+#ifdef WIN32
+    const DWORD attributes = GetFileAttributesA(dir.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+/**
+ * \brief whether two existing paths name the same directory, through symlinks and relative parts
+ */
+inline bool IsSameDirectory(const std::string& a, const std::string& b) {
+#ifdef WIN32
+    char full_a[MAX_PATH];
+    char full_b[MAX_PATH];
+    return _fullpath(full_a, a.c_str(), MAX_PATH) && _fullpath(full_b, b.c_str(), MAX_PATH) && _stricmp(full_a, full_b) == 0;
+#else
+    char real_a[PATH_MAX];
+    char real_b[PATH_MAX];
+    return realpath(a.c_str(), real_a) && realpath(b.c_str(), real_b) && strcmp(real_a, real_b) == 0;
+#endif
+}
+
+/**
+ * \class BatchImageStitcher
+ * \brief Stitches many photos taken with the same settings through a fixed pool of workers.
+ * Every worker configures one ImageStitcher once and reuses it for all of its images, so the
+ * per-instance setup (stitch type, output size, models, lens/offset maps) is paid once per worker
+ * instead of once per image. Each worker holds at most one image, so memory is bounded by worker_count.
+ */
+class BatchImageStitcher {
+public:
+    struct Job {
+        std::vector<std::string> inputs;
+        std::string output;
+    };
+
+    struct Result {
+        size_t total = 0;
+        size_t stitched = 0;
+        size_t failed = 0;
+        double seconds = 0;
+        std::vector<std::string> failed_outputs;
+
+        double ImagesPerSecond() const {
+            return seconds > 0 ? stitched / seconds : 0;
+        }
+    };
+
+    using ConfigureCallback = std::function<void(ins::ImageStitcher& stitcher)>;
+    using ProgressCallback = std::function<void(size_t done, size_t total)>;
+
+    /**
+     * \param configure applies the shared settings, everything but SetInputPath/SetOutputPath
+     */
+    BatchImageStitcher(int worker_count, const ConfigureCallback& configure)
+        : worker_count_(std::max(1, worker_count)), configure_(configure) {
+    }
+
+    /**
+     * \brief called from the workers, serialized
+     */
+    void SetProgressCallback(const ProgressCallback& callback) {
+        progress_callback_ = callback;
+    }
+
+    /**
+     * \brief block until every job is done
+     */
+    Result Run(const std::vector<Job>& jobs) {
+        Result result;
+        result.total = jobs.size();
+        std::atomic<size_t> next{ 0 };
+        std::mutex result_mutex;
+        const auto start_time = std::chrono::steady_clock::now();
+
+        auto worker = [&]() {
+            std::shared_ptr<ins::ImageStitcher> stitcher;
+            while (true) {
+                const size_t index = next.fetch_add(1);
+                if (index >= jobs.size()) {
+                    break;
+                }
+                if (!stitcher) {
+                    stitcher = std::make_shared<ins::ImageStitcher>();
+                    configure_(*stitcher);
+                }
+                // a copy, SetInputPath takes a non-const reference
+                std::vector<std::string> inputs = jobs[index].inputs;
+                stitcher->SetInputPath(inputs);
+                stitcher->SetOutputPath(jobs[index].output);
+                const bool ok = stitcher->Stitch();
+
+                std::lock_guard<std::mutex> lck(result_mutex);
+                if (ok) {
+                    result.stitched++;
+                }
+                else {
+                    result.failed++;
+                    result.failed_outputs.push_back(jobs[index].output);
+                }
+                if (progress_callback_) {
+                    progress_callback_(result.stitched + result.failed, result.total);
+                }
+            }
+        };
+
+        const int thread_count = static_cast<int>(std::min<size_t>(worker_count_, jobs.size()));
+        std::vector<std::thread> threads;
+        for (int i = 1; i < thread_count; i++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        result.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+        return result;
+    }
+
+private:
+    int worker_count_;
+    ConfigureCallback configure_;
+    ProgressCallback progress_callback_;
+};
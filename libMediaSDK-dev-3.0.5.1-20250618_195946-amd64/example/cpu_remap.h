@@ -0,0 +1,543 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_REMAP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_REMAP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_REMAP_TARGET(isa)
+#endif
+
+/*
+ * Experiment: an independent CPU template stitch (dual fisheye RGBA to equirect) that measures what SIMD
+ * remap and seam blend kernels can gain. main and the realtime demo do not use it: the SDK decodes and
+ * stitches internally and never hands out the dual fisheye frames, so its own CPU path (-disable_cuda)
+ * is unchanged. cpu_remap_bench compares the kernels with each other and with cv::remap only.
+ */
+
+/**
+ * \brief instruction set used by the CPU remap and seam blend kernels
+ */
+enum class RemapIsa {
+    Scalar,
+    SSE41,
+    AVX2,
+    AVX512
+};
+
+inline const char* RemapIsaName(RemapIsa isa) {
+    switch (isa) {
+    case RemapIsa::SSE41: return "sse4.1";
+    case RemapIsa::AVX2: return "avx2";
+    case RemapIsa::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+/**
+ * \brief best instruction set supported by both the CPU and the OS
+ */
+inline RemapIsa DetectRemapIsa() {
+#if defined(CPU_REMAP_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return RemapIsa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return RemapIsa::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return RemapIsa::SSE41;
+    }
+#elif defined(CPU_REMAP_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    if (os_avx && (info[1] & (1 << 16)) && (_xgetbv(0) & 0xE6) == 0xE6) {
+        return RemapIsa::AVX512;
+    }
+    if (os_avx && (info[1] & (1 << 5))) {
+        return RemapIsa::AVX2;
+    }
+    if (sse41) {
+        return RemapIsa::SSE41;
+    }
+#endif
+    return RemapIsa::Scalar;
+}
+
+/**
+ * \brief one equidistant fisheye lens inside the dual fisheye source image.
+ * yaw/pitch/roll (degrees) rotate the lens axis away from +z (front), yaw 180 is the back lens.
+ */
+struct FisheyeLens {
+    double center_x = 0;
+    double center_y = 0;
+    double radius = 0;     // image circle radius in pixels, at fov / 2
+    double fov = 200;      // degrees
+    double yaw = 0;
+    double pitch = 0;
+    double roll = 0;
+};
+
+/**
+ * \brief a run of output pixels of one row that is sampled from both lenses
+ */
+struct WarpSpan {
+    int32_t begin;
+    int32_t end;
+    uint32_t blend_offset;  // index of begin in blend_x/blend_y/blend_alpha
+};
+
+/**
+ * \brief fisheye-to-equirect lookup tables of a dual fisheye source.
+ * Every output pixel reads the lens that sees it closest to its axis (map_x/map_y). Pixels close to the
+ * seam also read the other lens (blend_x/blend_y), mixed in with blend_alpha (0..255, weight of the other lens).
+ */
+struct DualFisheyeWarp {
+    int width = 0;
+    int height = 0;
+    int src_width = 0;
+    int src_height = 0;
+    std::vector<float> map_x;
+    std::vector<float> map_y;
+    std::vector<float> blend_x;
+    std::vector<float> blend_y;
+    std::vector<uint8_t> blend_alpha;
+    std::vector<WarpSpan> spans;
+    std::vector<uint32_t> row_spans;  // spans of row y are [row_spans[y], row_spans[y + 1])
+};
+
+/**
+ * \brief non-owning view of the lookup tables, of a DualFisheyeWarp or of a memory-mapped cache file
+ */
+struct DualFisheyeWarpView {
+    int width;
+    int height;
+    int src_width;
+    int src_height;
+    const float* map_x;
+    const float* map_y;
+    const float* blend_x;
+    const float* blend_y;
+    const uint8_t* blend_alpha;
+    const WarpSpan* spans;
+    const uint32_t* row_spans;
+};
+
+inline DualFisheyeWarpView ViewOf(const DualFisheyeWarp& warp) {
+    DualFisheyeWarpView view;
+    view.width = warp.width;
+    view.height = warp.height;
+    view.src_width = warp.src_width;
+    view.src_height = warp.src_height;
+    view.map_x = warp.map_x.data();
+    view.map_y = warp.map_y.data();
+    view.blend_x = warp.blend_x.data();
+    view.blend_y = warp.blend_y.data();
+    view.blend_alpha = warp.blend_alpha.data();
+    view.spans = warp.spans.data();
+    view.row_spans = warp.row_spans.data();
+    return view;
+}
+
+/**
+ * \brief build the lookup tables for a width x height equirect output
+ * \param blend_width angular width of the seam blend in degrees
+ */
+inline void BuildDualFisheyeWarp(const FisheyeLens lenses[2], int src_width, int src_height, int width, int height,
+    double blend_width, DualFisheyeWarp& warp) {
+    const double pi = 3.14159265358979323846;
+    const double to_rad = pi / 180.0;
+    warp.width = width;
+    warp.height = height;
+    warp.src_width = src_width;
+    warp.src_height = src_height;
+    warp.map_x.assign(static_cast<size_t>(width) * height, 0.0f);
+    warp.map_y.assign(static_cast<size_t>(width) * height, 0.0f);
+    warp.blend_x.clear();
+    warp.blend_y.clear();
+    warp.blend_alpha.clear();
+    warp.spans.clear();
+    warp.row_spans.assign(1, 0);
+
+    // rows of the world-to-lens rotation of every lens: R = Rz(roll) * Rx(pitch) * Ry(yaw), applied transposed
+    double rotation[2][9];
+    for (int i = 0; i < 2; i++) {
+        const double cy = cos(lenses[i].yaw * to_rad), sy = sin(lenses[i].yaw * to_rad);
+        const double cp = cos(lenses[i].pitch * to_rad), sp = sin(lenses[i].pitch * to_rad);
+        const double cr = cos(lenses[i].roll * to_rad), sr = sin(lenses[i].roll * to_rad);
+        const double ry[9] = { cy, 0, sy, 0, 1, 0, -sy, 0, cy };
+        const double rx[9] = { 1, 0, 0, 0, cp, -sp, 0, sp, cp };
+        const double rz[9] = { cr, -sr, 0, sr, cr, 0, 0, 0, 1 };
+        double rzx[9];
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                rzx[r * 3 + c] = rz[r * 3] * rx[c] + rz[r * 3 + 1] * rx[3 + c] + rz[r * 3 + 2] * rx[6 + c];
+            }
+        }
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                rotation[i][c * 3 + r] = rzx[r * 3] * ry[c] + rzx[r * 3 + 1] * ry[3 + c] + rzx[r * 3 + 2] * ry[6 + c];
+            }
+        }
+    }
+
+    const double blend = std::max(blend_width, 1e-6) * to_rad;
+    for (int v = 0; v < height; v++) {
+        const double lat = pi / 2 - (v + 0.5) / height * pi;
+        WarpSpan span = { -1, -1, 0 };
+        for (int u = 0; u < width; u++) {
+            const double lon = (u + 0.5) / width * 2 * pi - pi;
+            const double dir[3] = { cos(lat) * sin(lon), sin(lat), cos(lat) * cos(lon) };
+            double theta[2];
+            double px[2];
+            double py[2];
+            for (int i = 0; i < 2; i++) {
+                const double* m = rotation[i];
+                const double x = m[0] * dir[0] + m[1] * dir[1] + m[2] * dir[2];
+                const double y = m[3] * dir[0] + m[4] * dir[1] + m[5] * dir[2];
+                const double z = m[6] * dir[0] + m[7] * dir[1] + m[8] * dir[2];
+                theta[i] = acos(std::max(-1.0, std::min(1.0, z)));
+                const double r = theta[i] / (lenses[i].fov * to_rad / 2) * lenses[i].radius;
+                const double phi = atan2(y, x);
+                px[i] = lenses[i].center_x + r * cos(phi) - 0.5;
+                py[i] = lenses[i].center_y - r * sin(phi) - 0.5;
+            }
+
+            const int primary = theta[0] <= theta[1] ? 0 : 1;
+            const int other = 1 - primary;
+            const size_t index = static_cast<size_t>(v) * width + u;
+            warp.map_x[index] = static_cast<float>(px[primary]);
+            warp.map_y[index] = static_cast<float>(py[primary]);
+
+            const double delta = theta[other] - theta[primary];
+            const bool in_seam = delta < blend && theta[other] <= lenses[other].fov * to_rad / 2;
+            if (in_seam) {
+                if (span.begin < 0) {
+                    span.begin = u;
+                    span.blend_offset = static_cast<uint32_t>(warp.blend_alpha.size());
+                }
+                span.end = u + 1;
+                warp.blend_x.push_back(static_cast<float>(px[other]));
+                warp.blend_y.push_back(static_cast<float>(py[other]));
+                const double weight = 0.5 * (1 - delta / blend);
+                warp.blend_alpha.push_back(static_cast<uint8_t>(weight * 255 + 0.5));
+            }
+            if ((!in_seam || u + 1 == width) && span.begin >= 0) {
+                warp.spans.push_back(span);
+                span.begin = -1;
+            }
+        }
+        warp.row_spans.push_back(static_cast<uint32_t>(warp.spans.size()));
+    }
+}
+
+// bilinear remap of count RGBA pixels, coordinates are clamped to the source
+inline void RemapRowScalar(const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    const float* map_x, const float* map_y, uint8_t* dst, int count) {
+    const float max_x = static_cast<float>(src_width - 1);
+    const float max_y = static_cast<float>(src_height - 1);
+    for (int i = 0; i < count; i++) {
+        // 0 first, so a NaN coordinate clamps to 0 like in the SIMD kernels
+        const float x = std::min(std::max(0.0f, map_x[i]), max_x);
+        const float y = std::min(std::max(0.0f, map_y[i]), max_y);
+        const int x0 = std::min(static_cast<int>(x), src_width - 2);
+        const int y0 = std::min(static_cast<int>(y), src_height - 2);
+        const float fx = x - x0;
+        const float fy = y - y0;
+        const uint8_t* p0 = src + y0 * src_stride + x0 * 4;
+        const uint8_t* p1 = p0 + src_stride;
+        for (int c = 0; c < 4; c++) {
+            const float top = p0[c] + (p0[4 + c] - p0[c]) * fx;
+            const float bottom = p1[c] + (p1[4 + c] - p1[c]) * fx;
+            dst[i * 4 + c] = static_cast<uint8_t>(static_cast<int>(top + (bottom - top) * fy + 0.5f));
+        }
+    }
+}
+
+// dst = dst * (256 - w) + other * w, with w = alpha scaled to 0..256
+inline void BlendRowScalar(uint8_t* dst, const uint8_t* other, const uint8_t* alpha, int count) {
+    for (int i = 0; i < count; i++) {
+        const int w = alpha[i] + (alpha[i] >> 7);
+        for (int c = 0; c < 4; c++) {
+            dst[i * 4 + c] = static_cast<uint8_t>((dst[i * 4 + c] * (256 - w) + other[i * 4 + c] * w + 128) >> 8);
+        }
+    }
+}
+
+#ifdef CPU_REMAP_X86
+CPU_REMAP_TARGET("sse4.1")
+inline void RemapRowSSE41(const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    const float* map_x, const float* map_y, uint8_t* dst, int count) {
+    const int* src32 = reinterpret_cast<const int*>(src);
+    const int stride_px = static_cast<int>(src_stride / 4);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max_x = _mm_set1_ps(static_cast<float>(src_width - 1));
+    const __m128 max_y = _mm_set1_ps(static_cast<float>(src_height - 1));
+    const __m128i last_x = _mm_set1_epi32(src_width - 2);
+    const __m128i last_y = _mm_set1_epi32(src_height - 2);
+    const __m128i stride = _mm_set1_epi32(stride_px);
+    const __m128i byte_mask = _mm_set1_epi32(0xFF);
+    const __m128 half = _mm_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(map_x + i), zero), max_x);
+        const __m128 y = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(map_y + i), zero), max_y);
+        const __m128i x0 = _mm_min_epi32(_mm_cvttps_epi32(x), last_x);
+        const __m128i y0 = _mm_min_epi32(_mm_cvttps_epi32(y), last_y);
+        const __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(x0));
+        const __m128 fy = _mm_sub_ps(y, _mm_cvtepi32_ps(y0));
+        const __m128i index = _mm_add_epi32(_mm_mullo_epi32(y0, stride), x0);
+
+        // no gather before AVX2, the four taps of every pixel are loaded one by one
+        alignas(16) int offsets[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(offsets), index);
+        const __m128i p00 = _mm_setr_epi32(src32[offsets[0]], src32[offsets[1]], src32[offsets[2]], src32[offsets[3]]);
+        const __m128i p01 = _mm_setr_epi32(src32[offsets[0] + 1], src32[offsets[1] + 1], src32[offsets[2] + 1], src32[offsets[3] + 1]);
+        const __m128i p10 = _mm_setr_epi32(src32[offsets[0] + stride_px], src32[offsets[1] + stride_px],
+            src32[offsets[2] + stride_px], src32[offsets[3] + stride_px]);
+        const __m128i p11 = _mm_setr_epi32(src32[offsets[0] + stride_px + 1], src32[offsets[1] + stride_px + 1],
+            src32[offsets[2] + stride_px + 1], src32[offsets[3] + stride_px + 1]);
+
+        __m128i result = _mm_setzero_si128();
+        for (int c = 0; c < 4; c++) {
+            const __m128 a = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p00, c * 8), byte_mask));
+            const __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p01, c * 8), byte_mask));
+            const __m128 d = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p10, c * 8), byte_mask));
+            const __m128 e = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p11, c * 8), byte_mask));
+            const __m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fx));
+            const __m128 bottom = _mm_add_ps(d, _mm_mul_ps(_mm_sub_ps(e, d), fx));
+            const __m128 value = _mm_add_ps(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy)), half);
+            result = _mm_or_si128(result, _mm_slli_epi32(_mm_cvttps_epi32(value), c * 8));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), result);
+    }
+    RemapRowScalar(src, src_width, src_height, src_stride, map_x + i, map_y + i, dst + i * 4, count - i);
+}
+
+CPU_REMAP_TARGET("sse4.1")
+inline void BlendRowSSE41(uint8_t* dst, const uint8_t* other, const uint8_t* alpha, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i splat = _mm_set1_epi32(0x01010101);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int packed_alpha;
+        memcpy(&packed_alpha, alpha + i, 4);
+        // every alpha byte repeated over the 4 channels of its pixel
+        const __m128i a8 = _mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed_alpha)), splat);
+        const __m128i d8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i * 4));
+        const __m128i o8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + i * 4));
+
+        __m128i w_lo = _mm_unpacklo_epi8(a8, zero);
+        __m128i w_hi = _mm_unpackhi_epi8(a8, zero);
+        w_lo = _mm_add_epi16(w_lo, _mm_srli_epi16(w_lo, 7));
+        w_hi = _mm_add_epi16(w_hi, _mm_srli_epi16(w_hi, 7));
+        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(d8, zero), _mm_sub_epi16(full, w_lo)),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(o8, zero), w_lo)), round), 8);
+        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(d8, zero), _mm_sub_epi16(full, w_hi)),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(o8, zero), w_hi)), round), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    BlendRowScalar(dst + i * 4, other + i * 4, alpha + i, count - i);
+}
+
+CPU_REMAP_TARGET("avx2")
+inline void RemapRowAVX2(const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    const float* map_x, const float* map_y, uint8_t* dst, int count) {
+    const int* src32 = reinterpret_cast<const int*>(src);
+    const int stride_px = static_cast<int>(src_stride / 4);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max_x = _mm256_set1_ps(static_cast<float>(src_width - 1));
+    const __m256 max_y = _mm256_set1_ps(static_cast<float>(src_height - 1));
+    const __m256i last_x = _mm256_set1_epi32(src_width - 2);
+    const __m256i last_y = _mm256_set1_epi32(src_height - 2);
+    const __m256i stride = _mm256_set1_epi32(stride_px);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(map_x + i), zero), max_x);
+        const __m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(map_y + i), zero), max_y);
+        const __m256i x0 = _mm256_min_epi32(_mm256_cvttps_epi32(x), last_x);
+        const __m256i y0 = _mm256_min_epi32(_mm256_cvttps_epi32(y), last_y);
+        const __m256 fx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+        const __m256 fy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+        const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(y0, stride), x0);
+        const __m256i index_below = _mm256_add_epi32(index, stride);
+
+        const __m256i p00 = _mm256_i32gather_epi32(src32, index, 4);
+        const __m256i p01 = _mm256_i32gather_epi32(src32, _mm256_add_epi32(index, one), 4);
+        const __m256i p10 = _mm256_i32gather_epi32(src32, index_below, 4);
+        const __m256i p11 = _mm256_i32gather_epi32(src32, _mm256_add_epi32(index_below, one), 4);
+
+        __m256i result = _mm256_setzero_si256();
+        for (int c = 0; c < 4; c++) {
+            const __m128i shift = _mm_cvtsi32_si128(c * 8);
+            const __m256 a = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(p00, shift), byte_mask));
+            const __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(p01, shift), byte_mask));
+            const __m256 d = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(p10, shift), byte_mask));
+            const __m256 e = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(p11, shift), byte_mask));
+            const __m256 top = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), fx));
+            const __m256 bottom = _mm256_add_ps(d, _mm256_mul_ps(_mm256_sub_ps(e, d), fx));
+            const __m256 value = _mm256_add_ps(_mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), fy)), half);
+            result = _mm256_or_si256(result, _mm256_sll_epi32(_mm256_cvttps_epi32(value), shift));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), result);
+    }
+    RemapRowSSE41(src, src_width, src_height, src_stride, map_x + i, map_y + i, dst + i * 4, count - i);
+}
+
+CPU_REMAP_TARGET("avx2")
+inline void BlendRowAVX2(uint8_t* dst, const uint8_t* other, const uint8_t* alpha, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(256);
+    const __m256i round = _mm256_set1_epi16(128);
+    const __m256i splat = _mm256_set1_epi32(0x01010101);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i a8 = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(alpha + i))), splat);
+        const __m256i d8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i * 4));
+        const __m256i o8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i * 4));
+
+        // unpack works per 128 bit lane on all three inputs, so the pixels stay matched
+        __m256i w_lo = _mm256_unpacklo_epi8(a8, zero);
+        __m256i w_hi = _mm256_unpackhi_epi8(a8, zero);
+        w_lo = _mm256_add_epi16(w_lo, _mm256_srli_epi16(w_lo, 7));
+        w_hi = _mm256_add_epi16(w_hi, _mm256_srli_epi16(w_hi, 7));
+        const __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(d8, zero), _mm256_sub_epi16(full, w_lo)),
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(o8, zero), w_lo)), round), 8);
+        const __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(d8, zero), _mm256_sub_epi16(full, w_hi)),
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(o8, zero), w_hi)), round), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_packus_epi16(lo, hi));
+    }
+    BlendRowSSE41(dst + i * 4, other + i * 4, alpha + i, count - i);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC 12 reports -Wmaybe-uninitialized inside its own avx512fintrin.h for _mm512_min/max
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+CPU_REMAP_TARGET("avx512f")
+inline void RemapRowAVX512(const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    const float* map_x, const float* map_y, uint8_t* dst, int count) {
+    const int* src32 = reinterpret_cast<const int*>(src);
+    const int stride_px = static_cast<int>(src_stride / 4);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 max_x = _mm512_set1_ps(static_cast<float>(src_width - 1));
+    const __m512 max_y = _mm512_set1_ps(static_cast<float>(src_height - 1));
+    const __m512i last_x = _mm512_set1_epi32(src_width - 2);
+    const __m512i last_y = _mm512_set1_epi32(src_height - 2);
+    const __m512i stride = _mm512_set1_epi32(stride_px);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i byte_mask = _mm512_set1_epi32(0xFF);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512 x = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(map_x + i), zero), max_x);
+        const __m512 y = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(map_y + i), zero), max_y);
+        const __m512i x0 = _mm512_min_epi32(_mm512_cvttps_epi32(x), last_x);
+        const __m512i y0 = _mm512_min_epi32(_mm512_cvttps_epi32(y), last_y);
+        const __m512 fx = _mm512_sub_ps(x, _mm512_cvtepi32_ps(x0));
+        const __m512 fy = _mm512_sub_ps(y, _mm512_cvtepi32_ps(y0));
+        const __m512i index = _mm512_add_epi32(_mm512_mullo_epi32(y0, stride), x0);
+        const __m512i index_below = _mm512_add_epi32(index, stride);
+
+        const __m512i p00 = _mm512_i32gather_epi32(index, src32, 4);
+        const __m512i p01 = _mm512_i32gather_epi32(_mm512_add_epi32(index, one), src32, 4);
+        const __m512i p10 = _mm512_i32gather_epi32(index_below, src32, 4);
+        const __m512i p11 = _mm512_i32gather_epi32(_mm512_add_epi32(index_below, one), src32, 4);
+
+        __m512i result = _mm512_setzero_si512();
+        for (int c = 0; c < 4; c++) {
+            const __m128i shift = _mm_cvtsi32_si128(c * 8);
+            const __m512 a = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(p00, shift), byte_mask));
+            const __m512 b = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(p01, shift), byte_mask));
+            const __m512 d = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(p10, shift), byte_mask));
+            const __m512 e = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(p11, shift), byte_mask));
+            const __m512 top = _mm512_add_ps(a, _mm512_mul_ps(_mm512_sub_ps(b, a), fx));
+            const __m512 bottom = _mm512_add_ps(d, _mm512_mul_ps(_mm512_sub_ps(e, d), fx));
+            const __m512 value = _mm512_add_ps(_mm512_add_ps(top, _mm512_mul_ps(_mm512_sub_ps(bottom, top), fy)), half);
+            result = _mm512_or_si512(result, _mm512_sll_epi32(_mm512_cvttps_epi32(value), shift));
+        }
+        _mm512_storeu_si512(reinterpret_cast<void*>(dst + i * 4), result);
+    }
+    RemapRowAVX2(src, src_width, src_height, src_stride, map_x + i, map_y + i, dst + i * 4, count - i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+inline void RemapRow(RemapIsa isa, const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    const float* map_x, const float* map_y, uint8_t* dst, int count) {
+    switch (isa) {
+#ifdef CPU_REMAP_X86
+    case RemapIsa::AVX512: RemapRowAVX512(src, src_width, src_height, src_stride, map_x, map_y, dst, count); break;
+    case RemapIsa::AVX2: RemapRowAVX2(src, src_width, src_height, src_stride, map_x, map_y, dst, count); break;
+    case RemapIsa::SSE41: RemapRowSSE41(src, src_width, src_height, src_stride, map_x, map_y, dst, count); break;
+#endif
+    default: RemapRowScalar(src, src_width, src_height, src_stride, map_x, map_y, dst, count); break;
+    }
+}
+
+inline void BlendRow(RemapIsa isa, uint8_t* dst, const uint8_t* other, const uint8_t* alpha, int count) {
+    switch (isa) {
+#ifdef CPU_REMAP_X86
+    // the blend only touches the seam, AVX2 is enough there
+    case RemapIsa::AVX512:
+    case RemapIsa::AVX2: BlendRowAVX2(dst, other, alpha, count); break;
+    case RemapIsa::SSE41: BlendRowSSE41(dst, other, alpha, count); break;
+#endif
+    default: BlendRowScalar(dst, other, alpha, count); break;
+    }
+}
+
+/**
+ * \brief stitch rows [first_row, last_row) of a packed RGBA dual fisheye source into an RGBA equirect.
+ * Rows are independent, callers split the frame over threads by row range.
+ * \param src_stride, dst_stride in bytes, src_stride must be a multiple of 4
+ */
+inline void StitchDualFisheyeRows(RemapIsa isa, const DualFisheyeWarpView& warp, const uint8_t* src, size_t src_stride,
+    uint8_t* dst, size_t dst_stride, int first_row, int last_row) {
+    std::vector<uint8_t> seam(static_cast<size_t>(warp.width) * 4);
+    for (int y = first_row; y < last_row; y++) {
+        const size_t row = static_cast<size_t>(y) * warp.width;
+        uint8_t* out = dst + static_cast<size_t>(y) * dst_stride;
+        RemapRow(isa, src, warp.src_width, warp.src_height, src_stride, warp.map_x + row, warp.map_y + row, out, warp.width);
+        for (uint32_t s = warp.row_spans[y]; s < warp.row_spans[y + 1]; s++) {
+            const WarpSpan& span = warp.spans[s];
+            const int count = span.end - span.begin;
+            RemapRow(isa, src, warp.src_width, warp.src_height, src_stride,
+                warp.blend_x + span.blend_offset, warp.blend_y + span.blend_offset, seam.data(), count);
+            BlendRow(isa, out + span.begin * 4, seam.data(), warp.blend_alpha + span.blend_offset, count);
+        }
+    }
+}
+
+inline void StitchDualFisheyeRows(RemapIsa isa, const DualFisheyeWarp& warp, const uint8_t* src, size_t src_stride,
+    uint8_t* dst, size_t dst_stride, int first_row, int last_row) {
+    StitchDualFisheyeRows(isa, ViewOf(warp), src, src_stride, dst, dst_stride, first_row, last_row);
+}
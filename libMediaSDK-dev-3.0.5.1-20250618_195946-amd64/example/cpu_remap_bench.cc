@@ -0,0 +1,210 @@
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "arg_parse.h"
+#include "cpu_remap.h"
+#include "warp_cache.h"
+
+using namespace std::chrono;
+
+// experiment: times the kernels of cpu_remap.h against each other and cv::remap, not against the SDK
+const std::string helpstr =
+"{-help                   | default               | print this message                  }\n"
+"{-sizes                  | 1920x960,3840x1920,11520x5760 | equirect output sizes       }\n"
+"{-iterations             | 10                    | stitched frames per measurement     }\n"
+"{-threads                | 1                     | rows are split over this many threads }\n"
+"{-blend_width            | 10                    | seam blend width in degrees         }\n"
+"{-offset                 | None                  | camera offset string, default is an ideal 200 degree dual fisheye }\n"
+"{-warp_cache             | None                  | directory of the lookup table cache }\n";
+
+template <typename Function>
+double measure(int iterations, const Function& function) {
+    function();
+    const auto start_time = steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        function();
+    }
+    return duration_cast<duration<double, std::milli>>(steady_clock::now() - start_time).count() / iterations;
+}
+
+void stitchThreaded(RemapIsa isa, const DualFisheyeWarpView& warp, const cv::Mat& src, cv::Mat& dst, int thread_count) {
+    std::vector<std::thread> threads;
+    const int rows_per_thread = (warp.height + thread_count - 1) / thread_count;
+    for (int t = 1; t < thread_count; t++) {
+        const int first_row = std::min(warp.height, t * rows_per_thread);
+        const int last_row = std::min(warp.height, first_row + rows_per_thread);
+        threads.emplace_back([&, first_row, last_row]() {
+            StitchDualFisheyeRows(isa, warp, src.data, src.step, dst.data, dst.step, first_row, last_row);
+        });
+    }
+    StitchDualFisheyeRows(isa, warp, src.data, src.step, dst.data, dst.step, 0, std::min(warp.height, rows_per_thread));
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int maxDifference(const cv::Mat& a, const cv::Mat& b) {
+    int difference = 0;
+    for (int y = 0; y < a.rows; y++) {
+        const uint8_t* pa = a.ptr<uint8_t>(y);
+        const uint8_t* pb = b.ptr<uint8_t>(y);
+        for (int x = 0; x < a.cols * 4; x++) {
+            difference = std::max(difference, std::abs(pa[x] - pb[x]));
+        }
+    }
+    return difference;
+}
+
+int main(int argc, char* argv[]) {
+    std::string sizes = "1920x960,3840x1920,11520x5760";
+    int iterations = 10;
+    int thread_count = 1;
+    double blend_width = 10;
+    std::string offset;
+    std::string warp_cache_dir;
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-sizes") == std::string(argv[i])) {
+            sizes = argv[++i];
+        }
+        else if (std::string("-iterations") == std::string(argv[i])) {
+            iterations = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-threads") == std::string(argv[i])) {
+            thread_count = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-blend_width") == std::string(argv[i])) {
+            blend_width = atof(argv[++i]);
+        }
+        else if (std::string("-offset") == std::string(argv[i])) {
+            offset = argv[++i];
+        }
+        else if (std::string("-warp_cache") == std::string(argv[i])) {
+            warp_cache_dir = argv[++i];
+        }
+        else if (std::string("-help") == std::string(argv[i])) {
+            std::cout << helpstr << std::endl;
+            return 0;
+        }
+    }
+
+    const RemapIsa best_isa = DetectRemapIsa();
+    std::vector<RemapIsa> isas = { RemapIsa::Scalar };
+    for (const RemapIsa isa : { RemapIsa::SSE41, RemapIsa::AVX2, RemapIsa::AVX512 }) {
+        if (isa <= best_isa) {
+            isas.push_back(isa);
+        }
+    }
+    // the OpenCV baseline runs on the same number of threads
+    cv::setNumThreads(thread_count);
+    std::cout << "cpu: " << RemapIsaName(best_isa) << "; threads = " << thread_count << std::endl;
+    std::shared_ptr<WarpCache> warp_cache;
+    if (!warp_cache_dir.empty()) {
+        warp_cache = std::make_shared<WarpCache>(warp_cache_dir);
+    }
+
+    for (const auto& size : split(sizes, ',')) {
+        const auto res = split(size, 'x');
+        if (res.size() != 2) {
+            continue;
+        }
+        const int width = atoi(res[0].c_str());
+        const int height = atoi(res[1].c_str());
+
+        // side by side dual fisheye with the same pixel count as the output
+        const int src_height = height;
+        const int src_width = height * 2;
+        WarpCacheKey key;
+        key.offset = offset;
+        key.width = width;
+        key.height = height;
+        key.src_width = src_width;
+        key.src_height = src_height;
+        key.blend_width = blend_width;
+        if (key.offset.empty()) {
+            std::ostringstream ideal;
+            ideal << "2";
+            for (int i = 0; i < 2; i++) {
+                ideal << "_" << src_height * 0.5 << "_" << src_height * (i + 0.5) << "_" << src_height * 0.5 << "_0_0_" << i * 180;
+            }
+            ideal << "_" << src_width << "_" << src_height;
+            key.offset = ideal.str();
+        }
+
+        DualFisheyeWarp built_warp;
+        std::shared_ptr<const WarpCacheEntry> cached_warp;
+        DualFisheyeWarpView warp;
+        std::string warp_source = "built";
+        const auto build_start_time = steady_clock::now();
+        if (warp_cache) {
+            WarpCache::Source source;
+            cached_warp = warp_cache->Get(key, &source);
+            if (!cached_warp) {
+                std::cout << "can not parse -offset " << key.offset << std::endl;
+                return -1;
+            }
+            warp = cached_warp->View();
+            warp_source = source == WarpCache::Source::Built ? "built, cached" : "mapped from cache";
+        }
+        else {
+            FisheyeLens lenses[2];
+            if (!ParseCameraOffset(key.offset, src_width, src_height, key.fov, lenses)) {
+                std::cout << "can not parse -offset " << key.offset << std::endl;
+                return -1;
+            }
+            BuildDualFisheyeWarp(lenses, src_width, src_height, width, height, blend_width, built_warp);
+            warp = ViewOf(built_warp);
+        }
+        const double build_ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - build_start_time).count();
+
+        cv::Mat src(src_height, src_width, CV_8UC4);
+        for (int y = 0; y < src.rows; y++) {
+            uint8_t* row = src.ptr<uint8_t>(y);
+            for (int x = 0; x < src.cols; x++) {
+                row[x * 4 + 0] = static_cast<uint8_t>(x * 7 + y);
+                row[x * 4 + 1] = static_cast<uint8_t>(y * 5);
+                row[x * 4 + 2] = static_cast<uint8_t>((x ^ y) * 3);
+                row[x * 4 + 3] = 255;
+            }
+        }
+
+        std::cout << std::endl << size << " from " << src_width << "x" << src_height
+            << ": warp = " << build_ms << "ms (" << warp_source << "); seam spans = " << warp.row_spans[warp.height] << std::endl;
+
+        const double megapixels = static_cast<double>(width) * height / 1e6;
+        cv::Mat reference(height, width, CV_8UC4);
+        double scalar_ms = 0;
+        for (const RemapIsa isa : isas) {
+            cv::Mat dst(height, width, CV_8UC4);
+            const double ms = measure(iterations, [&]() {
+                stitchThreaded(isa, warp, src, dst, thread_count);
+            });
+            if (isa == RemapIsa::Scalar) {
+                scalar_ms = ms;
+                dst.copyTo(reference);
+            }
+            std::cout << "  " << RemapIsaName(isa)
+                << ": " << ms << "ms; " << megapixels / (ms / 1000) << " MPix/s"
+                << "; speedup = " << scalar_ms / ms
+                << "; max diff = " << maxDifference(dst, reference) << std::endl;
+        }
+
+        // what a plain OpenCV CPU remap costs on the same lookup table, without the seam blend
+        const cv::Mat map_x(height, width, CV_32FC1, const_cast<float*>(warp.map_x));
+        const cv::Mat map_y(height, width, CV_32FC1, const_cast<float*>(warp.map_y));
+        cv::Mat opencv_dst;
+        const double opencv_ms = measure(iterations, [&]() {
+            cv::remap(src, opencv_dst, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+        });
+        std::cout << "  opencv remap: " << opencv_ms << "ms; " << megapixels / (opencv_ms / 1000) << " MPix/s"
+            << "; speedup = " << scalar_ms / opencv_ms << std::endl;
+    }
+    return 0;
+}
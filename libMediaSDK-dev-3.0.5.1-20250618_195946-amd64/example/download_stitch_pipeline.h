@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief groups the videos of a camera file list into stitch inputs: a _00_ file and its _10_ twin
+ * (dual-file cameras) form one group, a single .insv is a group of its own. .lrv proxies and photos are skipped.
+ */
+inline std::vector<std::vector<std::string>> GroupCameraVideos(const std::vector<std::string>& files) {
+    auto is_video = [](const std::string& file) {
+        const auto dot = file.find_last_of('.');
+        if (dot == std::string::npos) {
+            return false;
+        }
+        std::string suffix = file.substr(dot + 1);
+        std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+        return suffix == "insv" || suffix == "mp4";
+    };
+    auto twin_of = [](const std::string& file, const std::string& from, const std::string& to) {
+        const auto slash = file.find_last_of("/\\");
+        const auto pos = file.find(from, slash == std::string::npos ? 0 : slash);
+        return pos == std::string::npos ? std::string() : file.substr(0, pos) + to + file.substr(pos + from.size());
+    };
+
+    std::vector<std::vector<std::string>> groups;
+    for (const auto& file : files) {
+        if (!is_video(file)) {
+            continue;
+        }
+        const std::string first = twin_of(file, "_10_", "_00_");
+        if (!first.empty() && std::find(files.begin(), files.end(), first) != files.end()) {
+            // stitched together with its _00_ file
+            continue;
+        }
+        std::vector<std::string> group(1, file);
+        const std::string second = twin_of(file, "_00_", "_10_");
+        if (!second.empty() && std::find(files.begin(), files.end(), second) != files.end()) {
+            group.push_back(second);
+        }
+        groups.push_back(group);
+    }
+    return groups;
+}
+
+/**
+ * \class DownloadStitchPipeline
+ * \brief Downloads the inputs of one job while the previous job is being stitched, instead of
+ * downloading everything first. At most max_backlog downloaded jobs wait for the stitcher; the
+ * download stops until one is taken, so local disk use stays bounded.
+ * The stitcher needs complete files (the .insv metadata is at the end of the file), so the unit of
+ * overlap is a job: the first output starts as soon as the first job is downloaded.
+ */
+class DownloadStitchPipeline {
+public:
+    struct Job {
+        std::vector<std::string> remote_paths;
+        // same order as remote_paths
+        std::vector<std::string> local_paths;
+        std::string output;
+    };
+
+    struct Result {
+        bool downloaded = false;
+        bool stitched = false;
+        double download_seconds = 0;
+        double stitch_seconds = 0;
+        std::string error;
+    };
+
+    /**
+     * \brief one step of a job, returns false and sets error when it failed
+     */
+    using Step = std::function<bool(const Job& job, std::string& error)>;
+
+    DownloadStitchPipeline(size_t max_backlog, const Step& download, const Step& stitch)
+        : max_backlog_(std::max<size_t>(1, max_backlog)), download_(download), stitch_(stitch) {
+    }
+
+    /**
+     * \brief remove the local inputs of a job once it is stitched
+     */
+    void SetDeleteDownloads(bool delete_downloads) {
+        delete_downloads_ = delete_downloads;
+    }
+
+    void SetProgressCallback(const std::function<void(size_t downloaded, size_t stitched, size_t total)>& callback) {
+        progress_callback_ = callback;
+    }
+
+    /**
+     * \brief seconds from Run() to the end of the first stitched job
+     */
+    double FirstOutputSeconds() const {
+        return first_output_seconds_;
+    }
+
+    /**
+     * \brief downloads on a background thread, stitches on the calling thread
+     * \return one result per job, in the same order
+     */
+    std::vector<Result> Run(const std::vector<Job>& jobs) {
+        using namespace std::chrono;
+        const auto start_time = steady_clock::now();
+        std::vector<Result> results(jobs.size());
+        std::deque<size_t> ready;
+        bool download_done = false;
+        size_t downloaded = 0;
+        size_t stitched = 0;
+        first_output_seconds_ = 0;
+
+        std::thread downloader([&]() {
+            for (size_t i = 0; i < jobs.size(); i++) {
+                {
+                    std::unique_lock<std::mutex> lck(mutex_);
+                    cond_.wait(lck, [&]() {
+                        return ready.size() < max_backlog_;
+                    });
+                }
+                const auto download_start_time = steady_clock::now();
+                std::string error;
+                const bool ok = download_(jobs[i], error);
+
+                std::lock_guard<std::mutex> lck(mutex_);
+                results[i].downloaded = ok;
+                results[i].download_seconds = duration_cast<duration<double>>(steady_clock::now() - download_start_time).count();
+                results[i].error = error;
+                if (ok) {
+                    downloaded++;
+                    ready.push_back(i);
+                }
+                cond_.notify_all();
+            }
+            std::lock_guard<std::mutex> lck(mutex_);
+            download_done = true;
+            cond_.notify_all();
+        });
+
+        while (true) {
+            size_t index = 0;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                cond_.wait(lck, [&]() {
+                    return !ready.empty() || download_done;
+                });
+                if (ready.empty()) {
+                    break;
+                }
+                index = ready.front();
+                ready.pop_front();
+                // a backlog slot is free again
+                cond_.notify_all();
+            }
+
+            const auto stitch_start_time = steady_clock::now();
+            std::string error;
+            const bool ok = stitch_(jobs[index], error);
+            results[index].stitched = ok;
+            results[index].stitch_seconds = duration_cast<duration<double>>(steady_clock::now() - stitch_start_time).count();
+            if (!ok) {
+                results[index].error = error;
+            }
+            else if (stitched++ == 0) {
+                first_output_seconds_ = duration_cast<duration<double>>(steady_clock::now() - start_time).count();
+            }
+            if (ok && delete_downloads_) {
+                for (const auto& local_path : jobs[index].local_paths) {
+                    std::remove(local_path.c_str());
+                }
+            }
+            if (progress_callback_) {
+                size_t downloaded_now = 0;
+                {
+                    std::lock_guard<std::mutex> lck(mutex_);
+                    downloaded_now = downloaded;
+                }
+                progress_callback_(downloaded_now, stitched, jobs.size());
+            }
+        }
+        downloader.join();
+        return results;
+    }
+
+private:
+    size_t max_backlog_;
+    Step download_;
+    Step stitch_;
+    bool delete_downloads_ = false;
+    std::function<void(size_t downloaded, size_t stitched, size_t total)> progress_callback_;
+    double first_output_seconds_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
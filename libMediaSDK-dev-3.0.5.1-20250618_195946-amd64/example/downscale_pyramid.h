@@ -0,0 +1,122 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DOWNSCALE_HAS_SSE2 1
+#endif
+
+/**
+ * \brief 2x2 box downscale of a packed 4 bytes per pixel image (RGBA/BGRA), rounded to nearest.
+ * dst is (width / 2) x (height / 2), an odd last row or column of src is dropped.
+ */
+inline void DownscaleHalf4(const uint8_t* src, int width, int height, size_t src_stride, uint8_t* dst, size_t dst_stride) {
+    const int dst_width = width / 2;
+    const int dst_height = height / 2;
+    for (int y = 0; y < dst_height; y++) {
+        const uint8_t* row0 = src + static_cast<size_t>(2 * y) * src_stride;
+        const uint8_t* row1 = row0 + src_stride;
+        uint8_t* out = dst + static_cast<size_t>(y) * dst_stride;
+        int x = 0;
+#ifdef DOWNSCALE_HAS_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(2);
+        // 8 source pixels of both rows give 4 output pixels
+        for (; x + 4 <= dst_width; x += 4) {
+            const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+            const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16));
+            const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+            const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16));
+
+            // vertical sums in 16 bits, two pixels per register
+            const __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+            const __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+            const __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+            const __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+            // horizontal sums: the low 4 lanes plus the high 4 lanes of every register
+            const __m128i h0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+            const __m128i h1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+            const __m128i h2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+            const __m128i h3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+
+            const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(h0, h1), round), 2);
+            const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(h2, h3), round), 2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; x < dst_width; x++) {
+            for (int c = 0; c < 4; c++) {
+                const int sum = row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c];
+                out[x * 4 + c] = static_cast<uint8_t>((sum + 2) >> 2);
+            }
+        }
+    }
+}
+
+/**
+ * \brief scale src into dst, whose size and type are already set.
+ * Exact halvings of 4 channel images use DownscaleHalf4, every other ratio cv::resize(INTER_AREA).
+ */
+inline void DownscaleInto(const cv::Mat& src, cv::Mat& dst) {
+    if (src.rows == dst.rows && src.cols == dst.cols) {
+        src.copyTo(dst);
+    }
+    else if (src.type() == CV_8UC4 && src.cols / 2 == dst.cols && src.rows / 2 == dst.rows) {
+        DownscaleHalf4(src.data, src.cols, src.rows, src.step, dst.data, dst.step);
+    }
+    else {
+        cv::resize(src, dst, cv::Size(dst.cols, dst.rows), 0, 0, cv::INTER_AREA);
+    }
+}
+
+/**
+ * \brief pick the level to derive a width x height output from: the smallest candidate that is still
+ * at least as large in both dimensions, or the first candidate (the full resolution frame) if none is.
+ */
+inline size_t PickPyramidBase(const std::vector<cv::Size>& candidates, int width, int height) {
+    size_t best = 0;
+    for (size_t i = 1; i < candidates.size(); i++) {
+        const cv::Size& size = candidates[i];
+        if (size.width < width || size.height < height) {
+            continue;
+        }
+        const cv::Size& current = candidates[best];
+        if (static_cast<int64_t>(size.width) * size.height < static_cast<int64_t>(current.width) * current.height) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * \brief derive every size of targets from one stitched frame, levels[i] matches targets[i].
+ * Sizes are built from large to small and each one from the smallest level already built, so
+ * 3840x1920 -> 1920x960 -> 960x480 reads the full frame only once.
+ */
+inline void BuildDownscalePyramid(const cv::Mat& source, const std::vector<cv::Size>& targets, std::vector<cv::Mat>& levels) {
+    std::vector<size_t> order(targets.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return static_cast<int64_t>(targets[a].width) * targets[a].height > static_cast<int64_t>(targets[b].width) * targets[b].height;
+    });
+
+    levels.resize(targets.size());
+    std::vector<cv::Size> built_sizes(1, cv::Size(source.cols, source.rows));
+    std::vector<const cv::Mat*> built(1, &source);
+    for (const size_t index : order) {
+        const cv::Size& target = targets[index];
+        const cv::Mat& base = *built[PickPyramidBase(built_sizes, target.width, target.height)];
+        levels[index].create(target.height, target.width, source.type());
+        DownscaleInto(base, levels[index]);
+        built_sizes.push_back(target);
+        built.push_back(&levels[index]);
+    }
+}
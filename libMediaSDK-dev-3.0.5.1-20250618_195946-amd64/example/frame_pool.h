@@ -0,0 +1,199 @@
+#pragma once
+
+#include <ins_realtime_stitcher.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class FramePool;
+
+/**
+ * \class PooledFrame
+ * \brief A stitched frame owned by a FramePool.
+ * The frame is reference counted: every holder calls Release() exactly once,
+ * extra holders call Retain() first. The last Release() hands the frame back to the pool.
+ */
+class PooledFrame {
+public:
+    const uint8_t* Data() const { return data_.data(); }
+    // only for the producer, before the frame is handed to any consumer
+    uint8_t* MutableData() { return data_.data(); }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    int Stride() const { return stride_; }
+    int Format() const { return format_; }
+    int64_t Timestamp() const { return timestamp_; }
+
+    void Retain() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void Release();
+
+private:
+    friend class FramePool;
+
+    std::vector<uint8_t> data_;
+    int width_ = 0;
+    int height_ = 0;
+    int stride_ = 0;
+    int format_ = 0;
+    int64_t timestamp_ = 0;
+    std::atomic<int> refs_{ 0 };
+    std::chrono::steady_clock::time_point acquire_time_;
+    FramePool* pool_ = nullptr;
+};
+
+/**
+ * \class FramePool
+ * \brief Fixed set of preallocated frames for the realtime stitch output.
+ * When every frame is still held by consumers the new frame is dropped rather than allocated,
+ * the counters tell how often that happens and how long consumers keep frames.
+ */
+class FramePool {
+public:
+    struct Stats {
+        uint64_t acquired;
+        uint64_t exhausted_drops;   // frames dropped because consumers held the whole pool
+        uint64_t held_too_long;     // frames released after hold_budget
+        uint64_t outstanding;       // frames currently held
+        uint64_t max_outstanding;
+        double max_hold_ms;
+    };
+
+    /**
+     * \param frame_count number of frames in the pool
+     * \param width, height, bytes_per_pixel used to preallocate every frame
+     * \param hold_budget a frame held longer than this is counted in held_too_long
+     */
+    FramePool(int frame_count, int width, int height, int bytes_per_pixel,
+        std::chrono::milliseconds hold_budget = std::chrono::milliseconds(100))
+        : frames_(frame_count), hold_budget_(hold_budget) {
+        free_list_.reserve(frame_count);
+        for (auto& frame : frames_) {
+            frame.data_.resize(static_cast<size_t>(width) * height * bytes_per_pixel);
+            frame.pool_ = this;
+            free_list_.push_back(&frame);
+        }
+    }
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /**
+     * \brief copy one plane into a free frame
+     * \return the frame with one reference, or nullptr if the pool is exhausted
+     */
+    PooledFrame* Acquire(const uint8_t* data, int linesize, int width, int height, int bytes_per_pixel,
+        int format, int64_t timestamp) {
+        PooledFrame* frame = Acquire(width, height, bytes_per_pixel, format, timestamp);
+        if (!frame) {
+            return nullptr;
+        }
+
+        const int stride = frame->stride_;
+        const size_t bytes = static_cast<size_t>(stride) * height;
+        if (linesize == stride) {
+            memcpy(frame->data_.data(), data, bytes);
+        }
+        else {
+            for (int row = 0; row < height; row++) {
+                memcpy(frame->data_.data() + static_cast<size_t>(row) * stride, data + static_cast<size_t>(row) * linesize, stride);
+            }
+        }
+        return frame;
+    }
+
+    /**
+     * \brief take a free frame without copying, the producer fills MutableData() before sharing it
+     * \return the frame with one reference, or nullptr if the pool is exhausted
+     */
+    PooledFrame* Acquire(int width, int height, int bytes_per_pixel, int format, int64_t timestamp) {
+        PooledFrame* frame = nullptr;
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            if (free_list_.empty()) {
+                stats_.exhausted_drops++;
+                return nullptr;
+            }
+            frame = free_list_.back();
+            free_list_.pop_back();
+            stats_.acquired++;
+            stats_.outstanding++;
+            if (stats_.outstanding > stats_.max_outstanding) {
+                stats_.max_outstanding = stats_.outstanding;
+            }
+        }
+
+        const int stride = width * bytes_per_pixel;
+        const size_t bytes = static_cast<size_t>(stride) * height;
+        if (frame->data_.size() < bytes) {
+            // only happens if the output size changes after the pool was created
+            frame->data_.resize(bytes);
+        }
+
+        frame->width_ = width;
+        frame->height_ = height;
+        frame->stride_ = stride;
+        frame->format_ = format;
+        frame->timestamp_ = timestamp;
+        frame->acquire_time_ = std::chrono::steady_clock::now();
+        frame->refs_.store(1, std::memory_order_relaxed);
+        return frame;
+    }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return stats_;
+    }
+
+private:
+    friend class PooledFrame;
+
+    void Recycle(PooledFrame* frame) {
+        const auto held = std::chrono::steady_clock::now() - frame->acquire_time_;
+        const double held_ms = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(held).count();
+        std::lock_guard<std::mutex> lck(mutex_);
+        if (held > hold_budget_) {
+            stats_.held_too_long++;
+        }
+        if (held_ms > stats_.max_hold_ms) {
+            stats_.max_hold_ms = held_ms;
+        }
+        stats_.outstanding--;
+        free_list_.push_back(frame);
+    }
+
+    std::vector<PooledFrame> frames_;
+    std::vector<PooledFrame*> free_list_;
+    std::chrono::steady_clock::duration hold_budget_;
+    mutable std::mutex mutex_;
+    Stats stats_{};
+};
+
+void PooledFrame::Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        pool_->Recycle(this);
+    }
+}
+
+/**
+ * \brief opt-in replacement for SetStitchRealTimeDataCallback that delivers pooled frames.
+ * The callback owns one reference of the frame and must Release() it, possibly on another thread.
+ * Only the first plane is copied, which covers the packed RGBA output of RealTimeStitcher.
+ */
+inline void SetStitchRealTimePooledCallback(const std::shared_ptr<ins::RealTimeStitcher>& stitcher,
+    const std::shared_ptr<FramePool>& pool, int bytes_per_pixel, const std::function<void(PooledFrame* frame)>& callback) {
+    stitcher->SetStitchRealTimeDataCallback([pool, bytes_per_pixel, callback](uint8_t* data[4], int linesize[4], int width, int height, int format, int64_t timestamp) {
+        PooledFrame* frame = pool->Acquire(data[0], linesize[0], width, height, bytes_per_pixel, format, timestamp);
+        if (frame) {
+            callback(frame);
+        }
+    });
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+/**
+ * \class GyroCoalescer
+ * \brief Collects the many small gyro batches of StreamDelegate::OnGyroData in a preallocated
+ * single-producer/single-consumer ring, and hands them to the stitcher once per video frame:
+ * Release(frame_timestamp) delivers every queued sample up to frame_timestamp + lead in one batch,
+ * on the thread that feeds the video. Gyro timestamps are moved onto the video clock by the
+ * PreviewParam::gyro_timestamp offset before they are compared. The stitcher then sees one HandleGyroData per frame from the
+ * same thread as HandleVideoData, instead of one per USB callback from the receive thread.
+ *
+ * Nothing is allocated after construction. Samples only leave the ring in Release(), that is with the
+ * next stream 0 frame: if more than half of the ring is queued by then, that frame releases all of it
+ * (forced_batches). Nothing releases samples while no video arrives, so once the ring is full the
+ * producer drops new samples (overflow_drops) until frames resume.
+ */
+template <typename Gyro>
+class GyroCoalescer {
+public:
+    using Sink = std::function<void(const std::vector<Gyro>& batch)>;
+
+    struct Stats {
+        uint64_t pushed;
+        uint64_t delivered;
+        uint64_t batches;
+        uint64_t forced_batches;   // released because the queue was half full
+        uint64_t overflow_drops;   // ring full when the samples arrived
+        uint64_t high_watermark;   // max samples queued at once
+        uint64_t max_batch;
+    };
+
+    /**
+     * \param capacity samples the ring can hold, rounded up to a power of two
+     * \param lead samples up to frame_timestamp + lead are released with a frame (timestamp units)
+     * \param clock_offset PreviewParam::gyro_timestamp: gyro timestamps minus this are on the video clock
+     */
+    GyroCoalescer(size_t capacity, int64_t lead = 0, int64_t clock_offset = 0)
+        :lead_(lead), clock_offset_(clock_offset) {
+        size_t count = 2;
+        while (count < capacity) {
+            count <<= 1;
+        }
+        mask_ = count - 1;
+        samples_.resize(count);
+        batch_.reserve(count);
+        Reset();
+    }
+
+    GyroCoalescer(const GyroCoalescer&) = delete;
+    GyroCoalescer& operator=(const GyroCoalescer&) = delete;
+
+    /**
+     * \brief producer side, copies the samples into the ring. Source is Gyro or a type with the same
+     * layout (ins_camera::GyroData for ins::GyroData).
+     * \return false if some samples were dropped
+     */
+    template <typename Source>
+    bool Push(const std::vector<Source>& data) {
+        static_assert(sizeof(Source) == sizeof(Gyro), "the gyro types must have the same layout");
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        const uint64_t tail = tail_.load(std::memory_order_acquire);
+        const uint64_t queued = head - tail;
+        const uint64_t free_slots = mask_ + 1 - queued;
+        const size_t count = static_cast<size_t>(std::min<uint64_t>(free_slots, data.size()));
+        for (size_t i = 0; i < count; i++) {
+            memcpy(&samples_[static_cast<size_t>((head + i) & mask_)], &data[i], sizeof(Gyro));
+        }
+        head_.store(head + count, std::memory_order_release);
+
+        pushed_.fetch_add(count, std::memory_order_relaxed);
+        if (queued + count > high_watermark_.load(std::memory_order_relaxed)) {
+            high_watermark_.store(queued + count, std::memory_order_relaxed);
+        }
+        if (count < data.size()) {
+            overflow_drops_.fetch_add(data.size() - count, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief consumer side, called before the frame is given to the stitcher. Samples are released in
+     * arrival order up to the first one newer than frame_timestamp + lead.
+     * \return samples delivered
+     */
+    size_t Release(int64_t frame_timestamp, const Sink& sink) {
+        const uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        const bool forced = head - tail > (mask_ + 1) / 2;
+        batch_.clear();
+        while (tail != head) {
+            const Gyro& sample = samples_[static_cast<size_t>(tail & mask_)];
+            if (!forced && sample.timestamp - clock_offset_ > frame_timestamp + lead_) {
+                break;
+            }
+            batch_.push_back(sample);
+            tail++;
+        }
+        tail_.store(tail, std::memory_order_release);
+        if (forced && !batch_.empty()) {
+            forced_batches_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return Deliver(sink);
+    }
+
+    /**
+     * \brief consumer side, delivers everything queued, e.g. when the stream stops
+     */
+    size_t ReleaseAll(const Sink& sink) {
+        const uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        batch_.clear();
+        for (; tail != head; tail++) {
+            batch_.push_back(samples_[static_cast<size_t>(tail & mask_)]);
+        }
+        tail_.store(tail, std::memory_order_release);
+        return Deliver(sink);
+    }
+
+    size_t Size() const {
+        return static_cast<size_t>(head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire));
+    }
+
+    /**
+     * \brief discard queued samples and clear counters, only call while neither side is running
+     */
+    void Reset() {
+        head_.store(0);
+        tail_.store(0);
+        pushed_.store(0);
+        overflow_drops_.store(0);
+        high_watermark_.store(0);
+        delivered_.store(0);
+        batches_.store(0);
+        forced_batches_.store(0);
+        max_batch_.store(0);
+    }
+
+    Stats GetStats() const {
+        Stats stats{};
+        stats.pushed = pushed_.load(std::memory_order_relaxed);
+        stats.delivered = delivered_.load(std::memory_order_relaxed);
+        stats.batches = batches_.load(std::memory_order_relaxed);
+        stats.forced_batches = forced_batches_.load(std::memory_order_relaxed);
+        stats.overflow_drops = overflow_drops_.load(std::memory_order_relaxed);
+        stats.high_watermark = high_watermark_.load(std::memory_order_relaxed);
+        stats.max_batch = max_batch_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    size_t Deliver(const Sink& sink) {
+        if (batch_.empty()) {
+            return 0;
+        }
+        sink(batch_);
+        delivered_.fetch_add(batch_.size(), std::memory_order_relaxed);
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        if (batch_.size() > max_batch_.load(std::memory_order_relaxed)) {
+            max_batch_.store(batch_.size(), std::memory_order_relaxed);
+        }
+        return batch_.size();
+    }
+
+    int64_t lead_;
+    int64_t clock_offset_;
+    uint64_t mask_;
+    std::vector<Gyro> samples_;
+    // handed to the sink, capacity reserved for a full ring
+    std::vector<Gyro> batch_;
+
+    // producer and consumer indices are padded onto separate cache lines
+    uint8_t pad0_[64];
+    std::atomic<uint64_t> head_;
+    std::atomic<uint64_t> pushed_;
+    std::atomic<uint64_t> overflow_drops_;
+    std::atomic<uint64_t> high_watermark_;
+    uint8_t pad1_[64];
+    std::atomic<uint64_t> tail_;
+    std::atomic<uint64_t> delivered_;
+    std::atomic<uint64_t> batches_;
+    std::atomic<uint64_t> forced_batches_;
+    std::atomic<uint64_t> max_batch_;
+    uint8_t pad2_[64];
+};
@@ -0,0 +1,587 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GYRO_LOG_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GYRO_LOG_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GYRO_LOG_TARGET(isa)
+#endif
+
+/**
+ * Gyro logs (.insgyro) store GyroData (int64 timestamp, ax ay az gx gy gz as doubles, 56 bytes a
+ * sample) in blocks of columns:
+ * - timestamps: the first one, then the difference of every delta to the smallest delta of the block,
+ *   bit packed. A steady 1 kHz stream has zero bits per sample.
+ * - each channel: quantized to precision_bits with a per block scale (largest magnitude of the block),
+ *   then the zigzag difference to the previous sample, bit packed with the width of the largest one.
+ *
+ * Blocks are written as they fill up, a log cut by a crash loses only the unfinished block.
+ * layout: "INSGYRO1", byte order mark, block size, then BlockHeader + payload per block.
+ */
+namespace gyro_log_detail {
+    const char kMagic[8] = { 'I', 'N', 'S', 'G', 'Y', 'R', 'O', '1' };
+    const char kBlockMagic[4] = { 'G', 'B', 'L', 'K' };
+    const uint32_t kByteOrderMark = 0x01020304;
+    const int kChannels = 6;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t block_samples;
+    };
+
+    struct BlockHeader {
+        char magic[4];
+        uint32_t count;
+        // bytes after this header, including 8 bytes of padding
+        uint32_t payload_bytes;
+        uint8_t timestamp_bits;
+        uint8_t channel_bits[kChannels];
+        uint8_t reserved;
+        uint32_t padding;
+        int64_t first_timestamp;
+        int64_t min_delta;
+        float scale[kChannels];
+        int32_t first[kChannels];
+    };
+    static_assert(sizeof(BlockHeader) == 88, "BlockHeader is written as is");
+
+    // every column starts on an 8 byte boundary
+    inline size_t ColumnBytes(uint32_t values, int bits) {
+        return (static_cast<size_t>(values) * bits + 63) / 64 * 8;
+    }
+
+    inline int BitWidth(uint64_t value) {
+        int bits = 0;
+        while (value != 0) {
+            bits++;
+            value >>= 1;
+        }
+        return bits;
+    }
+
+    inline uint32_t ZigZag(int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    inline int32_t UnZigZag(uint32_t value) {
+        return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+    }
+
+    inline void Pack(const uint64_t* values, size_t count, int bits, uint8_t* out) {
+        uint64_t position = 0;
+        for (size_t i = 0; i < count && bits > 0; i++, position += bits) {
+            // bits <= 57, so a value spans at most 8 bytes from its first one
+            uint64_t word;
+            memcpy(&word, out + position / 8, 8);
+            word |= values[i] << (position % 8);
+            memcpy(out + position / 8, &word, 8);
+        }
+    }
+
+    // needs 8 readable bytes past the packed values
+    inline uint64_t Unpack(const uint8_t* in, uint64_t position, int bits) {
+        uint64_t word;
+        memcpy(&word, in + position / 8, 8);
+        return (word >> (position % 8)) & (bits == 64 ? ~0ULL : (1ULL << bits) - 1);
+    }
+
+    inline bool HasAvx2() {
+#if defined(GYRO_LOG_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#elif defined(GYRO_LOG_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        const bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+        __cpuidex(info, 7, 0);
+        return os_avx && (info[1] & (1 << 5));
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * \brief zigzag deltas to values: out[i] = scale * (first + sum of deltas[0..i])
+     */
+    inline void DecodeChannelScalar(const uint32_t* deltas, size_t count, int32_t first, double scale, double* out) {
+        int32_t value = first;
+        for (size_t i = 0; i < count; i++) {
+            value += UnZigZag(deltas[i]);
+            out[i] = value * scale;
+        }
+    }
+
+    /**
+     * \brief count values of bits <= 32 each, unpacked to 32 bit
+     */
+    inline void UnpackColumnScalar(const uint8_t* in, size_t count, int bits, uint32_t* out) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = bits > 0 ? static_cast<uint32_t>(Unpack(in, static_cast<uint64_t>(i) * bits, bits)) : 0;
+        }
+    }
+
+#ifdef GYRO_LOG_X86
+    GYRO_LOG_TARGET("avx2")
+    inline void UnpackColumnAVX2(const uint8_t* in, size_t count, int bits, uint32_t* out) {
+        if (bits == 0) {
+            std::fill(out, out + count, 0u);
+            return;
+        }
+        // 4 values per gather: 64 bit load at the first byte of each value, shifted by its bit offset
+        const __m256i mask = _mm256_set1_epi64x(static_cast<long long>((1ULL << bits) - 1));
+        const __m256i seven = _mm256_set1_epi64x(7);
+        const __m256i step = _mm256_set1_epi64x(4LL * bits);
+        const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        __m256i position = _mm256_setr_epi64x(0, bits, 2LL * bits, 3LL * bits);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const __m256i words = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(in), _mm256_srli_epi64(position, 3), 1);
+            const __m256i values = _mm256_and_si256(_mm256_srlv_epi64(words, _mm256_and_si256(position, seven)), mask);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(values, even)));
+            position = _mm256_add_epi64(position, step);
+        }
+        for (; i < count; i++) {
+            out[i] = static_cast<uint32_t>(Unpack(in, static_cast<uint64_t>(i) * bits, bits));
+        }
+    }
+
+    GYRO_LOG_TARGET("avx2")
+    inline void DecodeChannelAVX2(const uint32_t* deltas, size_t count, int32_t first, double scale, double* out) {
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256d scale4 = _mm256_set1_pd(scale);
+        __m256i carry = _mm256_set1_epi32(first);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(deltas + i));
+            __m256i x = _mm256_xor_si256(_mm256_srli_epi32(u, 1), _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(u, one)));
+            // prefix sum inside each 128 bit lane, then the low lane's total is added to the high lane
+            x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+            x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+            const __m256i low_total = _mm256_permute2x128_si256(_mm256_shuffle_epi32(x, 0xFF), _mm256_setzero_si256(), 0x08);
+            x = _mm256_add_epi32(_mm256_add_epi32(x, low_total), carry);
+            _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(x)), scale4));
+            _mm256_storeu_pd(out + i + 4, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1)), scale4));
+            carry = _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7));
+        }
+        const int32_t value = _mm256_cvtsi256_si32(carry);
+        DecodeChannelScalar(deltas + i, count - i, value, scale, out + i);
+    }
+#endif
+}
+
+/**
+ * \brief one decoded block, one vector per field
+ */
+struct GyroColumns {
+    std::vector<int64_t> timestamp;
+    std::vector<double> ax;
+    std::vector<double> ay;
+    std::vector<double> az;
+    std::vector<double> gx;
+    std::vector<double> gy;
+    std::vector<double> gz;
+
+    size_t Size() const {
+        return timestamp.size();
+    }
+
+    /**
+     * \brief AoS copy for RealTimeStitcher::HandleGyroData (ins::GyroData) or ins_camera::GyroData
+     */
+    template <typename Gyro>
+    void ToSamples(std::vector<Gyro>& samples) const {
+        samples.resize(Size());
+        for (size_t i = 0; i < samples.size(); i++) {
+            Gyro& sample = samples[i];
+            sample.timestamp = timestamp[i];
+            sample.ax = ax[i];
+            sample.ay = ay[i];
+            sample.az = az[i];
+            sample.gx = gx[i];
+            sample.gy = gy[i];
+            sample.gz = gz[i];
+        }
+    }
+};
+
+/**
+ * \class GyroLogWriter
+ * \brief Appends GyroData (ins::GyroData or ins_camera::GyroData) to a .insgyro file, a block is encoded
+ * and written whenever block_samples are buffered, so it can be fed from OnGyroData directly.
+ */
+class GyroLogWriter {
+public:
+    struct Options {
+        uint32_t block_samples = 1024;
+        // quantization of the channels, 16 keeps the resolution of the sensors' 16 bit ADCs
+        int precision_bits = 16;
+    };
+
+    GyroLogWriter() = default;
+
+    ~GyroLogWriter() {
+        Close();
+    }
+
+    GyroLogWriter(const GyroLogWriter&) = delete;
+    GyroLogWriter& operator=(const GyroLogWriter&) = delete;
+
+    bool Open(const std::string& path) {
+        return Open(path, Options());
+    }
+
+    bool Open(const std::string& path, const Options& options) {
+        Close();
+        options_ = options;
+        options_.block_samples = std::max<uint32_t>(2, options_.block_samples);
+        options_.precision_bits = std::max(2, std::min(24, options_.precision_bits));
+#ifdef WIN32
+        if (fopen_s(&fp_, path.c_str(), "wb") != 0) {
+            fp_ = nullptr;
+        }
+#else
+        fp_ = fopen(path.c_str(), "wb");
+#endif
+        if (!fp_) {
+            return false;
+        }
+        gyro_log_detail::FileHeader header{};
+        memcpy(header.magic, gyro_log_detail::kMagic, sizeof(header.magic));
+        header.byte_order = gyro_log_detail::kByteOrderMark;
+        header.block_samples = options_.block_samples;
+        bytes_ = sizeof(header);
+        return fwrite(&header, sizeof(header), 1, fp_) == 1;
+    }
+
+    bool IsOpen() const {
+        return fp_ != nullptr;
+    }
+
+    template <typename Gyro>
+    bool Append(const std::vector<Gyro>& samples) {
+        return Append(samples.data(), samples.size());
+    }
+
+    template <typename Gyro>
+    bool Append(const Gyro* samples, size_t count) {
+        if (!fp_) {
+            return false;
+        }
+        bool ok = true;
+        for (size_t i = 0; i < count; i++) {
+            const Gyro& sample = samples[i];
+            pending_.timestamp.push_back(sample.timestamp);
+            pending_.ax.push_back(sample.ax);
+            pending_.ay.push_back(sample.ay);
+            pending_.az.push_back(sample.az);
+            pending_.gx.push_back(sample.gx);
+            pending_.gy.push_back(sample.gy);
+            pending_.gz.push_back(sample.gz);
+            if (pending_.Size() >= options_.block_samples) {
+                ok = WriteBlock() && ok;
+            }
+        }
+        return ok;
+    }
+
+    /**
+     * \brief writes the buffered samples as a short block
+     */
+    bool Flush() {
+        if (!fp_) {
+            return false;
+        }
+        const bool ok = pending_.Size() == 0 || WriteBlock();
+        return fflush(fp_) == 0 && ok;
+    }
+
+    bool Close() {
+        if (!fp_) {
+            return true;
+        }
+        const bool ok = Flush();
+        const bool closed = fclose(fp_) == 0;
+        fp_ = nullptr;
+        return ok && closed;
+    }
+
+    uint64_t Samples() const {
+        return samples_;
+    }
+
+    uint64_t Bytes() const {
+        return bytes_;
+    }
+
+    /**
+     * \brief samples discarded with a block whose timestamps could not be encoded
+     */
+    uint64_t Dropped() const {
+        return dropped_;
+    }
+
+private:
+    bool WriteBlock() {
+        using namespace gyro_log_detail;
+        const uint32_t count = static_cast<uint32_t>(pending_.Size());
+        BlockHeader header{};
+        memcpy(header.magic, kBlockMagic, sizeof(header.magic));
+        header.count = count;
+        header.first_timestamp = pending_.timestamp[0];
+
+        // timestamp deltas relative to the smallest one
+        std::vector<uint64_t> timestamp_values(count - 1);
+        int64_t min_delta = 0;
+        for (uint32_t i = 1; i < count; i++) {
+            const int64_t delta = pending_.timestamp[i] - pending_.timestamp[i - 1];
+            min_delta = i == 1 ? delta : std::min(min_delta, delta);
+        }
+        uint64_t max_value = 0;
+        for (uint32_t i = 1; i < count; i++) {
+            timestamp_values[i - 1] = static_cast<uint64_t>(pending_.timestamp[i] - pending_.timestamp[i - 1] - min_delta);
+            max_value = std::max(max_value, timestamp_values[i - 1]);
+        }
+        header.min_delta = min_delta;
+        header.timestamp_bits = static_cast<uint8_t>(BitWidth(max_value));
+        if (header.timestamp_bits > 57) {
+            // a gap of more than 2^57 ticks does not happen, a corrupt timestamp does: the block is
+            // dropped so the next one starts clean
+            dropped_ += count;
+            pending_ = GyroColumns();
+            return false;
+        }
+
+        const std::vector<double>* channels[kChannels] = { &pending_.ax, &pending_.ay, &pending_.az, &pending_.gx, &pending_.gy, &pending_.gz };
+        const double max_quantized = static_cast<double>((1 << (options_.precision_bits - 1)) - 1);
+        std::vector<uint64_t> channel_values[kChannels];
+        for (int c = 0; c < kChannels; c++) {
+            const std::vector<double>& values = *channels[c];
+            double max_abs = 0;
+            for (const double value : values) {
+                max_abs = std::max(max_abs, std::isfinite(value) ? std::fabs(value) : 0.0);
+            }
+            float scale = static_cast<float>(max_abs / max_quantized);
+            if (!(scale > 0) || !std::isfinite(scale)) {
+                scale = 1;
+            }
+            header.scale[c] = scale;
+
+            int32_t previous = 0;
+            uint64_t max_delta = 0;
+            channel_values[c].resize(count - 1);
+            for (uint32_t i = 0; i < count; i++) {
+                const double quantized = std::isfinite(values[i]) ? std::round(values[i] / scale) : 0.0;
+                const int32_t value = static_cast<int32_t>(std::max(-max_quantized, std::min(max_quantized, quantized)));
+                if (i == 0) {
+                    header.first[c] = value;
+                }
+                else {
+                    channel_values[c][i - 1] = ZigZag(value - previous);
+                    max_delta = std::max(max_delta, channel_values[c][i - 1]);
+                }
+                previous = value;
+            }
+            header.channel_bits[c] = static_cast<uint8_t>(BitWidth(max_delta));
+        }
+
+        size_t payload_bytes = ColumnBytes(count - 1, header.timestamp_bits);
+        for (int c = 0; c < kChannels; c++) {
+            payload_bytes += ColumnBytes(count - 1, header.channel_bits[c]);
+        }
+        payload_bytes += 8;
+        header.payload_bytes = static_cast<uint32_t>(payload_bytes);
+        payload_.assign(payload_bytes, 0);
+        uint8_t* out = payload_.data();
+        Pack(timestamp_values.data(), count - 1, header.timestamp_bits, out);
+        out += ColumnBytes(count - 1, header.timestamp_bits);
+        for (int c = 0; c < kChannels; c++) {
+            Pack(channel_values[c].data(), count - 1, header.channel_bits[c], out);
+            out += ColumnBytes(count - 1, header.channel_bits[c]);
+        }
+
+        const bool ok = fwrite(&header, sizeof(header), 1, fp_) == 1 && fwrite(payload_.data(), payload_.size(), 1, fp_) == 1;
+        bytes_ += sizeof(header) + payload_.size();
+        samples_ += count;
+        pending_ = GyroColumns();
+        return ok;
+    }
+
+    Options options_;
+    FILE* fp_ = nullptr;
+    GyroColumns pending_;
+    std::vector<uint8_t> payload_;
+    uint64_t samples_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+/**
+ * \class GyroLogReader
+ * \brief Reads a .insgyro file block by block. The channels are decoded with AVX2 when the CPU has it
+ * (zigzag, prefix sum and scaling 8 samples at a time), the result goes to columns for offline
+ * processing or to GyroData vectors for RealTimeStitcher::HandleGyroData.
+ */
+class GyroLogReader {
+public:
+    GyroLogReader() : use_avx2_(gyro_log_detail::HasAvx2()) {
+    }
+
+    ~GyroLogReader() {
+        Close();
+    }
+
+    GyroLogReader(const GyroLogReader&) = delete;
+    GyroLogReader& operator=(const GyroLogReader&) = delete;
+
+    bool Open(const std::string& path) {
+        Close();
+#ifdef WIN32
+        if (fopen_s(&fp_, path.c_str(), "rb") != 0) {
+            fp_ = nullptr;
+        }
+#else
+        fp_ = fopen(path.c_str(), "rb");
+#endif
+        if (!fp_) {
+            return false;
+        }
+        gyro_log_detail::FileHeader header{};
+        if (fread(&header, sizeof(header), 1, fp_) != 1 || memcmp(header.magic, gyro_log_detail::kMagic, sizeof(header.magic)) != 0 ||
+            header.byte_order != gyro_log_detail::kByteOrderMark || header.block_samples < 2) {
+            Close();
+            return false;
+        }
+        block_samples_ = header.block_samples;
+        return true;
+    }
+
+    void Close() {
+        if (fp_) {
+            fclose(fp_);
+            fp_ = nullptr;
+        }
+    }
+
+    /**
+     * \brief false uses the scalar decoder, for comparison
+     */
+    void SetUseSimd(bool use_simd) {
+        use_avx2_ = use_simd && gyro_log_detail::HasAvx2();
+    }
+
+    bool UsesAvx2() const {
+        return use_avx2_;
+    }
+
+    uint32_t BlockSamples() const {
+        return block_samples_;
+    }
+
+    /**
+     * \brief the last block was cut short (the writer did not finish it)
+     */
+    bool Truncated() const {
+        return truncated_;
+    }
+
+    /**
+     * \brief decodes the next block
+     * \return false at the end of the log
+     */
+    bool Next(GyroColumns& columns) {
+        using namespace gyro_log_detail;
+        BlockHeader header{};
+        if (!fp_ || fread(&header, sizeof(header), 1, fp_) != 1) {
+            return false;
+        }
+        // the writer never puts more than block_samples in a block, a larger count is a corrupt header
+        if (memcmp(header.magic, kBlockMagic, sizeof(header.magic)) != 0 || header.count == 0 || header.count > block_samples_ ||
+            header.timestamp_bits > 57 || header.payload_bytes < 8) {
+            truncated_ = true;
+            return false;
+        }
+        size_t expected = ColumnBytes(header.count - 1, header.timestamp_bits) + 8;
+        for (int c = 0; c < kChannels; c++) {
+            if (header.channel_bits[c] > 32) {
+                truncated_ = true;
+                return false;
+            }
+            expected += ColumnBytes(header.count - 1, header.channel_bits[c]);
+        }
+        payload_.resize(header.payload_bytes);
+        if (expected != header.payload_bytes || fread(payload_.data(), payload_.size(), 1, fp_) != 1) {
+            truncated_ = true;
+            return false;
+        }
+
+        const uint32_t count = header.count;
+        const uint8_t* in = payload_.data();
+        columns.timestamp.resize(count);
+        columns.timestamp[0] = header.first_timestamp;
+        for (uint32_t i = 1; i < count; i++) {
+            const uint64_t value = header.timestamp_bits > 0 ? Unpack(in, static_cast<uint64_t>(i - 1) * header.timestamp_bits, header.timestamp_bits) : 0;
+            columns.timestamp[i] = columns.timestamp[i - 1] + header.min_delta + static_cast<int64_t>(value);
+        }
+        in += ColumnBytes(count - 1, header.timestamp_bits);
+
+        std::vector<double>* channels[kChannels] = { &columns.ax, &columns.ay, &columns.az, &columns.gx, &columns.gy, &columns.gz };
+        deltas_.resize(count);
+        for (int c = 0; c < kChannels; c++) {
+            const int bits = header.channel_bits[c];
+            // deltas_[0] = 0 makes the first value come out of the same prefix sum
+            deltas_[0] = 0;
+            std::vector<double>& out = *channels[c];
+            out.resize(count);
+#ifdef GYRO_LOG_X86
+            if (use_avx2_) {
+                UnpackColumnAVX2(in, count - 1, bits, deltas_.data() + 1);
+                in += ColumnBytes(count - 1, bits);
+                DecodeChannelAVX2(deltas_.data(), count, header.first[c], header.scale[c], out.data());
+                continue;
+            }
+#endif
+            UnpackColumnScalar(in, count - 1, bits, deltas_.data() + 1);
+            in += ColumnBytes(count - 1, bits);
+            DecodeChannelScalar(deltas_.data(), count, header.first[c], header.scale[c], out.data());
+        }
+        return true;
+    }
+
+    /**
+     * \brief decodes the next block into GyroData, e.g. std::vector<ins::GyroData> for HandleGyroData
+     */
+    template <typename Gyro>
+    bool Next(std::vector<Gyro>& samples) {
+        if (!Next(columns_)) {
+            return false;
+        }
+        columns_.ToSamples(samples);
+        return true;
+    }
+
+private:
+    FILE* fp_ = nullptr;
+    bool use_avx2_;
+    bool truncated_ = false;
+    uint32_t block_samples_ = 0;
+    std::vector<uint8_t> payload_;
+    std::vector<uint32_t> deltas_;
+    GyroColumns columns_;
+};
@@ -0,0 +1,175 @@
+#include <iostream>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "gyro_log.h"
+
+using namespace std::chrono;
+
+const std::string helpstr =
+"{-help                   | default               | print this message                  }\n"
+"{-seconds                | 600                   | length of the synthetic 1 kHz gyro log }\n"
+"{-block_samples          | 1024                  | samples per block                   }\n"
+"{-precision_bits         | 16                    | quantization of the channels        }\n"
+"{-output                 | gyro_bench.insgyro    | log written by the benchmark        }\n"
+"{-input                  | None                  | decode an existing .insgyro log instead }\n";
+
+// same layout as ins::GyroData
+struct Sample {
+    int64_t timestamp;
+    double ax;
+    double ay;
+    double az;
+    double gx;
+    double gy;
+    double gz;
+};
+
+std::vector<Sample> syntheticGyro(int seconds) {
+    // hand held motion: a few slow oscillations plus sensor noise, timestamps in ms with some jitter
+    std::vector<Sample> samples(static_cast<size_t>(seconds) * 1000);
+    uint32_t seed = 12345;
+    auto noise = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (static_cast<double>(seed >> 8) / (1 << 24) - 0.5);
+    };
+    int64_t timestamp = 1000000;
+    for (size_t i = 0; i < samples.size(); i++) {
+        const double t = i / 1000.0;
+        Sample& sample = samples[i];
+        timestamp += (i % 97 == 0) ? 2 : 1;
+        sample.timestamp = timestamp;
+        sample.ax = 0.3 * std::sin(t * 1.3) + 0.01 * noise();
+        sample.ay = 0.2 * std::sin(t * 0.7 + 1) + 0.01 * noise();
+        sample.az = 1.0 + 0.05 * std::sin(t * 2.1) + 0.01 * noise();
+        sample.gx = 0.8 * std::sin(t * 3.1) + 0.005 * noise();
+        sample.gy = 0.5 * std::sin(t * 1.9 + 2) + 0.005 * noise();
+        sample.gz = 0.3 * std::sin(t * 0.9 + 3) + 0.005 * noise();
+    }
+    return samples;
+}
+
+double decodeAll(const std::string& path, bool use_simd, std::vector<GyroColumns>& blocks, double& ms) {
+    GyroLogReader reader;
+    if (!reader.Open(path)) {
+        return -1;
+    }
+    reader.SetUseSimd(use_simd);
+    blocks.clear();
+    const auto start_time = steady_clock::now();
+    size_t samples = 0;
+    while (true) {
+        blocks.emplace_back();
+        if (!reader.Next(blocks.back())) {
+            blocks.pop_back();
+            break;
+        }
+        samples += blocks.back().Size();
+    }
+    ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - start_time).count();
+    if (reader.Truncated()) {
+        std::cout << path << ": the last block is incomplete" << std::endl;
+    }
+    return static_cast<double>(samples);
+}
+
+int main(int argc, char* argv[]) {
+    int seconds = 600;
+    GyroLogWriter::Options options;
+    std::string output = "gyro_bench.insgyro";
+    std::string input;
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-seconds") == std::string(argv[i])) {
+            seconds = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-block_samples") == std::string(argv[i])) {
+            options.block_samples = static_cast<uint32_t>(std::max(2, atoi(argv[++i])));
+        }
+        else if (std::string("-precision_bits") == std::string(argv[i])) {
+            options.precision_bits = atoi(argv[++i]);
+        }
+        else if (std::string("-output") == std::string(argv[i])) {
+            output = argv[++i];
+        }
+        else if (std::string("-input") == std::string(argv[i])) {
+            input = argv[++i];
+        }
+        else if (std::string("-help") == std::string(argv[i])) {
+            std::cout << helpstr << std::endl;
+            return 0;
+        }
+    }
+
+    std::vector<Sample> samples;
+    std::string path = input;
+    if (input.empty()) {
+        samples = syntheticGyro(seconds);
+        GyroLogWriter writer;
+        if (!writer.Open(output, options)) {
+            std::cout << "can not write " << output << std::endl;
+            return -1;
+        }
+        const auto start_time = steady_clock::now();
+        // OnGyroData delivers a few dozen samples per call
+        for (size_t i = 0; i < samples.size(); i += 50) {
+            writer.Append(samples.data() + i, std::min<size_t>(50, samples.size() - i));
+        }
+        writer.Close();
+        const double ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - start_time).count();
+        const double raw_bytes = static_cast<double>(samples.size() * sizeof(Sample));
+        std::cout << samples.size() << " samples: raw = " << raw_bytes / 1e6 << "MB, .insgyro = " << writer.Bytes() / 1e6
+            << "MB (" << raw_bytes / writer.Bytes() << "x, " << writer.Bytes() * 8.0 / samples.size() << " bits/sample)" << std::endl;
+        std::cout << "encode: " << ms << "ms (" << samples.size() / ms / 1e3 << " Msamples/s)" << std::endl;
+        path = output;
+    }
+
+    std::vector<GyroColumns> scalar_blocks;
+    std::vector<GyroColumns> simd_blocks;
+    double scalar_ms = 0;
+    double simd_ms = 0;
+    const double count = decodeAll(path, false, scalar_blocks, scalar_ms);
+    if (count < 0) {
+        std::cout << "can not read " << path << std::endl;
+        return -1;
+    }
+    std::cout << "decode scalar: " << scalar_ms << "ms (" << count / scalar_ms / 1e3 << " Msamples/s)" << std::endl;
+    if (gyro_log_detail::HasAvx2()) {
+        decodeAll(path, true, simd_blocks, simd_ms);
+        bool same = simd_blocks.size() == scalar_blocks.size();
+        for (size_t b = 0; same && b < simd_blocks.size(); b++) {
+            same = simd_blocks[b].timestamp == scalar_blocks[b].timestamp && simd_blocks[b].ax == scalar_blocks[b].ax &&
+                simd_blocks[b].ay == scalar_blocks[b].ay && simd_blocks[b].az == scalar_blocks[b].az &&
+                simd_blocks[b].gx == scalar_blocks[b].gx && simd_blocks[b].gy == scalar_blocks[b].gy && simd_blocks[b].gz == scalar_blocks[b].gz;
+        }
+        std::cout << "decode avx2: " << simd_ms << "ms (" << count / simd_ms / 1e3 << " Msamples/s, " << scalar_ms / simd_ms << "x)"
+            << (same ? "" : ", differs from scalar") << std::endl;
+    }
+
+    if (!samples.empty()) {
+        size_t index = 0;
+        bool timestamps_ok = true;
+        double max_error[6] = { 0, 0, 0, 0, 0, 0 };
+        for (const auto& block : scalar_blocks) {
+            for (size_t i = 0; i < block.Size() && index < samples.size(); i++, index++) {
+                const Sample& sample = samples[index];
+                timestamps_ok = timestamps_ok && block.timestamp[i] == sample.timestamp;
+                const double errors[6] = { block.ax[i] - sample.ax, block.ay[i] - sample.ay, block.az[i] - sample.az,
+                    block.gx[i] - sample.gx, block.gy[i] - sample.gy, block.gz[i] - sample.gz };
+                for (int c = 0; c < 6; c++) {
+                    max_error[c] = std::max(max_error[c], std::fabs(errors[c]));
+                }
+            }
+        }
+        std::cout << "timestamps " << (timestamps_ok && index == samples.size() ? "exact" : "DIFFER") << "; max error ax ay az = "
+            << max_error[0] << " " << max_error[1] << " " << max_error[2] << ", gx gy gz = "
+            << max_error[3] << " " << max_error[4] << " " << max_error[5] << std::endl;
+    }
+    return 0;
+}
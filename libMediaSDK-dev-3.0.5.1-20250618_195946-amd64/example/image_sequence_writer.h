@@ -0,0 +1,367 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "frame_pool.h"
+
+/**
+ * \class ImageSequenceWriter
+ * \brief Encodes stitched frames to numbered JPEG/PNG files on a pool of encoder threads.
+ * Submit() never waits: the frame is queued by reference (PooledFrame::Retain) or dropped and counted
+ * when max_queued_frames are already in flight. Encoded frames go through a reorder buffer so a single
+ * write-behind thread writes them in submit order, optionally with O_DIRECT and batched fsync.
+ */
+class ImageSequenceWriter {
+public:
+    enum class Format {
+        JPEG,
+        PNG
+    };
+
+    struct Options {
+        std::string dir;
+        Format format = Format::JPEG;
+        int jpeg_quality = 95;
+        int png_compression = 1;
+        int encoder_threads = 4;
+        // frames submitted but not yet written, bounds both the encode queue and the reorder buffer
+        int max_queued_frames = 8;
+        // bypass the page cache (Linux only), the file is padded to the block size and truncated back;
+        // on a filesystem without O_DIRECT (tmpfs) the files are written through the page cache
+        bool use_o_direct = false;
+        // fsync the written files every N frames (at most kMaxPendingSync), 0 leaves flushing to the OS
+        int fsync_every = 0;
+    };
+
+    struct Stats {
+        uint64_t submitted;
+        uint64_t dropped;          // queue full when the frame arrived
+        uint64_t encoded;
+        uint64_t written;
+        uint64_t write_errors;
+        uint64_t bytes_written;
+        uint64_t max_reorder_depth;
+        double encode_ms;          // total time spent in the encoders
+        double write_ms;           // total time spent in write/fsync
+    };
+
+    // files kept open until the batched fsync
+    static const int kMaxPendingSync = 64;
+
+    explicit ImageSequenceWriter(const Options& options) : options_(options) {
+        options_.encoder_threads = std::max(1, options_.encoder_threads);
+        options_.max_queued_frames = std::max(1, options_.max_queued_frames);
+        options_.fsync_every = std::min(options_.fsync_every, static_cast<int>(kMaxPendingSync));
+        // the parent directory has to exist, an existing directory is fine
+#ifdef WIN32
+        _mkdir(options_.dir.c_str());
+#else
+        mkdir(options_.dir.c_str(), 0755);
+#endif
+        for (int i = 0; i < options_.encoder_threads; i++) {
+            encoders_.emplace_back(&ImageSequenceWriter::EncodeLoop, this);
+        }
+        writer_ = std::thread(&ImageSequenceWriter::WriteLoop, this);
+    }
+
+    ~ImageSequenceWriter() {
+        Close();
+        free(direct_buffer_);
+    }
+
+    /**
+     * \brief queue a frame for encoding, the writer takes its own reference
+     * \return false if the frame was dropped
+     */
+    bool Submit(PooledFrame* frame) {
+        std::lock_guard<std::mutex> lck(mutex_);
+        if (closed_ || in_flight_ >= options_.max_queued_frames) {
+            stats_.dropped++;
+            return false;
+        }
+        frame->Retain();
+        encode_queue_.push_back(EncodeTask{ next_sequence_++, frame });
+        in_flight_++;
+        stats_.submitted++;
+        encode_cond_.notify_one();
+        return true;
+    }
+
+    /**
+     * \brief write everything that was submitted, then stop the threads
+     */
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            if (closed_) {
+                return;
+            }
+            closed_ = true;
+        }
+        encode_cond_.notify_all();
+        for (auto& encoder : encoders_) {
+            encoder.join();
+        }
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            encoders_done_ = true;
+        }
+        write_cond_.notify_one();
+        writer_.join();
+    }
+
+    const std::string& Dir() const {
+        return options_.dir;
+    }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return stats_;
+    }
+
+private:
+    struct EncodeTask {
+        uint64_t sequence;
+        PooledFrame* frame;
+    };
+
+    void EncodeLoop() {
+        cv::Mat bgr;
+        std::vector<int> params;
+        if (options_.format == Format::JPEG) {
+            params = { cv::IMWRITE_JPEG_QUALITY, options_.jpeg_quality };
+        }
+        else {
+            params = { cv::IMWRITE_PNG_COMPRESSION, options_.png_compression };
+        }
+        const std::string extension = options_.format == Format::JPEG ? ".jpg" : ".png";
+
+        while (true) {
+            EncodeTask task;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                encode_cond_.wait(lck, [this]() {
+                    return closed_ || !encode_queue_.empty();
+                });
+                if (encode_queue_.empty()) {
+                    break;
+                }
+                task = encode_queue_.front();
+                encode_queue_.pop_front();
+            }
+
+            const auto start_time = std::chrono::steady_clock::now();
+            PooledFrame* frame = task.frame;
+            const cv::Mat view(frame->Height(), frame->Width(), CV_8UC4, const_cast<uint8_t*>(frame->Data()), frame->Stride());
+            cv::cvtColor(view, bgr, cv::COLOR_RGBA2BGR);
+            frame->Release();
+
+            std::vector<uint8_t> encoded;
+            if (!cv::imencode(extension, bgr, encoded, params)) {
+                encoded.clear();
+            }
+            const double cost = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::steady_clock::now() - start_time).count();
+
+            std::lock_guard<std::mutex> lck(mutex_);
+            stats_.encode_ms += cost;
+            stats_.encoded++;
+            reorder_buffer_[task.sequence].swap(encoded);
+            stats_.max_reorder_depth = std::max<uint64_t>(stats_.max_reorder_depth, reorder_buffer_.size());
+            write_cond_.notify_one();
+        }
+    }
+
+    void WriteLoop() {
+        uint64_t sequence = 0;
+        const std::string extension = options_.format == Format::JPEG ? ".jpg" : ".png";
+        while (true) {
+            std::vector<uint8_t> encoded;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                write_cond_.wait(lck, [&]() {
+                    return reorder_buffer_.count(sequence) > 0 || (encoders_done_ && reorder_buffer_.empty());
+                });
+                if (reorder_buffer_.count(sequence) == 0) {
+                    break;
+                }
+                encoded.swap(reorder_buffer_[sequence]);
+                reorder_buffer_.erase(sequence);
+            }
+
+            const auto start_time = std::chrono::steady_clock::now();
+            char name[32];
+            snprintf(name, sizeof(name), "%06llu", static_cast<unsigned long long>(sequence));
+            const bool ok = !encoded.empty() && WriteFile(options_.dir + "/" + name + extension, encoded);
+            if (options_.fsync_every > 0 && static_cast<int>(pending_sync_.size()) >= options_.fsync_every) {
+                SyncPending();
+            }
+            const double cost = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::steady_clock::now() - start_time).count();
+
+            std::lock_guard<std::mutex> lck(mutex_);
+            stats_.write_ms += cost;
+            if (ok) {
+                stats_.written++;
+                stats_.bytes_written += encoded.size();
+            }
+            else {
+                stats_.write_errors++;
+            }
+            in_flight_--;
+            sequence++;
+        }
+        SyncPending();
+    }
+
+#ifdef WIN32
+    bool WriteFile(const std::string& path, const std::vector<uint8_t>& data) {
+        FILE* fp = nullptr;
+        if (fopen_s(&fp, path.c_str(), "wb") != 0 || !fp) {
+            return false;
+        }
+        const bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+        fclose(fp);
+        return ok;
+    }
+
+    void SyncPending() {
+    }
+#else
+    bool WriteFile(const std::string& path, const std::vector<uint8_t>& data) {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        if (options_.use_o_direct) {
+            flags |= O_DIRECT;
+        }
+#endif
+        int fd = open(path.c_str(), flags, 0644);
+        if (fd < 0 && errno == EINVAL && options_.use_o_direct) {
+            // the filesystem does not take O_DIRECT, the rest of the sequence goes through the page cache
+            options_.use_o_direct = false;
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd < 0) {
+            return false;
+        }
+
+        bool ok = true;
+        if (options_.use_o_direct) {
+            // O_DIRECT needs an aligned buffer and a length that is a multiple of the block size
+            const size_t block = 4096;
+            const size_t padded = (data.size() + block - 1) / block * block;
+            // the error of the call that failed, taken before anything else can touch errno
+            int error = 0;
+            if (direct_buffer_size_ < padded) {
+                free(direct_buffer_);
+                direct_buffer_ = nullptr;
+                direct_buffer_size_ = 0;
+                error = posix_memalign(&direct_buffer_, block, padded);
+                if (error == 0) {
+                    direct_buffer_size_ = padded;
+                }
+                else {
+                    direct_buffer_ = nullptr;
+                }
+            }
+            if (error == 0) {
+                memcpy(direct_buffer_, data.data(), data.size());
+                memset(static_cast<uint8_t*>(direct_buffer_) + data.size(), 0, padded - data.size());
+                if (!WriteAll(fd, static_cast<const uint8_t*>(direct_buffer_), padded)) {
+                    error = errno;
+                }
+                else if (ftruncate(fd, static_cast<off_t>(data.size())) != 0) {
+                    error = errno;
+                }
+            }
+            ok = error == 0;
+            if (error == EINVAL) {
+                // opened, but the filesystem rejects the direct write: write the file again without O_DIRECT
+                options_.use_o_direct = false;
+                close(fd);
+                fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    return false;
+                }
+                ok = WriteAll(fd, data.data(), data.size());
+            }
+        }
+        else {
+            ok = WriteAll(fd, data.data(), data.size());
+        }
+
+        if (ok && options_.fsync_every > 0) {
+            // closed after the batched fsync
+            pending_sync_.push_back(fd);
+        }
+        else {
+            close(fd);
+        }
+        return ok;
+    }
+
+    static bool WriteAll(int fd, const uint8_t* data, size_t size) {
+        while (size > 0) {
+            const ssize_t written = write(fd, data, size);
+            if (written < 0) {
+                return false;
+            }
+            if (written == 0) {
+                // no errno from write, do not leave a stale one for the caller
+                errno = EIO;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    void SyncPending() {
+        for (const int fd : pending_sync_) {
+            fsync(fd);
+            close(fd);
+        }
+        pending_sync_.clear();
+    }
+#endif
+
+    Options options_;
+    std::vector<std::thread> encoders_;
+    std::thread writer_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable encode_cond_;
+    std::condition_variable write_cond_;
+    std::deque<EncodeTask> encode_queue_;
+    std::map<uint64_t, std::vector<uint8_t>> reorder_buffer_;
+    uint64_t next_sequence_ = 0;
+    int in_flight_ = 0;
+    bool closed_ = false;
+    bool encoders_done_ = false;
+    Stats stats_{};
+
+    // owned by the writer thread
+    std::vector<int> pending_sync_;
+    void* direct_buffer_ = nullptr;
+    size_t direct_buffer_size_ = 0;
+};
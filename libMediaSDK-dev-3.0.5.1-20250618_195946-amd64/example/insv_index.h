@@ -0,0 +1,404 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <process.h>
+#define INSV_FSEEK _fseeki64
+#define INSV_FTELL _ftelli64
+#else
+#include <unistd.h>
+#define INSV_FSEEK fseeko
+#define INSV_FTELL ftello
+#endif
+
+/**
+ * \brief sample table of the first video track of an .insv/.mp4 file
+ */
+struct InsvTrackIndex {
+    uint32_t timescale = 0;
+    uint64_t duration = 0;
+    uint64_t sample_count = 0;
+    // 0-based frame numbers of the sync (IDR) samples, ascending
+    std::vector<uint64_t> sync_samples;
+
+    /**
+     * \brief the last sync sample at or before frame
+     */
+    uint64_t KeyframeBefore(uint64_t frame) const {
+        const auto it = std::upper_bound(sync_samples.begin(), sync_samples.end(), frame);
+        return it == sync_samples.begin() ? 0 : *(it - 1);
+    }
+};
+
+namespace insv_index_detail {
+    struct Box {
+        uint32_t type;
+        int64_t begin;    // first byte after the header
+        int64_t end;
+    };
+
+    inline uint32_t FourCC(const char* s) {
+        return (static_cast<uint32_t>(static_cast<uint8_t>(s[0])) << 24) | (static_cast<uint32_t>(static_cast<uint8_t>(s[1])) << 16) |
+            (static_cast<uint32_t>(static_cast<uint8_t>(s[2])) << 8) | static_cast<uint32_t>(static_cast<uint8_t>(s[3]));
+    }
+
+    inline bool ReadU32(FILE* fp, uint32_t& value) {
+        uint8_t b[4];
+        if (fread(b, 1, 4, fp) != 4) {
+            return false;
+        }
+        value = (static_cast<uint32_t>(b[0]) << 24) | (static_cast<uint32_t>(b[1]) << 16) | (static_cast<uint32_t>(b[2]) << 8) | b[3];
+        return true;
+    }
+
+    inline bool ReadU64(FILE* fp, uint64_t& value) {
+        uint32_t hi = 0;
+        uint32_t lo = 0;
+        if (!ReadU32(fp, hi) || !ReadU32(fp, lo)) {
+            return false;
+        }
+        value = (static_cast<uint64_t>(hi) << 32) | lo;
+        return true;
+    }
+
+    inline bool ReadBoxHeader(FILE* fp, int64_t limit, Box& box) {
+        const int64_t start = INSV_FTELL(fp);
+        if (start + 8 > limit) {
+            return false;
+        }
+        uint32_t size32 = 0;
+        if (!ReadU32(fp, size32) || !ReadU32(fp, box.type)) {
+            return false;
+        }
+        uint64_t size = size32;
+        if (size32 == 1) {
+            if (!ReadU64(fp, size)) {
+                return false;
+            }
+        }
+        else if (size32 == 0) {
+            size = static_cast<uint64_t>(limit - start);
+        }
+        box.begin = INSV_FTELL(fp);
+        box.end = start + static_cast<int64_t>(size);
+        return box.end > start && box.end <= limit;
+    }
+
+    /**
+     * \brief find the first child box of the given type inside [begin, end)
+     */
+    inline bool FindChild(FILE* fp, int64_t begin, int64_t end, uint32_t type, Box& found) {
+        int64_t pos = begin;
+        while (pos < end) {
+            if (INSV_FSEEK(fp, pos, SEEK_SET) != 0) {
+                return false;
+            }
+            Box box;
+            if (!ReadBoxHeader(fp, end, box)) {
+                return false;
+            }
+            if (box.type == type) {
+                found = box;
+                return true;
+            }
+            pos = box.end;
+        }
+        return false;
+    }
+
+    inline bool IsVideoTrack(FILE* fp, const Box& mdia) {
+        Box hdlr;
+        if (!FindChild(fp, mdia.begin, mdia.end, FourCC("hdlr"), hdlr)) {
+            return false;
+        }
+        // version/flags(4) + pre_defined(4) + handler_type(4)
+        uint32_t skip = 0;
+        uint32_t handler = 0;
+        INSV_FSEEK(fp, hdlr.begin, SEEK_SET);
+        return ReadU32(fp, skip) && ReadU32(fp, skip) && ReadU32(fp, handler) && handler == FourCC("vide");
+    }
+
+    inline bool ReadMdhd(FILE* fp, const Box& mdhd, InsvTrackIndex& index) {
+        INSV_FSEEK(fp, mdhd.begin, SEEK_SET);
+        uint32_t version_flags = 0;
+        if (!ReadU32(fp, version_flags)) {
+            return false;
+        }
+        uint32_t value32 = 0;
+        if ((version_flags >> 24) == 1) {
+            uint64_t skip = 0;
+            return ReadU64(fp, skip) && ReadU64(fp, skip) && ReadU32(fp, index.timescale) && ReadU64(fp, index.duration);
+        }
+        if (!ReadU32(fp, value32) || !ReadU32(fp, value32) || !ReadU32(fp, index.timescale) || !ReadU32(fp, value32)) {
+            return false;
+        }
+        index.duration = value32;
+        return true;
+    }
+
+    /**
+     * \brief sync samples ascending and inside the track, as KeyframeBefore and the segment split expect
+     */
+    inline bool ValidSyncSamples(const InsvTrackIndex& index) {
+        for (size_t i = 0; i < index.sync_samples.size(); i++) {
+            if (index.sync_samples[i] >= index.sample_count || (i > 0 && index.sync_samples[i] <= index.sync_samples[i - 1])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * \brief the counts come from the file: they are bounded by the box or file size before anything is
+     * allocated, so a corrupt table fails instead of throwing bad_alloc
+     */
+    inline bool ReadStbl(FILE* fp, const Box& stbl, int64_t file_size, InsvTrackIndex& index) {
+        Box stsz;
+        if (!FindChild(fp, stbl.begin, stbl.end, FourCC("stsz"), stsz)) {
+            return false;
+        }
+        // version/flags(4) + sample_size(4) + sample_count(4), the sizes themselves are not needed
+        uint32_t value = 0;
+        uint32_t count = 0;
+        INSV_FSEEK(fp, stsz.begin, SEEK_SET);
+        uint32_t sample_size = 0;
+        if (!ReadU32(fp, value) || !ReadU32(fp, sample_size) || !ReadU32(fp, count)) {
+            return false;
+        }
+        // one size entry per sample, or a constant size: either way every sample takes bytes of the file
+        if (sample_size == 0 ? static_cast<uint64_t>(count) * 4 > static_cast<uint64_t>(stsz.end - INSV_FTELL(fp)) :
+            static_cast<uint64_t>(count) * sample_size > static_cast<uint64_t>(file_size)) {
+            return false;
+        }
+        index.sample_count = count;
+
+        Box stss;
+        index.sync_samples.clear();
+        if (!FindChild(fp, stbl.begin, stbl.end, FourCC("stss"), stss)) {
+            // no sync sample table means every sample is a sync sample
+            for (uint64_t i = 0; i < index.sample_count; i++) {
+                index.sync_samples.push_back(i);
+            }
+            return true;
+        }
+        uint32_t entries = 0;
+        INSV_FSEEK(fp, stss.begin, SEEK_SET);
+        if (!ReadU32(fp, value) || !ReadU32(fp, entries)) {
+            return false;
+        }
+        if (entries > index.sample_count || static_cast<uint64_t>(entries) * 4 > static_cast<uint64_t>(stss.end - INSV_FTELL(fp))) {
+            return false;
+        }
+        index.sync_samples.reserve(entries);
+        for (uint32_t i = 0; i < entries; i++) {
+            uint32_t sample = 0;
+            if (!ReadU32(fp, sample) || sample == 0) {
+                return false;
+            }
+            index.sync_samples.push_back(sample - 1);
+        }
+        return ValidSyncSamples(index);
+    }
+}
+
+/**
+ * \brief read the sample table of the first video track, only the moov box is touched
+ * \return false if the file is not an ISO-BMFF container or has no video track
+ */
+inline bool ReadInsvIndex(const std::string& path, InsvTrackIndex& index) {
+    using namespace insv_index_detail;
+#ifdef WIN32
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path.c_str(), "rb") != 0) {
+        fp = nullptr;
+    }
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+#endif
+    if (!fp) {
+        return false;
+    }
+
+    INSV_FSEEK(fp, 0, SEEK_END);
+    const int64_t file_size = INSV_FTELL(fp);
+
+    bool ret = false;
+    Box moov;
+    if (FindChild(fp, 0, file_size, FourCC("moov"), moov)) {
+        int64_t pos = moov.begin;
+        while (!ret && pos < moov.end) {
+            Box trak;
+            INSV_FSEEK(fp, pos, SEEK_SET);
+            if (!ReadBoxHeader(fp, moov.end, trak)) {
+                break;
+            }
+            pos = trak.end;
+
+            Box mdia, mdhd, minf, stbl;
+            if (trak.type != FourCC("trak") ||
+                !FindChild(fp, trak.begin, trak.end, FourCC("mdia"), mdia) ||
+                !IsVideoTrack(fp, mdia) ||
+                !FindChild(fp, mdia.begin, mdia.end, FourCC("mdhd"), mdhd) ||
+                !FindChild(fp, mdia.begin, mdia.end, FourCC("minf"), minf) ||
+                !FindChild(fp, minf.begin, minf.end, FourCC("stbl"), stbl)) {
+                continue;
+            }
+            ret = ReadMdhd(fp, mdhd, index) && ReadStbl(fp, stbl, file_size, index);
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+namespace insv_index_detail {
+    const char kSidecarMagic[8] = { 'I', 'N', 'S', 'V', 'I', 'D', 'X', '2' };
+    const uint32_t kByteOrderMark = 0x01020304;
+
+    struct SidecarHeader {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t timescale;
+        uint64_t source_size;
+        int64_t source_mtime;
+        uint64_t duration;
+        uint64_t sample_count;
+        uint64_t sync_count;
+    };
+
+    inline bool StatFile(const std::string& path, uint64_t& size, int64_t& mtime) {
+#ifdef WIN32
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0) {
+            return false;
+        }
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+#endif
+        size = static_cast<uint64_t>(st.st_size);
+        mtime = static_cast<int64_t>(st.st_mtime);
+        return true;
+    }
+
+    inline FILE* OpenFile(const std::string& path, const char* mode) {
+#ifdef WIN32
+        FILE* fp = nullptr;
+        if (fopen_s(&fp, path.c_str(), mode) != 0) {
+            return nullptr;
+        }
+        return fp;
+#else
+        return fopen(path.c_str(), mode);
+#endif
+    }
+
+    template <typename T>
+    inline bool ReadArray(FILE* fp, std::vector<T>& values, uint64_t count) {
+        values.resize(count);
+        return count == 0 || fread(values.data(), sizeof(T), count, fp) == count;
+    }
+
+    template <typename T>
+    inline bool WriteArray(FILE* fp, const std::vector<T>& values) {
+        return values.empty() || fwrite(values.data(), sizeof(T), values.size(), fp) == values.size();
+    }
+}
+
+/**
+ * \brief path of the index cached next to the input, e.g. VID_xxx.insv.idx
+ */
+inline std::string InsvIndexSidecarPath(const std::string& path) {
+    return path + ".idx";
+}
+
+/**
+ * \brief load the cached index, or read the sample table and cache it next to the file.
+ * The sidecar is rebuilt when the size or mtime of the source file changed.
+ * \param from_cache set to true when the sidecar was used
+ */
+inline bool LoadOrBuildInsvIndex(const std::string& path, InsvTrackIndex& index, bool* from_cache = nullptr) {
+    using namespace insv_index_detail;
+    if (from_cache) {
+        *from_cache = false;
+    }
+
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    if (!StatFile(path, source_size, source_mtime)) {
+        return false;
+    }
+
+    const std::string sidecar_path = InsvIndexSidecarPath(path);
+    FILE* fp = OpenFile(sidecar_path, "rb");
+    if (fp) {
+        SidecarHeader header{};
+        bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+            memcmp(header.magic, kSidecarMagic, sizeof(kSidecarMagic)) == 0 &&
+            header.byte_order == kByteOrderMark &&
+            header.source_size == source_size &&
+            header.source_mtime == source_mtime;
+        if (ok) {
+            // bound the stored count by the track and by the bytes left in the sidecar before allocating
+            const int64_t data_begin = INSV_FTELL(fp);
+            INSV_FSEEK(fp, 0, SEEK_END);
+            const int64_t sidecar_size = INSV_FTELL(fp);
+            ok = INSV_FSEEK(fp, data_begin, SEEK_SET) == 0 && sidecar_size >= data_begin &&
+                header.sync_count <= header.sample_count &&
+                header.sync_count <= static_cast<uint64_t>(sidecar_size - data_begin) / sizeof(uint64_t);
+        }
+        if (ok) {
+            index.timescale = header.timescale;
+            index.duration = header.duration;
+            index.sample_count = header.sample_count;
+            ok = ReadArray(fp, index.sync_samples, header.sync_count) && ValidSyncSamples(index);
+        }
+        fclose(fp);
+        if (ok) {
+            if (from_cache) {
+                *from_cache = true;
+            }
+            return true;
+        }
+    }
+
+    if (!ReadInsvIndex(path, index)) {
+        return false;
+    }
+
+    // a read-only media directory is not an error, the index is just rebuilt next time.
+    // A per-process temporary name, so concurrent processes indexing the same input never write into the same file.
+#ifdef WIN32
+    const std::string tmp_path = sidecar_path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+    const std::string tmp_path = sidecar_path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    fp = OpenFile(tmp_path, "wb");
+    if (fp) {
+        SidecarHeader header{};
+        memcpy(header.magic, kSidecarMagic, sizeof(kSidecarMagic));
+        header.byte_order = kByteOrderMark;
+        header.timescale = index.timescale;
+        header.source_size = source_size;
+        header.source_mtime = source_mtime;
+        header.duration = index.duration;
+        header.sample_count = index.sample_count;
+        header.sync_count = index.sync_samples.size();
+        const bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            WriteArray(fp, index.sync_samples);
+        fclose(fp);
+        if (!ok || rename(tmp_path.c_str(), sidecar_path.c_str()) != 0) {
+            remove(tmp_path.c_str());
+        }
+    }
+    return true;
+}
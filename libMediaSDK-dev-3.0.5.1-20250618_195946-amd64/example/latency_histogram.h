@@ -0,0 +1,361 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief steady clock in ns, the time base of all latency measurements
+ */
+inline int64_t LatencyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * \class LatencyHistogram
+ * \brief Lock-free histogram of durations in ns. Buckets are log-linear: 32 exact buckets below 32ns,
+ * then 16 buckets per power of two, so any percentile is within 1/16 (6%) of the true value.
+ * Record() is a few relaxed atomic adds and can be called from any thread.
+ */
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count;
+        double mean_us;
+        double p50_us;
+        double p99_us;
+        double p999_us;
+        double max_us;
+    };
+
+    LatencyHistogram() {
+        Reset();
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Record(int64_t ns) {
+        const uint64_t value = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+        buckets_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * \brief the clear is not atomic with concurrent Record() calls, a sample may land on either side
+     */
+    void Reset() {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief p in [0, 1], the middle of the bucket holding the p-th sample, in ns
+     */
+    double Percentile(double p) const {
+        uint64_t counts[kBucketCount];
+        uint64_t total = 0;
+        for (int i = 0; i < kBucketCount; i++) {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        return PercentileOf(counts, total, p);
+    }
+
+    /**
+     * \brief share of the samples above ns, e.g. frames over a latency SLO
+     */
+    double FractionAbove(int64_t ns) const {
+        uint64_t total = 0;
+        uint64_t above = 0;
+        const int threshold = BucketOf(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+        for (int i = 0; i < kBucketCount; i++) {
+            const uint64_t count = buckets_[i].load(std::memory_order_relaxed);
+            total += count;
+            above += i > threshold ? count : 0;
+        }
+        return total > 0 ? static_cast<double>(above) / total : 0.0;
+    }
+
+    Summary GetSummary() const {
+        uint64_t counts[kBucketCount];
+        uint64_t total = 0;
+        for (int i = 0; i < kBucketCount; i++) {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        Summary summary{};
+        summary.count = total;
+        if (total == 0) {
+            return summary;
+        }
+        summary.mean_us = static_cast<double>(sum_.load(std::memory_order_relaxed)) / std::max<uint64_t>(1, count_.load(std::memory_order_relaxed)) / 1e3;
+        summary.p50_us = PercentileOf(counts, total, 0.5) / 1e3;
+        summary.p99_us = PercentileOf(counts, total, 0.99) / 1e3;
+        summary.p999_us = PercentileOf(counts, total, 0.999) / 1e3;
+        summary.max_us = max_.load(std::memory_order_relaxed) / 1e3;
+        return summary;
+    }
+
+private:
+    static const int kExactBuckets = 32;
+    static const int kSubBuckets = 16;
+    static const int kBucketCount = kExactBuckets + (64 - 5) * kSubBuckets;
+
+    static int Msb(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(value);
+#else
+        int msb = 0;
+        while (value >>= 1) {
+            msb++;
+        }
+        return msb;
+#endif
+    }
+
+    static int BucketOf(uint64_t value) {
+        if (value < kExactBuckets) {
+            return static_cast<int>(value);
+        }
+        const int msb = Msb(value);
+        const int shift = msb - 4;
+        return kExactBuckets + (msb - 5) * kSubBuckets + static_cast<int>(value >> shift) - kSubBuckets;
+    }
+
+    static double BucketMiddle(int bucket) {
+        if (bucket < kExactBuckets) {
+            return bucket;
+        }
+        const int msb = (bucket - kExactBuckets) / kSubBuckets + 5;
+        const uint64_t top = (bucket - kExactBuckets) % kSubBuckets + kSubBuckets;
+        const int shift = msb - 4;
+        return (static_cast<double>(top << shift) + static_cast<double>((top + 1) << shift)) / 2;
+    }
+
+    static double PercentileOf(const uint64_t* counts, uint64_t total, double p) {
+        if (total == 0) {
+            return 0;
+        }
+        const uint64_t rank = std::min<uint64_t>(total, static_cast<uint64_t>(p * total) + 1);
+        uint64_t seen = 0;
+        for (int i = 0; i < kBucketCount; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return BucketMiddle(i);
+            }
+        }
+        return BucketMiddle(kBucketCount - 1);
+    }
+
+    std::atomic<uint64_t> buckets_[kBucketCount];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+/**
+ * \class FrameTimeline
+ * \brief Host time of the points a frame passes (arrived, handed to the stitcher, ...), looked up by
+ * the frame's timestamp so each stage can measure from an earlier one on another thread. A fixed table
+ * of slots is indexed by a hash of the timestamp; a slot is reused by a later frame, so lookups of
+ * frames older than the table simply miss.
+ */
+class FrameTimeline {
+public:
+    static const int kMaxPoints = 8;
+
+    explicit FrameTimeline(size_t slot_count = 256) {
+        size_t count = 1;
+        bits_ = 0;
+        while (count < slot_count) {
+            count <<= 1;
+            bits_++;
+        }
+        slots_.reset(new Slot[count]);
+        slot_count_ = count;
+        Reset();
+    }
+
+    /**
+     * \brief first point of a frame, forgets what the slot held before
+     */
+    void Begin(int64_t key, int point, int64_t ns) {
+        Slot& slot = SlotOf(key);
+        slot.key.store(kEmpty, std::memory_order_relaxed);
+        for (auto& time : slot.times) {
+            time.store(0, std::memory_order_relaxed);
+        }
+        slot.times[point].store(ns, std::memory_order_relaxed);
+        slot.key.store(key, std::memory_order_release);
+    }
+
+    void Mark(int64_t key, int point, int64_t ns) {
+        Slot& slot = SlotOf(key);
+        if (slot.key.load(std::memory_order_acquire) == key) {
+            slot.times[point].store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * \return the time of the point, or 0 if the frame is unknown or did not pass it
+     */
+    int64_t Get(int64_t key, int point) const {
+        const Slot& slot = SlotOf(key);
+        if (slot.key.load(std::memory_order_acquire) != key) {
+            return 0;
+        }
+        const int64_t ns = slot.times[point].load(std::memory_order_relaxed);
+        // the slot was taken by another frame meanwhile
+        return slot.key.load(std::memory_order_acquire) == key ? ns : 0;
+    }
+
+    void Reset() {
+        for (size_t i = 0; i < slot_count_; i++) {
+            slots_[i].key.store(kEmpty, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static const int64_t kEmpty = INT64_MIN;
+
+    struct Slot {
+        std::atomic<int64_t> key;
+        std::atomic<int64_t> times[kMaxPoints];
+    };
+
+    Slot& SlotOf(int64_t key) const {
+        const uint64_t hash = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+        return slots_[bits_ == 0 ? 0 : static_cast<size_t>(hash >> (64 - bits_))];
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t slot_count_ = 0;
+    int bits_ = 0;
+};
+
+/**
+ * \class PipelineLatency
+ * \brief One LatencyHistogram per named stage of a pipeline. Stages are recorded from any thread,
+ * read with Snapshot() or Format(), and optionally dumped every period by a background thread.
+ */
+class PipelineLatency {
+public:
+    struct StageSummary {
+        std::string name;
+        LatencyHistogram::Summary summary;
+    };
+
+    explicit PipelineLatency(const std::vector<std::string>& stage_names) : names_(stage_names) {
+        for (size_t i = 0; i < names_.size(); i++) {
+            histograms_.emplace_back(new LatencyHistogram());
+        }
+    }
+
+    ~PipelineLatency() {
+        StopDump();
+    }
+
+    void Record(int stage, int64_t ns) {
+        histograms_[stage]->Record(ns);
+    }
+
+    const LatencyHistogram& Stage(int stage) const {
+        return *histograms_[stage];
+    }
+
+    void Reset() {
+        for (auto& histogram : histograms_) {
+            histogram->Reset();
+        }
+    }
+
+    std::vector<StageSummary> Snapshot() const {
+        std::vector<StageSummary> stages;
+        for (size_t i = 0; i < names_.size(); i++) {
+            stages.push_back({ names_[i], histograms_[i]->GetSummary() });
+        }
+        return stages;
+    }
+
+    /**
+     * \brief one line per stage with samples, times in us
+     */
+    std::string Format() const {
+        std::string text;
+        char line[256];
+        for (const auto& stage : Snapshot()) {
+            if (stage.summary.count == 0) {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%-14s n=%-8llu mean=%9.1f p50=%9.1f p99=%9.1f p999=%9.1f max=%9.1f us\n", stage.name.c_str(),
+                static_cast<unsigned long long>(stage.summary.count), stage.summary.mean_us, stage.summary.p50_us,
+                stage.summary.p99_us, stage.summary.p999_us, stage.summary.max_us);
+            text += line;
+        }
+        return text;
+    }
+
+    /**
+     * \brief call sink with Format() every period
+     * \param reset clear the histograms after each dump, so every dump covers one period
+     */
+    void StartDump(std::chrono::milliseconds period, const std::function<void(const std::string& text)>& sink, bool reset) {
+        StopDump();
+        {
+            std::lock_guard<std::mutex> lck(dump_mutex_);
+            dump_stop_ = false;
+        }
+        dump_thread_ = std::thread([this, period, sink, reset]() {
+            std::unique_lock<std::mutex> lck(dump_mutex_);
+            while (!dump_cond_.wait_for(lck, period, [this]() { return dump_stop_; })) {
+                lck.unlock();
+                sink(Format());
+                if (reset) {
+                    Reset();
+                }
+                lck.lock();
+            }
+        });
+    }
+
+    void StopDump() {
+        {
+            std::lock_guard<std::mutex> lck(dump_mutex_);
+            dump_stop_ = true;
+        }
+        dump_cond_.notify_all();
+        if (dump_thread_.joinable()) {
+            dump_thread_.join();
+        }
+    }
+
+private:
+    std::vector<std::string> names_;
+    std::vector<std::unique_ptr<LatencyHistogram>> histograms_;
+    std::thread dump_thread_;
+    std::mutex dump_mutex_;
+    std::condition_variable dump_cond_;
+    bool dump_stop_ = true;
+};
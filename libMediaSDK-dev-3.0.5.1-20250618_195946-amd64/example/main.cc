@@ -1,17 +1,34 @@
 #include <iostream>
 #include <ins_stitcher.h>
+#include <camera/camera.h>
+#include <camera/device_discovery.h>
 
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <chrono>
+#include <thread>
 #include <vector>
 #include <sstream>
+#include <opencv2/opencv.hpp>
+
+#include "arg_parse.h"
+#include "batch_image_stitch.h"
+#include "download_manager.h"
+#include "download_stitch_pipeline.h"
+#include "downscale_pyramid.h"
+#include "model_check.h"
+#include "sharded_stitch.h"
+#include "stitch_job.h"
+#include "stitch_service.h"
 
 #ifdef WIN32
 #include <direct.h>
 #include <Windows.h>
+#else
+#include <sys/stat.h>
 #endif // WIN32
 
 using namespace std::chrono;
@@ -20,6 +37,7 @@ using namespace ins;
 const std::string helpstr =
 "{-help                   | default               | print this message                  }\n"
 "{-inputs                 | None                  | input files                         }\n"
+"{-input_dir              | None                  | stitch every .insp/.jpg of a directory into the -output directory }\n"
 "{-output                 | None                  | out path                            }\n"
 "{-stitch_type            | template              | template                            }\n"
 "{                                                | optflow                             }\n"
@@ -45,7 +63,17 @@ const std::string helpstr =
 "{-image_type             | jpg                   | jpg                                 }\n"
 "{                                                | png                                 }\n"
 "{-camera_accessory_type  | default 0             | refer to 'common.h'                 }\n"
-"{-export_frame_index     |                       | Derived frame number sequence, example: 20-50-30 }\n";
+"{-export_frame_index     |                       | Derived frame number sequence, example: 20-50-30 }\n"
+"{-shards                 | 1                     | experimental: split the timeline at keyframes and stitch segments in parallel (image sequence only), measure with stitch_bench -shards }\n"
+"{-workers                | 1                     | parallel image stitchers for -input_dir }\n"
+"{-derive_threads         | 1                     | downscale threads for -extra_output_sizes }\n"
+"{-extra_output_sizes     | None                  | example: 3840x1920,1920x960, derived from the stitched image sequence into <image_sequence_dir>_<W>x<H> }\n"
+"{-ingest_dir             | None                  | download the videos of the first camera here and stitch them into the -output directory while downloading }\n"
+"{-ingest_backlog         | 1                     | downloaded videos waiting for the stitcher before the download pauses }\n"
+"{-ingest_delete          | OFF                   | delete a downloaded video once it is stitched }\n"
+"{-serve                  | OFF                   | stay resident and take stitch jobs on stdin, see stitch_service.h for the protocol }\n"
+"{-serve_socket           | None                  | stay resident and take stitch jobs on this Unix socket }\n"
+"{-serve_jobs             | 1                     | jobs the service stitches at the same time }\n";
 
 static std::string stringToUtf8(const std::string& original_str) {
 #ifdef WIN32
@@ -80,24 +108,72 @@ static std::string stringToUtf8(const std::string& original_str) {
 #endif
 }
 
-std::vector<std::string> split(const std::string& s, char delimiter) {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
+/**
+ * \brief derive smaller copies of a stitched image sequence, every frame is decoded once and all sizes
+ * are built from it through a downscale pyramid, written to <dir>_<W>x<H> with the same file names.
+ * The SDK only hands out the encoded files, so each derived frame is a second encode of a decoded JPEG;
+ * JPEG frames decode to 3 channels and are scaled by cv::resize, DownscaleHalf4 only takes 4 channels.
+ * \return number of frames that could not be read or written
+ */
+static size_t deriveImageSequenceSizes(const std::string& dir, const std::vector<cv::Size>& sizes, int worker_count) {
+    const std::string base_dir = (dir.back() == '/' || dir.back() == '\\') ? dir.substr(0, dir.size() - 1) : dir;
+    std::vector<std::string> size_dirs;
+    for (const auto& size : sizes) {
+        size_dirs.push_back(base_dir + "_" + std::to_string(size.width) + "x" + std::to_string(size.height));
+#ifdef WIN32
+        _mkdir(size_dirs.back().c_str());
+#else
+        mkdir(size_dirs.back().c_str(), 0755);
+#endif
     }
 
-    return tokens;
+    const auto files = ListFilesWithSuffix(dir, { "jpg", "png" });
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> failed{ 0 };
+    auto worker = [&]() {
+        std::vector<cv::Mat> levels;
+        while (true) {
+            const size_t index = next.fetch_add(1);
+            if (index >= files.size()) {
+                break;
+            }
+            const cv::Mat frame = cv::imread(files[index], cv::IMREAD_UNCHANGED);
+            if (frame.empty()) {
+                failed++;
+                continue;
+            }
+            BuildDownscalePyramid(frame, sizes, levels);
+            const std::string name = files[index].substr(files[index].find_last_of("/\\") + 1);
+            for (size_t i = 0; i < sizes.size(); i++) {
+                if (!cv::imwrite(size_dirs[i] + "/" + name, levels[i])) {
+                    failed++;
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::min<int>(worker_count, static_cast<int>(files.size())); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return failed;
 }
 
 int main(int argc, char* argv[]) {
+    const auto init_start_time = steady_clock::now();
     ins::SetLogLevel(ins::InsLogLevel::WARNING);
     ins::InitEnv();
+    const double init_ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - init_start_time).count();
 
     std::vector<std::string> input_paths;
     std::string output_path;
+    std::string input_dir;
+    std::string ingest_dir;
     std::string image_sequence_dir;
     std::string ai_stitching_model;
     std::string color_plus_model_path;
@@ -112,6 +188,15 @@ int main(int argc, char* argv[]) {
     int output_width = 1920;
     int output_height = 960;
     int output_bitrate = 0;
+    int shard_count = 1;
+    int worker_count = 1;
+    int derive_threads = 1;
+    int ingest_backlog = 1;
+    bool ingest_delete = false;
+    bool serve_stdin = false;
+    std::string serve_socket;
+    int serve_jobs = 1;
+    std::vector<cv::Size> extra_output_sizes;
 
     bool enable_flowstate = false;
     bool enable_cuda = true;
@@ -217,11 +302,339 @@ int main(int argc, char* argv[]) {
         else if (std::string("-enable_soft_decode") == std::string(argv[i])) {
             enable_soft_decode = true;
         }
+        else if (std::string("-input_dir") == std::string(argv[i])) {
+            input_dir = stringToUtf8(argv[++i]);
+        }
+        else if (std::string("-workers") == std::string(argv[i])) {
+            worker_count = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-derive_threads") == std::string(argv[i])) {
+            derive_threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-shards") == std::string(argv[i])) {
+            shard_count = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-extra_output_sizes") == std::string(argv[i])) {
+            const auto sizes = parseSizes(argv[++i]);
+            extra_output_sizes.insert(extra_output_sizes.end(), sizes.begin(), sizes.end());
+        }
+        else if (std::string("-ingest_dir") == std::string(argv[i])) {
+            ingest_dir = stringToUtf8(argv[++i]);
+        }
+        else if (std::string("-ingest_backlog") == std::string(argv[i])) {
+            ingest_backlog = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-ingest_delete") == std::string(argv[i])) {
+            ingest_delete = true;
+        }
+        else if (std::string("-serve") == std::string(argv[i])) {
+            serve_stdin = true;
+        }
+        else if (std::string("-serve_socket") == std::string(argv[i])) {
+            serve_socket = argv[++i];
+        }
+        else if (std::string("-serve_jobs") == std::string(argv[i])) {
+            serve_jobs = std::max(1, atoi(argv[++i]));
+        }
         else if (std::string("-help") == std::string(argv[i])) {
             std::cout << helpstr << std::endl;
         }
     }
 
+    if (color_plus_model_path.empty()) {
+        enable_colorplus = false;
+    }
+
+    for (const std::string* model : { &ai_stitching_model, &color_plus_model_path, &denoise_model_path, &deflicker_model_path }) {
+        std::string error;
+        if (!CheckModelFile(*model, error)) {
+            std::cout << error << std::endl;
+            return -1;
+        }
+    }
+
+    auto configure_image_stitcher = [&](ImageStitcher& stitcher) {
+        stitcher.SetStitchType(stitch_type);
+        stitcher.SetOutputSize(output_width, output_height);
+        stitcher.EnableFlowState(enable_flowstate);
+        stitcher.EnableDenoise(enable_sequence_denoise, denoise_model_path);
+        stitcher.EnableCuda(enable_cuda);
+        stitcher.EnableStitchFusion(enalbe_stitchfusion);
+        stitcher.SetCameraAccessoryType(accessory_type);
+        stitcher.SetAiStitchModelFile(ai_stitching_model);
+        stitcher.EnableColorPlus(enable_colorplus, color_plus_model_path);
+    };
+
+    // everything but the input and the output
+    auto configure_stitcher_settings = [&](VideoStitcher& stitcher) {
+        stitcher.SetStitchType(stitch_type);
+        stitcher.EnableCuda(enable_cuda);
+        stitcher.EnableStitchFusion(enalbe_stitchfusion);
+        stitcher.EnableColorPlus(enable_colorplus, color_plus_model_path);
+        stitcher.SetOutputSize(output_width, output_height);
+        stitcher.SetOutputBitRate(output_bitrate);
+        stitcher.EnableFlowState(enable_flowstate);
+        stitcher.SetAiStitchModelFile(ai_stitching_model);
+        stitcher.EnableDenoise(enable_sequence_denoise);
+        stitcher.EnableDirectionLock(enable_directionlock);
+        stitcher.SetCameraAccessoryType(accessory_type);
+        stitcher.SetSoftwareCodecUsage(enable_soft_encode, enable_soft_decode);
+        if (enable_H265_encoder) {
+            stitcher.EnableH265Encoder();
+        }
+        stitcher.EnableDeflicker(enable_deflicker, deflicker_model_path);
+    };
+
+    auto configure_stitcher = [&](VideoStitcher& stitcher) {
+        stitcher.SetInputPath(input_paths);
+        if (image_sequence_dir.empty()) {
+            stitcher.SetOutputPath(output_path);
+        }
+        else {
+            stitcher.SetImageSequenceInfo(image_sequence_dir, image_type);
+        }
+        configure_stitcher_settings(stitcher);
+    };
+
+    if (serve_stdin || !serve_socket.empty()) {
+        // the command line sets the defaults of every job, a job overrides input, output, size, stitch type and model
+        auto configure_job = [&](VideoStitcher& stitcher, const StitchServiceJob& job, std::string& error) {
+            configure_stitcher_settings(stitcher);
+            std::vector<std::string> job_inputs = job.inputs;
+            stitcher.SetInputPath(job_inputs);
+            if (!job.output.empty()) {
+                stitcher.SetOutputPath(job.output);
+            }
+            else {
+                stitcher.SetImageSequenceInfo(job.image_sequence_dir, image_type);
+            }
+            if (job.output_width > 0) {
+                stitcher.SetOutputSize(job.output_width, job.output_height);
+            }
+            if (job.stitch_type == "template") {
+                stitcher.SetStitchType(STITCH_TYPE::TEMPLATE);
+            }
+            else if (job.stitch_type == "optflow") {
+                stitcher.SetStitchType(STITCH_TYPE::OPTFLOW);
+            }
+            else if (job.stitch_type == "dynamicstitch") {
+                stitcher.SetStitchType(STITCH_TYPE::DYNAMICSTITCH);
+            }
+            else if (job.stitch_type == "aistitch") {
+                stitcher.SetStitchType(STITCH_TYPE::AIFLOW);
+            }
+            else if (!job.stitch_type.empty()) {
+                error = "unknown stitch_type " + job.stitch_type;
+                return false;
+            }
+            if (!job.ai_stitching_model.empty()) {
+                if (!CheckModelFile(job.ai_stitching_model, error)) {
+                    return false;
+                }
+                stitcher.SetAiStitchModelFile(job.ai_stitching_model);
+            }
+            if (!job.export_frames.empty()) {
+                if (job.image_sequence_dir.empty()) {
+                    error = "export_frame_index needs image_sequence_dir";
+                    return false;
+                }
+                stitcher.SetExportFrameSequence(job.export_frames);
+            }
+            return true;
+        };
+
+        // what a new process per file pays before its first job: loading the libraries and InitEnv
+        const double startup_ms = std::max(stitch_service_detail::ProcessAgeMs(), init_ms);
+        StitchService service(serve_jobs, startup_ms, configure_job);
+        if (!serve_socket.empty()) {
+#ifdef WIN32
+            std::cout << "-serve_socket needs a Unix socket, use -serve" << std::endl;
+            return -1;
+#else
+            std::cout << "serving on " << serve_socket << "; startup = " << startup_ms << "ms" << std::endl;
+            std::string error;
+            if (!service.ServeUnixSocket(serve_socket, error)) {
+                std::cout << error << std::endl;
+                return -1;
+            }
+            std::cout << service.FormatStats() << std::endl;
+#endif
+        }
+        else {
+            service.ServeStream(std::cin, std::cout);
+        }
+        return 0;
+    }
+
+    if (!input_dir.empty()) {
+        if (output_path.empty()) {
+            std::cout << "-input_dir needs an -output directory" << std::endl;
+            return -1;
+        }
+        if (!MakeDirectories(output_path)) {
+            std::cout << "can not create the -output directory " << output_path << std::endl;
+            return -1;
+        }
+        // <name>.jpg in the input directory would overwrite the .jpg inputs
+        if (IsSameDirectory(input_dir, output_path)) {
+            std::cout << "-output must not be the -input_dir directory" << std::endl;
+            return -1;
+        }
+
+        const auto files = ListFilesWithSuffix(input_dir, { "insp", "jpg" });
+        std::vector<std::string> output_names;
+        std::string conflict;
+        if (!BatchOutputNames(files, output_names, conflict)) {
+            std::cout << "two inputs would write the same output: " << conflict << std::endl;
+            return -1;
+        }
+        std::vector<BatchImageStitcher::Job> jobs;
+        const std::string separator = (output_path.back() == '/' || output_path.back() == '\\') ? "" : "/";
+        for (size_t i = 0; i < files.size(); i++) {
+            BatchImageStitcher::Job job;
+            job.inputs.push_back(files[i]);
+            job.output = output_path + separator + output_names[i];
+            jobs.push_back(job);
+        }
+        if (jobs.empty()) {
+            std::cout << "no .insp/.jpg file in " << input_dir << std::endl;
+            return -1;
+        }
+
+        BatchImageStitcher batch_stitcher(worker_count, configure_image_stitcher);
+        batch_stitcher.SetProgressCallback([](size_t done, size_t total) {
+            std::cout << "\r" << done << "/" << total << std::flush;
+        });
+        std::cout << "start stitch " << jobs.size() << " images with " << worker_count << " workers" << std::endl;
+        const auto result = batch_stitcher.Run(jobs);
+        std::cout << std::endl;
+        for (const auto& failed : result.failed_outputs) {
+            std::cout << "failed: " << failed << std::endl;
+        }
+        std::cout << "images = " << result.stitched << "; failed = " << result.failed
+            << "; cost = " << result.seconds << "; images/s = " << result.ImagesPerSecond() << std::endl;
+        return result.failed == 0 ? 0 : -1;
+    }
+
+    if (!ingest_dir.empty()) {
+        if (output_path.empty()) {
+            std::cout << "-ingest_dir needs an -output directory" << std::endl;
+            return -1;
+        }
+        if (!image_sequence_dir.empty()) {
+            std::cout << "-ingest_dir writes one video per camera file, -image_sequence_dir ignored" << std::endl;
+            image_sequence_dir.clear();
+        }
+        // before the camera is opened, a missing directory would fail every job only after its download
+        if (!MakeDirectories(ingest_dir)) {
+            std::cout << "can not create the -ingest_dir directory " << ingest_dir << std::endl;
+            return -1;
+        }
+        if (!MakeDirectories(output_path)) {
+            std::cout << "can not create the -output directory " << output_path << std::endl;
+            return -1;
+        }
+
+        ins_camera::DeviceDiscovery discovery;
+        auto list = discovery.GetAvailableDevices();
+        if (list.empty()) {
+            std::cout << "no device found." << std::endl;
+            discovery.FreeDeviceDescriptors(list);
+            return -1;
+        }
+        auto cam = std::make_shared<ins_camera::Camera>(list[0].info);
+        if (!cam->Open()) {
+            std::cout << "failed to open camera" << std::endl;
+            discovery.FreeDeviceDescriptors(list);
+            return -1;
+        }
+        discovery.FreeDeviceDescriptors(list);
+
+        std::vector<DownloadStitchPipeline::Job> jobs;
+        const std::string ingest_separator = (ingest_dir.back() == '/' || ingest_dir.back() == '\\') ? "" : "/";
+        const std::string output_separator = (output_path.back() == '/' || output_path.back() == '\\') ? "" : "/";
+        for (const auto& group : GroupCameraVideos(cam->GetCameraFilesList())) {
+            DownloadStitchPipeline::Job job;
+            job.remote_paths = group;
+            for (const auto& remote_path : group) {
+                job.local_paths.push_back(ingest_dir + ingest_separator + remote_path.substr(remote_path.find_last_of("/\\") + 1));
+            }
+            const auto begin = group[0].find_last_of("/\\") + 1;
+            const auto end = group[0].find_last_of('.');
+            job.output = output_path + output_separator + group[0].substr(begin, end - begin) + ".mp4";
+            jobs.push_back(job);
+        }
+        if (jobs.empty()) {
+            std::cout << "no video on the camera" << std::endl;
+            cam->Close();
+            return -1;
+        }
+
+        // Range requests over the camera's http server, DownloadCameraFile when it has none
+        const std::string base_url = cam->GetHttpBaseUrl();
+        auto download = [&](const DownloadStitchPipeline::Job& job, std::string& error) {
+            DownloadManager manager(base_url, DownloadManager::Options());
+            if (!manager.IsValid()) {
+                for (size_t i = 0; i < job.remote_paths.size(); i++) {
+                    if (!cam->DownloadCameraFile(job.remote_paths[i], job.local_paths[i])) {
+                        error = "failed to download " + job.remote_paths[i];
+                        return false;
+                    }
+                }
+                return true;
+            }
+            for (size_t i = 0; i < job.remote_paths.size(); i++) {
+                manager.Add(job.remote_paths[i], job.local_paths[i]);
+            }
+            for (const auto& result : manager.Run()) {
+                if (!result.ok) {
+                    error = result.remote_path + ": " + result.error;
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        StitchJobRunner stitch_runner;
+        auto stitch = [&](const DownloadStitchPipeline::Job& job, std::string& error) {
+            auto video_stitcher = std::make_shared<VideoStitcher>();
+            configure_stitcher(*video_stitcher);
+            std::vector<std::string> job_inputs = job.local_paths;
+            video_stitcher->SetInputPath(job_inputs);
+            video_stitcher->SetOutputPath(job.output);
+            const auto result = stitch_runner.Submit(video_stitcher).Wait();
+            error = result.message;
+            return result.Ok();
+        };
+
+        DownloadStitchPipeline pipeline(ingest_backlog, download, stitch);
+        pipeline.SetDeleteDownloads(ingest_delete);
+        pipeline.SetProgressCallback([](size_t downloaded, size_t stitched, size_t total) {
+            std::cout << "downloaded = " << downloaded << "/" << total << "; stitched = " << stitched << "/" << total << std::endl;
+        });
+        std::cout << "start ingest " << jobs.size() << " videos" << std::endl;
+        const auto start_time = steady_clock::now();
+        const auto results = pipeline.Run(jobs);
+        cam->Close();
+
+        int failed = 0;
+        double download_seconds = 0;
+        double stitch_seconds = 0;
+        for (size_t i = 0; i < results.size(); i++) {
+            download_seconds += results[i].download_seconds;
+            stitch_seconds += results[i].stitch_seconds;
+            if (!results[i].stitched) {
+                failed++;
+                std::cout << "failed: " << jobs[i].remote_paths[0] << ": " << results[i].error << std::endl;
+            }
+        }
+        std::cout << "videos = " << results.size() - failed << "; failed = " << failed
+            << "; first output = " << pipeline.FirstOutputSeconds()
+            << "; download = " << download_seconds << "; stitch = " << stitch_seconds
+            << "; cost = " << duration_cast<duration<double>>(steady_clock::now() - start_time).count() << std::endl;
+        return failed == 0 ? 0 : -1;
+    }
+
     if (input_paths.empty()) {
         std::cout << "can not find input_file" << std::endl;
         std::cout << helpstr << std::endl;
@@ -234,6 +647,23 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
+    if (!extra_output_sizes.empty() && image_sequence_dir.empty()) {
+        std::cout << "-extra_output_sizes needs -image_sequence_dir, ignored" << std::endl;
+        extra_output_sizes.clear();
+    }
+
+    // the video is stitched once at -output_size, the smaller sizes are derived from the written frames
+    auto derive_extra_sizes = [&]() {
+        if (extra_output_sizes.empty()) {
+            return;
+        }
+        const auto derive_start_time = steady_clock::now();
+        const size_t failed = deriveImageSequenceSizes(image_sequence_dir, extra_output_sizes, derive_threads);
+        std::cout << "derived sizes = " << extra_output_sizes.size()
+            << "; failed = " << failed
+            << "; cost = " << duration_cast<duration<double>>(steady_clock::now() - derive_start_time).count() << std::endl;
+    };
+
     std::vector<uint64_t> export_frame_nums;
     if (!image_sequence_dir.empty()) {
         auto frame_index_vec = split(exported_frame_number_sequence, '-');
@@ -243,99 +673,125 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (color_plus_model_path.empty()) {
-        enable_colorplus = false;
-    }
-
+    int exit_code = 0;
     int count = 1;
     while (count--) {
-        std::mutex mutex;
-        std::condition_variable cond;
-        bool is_finished = false;
-        bool has_error = false;
-        int stitch_progress = 0;
         std::string suffix = input_paths[0].substr(input_paths[0].find_last_of(".") + 1);
         std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
         if (suffix == "insp" || suffix == "jpg") {
             auto image_stitcher = std::make_shared<ImageStitcher>();
+            configure_image_stitcher(*image_stitcher);
             image_stitcher->SetInputPath(input_paths);
-            image_stitcher->SetStitchType(stitch_type);
             image_stitcher->SetOutputPath(output_path);
-            image_stitcher->SetOutputSize(output_width, output_height);
-            image_stitcher->EnableFlowState(enable_flowstate);
-            image_stitcher->EnableDenoise(enable_sequence_denoise, denoise_model_path);
-            image_stitcher->EnableCuda(enable_cuda);
-            image_stitcher->EnableStitchFusion(enalbe_stitchfusion);
-            image_stitcher->SetCameraAccessoryType(accessory_type);
-            image_stitcher->SetAiStitchModelFile(ai_stitching_model);
-            image_stitcher->EnableColorPlus(enable_colorplus, color_plus_model_path);
             image_stitcher->Stitch();
         }
         else if (suffix == "mp4" || suffix == "insv" || suffix == "lrv") {
             auto start_time = steady_clock::now();
-            auto video_stitcher = std::make_shared<VideoStitcher>();
-            video_stitcher->SetInputPath(input_paths);
-            if (image_sequence_dir.empty()) {
-                video_stitcher->SetOutputPath(output_path);
+
+            // the keyframe index is cached next to the input as <input>.idx
+            InsvTrackIndex track_index;
+            bool has_track_index = false;
+            if (shard_count > 1 || !export_frame_nums.empty()) {
+                bool from_cache = false;
+                has_track_index = LoadOrBuildInsvIndex(input_paths[0], track_index, &from_cache) && track_index.sample_count > 0;
+                if (has_track_index) {
+                    std::cout << "index: " << track_index.sample_count << " frames, " << track_index.sync_samples.size()
+                        << " keyframes" << (from_cache ? " (cached)" : "") << std::endl;
+                }
             }
-            else {
-                if (!export_frame_nums.empty()) {
-                    video_stitcher->SetExportFrameSequence(export_frame_nums);
+
+            if (shard_count > 1) {
+                if (image_sequence_dir.empty()) {
+                    std::cout << "-shards needs -image_sequence_dir, stitching on one pipeline" << std::endl;
+                    shard_count = 1;
+                }
+                else if (!has_track_index) {
+                    std::cout << "can not read the sample table of " << input_paths[0] << ", stitching on one pipeline" << std::endl;
+                    shard_count = 1;
                 }
+            }
 
-                video_stitcher->SetImageSequenceInfo(image_sequence_dir, image_type);
-            }
-            video_stitcher->SetStitchType(stitch_type);
-            video_stitcher->EnableCuda(enable_cuda);
-            video_stitcher->EnableStitchFusion(enalbe_stitchfusion);
-            video_stitcher->EnableColorPlus(enable_colorplus, color_plus_model_path);
-            video_stitcher->SetOutputSize(output_width, output_height);
-            video_stitcher->SetOutputBitRate(output_bitrate);
-            video_stitcher->EnableFlowState(enable_flowstate);
-            video_stitcher->SetAiStitchModelFile(ai_stitching_model);
-            video_stitcher->EnableDenoise(enable_sequence_denoise);
-            video_stitcher->EnableDirectionLock(enable_directionlock);
-            video_stitcher->SetCameraAccessoryType(accessory_type);
-            video_stitcher->SetSoftwareCodecUsage(enable_soft_encode, enable_soft_decode);
-            if (enable_H265_encoder) {
-                video_stitcher->EnableH265Encoder();
-            }
-            video_stitcher->EnableDeflicker(enable_deflicker, deflicker_model_path);
-            video_stitcher->SetStitchProgressCallback([&](int process, int error) {
-                if (stitch_progress != process) {
+            if (has_track_index && !export_frame_nums.empty()) {
+                // one forward pass over sorted, unique, in-range frames
+                const auto plan = SplitSparseExport(track_index, 1, export_frame_nums);
+                if (plan.empty()) {
+                    std::cout << "no frame of -export_frame_index is inside the video" << std::endl;
+                    exit_code = -1;
+                    continue;
+                }
+                export_frame_nums = plan[0].frames;
+                std::cout << "export " << export_frame_nums.size() << " frames, at least " << plan[0].decode_frames
+                    << " frames to decode from their keyframes" << std::endl;
+            }
+
+            if (shard_count > 1) {
+                const auto segments = SplitAtKeyframes(track_index, shard_count, export_frame_nums);
+                ShardedVideoStitcher sharded_stitcher(segments, shard_count, image_sequence_dir,
+                    [&](VideoStitcher& stitcher, const std::string& segment_dir) {
+                    stitcher.SetInputPath(input_paths);
+                    stitcher.SetImageSequenceInfo(segment_dir, image_type);
+                    configure_stitcher_settings(stitcher);
+                });
+                sharded_stitcher.SetStitchProgressCallback([&](int process) {
                     const std::string process_desc = "process = " + std::to_string(process) + std::string("%");
                     std::cout << "\r" << process_desc << std::flush;
-                    stitch_progress = process;
-                }
+                });
 
-                if (stitch_progress == 100) {
-                    std::cout << std::endl;
-                    std::unique_lock<std::mutex> lck(mutex);
-                    cond.notify_one();
-                    is_finished = true;
+                std::cout << "start stitch " << segments.size() << " segments" << std::endl;
+                std::string error;
+                const bool ok = sharded_stitcher.Run(error);
+                if (!ok) {
+                    std::cout << std::endl << "error: " << error << std::endl;
+                }
+                std::cout << std::endl << "end stitch " << std::endl;
+
+                const double cost = duration_cast<duration<double>>(steady_clock::now() - start_time).count();
+                std::cout << "shards = " << segments.size()
+                    << "; frames = " << sharded_stitcher.TotalFrames()
+                    << "; cost = " << cost
+                    << "; fps = " << sharded_stitcher.TotalFrames() / cost << std::endl;
+                if (ok) {
+                    derive_extra_sizes();
                 }
-            });
+                else {
+                    exit_code = -1;
+                }
+                continue;
+            }
 
-            video_stitcher->SetStitchStateCallback([&](int error, const char* err_info) {
-                std::cout << "error: " << err_info << std::endl;
-                has_error = true;
-                cond.notify_one();
-            });
+            auto video_stitcher = std::make_shared<VideoStitcher>();
+            configure_stitcher(*video_stitcher);
+            if (!image_sequence_dir.empty() && !export_frame_nums.empty()) {
+                video_stitcher->SetExportFrameSequence(export_frame_nums);
+            }
+            int stitch_progress = 0;
+            StitchJobOptions options;
+            options.progress_callback = [&stitch_progress](int process) {
+                if (stitch_progress != process) {
+                    const std::string process_desc = "process = " + std::to_string(process) + std::string("%");
+                    std::cout << "\r" << process_desc << std::flush;
+                    stitch_progress = process;
+                }
+            };
 
             std::cout << "start stitch " << std::endl;
-            video_stitcher->StartStitch();
-
-            std::unique_lock<std::mutex> lck(mutex);
-            cond.wait(lck, [&] {
-                std::cout << "progress: " << video_stitcher->GetStitchProgress() << "; finished: " << is_finished << std::endl;
-                return is_finished || has_error;
-            });
-
+            StitchJobRunner runner;
+            const auto result = runner.Submit(video_stitcher, options).Wait();
+            std::cout << std::endl;
+            if (!result.Ok()) {
+                std::cout << "error: " << result.message << std::endl;
+            }
             std::cout << "end stitch " << std::endl;
 
             auto end_time = steady_clock::now();
             std::cout << "cost = " << duration_cast<duration<double>>(end_time - start_time).count() << std::endl;
+            if (result.Ok()) {
+                derive_extra_sizes();
+            }
+            else {
+                exit_code = -1;
+            }
         }
     }
-    return 0;
+    return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace model_check_detail {
+    const char kLfsPointer[] = "version https://git-lfs";
+}
+
+/**
+ * \brief checks that a .ins model (ai stitch, colorplus, deflicker, denoise) can be read and is not a
+ * git-lfs pointer left by a clone without `git lfs pull`; the SDK only reports such a model as a failed
+ * stitch. An empty path is not checked.
+ * \return false with error set if the model can not be used
+ */
+inline bool CheckModelFile(const std::string& path, std::string& error) {
+    using namespace model_check_detail;
+    if (path.empty()) {
+        return true;
+    }
+#ifdef WIN32
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path.c_str(), "rb") != 0) {
+        fp = nullptr;
+    }
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+#endif
+    if (!fp) {
+        error = "can not read model " + path;
+        return false;
+    }
+    char prefix[sizeof(kLfsPointer) - 1] = {};
+    const size_t size = fread(prefix, 1, sizeof(prefix), fp);
+    fclose(fp);
+    if (size == 0) {
+        error = "model " + path + " is empty";
+        return false;
+    }
+    if (size == sizeof(prefix) && memcmp(prefix, kLfsPointer, sizeof(prefix)) == 0) {
+        error = path + " is a git lfs pointer, not the model: run git lfs pull";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "downscale_pyramid.h"
+#include "frame_pool.h"
+
+/**
+ * \class MultiResolutionOutput
+ * \brief Derives smaller outputs from every stitched frame, so one stitch at the largest size
+ * feeds several sinks (archive, review, thumbnails) instead of one stitch per size.
+ * Every output has its own FramePool, and a size is derived from the smallest frame already built for
+ * the same source frame. A dropped frame (pool exhausted) is counted by that output's pool.
+ */
+class MultiResolutionOutput {
+public:
+    using FrameCallback = std::function<void(PooledFrame* frame)>;
+
+    /**
+     * \param frames_per_output pool size of every derived output
+     */
+    explicit MultiResolutionOutput(int frames_per_output) : frames_per_output_(frames_per_output) {
+    }
+
+    /**
+     * \brief the callback owns one reference of every derived frame and must Release() it
+     */
+    void AddOutput(int width, int height, const FrameCallback& callback) {
+        Output output;
+        output.width = width;
+        output.height = height;
+        output.pool = std::make_shared<FramePool>(frames_per_output_, width, height, 4);
+        output.callback = callback;
+        // keep the outputs sorted from large to small so every size can reuse the previous ones
+        auto it = outputs_.begin();
+        while (it != outputs_.end() && static_cast<int64_t>(it->width) * it->height >= static_cast<int64_t>(width) * height) {
+            ++it;
+        }
+        outputs_.insert(it, output);
+    }
+
+    size_t OutputCount() const {
+        return outputs_.size();
+    }
+
+    cv::Size OutputSize(size_t index) const {
+        return cv::Size(outputs_[index].width, outputs_[index].height);
+    }
+
+    const std::shared_ptr<FramePool>& OutputPool(size_t index) const {
+        return outputs_[index].pool;
+    }
+
+    /**
+     * \brief derive every output from a packed RGBA frame, runs on the caller thread.
+     * The caller keeps its own reference of frame.
+     */
+    void Submit(PooledFrame* frame) {
+        std::vector<cv::Size> built_sizes(1, cv::Size(frame->Width(), frame->Height()));
+        std::vector<PooledFrame*> built(1, frame);
+        for (auto& output : outputs_) {
+            PooledFrame* derived = output.pool->Acquire(output.width, output.height, 4, frame->Format(), frame->Timestamp());
+            if (!derived) {
+                continue;
+            }
+            const PooledFrame* base = built[PickPyramidBase(built_sizes, output.width, output.height)];
+            const cv::Mat src(base->Height(), base->Width(), CV_8UC4, const_cast<uint8_t*>(base->Data()), base->Stride());
+            cv::Mat dst(derived->Height(), derived->Width(), CV_8UC4, derived->MutableData(), derived->Stride());
+            DownscaleInto(src, dst);
+
+            // one reference for the callback, one kept as the base of the smaller outputs
+            derived->Retain();
+            built_sizes.push_back(cv::Size(output.width, output.height));
+            built.push_back(derived);
+            output.callback(derived);
+        }
+        for (size_t i = 1; i < built.size(); i++) {
+            built[i]->Release();
+        }
+    }
+
+private:
+    struct Output {
+        int width;
+        int height;
+        std::shared_ptr<FramePool> pool;
+        FrameCallback callback;
+    };
+
+    int frames_per_output_;
+    std::vector<Output> outputs_;
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * \class SpscPacketRing
+ * \brief Preallocated single-producer/single-consumer ring of encoded video packets.
+ * Every slot owns a fixed-size slab, so pushing a packet is one memcpy and never allocates.
+ * The producer never waits: a full ring or a packet larger than a slab is dropped and counted.
+ */
+class SpscPacketRing {
+public:
+    struct Packet {
+        const uint8_t* data;
+        size_t size;
+        int64_t timestamp;
+        uint8_t stream_type;
+    };
+
+    struct Stats {
+        uint64_t pushed;
+        uint64_t popped;
+        uint64_t overflow_drops;   // ring full when the packet arrived
+        uint64_t oversize_drops;   // packet larger than slab_size
+        uint64_t high_watermark;   // max packets queued at once
+    };
+
+    /**
+     * \param slot_count number of packets the ring can hold, rounded up to a power of two
+     * \param slab_size max bytes of one packet
+     */
+    SpscPacketRing(size_t slot_count, size_t slab_size) : slab_size_(slab_size) {
+        size_t count = 1;
+        while (count < slot_count) {
+            count <<= 1;
+        }
+        mask_ = count - 1;
+        slots_.resize(count);
+        slabs_.resize(count * slab_size);
+        Reset();
+    }
+
+    SpscPacketRing(const SpscPacketRing&) = delete;
+    SpscPacketRing& operator=(const SpscPacketRing&) = delete;
+
+    /**
+     * \brief producer side, copies the packet into the next free slab
+     * \return false if the packet was dropped
+     */
+    bool TryPush(const uint8_t* data, size_t size, int64_t timestamp, uint8_t stream_type) {
+        if (size > slab_size_) {
+            oversize_drops_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        const uint64_t tail = tail_.load(std::memory_order_acquire);
+        const uint64_t queued = head - tail;
+        if (queued > mask_) {
+            overflow_drops_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        const size_t index = static_cast<size_t>(head & mask_);
+        memcpy(&slabs_[index * slab_size_], data, size);
+        slots_[index].size = size;
+        slots_[index].timestamp = timestamp;
+        slots_[index].stream_type = stream_type;
+        head_.store(head + 1, std::memory_order_release);
+
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        if (queued + 1 > high_watermark_.load(std::memory_order_relaxed)) {
+            high_watermark_.store(queued + 1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /**
+     * \brief consumer side, exposes the oldest packet without copying.
+     * The packet stays valid until Pop() is called.
+     */
+    bool Peek(Packet& packet) const {
+        const uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        const size_t index = static_cast<size_t>(tail & mask_);
+        packet.data = &slabs_[index * slab_size_];
+        packet.size = slots_[index].size;
+        packet.timestamp = slots_[index].timestamp;
+        packet.stream_type = slots_[index].stream_type;
+        return true;
+    }
+
+    void Pop() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        popped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t Size() const {
+        return static_cast<size_t>(head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire));
+    }
+
+    /**
+     * \brief discard queued packets and clear counters, only call while neither side is running
+     */
+    void Reset() {
+        head_.store(0);
+        tail_.store(0);
+        pushed_.store(0);
+        popped_.store(0);
+        overflow_drops_.store(0);
+        oversize_drops_.store(0);
+        high_watermark_.store(0);
+    }
+
+    Stats GetStats() const {
+        Stats stats{};
+        stats.pushed = pushed_.load(std::memory_order_relaxed);
+        stats.popped = popped_.load(std::memory_order_relaxed);
+        stats.overflow_drops = overflow_drops_.load(std::memory_order_relaxed);
+        stats.oversize_drops = oversize_drops_.load(std::memory_order_relaxed);
+        stats.high_watermark = high_watermark_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    struct Slot {
+        size_t size;
+        int64_t timestamp;
+        uint8_t stream_type;
+    };
+
+    size_t slab_size_;
+    uint64_t mask_;
+    std::vector<Slot> slots_;
+    std::vector<uint8_t> slabs_;
+
+    // producer and consumer indices are padded onto separate cache lines
+    uint8_t pad0_[64];
+    std::atomic<uint64_t> head_;
+    std::atomic<uint64_t> pushed_;
+    std::atomic<uint64_t> overflow_drops_;
+    std::atomic<uint64_t> oversize_drops_;
+    std::atomic<uint64_t> high_watermark_;
+    uint8_t pad1_[64];
+    std::atomic<uint64_t> tail_;
+    std::atomic<uint64_t> popped_;
+    uint8_t pad2_[64];
+};
+
+/**
+ * \class VideoPacketPump
+ * \brief Decouples StreamDelegate::OnVideoData from the stitcher.
+ * The receive thread copies packets into one SpscPacketRing per stream_index,
+ * and a dedicated thread drains the rings into the sink (usually RealTimeStitcher::HandleVideoData).
+ */
+class VideoPacketPump {
+public:
+    using PacketSink = std::function<void(const uint8_t* data, size_t size, int64_t timestamp, uint8_t stream_type, int stream_index)>;
+
+    VideoPacketPump(int stream_count, size_t slot_count, size_t slab_size) {
+        for (int i = 0; i < stream_count; i++) {
+            rings_.emplace_back(new SpscPacketRing(slot_count, slab_size));
+        }
+    }
+
+    ~VideoPacketPump() {
+        Stop();
+    }
+
+    /**
+     * \brief start the drain thread, the queued packets from the previous session are discarded
+     */
+    void Start(const PacketSink& sink) {
+        Stop();
+        for (auto& ring : rings_) {
+            ring->Reset();
+        }
+        unknown_stream_drops_.store(0);
+        sink_ = sink;
+        running_.store(true);
+        thread_ = std::thread(&VideoPacketPump::Run, this);
+    }
+
+    void Stop() {
+        running_.store(false);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    /**
+     * \brief called on the receive thread, never blocks
+     */
+    bool Push(const uint8_t* data, size_t size, int64_t timestamp, uint8_t stream_type, int stream_index) {
+        if (stream_index < 0 || stream_index >= static_cast<int>(rings_.size())) {
+            unknown_stream_drops_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return rings_[stream_index]->TryPush(data, size, timestamp, stream_type);
+    }
+
+    int StreamCount() const {
+        return static_cast<int>(rings_.size());
+    }
+
+    SpscPacketRing::Stats GetStats(int stream_index) const {
+        return rings_[stream_index]->GetStats();
+    }
+
+    uint64_t UnknownStreamDrops() const {
+        return unknown_stream_drops_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void Run() {
+        int idle_rounds = 0;
+        while (running_.load(std::memory_order_acquire)) {
+            bool has_data = false;
+            // one packet per stream per round keeps the dual streams interleaved
+            for (int i = 0; i < static_cast<int>(rings_.size()); i++) {
+                SpscPacketRing::Packet packet;
+                if (rings_[i]->Peek(packet)) {
+                    sink_(packet.data, packet.size, packet.timestamp, packet.stream_type, i);
+                    rings_[i]->Pop();
+                    has_data = true;
+                }
+            }
+
+            if (has_data) {
+                idle_rounds = 0;
+            }
+            else if (++idle_rounds < 64) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<SpscPacketRing>> rings_;
+    PacketSink sink_;
+    std::thread thread_;
+    std::atomic<bool> running_{ false };
+    std::atomic<uint64_t> unknown_stream_drops_{ 0 };
+};
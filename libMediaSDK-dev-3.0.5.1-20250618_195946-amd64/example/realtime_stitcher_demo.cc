@@ -4,7 +4,9 @@
 #include <camera/device_discovery.h>
 
 #include <iostream>
+#include <algorithm>
 #include <condition_variable>
+#include <cstdlib>
 #include <mutex>
 #include <thread>
 #include <chrono>
@@ -12,23 +14,46 @@
 #include <sstream>
 #include <opencv2/opencv.hpp>
 
+#include "arg_parse.h"
+#include "frame_pool.h"
+#include "gyro_coalescer.h"
+#include "gyro_log.h"
+#include "image_sequence_writer.h"
+#include "latency_histogram.h"
+#include "multi_resolution_output.h"
+#include "packet_ring.h"
+
 const std::string window_name = "realtime_stitcher";
+const int output_width = 960;
+const int output_height = 480;
 
-std::vector<std::string> split(const std::string& s, char delimiter) {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
+// stages of the pipeline, recorded per frame of stream 0 (receive and handle_video per packet)
+enum LatencyStage {
+    kStageReceive,       // OnVideoData, copy into the ring
+    kStageQueue,         // arrival to the pump thread
+    kStageGyro,          // gyro batch for the frame
+    kStageHandleVideo,   // RealTimeStitcher::HandleVideoData
+    kStageStitch,        // HandleVideoData returned to the stitched frame callback (decode and stitch)
+    kStageDeliver,       // callback to the display thread picking the frame up
+    kStageDisplay,       // color conversion and imshow
+    kStageTotal          // arrival to displayed
+};
 
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
-    }
+const std::vector<std::string> latency_stage_names = { "receive", "queue", "gyro", "handle_video", "stitch", "deliver", "display", "total" };
 
-    return tokens;
-}
+// points of a frame on the FrameTimeline, looked up by its timestamp
+enum FramePoint {
+    kPointArrived,
+    kPointHandled,
+    kPointDelivered
+};
 
 class StitchDelegate : public ins_camera::StreamDelegate {
 public:
-    StitchDelegate(const std::shared_ptr<ins::RealTimeStitcher>& stitcher) :stitcher_(stitcher) {
+    StitchDelegate(const std::shared_ptr<ins::RealTimeStitcher>& stitcher, const std::shared_ptr<VideoPacketPump>& pump,
+        const std::shared_ptr<GyroCoalescer<ins::GyroData>>& gyro_coalescer, const std::shared_ptr<GyroLogWriter>& gyro_log,
+        const std::shared_ptr<PipelineLatency>& latency, const std::shared_ptr<FrameTimeline>& timeline)
+        :stitcher_(stitcher), pump_(pump), gyro_coalescer_(gyro_coalescer), gyro_log_(gyro_log), latency_(latency), timeline_(timeline) {
     }
 
     virtual ~StitchDelegate() {
@@ -37,13 +62,29 @@ public:
     void OnAudioData(const uint8_t* data, size_t size, int64_t timestamp) override {}
 
     void OnVideoData(const uint8_t* data, size_t size, int64_t timestamp, uint8_t streamType, int stream_index) override {
-        stitcher_->HandleVideoData(data, size, timestamp, streamType, stream_index);
+        const int64_t arrived = LatencyNow();
+        if (stream_index == 0) {
+            timeline_->Begin(timestamp, kPointArrived, arrived);
+        }
+        // only copy into the ring here, the stitcher runs on the pump thread
+        pump_->Push(data, size, timestamp, streamType, stream_index);
+        latency_->Record(kStageReceive, LatencyNow() - arrived);
     }
 
     void OnGyroData(const std::vector<ins_camera::GyroData>& data) override {
-        std::vector<ins::GyroData> data_vec(data.size());
-        memcpy(data_vec.data(), data.data(), data.size() * sizeof(ins_camera::GyroData));
-        stitcher_->HandleGyroData(data_vec);
+        if (gyro_coalescer_) {
+            // handed to the stitcher with the next video frame, on the pump thread
+            gyro_coalescer_->Push(data);
+        }
+        else {
+            // gyro_data_ keeps its capacity between callbacks
+            gyro_data_.resize(data.size());
+            memcpy(gyro_data_.data(), data.data(), data.size() * sizeof(ins_camera::GyroData));
+            stitcher_->HandleGyroData(gyro_data_);
+        }
+        if (gyro_log_) {
+            gyro_log_->Append(data);
+        }
     }
 
     void OnExposureData(const ins_camera::ExposureData& data) override {
@@ -55,13 +96,84 @@ public:
 
 private:
     std::shared_ptr<ins::RealTimeStitcher> stitcher_;
+    std::shared_ptr<VideoPacketPump> pump_;
+    std::shared_ptr<GyroCoalescer<ins::GyroData>> gyro_coalescer_;
+    std::shared_ptr<GyroLogWriter> gyro_log_;
+    std::shared_ptr<PipelineLatency> latency_;
+    std::shared_ptr<FrameTimeline> timeline_;
+    std::vector<ins::GyroData> gyro_data_;
 };
 
+void printFramePoolStats(const std::shared_ptr<FramePool>& pool) {
+    const auto stats = pool->GetStats();
+    std::cout << "frame pool: acquired " << stats.acquired
+        << ", exhausted drops " << stats.exhausted_drops
+        << ", held too long " << stats.held_too_long
+        << ", max outstanding " << stats.max_outstanding
+        << ", max hold " << stats.max_hold_ms << "ms" << std::endl;
+}
+
+void printWriterStats(const std::shared_ptr<ImageSequenceWriter>& writer) {
+    const auto stats = writer->GetStats();
+    std::cout << "image sequence " << writer->Dir() << ": submitted " << stats.submitted
+        << ", dropped " << stats.dropped
+        << ", written " << stats.written
+        << ", write errors " << stats.write_errors
+        << ", " << stats.bytes_written / (1024 * 1024) << "MB"
+        << ", encode " << (stats.encoded ? stats.encode_ms / stats.encoded : 0) << "ms/frame"
+        << ", write " << (stats.written ? stats.write_ms / stats.written : 0) << "ms/frame"
+        << ", max reorder depth " << stats.max_reorder_depth << std::endl;
+}
+
+void printPumpStats(const std::shared_ptr<VideoPacketPump>& pump) {
+    for (int i = 0; i < pump->StreamCount(); i++) {
+        const auto stats = pump->GetStats(i);
+        std::cout << "stream " << i
+            << ": pushed " << stats.pushed
+            << ", popped " << stats.popped
+            << ", overflow drops " << stats.overflow_drops
+            << ", oversize drops " << stats.oversize_drops
+            << ", high watermark " << stats.high_watermark << std::endl;
+    }
+    if (pump->UnknownStreamDrops() > 0) {
+        std::cout << "unknown stream drops: " << pump->UnknownStreamDrops() << std::endl;
+    }
+}
+
+void printLatency(const std::shared_ptr<PipelineLatency>& latency, int slo_ms) {
+    std::cout << "latency:" << std::endl << latency->Format();
+    const auto& total = latency->Stage(kStageTotal);
+    if (slo_ms > 0 && total.Count() > 0) {
+        std::cout << "frames over " << slo_ms << "ms: " << total.FractionAbove(static_cast<int64_t>(slo_ms) * 1000000) * 100 << "%" << std::endl;
+    }
+}
+
+void printGyroStats(const std::shared_ptr<GyroCoalescer<ins::GyroData>>& coalescer) {
+    const auto stats = coalescer->GetStats();
+    std::cout << "gyro: pushed " << stats.pushed
+        << ", delivered " << stats.delivered
+        << " in " << stats.batches << " batches"
+        << " (max " << stats.max_batch << ", forced " << stats.forced_batches << ")"
+        << ", overflow drops " << stats.overflow_drops
+        << ", high watermark " << stats.high_watermark << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     ins::InitEnv();
     std::cout << "begin open camera" << std::endl;
     ins_camera::SetLogLevel(ins_camera::LogLevel::WARNING);
     ins::SetLogLevel(ins::InsLogLevel::WARNING);
+    size_t ring_slots = 64;
+    size_t ring_slab_size = 1024 * 1024;
+    int frame_pool_size = 4;
+    ImageSequenceWriter::Options record_options;
+    std::string record_sizes;
+    std::string gyro_log_path;
+    bool gyro_direct = false;
+    size_t gyro_ring = 4096;
+    int64_t gyro_lead_ms = 0;
+    int latency_dump_s = 0;
+    int latency_slo_ms = 0;
     for (int i = 1; i < argc; i++) {
         const std::string arg = argv[i];
         if (arg == std::string("--debug")) {
@@ -71,6 +183,61 @@ int main(int argc, char* argv[]) {
             const std::string log_file = argv[++i];
             ins_camera::SetLogPath(log_file);
         }
+        else if (arg == std::string("--ring_slots")) {
+            ring_slots = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (arg == std::string("--ring_slab_kb")) {
+            // up to 1GB per packet, every slot of both rings holds one slab
+            const long long slab_kb = std::strtoll(argv[++i], nullptr, 10);
+            if (slab_kb <= 0 || slab_kb > 1024 * 1024) {
+                std::cerr << "--ring_slab_kb must be between 1 and 1048576" << std::endl;
+                return -1;
+            }
+            ring_slab_size = static_cast<size_t>(slab_kb) * 1024;
+        }
+        else if (arg == std::string("--frame_pool")) {
+            frame_pool_size = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--record_dir")) {
+            record_options.dir = argv[++i];
+        }
+        else if (arg == std::string("--record_format")) {
+            const std::string format = argv[++i];
+            record_options.format = format == std::string("png") ? ImageSequenceWriter::Format::PNG : ImageSequenceWriter::Format::JPEG;
+        }
+        else if (arg == std::string("--record_threads")) {
+            record_options.encoder_threads = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--record_queue")) {
+            record_options.max_queued_frames = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--record_odirect")) {
+            record_options.use_o_direct = true;
+        }
+        else if (arg == std::string("--record_fsync_every")) {
+            record_options.fsync_every = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--record_sizes")) {
+            record_sizes = argv[++i];
+        }
+        else if (arg == std::string("--gyro_log")) {
+            gyro_log_path = argv[++i];
+        }
+        else if (arg == std::string("--gyro_direct")) {
+            gyro_direct = true;
+        }
+        else if (arg == std::string("--gyro_ring")) {
+            gyro_ring = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--gyro_lead_ms")) {
+            gyro_lead_ms = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--latency_dump_s")) {
+            latency_dump_s = std::atoi(argv[++i]);
+        }
+        else if (arg == std::string("--latency_slo_ms")) {
+            latency_slo_ms = std::atoi(argv[++i]);
+        }
     }
 
     ins_camera::DeviceDiscovery discovery;
@@ -98,7 +265,7 @@ int main(int argc, char* argv[]) {
 
     discovery.FreeDeviceDescriptors(list);
 
-    cv::Mat show_image_;
+    PooledFrame* show_frame_ = nullptr;
     std::thread show_thread_;
     std::mutex show_image_mutex_;
     bool is_stop_ = true;
@@ -122,14 +289,86 @@ int main(int argc, char* argv[]) {
     stitcher->SetCameraInfo(camera_info);
     stitcher->SetStitchType(ins::STITCH_TYPE::DYNAMICSTITCH);
     stitcher->EnableFlowState(true);
-    stitcher->SetOutputSize(960, 480);
-    stitcher->SetStitchRealTimeDataCallback([&](uint8_t* data[4], int linesize[4], int width, int height, int format, int64_t timestamp) {
+    stitcher->SetOutputSize(output_width, output_height);
+
+    // frames held by the image sequence writer come out of the same pool
+    if (!record_options.dir.empty()) {
+        frame_pool_size += record_options.max_queued_frames;
+    }
+
+    // stitched RGBA frames are copied into a fixed pool instead of a new cv::Mat per frame
+    auto frame_pool = std::make_shared<FramePool>(frame_pool_size, output_width, output_height, 4);
+    std::shared_ptr<ImageSequenceWriter> image_writer;
+    if (!record_options.dir.empty()) {
+        image_writer = std::make_shared<ImageSequenceWriter>(record_options);
+    }
+
+    // smaller copies of the recording are derived from the stitched frame, written to <record_dir>/<W>x<H>
+    std::shared_ptr<MultiResolutionOutput> derived_outputs;
+    std::vector<std::shared_ptr<ImageSequenceWriter>> derived_writers;
+    if (image_writer && !record_sizes.empty()) {
+        derived_outputs = std::make_shared<MultiResolutionOutput>(record_options.max_queued_frames + 1);
+        for (const auto& size : split(record_sizes, ',')) {
+            const auto res = split(size, 'x');
+            if (res.size() != 2 || std::atoi(res[0].c_str()) <= 0 || std::atoi(res[1].c_str()) <= 0) {
+                std::cerr << "invalid --record_sizes entry: " << size << std::endl;
+                continue;
+            }
+            ImageSequenceWriter::Options options = record_options;
+            options.dir = record_options.dir + "/" + size;
+            auto writer = std::make_shared<ImageSequenceWriter>(options);
+            derived_writers.push_back(writer);
+            derived_outputs->AddOutput(std::atoi(res[0].c_str()), std::atoi(res[1].c_str()), [writer](PooledFrame* frame) {
+                writer->Submit(frame);
+                frame->Release();
+            });
+        }
+    }
+
+    // per stage latency histograms, printed when the preview stops and every --latency_dump_s seconds
+    auto latency = std::make_shared<PipelineLatency>(latency_stage_names);
+    auto timeline = std::make_shared<FrameTimeline>();
+
+    SetStitchRealTimePooledCallback(stitcher, frame_pool, 4, [&](PooledFrame* frame) {
+        const int64_t delivered = LatencyNow();
+        const int64_t handled = timeline->Get(frame->Timestamp(), kPointHandled);
+        if (handled != 0) {
+            latency->Record(kStageStitch, delivered - handled);
+        }
+        timeline->Mark(frame->Timestamp(), kPointDelivered, delivered);
+        if (image_writer) {
+            image_writer->Submit(frame);
+        }
+        if (derived_outputs) {
+            derived_outputs->Submit(frame);
+        }
         std::unique_lock<std::mutex> lck(show_image_mutex_);
-        show_image_ = cv::Mat(height, width, CV_8UC4, data[0]).clone();
+        if (show_frame_) {
+            // the display thread has not picked up the previous frame, only show the latest one
+            show_frame_->Release();
+        }
+        show_frame_ = frame;
         show_image_cond_.notify_one();
     });
 
-    std::shared_ptr<ins_camera::StreamDelegate> delegate = std::make_shared<StitchDelegate>(stitcher);
+    // dual fisheye streams arrive with stream_index 0 and 1
+    auto pump = std::make_shared<VideoPacketPump>(2, ring_slots, ring_slab_size);
+    std::shared_ptr<GyroLogWriter> gyro_log;
+    if (!gyro_log_path.empty()) {
+        gyro_log = std::make_shared<GyroLogWriter>();
+        if (!gyro_log->Open(gyro_log_path)) {
+            std::cerr << "can not write gyro log " << gyro_log_path << std::endl;
+            gyro_log.reset();
+        }
+    }
+    std::shared_ptr<GyroCoalescer<ins::GyroData>> gyro_coalescer;
+    if (!gyro_direct) {
+        gyro_coalescer = std::make_shared<GyroCoalescer<ins::GyroData>>(gyro_ring, gyro_lead_ms, preview_param.gyro_timestamp);
+    }
+    const GyroCoalescer<ins::GyroData>::Sink gyro_sink = [stitcher](const std::vector<ins::GyroData>& batch) {
+        stitcher->HandleGyroData(batch);
+    };
+    std::shared_ptr<ins_camera::StreamDelegate> delegate = std::make_shared<StitchDelegate>(stitcher, pump, gyro_coalescer, gyro_log, latency, timeline);
     cam->SetStreamDelegate(delegate);
 
     std::cout << "Succeed to open camera..." << std::endl;
@@ -162,30 +401,84 @@ int main(int argc, char* argv[]) {
             param.video_bitrate = 1024 * 1024 / 2;
             param.enable_audio = false;
             param.using_lrv = false;
+            if (gyro_coalescer) {
+                gyro_coalescer->Reset();
+            }
+            latency->Reset();
+            timeline->Reset();
+            if (latency_dump_s > 0) {
+                latency->StartDump(std::chrono::seconds(latency_dump_s), [](const std::string& text) {
+                    std::cout << "latency:" << std::endl << text << std::flush;
+                }, true);
+            }
+            pump->Start([stitcher, gyro_coalescer, &gyro_sink, latency, timeline](const uint8_t* data, size_t size, int64_t timestamp, uint8_t stream_type, int stream_index) {
+                if (stream_index == 0) {
+                    const int64_t dequeued = LatencyNow();
+                    const int64_t arrived = timeline->Get(timestamp, kPointArrived);
+                    if (arrived != 0) {
+                        latency->Record(kStageQueue, dequeued - arrived);
+                    }
+                    if (gyro_coalescer) {
+                        // the gyro this frame needs, as one batch
+                        gyro_coalescer->Release(timestamp, gyro_sink);
+                        latency->Record(kStageGyro, LatencyNow() - dequeued);
+                    }
+                }
+                const int64_t handle_start = LatencyNow();
+                stitcher->HandleVideoData(data, size, timestamp, stream_type, stream_index);
+                const int64_t handled = LatencyNow();
+                latency->Record(kStageHandleVideo, handled - handle_start);
+                if (stream_index == 0) {
+                    timeline->Mark(timestamp, kPointHandled, handled);
+                }
+            });
             if (cam->StartLiveStreaming(param)) {
                 stitcher->StartStitch();
                 std::cout << "successfully started live stream" << std::endl;
             }
+            else {
+                pump->Stop();
+                latency->StopDump();
+                std::cerr << "failed to start live stream." << std::endl;
+                continue;
+            }
 
             show_thread_ = std::thread([&]() {
                 cv::namedWindow(window_name, cv::WINDOW_NORMAL);
+                cv::Mat display_image;
                 is_stop_ = false;
                 while (!is_stop_)
                 {
                     std::unique_lock<std::mutex> lck(show_image_mutex_);
                     show_image_cond_.wait(lck, [&]() {
-                        return  is_stop_ || !show_image_.empty();
+                        return  is_stop_ || show_frame_ != nullptr;
                     });
 
                     if (is_stop_) {
                         break;
                     }
 
-                    auto temp = show_image_.clone();
-                    show_image_ = cv::Mat();
+                    PooledFrame* frame = show_frame_;
+                    show_frame_ = nullptr;
                     lck.unlock();
-                    cv::cvtColor(temp, temp, cv::COLOR_RGBA2BGRA);
-                    cv::imshow(window_name, temp);
+                    const int64_t picked = LatencyNow();
+                    const int64_t timestamp = frame->Timestamp();
+                    const int64_t delivered = timeline->Get(timestamp, kPointDelivered);
+                    if (delivered != 0) {
+                        latency->Record(kStageDeliver, picked - delivered);
+                    }
+                    // display_image keeps its buffer between frames
+                    const cv::Mat view(frame->Height(), frame->Width(), CV_8UC4, const_cast<uint8_t*>(frame->Data()), frame->Stride());
+                    cv::cvtColor(view, display_image, cv::COLOR_RGBA2BGRA);
+                    frame->Release();
+                    cv::imshow(window_name, display_image);
+                    // waitKey only pumps window events, it is not part of the frame's latency
+                    const int64_t displayed = LatencyNow();
+                    latency->Record(kStageDisplay, displayed - picked);
+                    const int64_t arrived = timeline->Get(timestamp, kPointArrived);
+                    if (arrived != 0) {
+                        latency->Record(kStageTotal, displayed - arrived);
+                    }
                     cv::waitKey(5);
                 }
             });
@@ -195,13 +488,33 @@ int main(int argc, char* argv[]) {
             std::unique_lock<std::mutex> lck(show_image_mutex_);
             is_stop_ = true;
             show_image_cond_.notify_one();
+            if (show_frame_) {
+                show_frame_->Release();
+                show_frame_ = nullptr;
+            }
             lck.unlock();
             if (show_thread_.joinable()) {
                 show_thread_.join();
             }
             cv::destroyWindow(window_name);
-            if (cam->StopLiveStreaming()) {
+            const bool stopped = cam->StopLiveStreaming();
+            // the pump stops whether or not the camera acknowledged the stop
+            pump->Stop();
+            if (stopped) {
                 stitcher->CancelStitch();
+                latency->StopDump();
+                printPumpStats(pump);
+                printLatency(latency, latency_slo_ms);
+                if (gyro_coalescer) {
+                    printGyroStats(gyro_coalescer);
+                }
+                printFramePoolStats(frame_pool);
+                if (image_writer) {
+                    printWriterStats(image_writer);
+                }
+                for (const auto& writer : derived_writers) {
+                    printWriterStats(writer);
+                }
                 std::cout << "success!" << std::endl;
             }
             else {
@@ -212,11 +525,28 @@ int main(int argc, char* argv[]) {
     std::unique_lock<std::mutex> lck(show_image_mutex_);
     is_stop_ = true;
     show_image_cond_.notify_one();
+    if (show_frame_) {
+        show_frame_->Release();
+        show_frame_ = nullptr;
+    }
     lck.unlock();
     if (show_thread_.joinable()) {
         show_thread_.join();
     }
     cv::destroyWindow(window_name);
     cam->Close();
+    pump->Stop();
+    if (image_writer) {
+        image_writer->Close();
+        printWriterStats(image_writer);
+    }
+    for (const auto& writer : derived_writers) {
+        writer->Close();
+        printWriterStats(writer);
+    }
+    if (gyro_log) {
+        gyro_log->Close();
+        std::cout << "gyro log: " << gyro_log->Samples() << " samples, " << gyro_log->Bytes() << " bytes" << std::endl;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <ins_stitcher.h>
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "batch_image_stitch.h"
+#include "insv_index.h"
+#include "stitch_job.h"
+
+#ifdef WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * \brief a contiguous run of frames that starts on a keyframe
+ */
+struct StitchSegment {
+    uint64_t first_frame = 0;
+    uint64_t frame_count = 0;
+    // frames that have to be decoded: from the keyframe before every requested frame up to that frame
+    uint64_t decode_frames = 0;
+    // frames passed to SetExportFrameSequence
+    std::vector<uint64_t> frames;
+};
+
+/**
+ * \brief split a sparse export list into GOP clusters and group them into at most segment_count segments.
+ * Every requested frame needs its GOP decoded from the previous keyframe, clusters whose GOP ranges
+ * overlap are merged, and the segments are balanced by decoded frames rather than requested frames.
+ * Frames outside of the video are dropped, duplicates are removed.
+ */
+inline std::vector<StitchSegment> SplitSparseExport(const InsvTrackIndex& index, int segment_count, const std::vector<uint64_t>& export_frames) {
+    std::vector<uint64_t> wanted = export_frames;
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+    wanted.erase(std::lower_bound(wanted.begin(), wanted.end(), index.sample_count), wanted.end());
+
+    std::vector<StitchSegment> clusters;
+    uint64_t total_decode = 0;
+    for (const auto frame : wanted) {
+        const uint64_t keyframe = index.KeyframeBefore(frame);
+        if (clusters.empty() || keyframe > clusters.back().first_frame + clusters.back().frame_count - 1) {
+            StitchSegment cluster;
+            cluster.first_frame = keyframe;
+            clusters.push_back(cluster);
+        }
+        StitchSegment& cluster = clusters.back();
+        cluster.frame_count = frame - cluster.first_frame + 1;
+        cluster.frames.push_back(frame);
+    }
+    for (auto& cluster : clusters) {
+        cluster.decode_frames = cluster.frame_count;
+        total_decode += cluster.decode_frames;
+    }
+
+    std::vector<StitchSegment> segments;
+    uint64_t assigned = 0;
+    for (const auto& cluster : clusters) {
+        // start the next segment once the current ones hold their share of the decode work
+        const uint64_t target = total_decode * segments.size() / std::max(1, segment_count);
+        if (segments.empty() || (assigned >= target && static_cast<int>(segments.size()) < segment_count)) {
+            StitchSegment segment;
+            segment.first_frame = cluster.first_frame;
+            segments.push_back(segment);
+        }
+        StitchSegment& segment = segments.back();
+        segment.frame_count = cluster.first_frame + cluster.frame_count - segment.first_frame;
+        segment.decode_frames += cluster.decode_frames;
+        segment.frames.insert(segment.frames.end(), cluster.frames.begin(), cluster.frames.end());
+        assigned += cluster.decode_frames;
+    }
+    return segments;
+}
+
+/**
+ * \brief split the timeline into at most segment_count segments, every boundary snapped to a sync sample.
+ * \param export_frames sparse frames to export, empty means every frame, see SplitSparseExport.
+ */
+inline std::vector<StitchSegment> SplitAtKeyframes(const InsvTrackIndex& index, int segment_count, const std::vector<uint64_t>& export_frames) {
+    if (!export_frames.empty()) {
+        return SplitSparseExport(index, segment_count, export_frames);
+    }
+
+    std::vector<uint64_t> boundaries;
+    boundaries.push_back(0);
+    for (int i = 1; i < segment_count; i++) {
+        const uint64_t ideal = index.sample_count * i / segment_count;
+        const auto it = std::lower_bound(index.sync_samples.begin(), index.sync_samples.end(), ideal);
+        if (it == index.sync_samples.end()) {
+            break;
+        }
+        if (*it > boundaries.back()) {
+            boundaries.push_back(*it);
+        }
+    }
+    boundaries.push_back(index.sample_count);
+
+    std::vector<StitchSegment> segments;
+    for (size_t i = 0; i + 1 < boundaries.size(); i++) {
+        StitchSegment segment;
+        segment.first_frame = boundaries[i];
+        segment.frame_count = boundaries[i + 1] - boundaries[i];
+        segment.decode_frames = segment.frame_count;
+        segment.frames.reserve(segment.frame_count);
+        for (uint64_t frame = boundaries[i]; frame < boundaries[i + 1]; frame++) {
+            segment.frames.push_back(frame);
+        }
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+namespace sharded_stitch_detail {
+
+/**
+ * \brief an exported frame file, its name split around the last run of digits before the extension
+ */
+struct ExportedFrame {
+    std::string path;
+    std::string prefix;
+    std::string suffix;
+    uint64_t number = 0;
+    size_t digits = 0;
+    bool padded = false;
+};
+
+inline bool ParseExportedFrame(const std::string& path, ExportedFrame& frame) {
+    const size_t name_begin = path.find_last_of("/\\") == std::string::npos ? 0 : path.find_last_of("/\\") + 1;
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || dot < name_begin) {
+        return false;
+    }
+    size_t end = dot;
+    while (end > name_begin && !isdigit(static_cast<unsigned char>(path[end - 1]))) {
+        end--;
+    }
+    size_t begin = end;
+    while (begin > name_begin && isdigit(static_cast<unsigned char>(path[begin - 1]))) {
+        begin--;
+    }
+    if (begin == end || end - begin > 19) {
+        return false;
+    }
+    frame.path = path;
+    frame.prefix = path.substr(name_begin, begin - name_begin);
+    frame.suffix = path.substr(end);
+    frame.number = strtoull(path.substr(begin, end - begin).c_str(), nullptr, 10);
+    frame.digits = end - begin;
+    frame.padded = frame.digits > 1 && path[begin] == '0';
+    return true;
+}
+
+inline std::string FrameName(const ExportedFrame& frame, uint64_t number) {
+    std::string digits = std::to_string(number);
+    if (frame.padded && digits.size() < frame.digits) {
+        digits.insert(0, frame.digits - digits.size(), '0');
+    }
+    return frame.prefix + digits + frame.suffix;
+}
+
+}
+
+/**
+ * \class ShardedVideoStitcher
+ * \brief Stitches the segments of one input concurrently, one VideoStitcher job per segment on a StitchJobRunner.
+ * Only image sequence output can be sharded. Nothing in the SDK says whether an exported file is named
+ * after its source frame or numbered per stitcher, so every segment writes into its own staging
+ * directory inside the output directory. Once all segments succeeded their files are renamed into the
+ * output directory by source frame number: the n-th file of a segment, in numeric order, is the n-th
+ * frame of its export list. A segment that wrote a different number of files fails the run.
+ * Whether the SDK seeks to the first exported frame or decodes the clip from its start is not known
+ * either, measure the speed-up with stitch_bench -shards before relying on it.
+ */
+class ShardedVideoStitcher {
+public:
+    using ConfigureCallback = std::function<void(ins::VideoStitcher& stitcher, const std::string& image_sequence_dir)>;
+    using ProgressCallback = std::function<void(int progress)>;
+
+    /**
+     * \param output_dir image sequence directory the frames end up in
+     * \param configure applies the common settings (input, image sequence info into the given directory,
+     * stitch type...) to a segment stitcher
+     * \param max_parallel number of segments stitched at the same time
+     */
+    ShardedVideoStitcher(const std::vector<StitchSegment>& segments, int max_parallel, const std::string& output_dir,
+        const ConfigureCallback& configure)
+        : segments_(segments), max_parallel_(std::max(1, max_parallel)), output_dir_(output_dir), configure_(configure),
+        progress_(segments.size(), 0) {
+        for (const auto& segment : segments_) {
+            total_frames_ += segment.frames.size();
+        }
+#ifdef WIN32
+        const int pid = _getpid();
+#else
+        const int pid = getpid();
+#endif
+        for (size_t index = 0; index < segments_.size(); index++) {
+            segment_dirs_.push_back(output_dir_ + "/.shard_" + std::to_string(pid) + "_" + std::to_string(index));
+        }
+    }
+
+    /**
+     * \brief progress in percent, weighted by the frame count of every segment.
+     * The callback is serialized and never reports a lower value than before.
+     */
+    void SetStitchProgressCallback(const ProgressCallback& callback) {
+        progress_callback_ = callback;
+    }
+
+    /**
+     * \brief block until every segment is stitched or one of them fails, the others are then cancelled.
+     * The staging directories are removed in both cases.
+     */
+    bool Run(std::string& error) {
+        bool ok = MakeDirectories(output_dir_);
+        for (size_t index = 0; ok && index < segments_.size(); index++) {
+            ok = MakeDirectories(segment_dirs_[index]);
+        }
+        if (!ok) {
+            error = "can not create the staging directories in " + output_dir_;
+        }
+        else {
+            ok = Stitch(error);
+        }
+        for (size_t index = 0; ok && index < segments_.size(); index++) {
+            ok = MoveSegmentFrames(index, error);
+        }
+        for (const auto& dir : segment_dirs_) {
+            RemoveStagingDir(dir);
+        }
+        return ok;
+    }
+
+    uint64_t TotalFrames() const {
+        return total_frames_;
+    }
+
+private:
+    bool Stitch(std::string& error) {
+        // destroying the runner at the end of this scope cancels the segments still queued or running,
+        // before their staging directories are touched
+        StitchJobRunner runner(max_parallel_);
+        for (size_t index = 0; index < segments_.size(); index++) {
+            auto stitcher = std::make_shared<ins::VideoStitcher>();
+            configure_(*stitcher, segment_dirs_[index]);
+            stitcher->SetExportFrameSequence(segments_[index].frames);
+            StitchJobOptions options;
+            options.progress_callback = [this, index](int process) {
+                OnProgress(index, process);
+            };
+            runner.Submit(stitcher, options).Then([this, index](const StitchJobResult& result) {
+                std::unique_lock<std::mutex> lck(mutex_);
+                done_++;
+                if (!result.Ok() && !has_error_) {
+                    error_ = "segment " + std::to_string(index) + ": " + result.message;
+                    has_error_ = true;
+                }
+                cond_.notify_one();
+            });
+        }
+
+        std::unique_lock<std::mutex> lck(mutex_);
+        cond_.wait(lck, [this]() {
+            return has_error_ || done_ == segments_.size();
+        });
+        if (has_error_) {
+            error = error_;
+            return false;
+        }
+        return true;
+    }
+
+    bool MoveSegmentFrames(size_t index, std::string& error) {
+        const auto& frames = segments_[index].frames;
+        std::vector<sharded_stitch_detail::ExportedFrame> exported;
+        for (const auto& path : ListFilesWithSuffix(segment_dirs_[index], { "jpg", "jpeg", "png", "bmp" })) {
+            sharded_stitch_detail::ExportedFrame frame;
+            if (!sharded_stitch_detail::ParseExportedFrame(path, frame)) {
+                error = "segment " + std::to_string(index) + ": no frame number in " + path;
+                return false;
+            }
+            exported.push_back(frame);
+        }
+        if (exported.size() != frames.size()) {
+            error = "segment " + std::to_string(index) + ": wrote " + std::to_string(exported.size()) +
+                " frames, expected " + std::to_string(frames.size());
+            return false;
+        }
+        std::sort(exported.begin(), exported.end(), [](const sharded_stitch_detail::ExportedFrame& a, const sharded_stitch_detail::ExportedFrame& b) {
+            return a.number < b.number;
+        });
+        for (size_t i = 0; i < exported.size(); i++) {
+            const std::string target = output_dir_ + "/" + sharded_stitch_detail::FrameName(exported[i], frames[i]);
+#ifdef WIN32
+            remove(target.c_str());
+#endif
+            if (rename(exported[i].path.c_str(), target.c_str()) != 0) {
+                error = "segment " + std::to_string(index) + ": can not move " + exported[i].path + " to " + target;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void RemoveStagingDir(const std::string& dir) {
+        for (const auto& path : ListFilesWithSuffix(dir, { "jpg", "jpeg", "png", "bmp" })) {
+            remove(path.c_str());
+        }
+#ifdef WIN32
+        _rmdir(dir.c_str());
+#else
+        rmdir(dir.c_str());
+#endif
+    }
+
+    void OnProgress(size_t index, int process) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        if (progress_[index] == 100 || process == progress_[index]) {
+            return;
+        }
+        progress_[index] = process;
+        // segments report from their own threads, only forward a monotonic aggregate
+        const int aggregated = AggregatedProgress();
+        if (aggregated > reported_progress_) {
+            reported_progress_ = aggregated;
+            if (progress_callback_) {
+                progress_callback_(aggregated);
+            }
+        }
+    }
+
+    int AggregatedProgress() const {
+        if (total_frames_ == 0) {
+            return 100;
+        }
+        uint64_t done = 0;
+        for (size_t i = 0; i < segments_.size(); i++) {
+            done += segments_[i].frames.size() * progress_[i];
+        }
+        return static_cast<int>(done / total_frames_);
+    }
+
+    std::vector<StitchSegment> segments_;
+    int max_parallel_;
+    std::string output_dir_;
+    std::vector<std::string> segment_dirs_;
+    ConfigureCallback configure_;
+    ProgressCallback progress_callback_;
+    std::vector<int> progress_;
+    uint64_t total_frames_ = 0;
+    size_t done_ = 0;
+    int reported_progress_ = 0;
+    bool has_error_ = false;
+    std::string error_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
@@ -0,0 +1,854 @@
+#include <iostream>
+#include <ins_stitcher.h>
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "arg_parse.h"
+#include "insv_index.h"
+#include "latency_histogram.h"
+#include "sharded_stitch.h"
+#include "stitch_job.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std::chrono;
+using namespace ins;
+
+const std::string helpstr =
+"{-help                   | default               | print this message                  }\n"
+"{-output                 | stitch_bench.json     | JSON file with one entry per run    }\n"
+"{-work_dir               | stitch_bench_inputs   | synthetic inputs and stitched outputs, inputs are reused by later runs }\n"
+"{-label                  | None                  | free text stored in the JSON, e.g. the SDK version }\n"
+"{-input_sizes            | 2880x1440,5760x2880   | dual fisheye sizes of -synthetic    }\n"
+"{-output_sizes           | 1920x960,3840x1920    | stitched output sizes               }\n"
+"{-stitch_types           | template,dynamicstitch,optflow,aistitch | stitch types to sweep }\n"
+"{-codecs                 | soft,hard             | video codecs to sweep (SetSoftwareCodecUsage) }\n"
+"{-kinds                  | video,image           | sweep videos, images or both        }\n"
+"{-frames                 | 60                    | frames of each synthetic video      }\n"
+"{-fps                    | 30                    | frame rate of the synthetic videos  }\n"
+"{-images                 | 5                     | synthetic images per input size     }\n"
+"{-repeat                 | 1                     | runs of each configuration          }\n"
+"{-enable_cuda            | OFF                   | also sweep EnableCuda(true), runs are CPU only by default }\n"
+"{-ai_stitching_model     | None                  | model of aistitch, aistitch runs are skipped without it }\n"
+"{-video                  | None                  | bench this .insv (comma separated for a clip of two files), repeatable }\n"
+"{-image                  | None                  | bench this .insp, repeatable        }\n"
+"{-synthetic              | OFF                   | also bench generated inputs of -input_sizes, stops if the SDK does not stitch them }\n"
+"{-shards                 | None                  | e.g. 1,2,4,8: also stitch every -video clip into an image sequence through ShardedVideoStitcher with each segment count }\n"
+"{-timeout_s              | 600                   | cancel a video run after this many seconds }\n"
+"{-keep_outputs           | OFF                   | keep the stitched files             }\n";
+
+std::string sizeName(const cv::Size& size) {
+    return std::to_string(size.width) + "x" + std::to_string(size.height);
+}
+
+bool fileExists(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp) {
+        fclose(fp);
+    }
+    return fp != nullptr;
+}
+
+/**
+ * \brief remove a stitched video or image, or the image sequence directory of a -shards run
+ */
+void removeOutput(const std::string& path) {
+    for (const auto& file : ListFilesWithSuffix(path, { "jpg" })) {
+        remove(file.c_str());
+    }
+#ifdef WIN32
+    if (!RemoveDirectoryA(path.c_str())) {
+        remove(path.c_str());
+    }
+#else
+    remove(path.c_str());
+#endif
+}
+
+struct StitchTypeName {
+    const char* name;
+    STITCH_TYPE type;
+};
+
+// names as in main.cc -stitch_type
+const StitchTypeName stitch_type_names[] = {
+    { "template", STITCH_TYPE::TEMPLATE },
+    { "dynamicstitch", STITCH_TYPE::DYNAMICSTITCH },
+    { "optflow", STITCH_TYPE::OPTFLOW },
+    { "aistitch", STITCH_TYPE::AIFLOW },
+};
+
+/**
+ * \brief The synthetic inputs are an ideal dual fisheye (two 200 degree equidistant lenses side by side, the
+ * back one turned by 180 degrees) looking at a checkered sphere that pans at 30 degrees per second, so every
+ * run of the same size stitches the same pixels. They are plain .mp4 and .jpg files without the Insta360
+ * trailer (calibration, gyro), which the SDK may not accept, so they are only benched with -synthetic and
+ * after one probe run stitched them; the -video and -image clips are the inputs of a normal sweep.
+ */
+class SyntheticDualFisheye {
+public:
+    explicit SyntheticDualFisheye(const cv::Size& size) : size_(size) {
+        const double pi = 3.14159265358979323846;
+        const int lens_size = size.height;
+        const double radius = lens_size / 2.0;
+        const double half_fov = 100 * pi / 180;
+        longitude_.assign(static_cast<size_t>(size.width) * size.height, 0);
+        latitude_.assign(longitude_.size(), 0);
+        inside_.assign(longitude_.size(), 0);
+        for (int y = 0; y < size.height; y++) {
+            for (int x = 0; x < size.width; x++) {
+                const int lens = x < lens_size ? 0 : 1;
+                const double dx = (x - lens * lens_size + 0.5 - radius) / radius;
+                const double dy = (y + 0.5 - radius) / radius;
+                const double r = std::sqrt(dx * dx + dy * dy);
+                if (r > 1) {
+                    continue;
+                }
+                const double theta = r * half_fov;
+                const double phi = std::atan2(dy, dx);
+                double dir_x = std::sin(theta) * std::cos(phi);
+                const double dir_y = std::sin(theta) * std::sin(phi);
+                double dir_z = std::cos(theta);
+                if (lens == 1) {
+                    dir_x = -dir_x;
+                    dir_z = -dir_z;
+                }
+                const size_t index = static_cast<size_t>(y) * size.width + x;
+                longitude_[index] = static_cast<float>(std::atan2(dir_x, dir_z));
+                latitude_[index] = static_cast<float>(std::asin(std::max(-1.0, std::min(1.0, dir_y))));
+                inside_[index] = 1;
+            }
+        }
+    }
+
+    /**
+     * \param seconds time of the frame, moves the scene
+     */
+    void Render(double seconds, cv::Mat& frame) const {
+        const double pi = 3.14159265358979323846;
+        const double cell = 10 * pi / 180;
+        const double pan = seconds * 30 * pi / 180;
+        frame.create(size_.height, size_.width, CV_8UC3);
+        cv::parallel_for_(cv::Range(0, size_.height), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++) {
+                uint8_t* row = frame.ptr<uint8_t>(y);
+                for (int x = 0; x < size_.width; x++) {
+                    const size_t index = static_cast<size_t>(y) * size_.width + x;
+                    uint8_t* pixel = row + x * 3;
+                    if (!inside_[index]) {
+                        pixel[0] = pixel[1] = pixel[2] = 0;
+                        continue;
+                    }
+                    const double longitude = longitude_[index] + pan;
+                    const double latitude = latitude_[index];
+                    const long checker = static_cast<long>(std::floor(longitude / cell)) + static_cast<long>(std::floor(latitude / cell));
+                    pixel[0] = static_cast<uint8_t>((checker & 1) ? 200 : 55);
+                    pixel[1] = static_cast<uint8_t>(128 + 100 * std::sin(latitude * 3));
+                    pixel[2] = static_cast<uint8_t>(128 + 100 * std::cos(longitude));
+                }
+            }
+        });
+    }
+
+    /**
+     * \brief write the video once, later runs reuse it
+     */
+    bool WriteVideo(const std::string& path, int frames, double fps) const {
+        if (fileExists(path)) {
+            return true;
+        }
+        // the container is picked from the extension, so the temporary name keeps .mp4
+        const std::string temp_path = path + ".tmp.mp4";
+        cv::VideoWriter writer;
+        if (!writer.open(temp_path, cv::VideoWriter::fourcc('a', 'v', 'c', '1'), fps, size_) &&
+            !writer.open(temp_path, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, size_)) {
+            return false;
+        }
+        cv::Mat frame;
+        for (int i = 0; i < frames; i++) {
+            Render(i / fps, frame);
+            writer.write(frame);
+        }
+        writer.release();
+        remove(path.c_str());
+        return rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+
+    bool WriteImage(const std::string& path, double seconds) const {
+        if (fileExists(path)) {
+            return true;
+        }
+        cv::Mat frame;
+        Render(seconds, frame);
+        const std::string temp_path = path + ".tmp.jpg";
+        if (!cv::imwrite(temp_path, frame, { cv::IMWRITE_JPEG_QUALITY, 95 })) {
+            return false;
+        }
+        remove(path.c_str());
+        return rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    cv::Size size_;
+    std::vector<float> longitude_;
+    std::vector<float> latitude_;
+    std::vector<uint8_t> inside_;
+};
+
+/**
+ * \brief forget the peak RSS of the process so far, so the next peakRssMb() covers one run
+ * \return false if the peak can not be reset, it then covers every run so far
+ */
+bool resetPeakRss() {
+#ifdef WIN32
+    return false;
+#else
+    // Linux 4.0+: writing 5 to clear_refs resets VmHWM
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+    if (!fp) {
+        return false;
+    }
+    const bool ok = fputs("5", fp) >= 0;
+    return fclose(fp) == 0 && ok;
+#endif
+}
+
+double peakRssMb() {
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+    return 0;
+#else
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+                break;
+            }
+        }
+        fclose(fp);
+        if (kb >= 0) {
+            return kb / 1024.0;
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+/**
+ * \brief user + system CPU time of the process, all threads
+ */
+double cpuSeconds() {
+#ifdef WIN32
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+        return 0;
+    }
+    auto seconds = [](const FILETIME& time) {
+        return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 1e7;
+    };
+    return seconds(kernel_time) + seconds(user_time);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+std::string cpuModel() {
+    std::string model;
+#ifndef WIN32
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (fp) {
+        char line[512];
+        while (fgets(line, sizeof(line), fp)) {
+            const std::string text(line);
+            if (text.compare(0, 10, "model name") == 0 && text.find(':') != std::string::npos) {
+                model = text.substr(text.find(':') + 2);
+                model.erase(model.find_last_not_of("\r\n") + 1);
+                break;
+            }
+        }
+        fclose(fp);
+    }
+#endif
+    return model;
+}
+
+std::string jsonString(const std::string& text) {
+    std::string result = "\"";
+    for (const char c : text) {
+        switch (c) {
+        case '"': result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\n': result += "\\n"; break;
+        case '\r': result += "\\r"; break;
+        case '\t': result += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                result += escaped;
+            }
+            else {
+                result += c;
+            }
+        }
+    }
+    return result + "\"";
+}
+
+struct BenchCase {
+    std::string kind;          // "video" or "image"
+    std::string input_name;    // input size or file name
+    std::vector<std::vector<std::string>> inputs;  // one entry per video, or per image
+    uint64_t frames;           // frames per video
+    bool synthetic;            // generated by SyntheticDualFisheye
+    InsvTrackIndex index;      // keyframes of a real video, for the -shards runs
+};
+
+struct BenchConfig {
+    std::string stitch_type;
+    bool cuda;
+    std::string codec;         // "soft", "hard", or "n/a" for images
+    cv::Size output_size;
+    int shards;                // 0: one VideoStitcher into a video file, else image sequence through ShardedVideoStitcher
+};
+
+struct BenchResult {
+    bool ok = false;
+    std::string error;
+    uint64_t frames = 0;
+    double wall_seconds = 0;
+    double cpu_seconds = 0;
+    double peak_rss_mb = 0;
+    bool peak_rss_reset = false;
+    LatencyHistogram::Summary latency{};
+};
+
+bool parseStitchType(const std::string& name, STITCH_TYPE& type) {
+    for (const auto& entry : stitch_type_names) {
+        if (name == entry.name) {
+            type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+STITCH_TYPE stitchTypeOf(const std::string& name) {
+    STITCH_TYPE type = STITCH_TYPE::OPTFLOW;
+    parseStitchType(name, type);
+    return type;
+}
+
+/**
+ * \brief The SDK reports video progress in percent only, so the per frame latency of a video is the time
+ * between two progress callbacks divided by the frames they cover: the percentiles show how steady the
+ * throughput is, at about 1% of the clip resolution. Images are timed one Stitch() call each.
+ */
+BenchResult runVideo(const BenchCase& bench_case, const BenchConfig& config, const std::string& ai_model,
+    const std::string& output_path, int timeout_s) {
+    // the runner releases a stitcher on its own thread, a progress callback of a cancelled job may still
+    // come after Wait() returned: it only touches this shared state
+    struct ProgressState {
+        std::mutex mutex;
+        LatencyHistogram latency;
+        int last_progress = 0;
+        int64_t last_time = 0;
+    };
+    BenchResult result;
+    auto state = std::make_shared<ProgressState>();
+    result.peak_rss_reset = resetPeakRss();
+    const double cpu_start = cpuSeconds();
+    const auto start_time = steady_clock::now();
+
+    StitchJobRunner runner;
+    // a copy, SetInputPath takes a non-const reference
+    for (auto inputs : bench_case.inputs) {
+        {
+            std::lock_guard<std::mutex> lck(state->mutex);
+            state->last_progress = 0;
+            state->last_time = LatencyNow();
+        }
+
+        auto stitcher = std::make_shared<VideoStitcher>();
+        stitcher->SetInputPath(inputs);
+        stitcher->SetOutputPath(output_path);
+        stitcher->SetStitchType(stitchTypeOf(config.stitch_type));
+        stitcher->EnableCuda(config.cuda);
+        stitcher->SetOutputSize(config.output_size.width, config.output_size.height);
+        stitcher->SetAiStitchModelFile(ai_model);
+        stitcher->SetSoftwareCodecUsage(config.codec == "soft", config.codec == "soft");
+        StitchJobOptions options;
+        options.deadline = steady_clock::now() + seconds(timeout_s);
+        const uint64_t case_frames = bench_case.frames;
+        options.progress_callback = [state, case_frames](int process) {
+            std::unique_lock<std::mutex> lck(state->mutex);
+            if (process > state->last_progress) {
+                const int64_t now = LatencyNow();
+                const double frames = case_frames * (process - state->last_progress) / 100.0;
+                const int64_t per_frame = static_cast<int64_t>((now - state->last_time) / std::max(1.0, frames));
+                for (int i = 0; i < std::max(1, static_cast<int>(std::lround(frames))); i++) {
+                    state->latency.Record(per_frame);
+                }
+                state->last_progress = process;
+                state->last_time = now;
+            }
+        };
+
+        const StitchJobResult job_result = runner.Submit(stitcher, options).Wait();
+        if (!job_result.Ok()) {
+            result.error = job_result.status == StitchJobStatus::kDeadlineExceeded ? "timeout" : job_result.message;
+            break;
+        }
+        result.frames += bench_case.frames;
+    }
+
+    result.wall_seconds = duration_cast<duration<double>>(steady_clock::now() - start_time).count();
+    result.cpu_seconds = cpuSeconds() - cpu_start;
+    result.peak_rss_mb = peakRssMb();
+    {
+        std::lock_guard<std::mutex> lck(state->mutex);
+        result.latency = state->latency.GetSummary();
+    }
+    result.ok = result.error.empty();
+    return result;
+}
+
+/**
+ * \brief a -shards run: the whole clip into an image sequence, config.shards segments stitched at the same
+ * time. shards = 1 is the single pipeline baseline of the same output, so the fps of the runs compare
+ * directly, and cpu_s shows how much decoding the segments repeat. The latency comes from the
+ * aggregated progress as in runVideo. There is no deadline, -timeout_s does not apply.
+ */
+BenchResult runSharded(const BenchCase& bench_case, const BenchConfig& config, const std::string& ai_model,
+    const std::string& sequence_dir) {
+    BenchResult result;
+    LatencyHistogram latency;
+    std::mutex mutex;
+    int last_progress = 0;
+    int64_t last_time = LatencyNow();
+    result.peak_rss_reset = resetPeakRss();
+    const double cpu_start = cpuSeconds();
+    const auto start_time = steady_clock::now();
+
+    const auto segments = SplitAtKeyframes(bench_case.index, config.shards, std::vector<uint64_t>());
+    ShardedVideoStitcher stitcher(segments, config.shards, sequence_dir,
+        [&](VideoStitcher& segment_stitcher, const std::string& segment_dir) {
+        std::vector<std::string> inputs = bench_case.inputs[0];
+        segment_stitcher.SetInputPath(inputs);
+        segment_stitcher.SetImageSequenceInfo(segment_dir, IMAGE_TYPE::JPEG);
+        segment_stitcher.SetStitchType(stitchTypeOf(config.stitch_type));
+        segment_stitcher.EnableCuda(config.cuda);
+        segment_stitcher.SetOutputSize(config.output_size.width, config.output_size.height);
+        segment_stitcher.SetAiStitchModelFile(ai_model);
+        segment_stitcher.SetSoftwareCodecUsage(config.codec == "soft", config.codec == "soft");
+    });
+    const uint64_t total_frames = stitcher.TotalFrames();
+    stitcher.SetStitchProgressCallback([&](int process) {
+        std::lock_guard<std::mutex> lck(mutex);
+        const int64_t now = LatencyNow();
+        const double frames = total_frames * (process - last_progress) / 100.0;
+        const int64_t per_frame = static_cast<int64_t>((now - last_time) / std::max(1.0, frames));
+        for (int i = 0; i < std::max(1, static_cast<int>(std::lround(frames))); i++) {
+            latency.Record(per_frame);
+        }
+        last_progress = process;
+        last_time = now;
+    });
+    if (stitcher.Run(result.error)) {
+        result.frames = total_frames;
+    }
+
+    result.wall_seconds = duration_cast<duration<double>>(steady_clock::now() - start_time).count();
+    result.cpu_seconds = cpuSeconds() - cpu_start;
+    result.peak_rss_mb = peakRssMb();
+    result.latency = latency.GetSummary();
+    result.ok = result.error.empty();
+    return result;
+}
+
+BenchResult runImages(const BenchCase& bench_case, const BenchConfig& config, const std::string& ai_model,
+    const std::string& output_path) {
+    BenchResult result;
+    LatencyHistogram latency;
+    result.peak_rss_reset = resetPeakRss();
+    const double cpu_start = cpuSeconds();
+    const auto start_time = steady_clock::now();
+
+    // a copy, SetInputPath takes a non-const reference
+    for (auto inputs : bench_case.inputs) {
+        ImageStitcher stitcher;
+        stitcher.SetInputPath(inputs);
+        stitcher.SetOutputPath(output_path);
+        stitcher.SetStitchType(stitchTypeOf(config.stitch_type));
+        stitcher.EnableCuda(config.cuda);
+        stitcher.SetOutputSize(config.output_size.width, config.output_size.height);
+        stitcher.SetAiStitchModelFile(ai_model);
+        const int64_t image_start = LatencyNow();
+        if (!stitcher.Stitch()) {
+            result.error = "stitch failed: " + inputs[0];
+            break;
+        }
+        latency.Record(LatencyNow() - image_start);
+        result.frames++;
+    }
+
+    result.wall_seconds = duration_cast<duration<double>>(steady_clock::now() - start_time).count();
+    result.cpu_seconds = cpuSeconds() - cpu_start;
+    result.peak_rss_mb = peakRssMb();
+    result.latency = latency.GetSummary();
+    result.ok = result.error.empty();
+    return result;
+}
+
+std::string runJson(const BenchCase& bench_case, const BenchConfig& config, int repeat, const BenchResult& result) {
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "    {\"kind\": " << jsonString(bench_case.kind)
+        << ", \"input\": " << jsonString(bench_case.input_name)
+        << ", \"output_size\": " << jsonString(sizeName(config.output_size))
+        << ", \"stitch_type\": " << jsonString(config.stitch_type)
+        << ", \"cuda\": " << (config.cuda ? "true" : "false")
+        << ", \"codec\": " << jsonString(config.codec)
+        << ", \"shards\": " << config.shards
+        << ", \"repeat\": " << repeat
+        << ", \"ok\": " << (result.ok ? "true" : "false")
+        << ", \"error\": " << jsonString(result.error)
+        << ", \"frames\": " << result.frames
+        << ", \"wall_s\": " << result.wall_seconds
+        << ", \"fps\": " << (result.wall_seconds > 0 ? result.frames / result.wall_seconds : 0)
+        << ", \"latency_ms\": {\"mean\": " << result.latency.mean_us / 1e3
+        << ", \"p50\": " << result.latency.p50_us / 1e3
+        << ", \"p99\": " << result.latency.p99_us / 1e3
+        << ", \"p999\": " << result.latency.p999_us / 1e3
+        << ", \"max\": " << result.latency.max_us / 1e3 << "}"
+        << ", \"peak_rss_mb\": " << result.peak_rss_mb
+        << ", \"peak_rss_reset\": " << (result.peak_rss_reset ? "true" : "false")
+        << ", \"cpu_s\": " << result.cpu_seconds
+        << ", \"cpu_cores_used\": " << (result.wall_seconds > 0 ? result.cpu_seconds / result.wall_seconds : 0) << "}";
+    return json.str();
+}
+
+/**
+ * \brief rewritten after every run, so an interrupted sweep keeps the runs done so far
+ */
+bool writeJson(const std::string& path, const std::string& header, const std::vector<std::string>& runs) {
+    const std::string temp_path = path + ".tmp";
+    FILE* fp = fopen(temp_path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    std::string text = header + "  \"runs\": [\n";
+    for (size_t i = 0; i < runs.size(); i++) {
+        text += runs[i] + (i + 1 < runs.size() ? ",\n" : "\n");
+    }
+    text += "  ]\n}\n";
+    const bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+    if (fclose(fp) != 0 || !ok) {
+        remove(temp_path.c_str());
+        return false;
+    }
+    remove(path.c_str());
+    return rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string output = "stitch_bench.json";
+    std::string work_dir = "stitch_bench_inputs";
+    std::string label;
+    std::vector<cv::Size> input_sizes = parseSizes("2880x1440,5760x2880");
+    std::vector<cv::Size> output_sizes = parseSizes("1920x960,3840x1920");
+    std::vector<std::string> stitch_types = { "template", "dynamicstitch", "optflow", "aistitch" };
+    std::vector<std::string> codecs = { "soft", "hard" };
+    std::vector<std::string> kinds = { "video", "image" };
+    int frames = 60;
+    double fps = 30;
+    int images = 5;
+    int repeat = 1;
+    bool sweep_cuda = false;
+    std::string ai_model;
+    std::vector<std::string> real_videos;
+    std::vector<std::string> real_images;
+    int timeout_s = 600;
+    bool keep_outputs = false;
+    bool synthetic = false;
+    std::vector<int> shard_counts;
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-output") == std::string(argv[i])) {
+            output = argv[++i];
+        }
+        else if (std::string("-work_dir") == std::string(argv[i])) {
+            work_dir = argv[++i];
+        }
+        else if (std::string("-label") == std::string(argv[i])) {
+            label = argv[++i];
+        }
+        else if (std::string("-input_sizes") == std::string(argv[i])) {
+            input_sizes = parseSizes(argv[++i]);
+        }
+        else if (std::string("-output_sizes") == std::string(argv[i])) {
+            output_sizes = parseSizes(argv[++i]);
+        }
+        else if (std::string("-stitch_types") == std::string(argv[i])) {
+            stitch_types = split(argv[++i], ',');
+        }
+        else if (std::string("-codecs") == std::string(argv[i])) {
+            codecs = split(argv[++i], ',');
+        }
+        else if (std::string("-kinds") == std::string(argv[i])) {
+            kinds = split(argv[++i], ',');
+        }
+        else if (std::string("-frames") == std::string(argv[i])) {
+            frames = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-fps") == std::string(argv[i])) {
+            fps = std::max(1.0, atof(argv[++i]));
+        }
+        else if (std::string("-images") == std::string(argv[i])) {
+            images = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-repeat") == std::string(argv[i])) {
+            repeat = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-enable_cuda") == std::string(argv[i])) {
+            sweep_cuda = true;
+        }
+        else if (std::string("-ai_stitching_model") == std::string(argv[i])) {
+            ai_model = argv[++i];
+        }
+        else if (std::string("-video") == std::string(argv[i])) {
+            real_videos.push_back(argv[++i]);
+        }
+        else if (std::string("-image") == std::string(argv[i])) {
+            real_images.push_back(argv[++i]);
+        }
+        else if (std::string("-shards") == std::string(argv[i])) {
+            for (const auto& count : split(argv[++i], ',')) {
+                shard_counts.push_back(std::max(1, atoi(count.c_str())));
+            }
+        }
+        else if (std::string("-timeout_s") == std::string(argv[i])) {
+            timeout_s = std::max(1, atoi(argv[++i]));
+        }
+        else if (std::string("-keep_outputs") == std::string(argv[i])) {
+            keep_outputs = true;
+        }
+        else if (std::string("-synthetic") == std::string(argv[i])) {
+            synthetic = true;
+        }
+        else if (std::string("-help") == std::string(argv[i])) {
+            std::cout << helpstr << std::endl;
+            return 0;
+        }
+    }
+
+    for (const auto& type : stitch_types) {
+        STITCH_TYPE parsed;
+        if (!parseStitchType(type, parsed)) {
+            std::cout << "unknown stitch type " << type << std::endl;
+            return -1;
+        }
+    }
+    const bool do_video = std::find(kinds.begin(), kinds.end(), "video") != kinds.end();
+    const bool do_image = std::find(kinds.begin(), kinds.end(), "image") != kinds.end();
+    if (real_videos.empty() && real_images.empty() && !synthetic) {
+        std::cout << "nothing to bench: give real clips with -video file.insv and -image file.insp, "
+            << "or generated inputs with -synthetic" << std::endl;
+        return -1;
+    }
+    if (stitch_types.empty() || output_sizes.empty()) {
+        std::cout << "nothing to bench: no -stitch_types or -output_sizes" << std::endl;
+        return -1;
+    }
+
+    ins::SetLogLevel(ins::InsLogLevel::ERR);
+    ins::InitEnv();
+
+#ifdef WIN32
+    CreateDirectoryA(work_dir.c_str(), nullptr);
+#else
+    mkdir(work_dir.c_str(), 0755);
+#endif
+
+    std::vector<BenchCase> cases;
+    for (const auto& size : synthetic ? input_sizes : std::vector<cv::Size>()) {
+        if (size.width != size.height * 2) {
+            std::cout << "skip input size " << sizeName(size) << ": a dual fisheye input is twice as wide as high" << std::endl;
+            continue;
+        }
+        const SyntheticDualFisheye synthetic(size);
+        const std::string base = work_dir + "/synthetic_" + sizeName(size);
+        if (do_video) {
+            const std::string path = base + "_" + std::to_string(frames) + "f.mp4";
+            std::cout << "input " << path << std::endl;
+            if (!synthetic.WriteVideo(path, frames, fps)) {
+                std::cout << "can not write " << path << std::endl;
+                return -1;
+            }
+            cases.push_back({ "video", sizeName(size), { { path } }, static_cast<uint64_t>(frames), true, InsvTrackIndex() });
+        }
+        if (do_image) {
+            BenchCase image_case{ "image", sizeName(size), {}, 1, true, InsvTrackIndex() };
+            for (int i = 0; i < images; i++) {
+                const std::string path = base + "_" + std::to_string(i) + ".jpg";
+                if (!synthetic.WriteImage(path, i * 0.5)) {
+                    std::cout << "can not write " << path << std::endl;
+                    return -1;
+                }
+                image_case.inputs.push_back({ path });
+            }
+            std::cout << "input " << base << "_*.jpg" << std::endl;
+            cases.push_back(image_case);
+        }
+    }
+    for (const auto& video : real_videos) {
+        const auto inputs = split(video, ',');
+        InsvTrackIndex index;
+        if (inputs.empty() || !LoadOrBuildInsvIndex(inputs[0], index) || index.sample_count == 0) {
+            std::cout << "can not read the sample table of " << video << std::endl;
+            return -1;
+        }
+        cases.push_back({ "video", video, { inputs }, index.sample_count, false, index });
+    }
+    for (const auto& image : real_images) {
+        cases.push_back({ "image", image, { { image } }, 1, false, InsvTrackIndex() });
+    }
+
+    std::vector<bool> cuda_values = { false };
+    if (sweep_cuda) {
+        cuda_values.push_back(true);
+    }
+
+    auto run = [&](const BenchCase& bench_case, const BenchConfig& config, const std::string& output_path) {
+        if (config.shards > 0) {
+            return runSharded(bench_case, config, ai_model, output_path);
+        }
+        return bench_case.kind == "video"
+            ? runVideo(bench_case, config, ai_model, output_path, timeout_s)
+            : runImages(bench_case, config, ai_model, output_path);
+    };
+
+    // the synthetic inputs lack the Insta360 trailer: one stitch of each, before the sweep, shows
+    // whether the SDK takes them at all, rather than a JSON of failed runs
+    for (const auto& bench_case : cases) {
+        if (!bench_case.synthetic) {
+            continue;
+        }
+        std::string probe_type = stitch_types[0];
+        if (std::find(stitch_types.begin(), stitch_types.end(), "template") != stitch_types.end()) {
+            probe_type = "template";
+        }
+        BenchCase probe_case = bench_case;
+        probe_case.inputs.resize(1);
+        const BenchConfig config{ probe_type, false, bench_case.kind == "video" && !codecs.empty() ? codecs[0] : "n/a", output_sizes[0], 0 };
+        const std::string output_path = work_dir + "/probe_" + bench_case.kind + (bench_case.kind == "video" ? ".mp4" : ".jpg");
+        const BenchResult result = run(probe_case, config, output_path);
+        remove(output_path.c_str());
+        if (!result.ok) {
+            std::cout << "the SDK does not stitch the synthetic " << bench_case.kind << " " << bench_case.input_name << " (" << probe_type
+                << "): " << result.error << std::endl << "bench real clips with -video and -image instead" << std::endl;
+            return -1;
+        }
+        std::cout << "probe " << bench_case.kind << " " << bench_case.input_name << ": stitched" << std::endl;
+    }
+
+    std::ostringstream header;
+    {
+        char date[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        header << "{\n"
+            << "  \"label\": " << jsonString(label) << ",\n"
+            << "  \"date\": " << jsonString(date) << ",\n"
+            << "  \"host\": {\"cpu\": " << jsonString(cpuModel()) << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << "},\n"
+            << "  \"synthetic\": {\"frames\": " << frames << ", \"fps\": " << fps << ", \"images\": " << images << "},\n";
+    }
+
+    std::vector<std::string> runs;
+    size_t ok_runs = 0;
+    for (const auto& bench_case : cases) {
+        for (const auto& stitch_type : stitch_types) {
+            if (stitch_type == "aistitch" && ai_model.empty()) {
+                std::cout << "skip aistitch on " << bench_case.input_name << ": no -ai_stitching_model" << std::endl;
+                continue;
+            }
+            for (const bool cuda : cuda_values) {
+                const std::vector<std::string> case_codecs = bench_case.kind == "video" ? codecs : std::vector<std::string>{ "n/a" };
+                // 0 is the video file run, the -shards counts stitch real clips into image sequences
+                std::vector<int> case_shards = { 0 };
+                if (bench_case.kind == "video" && !bench_case.synthetic) {
+                    case_shards.insert(case_shards.end(), shard_counts.begin(), shard_counts.end());
+                }
+                for (const auto& codec : case_codecs) {
+                    for (const auto& output_size : output_sizes) {
+                        for (const int shards : case_shards) {
+                            const BenchConfig config{ stitch_type, cuda, codec, output_size, shards };
+                            const std::string output_path = work_dir + "/out_" + bench_case.kind + "_" + stitch_type + "_" + sizeName(output_size) +
+                                (shards > 0 ? "_shards" + std::to_string(shards) : (bench_case.kind == "video" ? ".mp4" : ".jpg"));
+                            for (int r = 0; r < repeat; r++) {
+                                const BenchResult result = run(bench_case, config, output_path);
+                                if (!keep_outputs) {
+                                    removeOutput(output_path);
+                                }
+                                std::cout << bench_case.kind << " " << bench_case.input_name << " -> " << sizeName(output_size) << " " << stitch_type
+                                    << (cuda ? " cuda" : " cpu") << " " << codec;
+                                if (shards > 0) {
+                                    std::cout << " shards " << shards;
+                                }
+                                std::cout << ": ";
+                                if (result.ok) {
+                                    ok_runs++;
+                                    std::cout << "fps = " << result.frames / std::max(1e-9, result.wall_seconds)
+                                        << "; p50 = " << result.latency.p50_us / 1e3 << "ms; p99 = " << result.latency.p99_us / 1e3
+                                        << "ms; peak rss = " << result.peak_rss_mb << "MB; cpu = " << result.cpu_seconds / std::max(1e-9, result.wall_seconds)
+                                        << " cores" << std::endl;
+                                }
+                                else {
+                                    std::cout << "failed: " << result.error << std::endl;
+                                }
+                                runs.push_back(runJson(bench_case, config, r, result));
+                                if (!writeJson(output, header.str(), runs)) {
+                                    std::cout << "can not write " << output << std::endl;
+                                    return -1;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::cout << runs.size() << " runs written to " << output << ", " << ok_runs << " succeeded" << std::endl;
+    if (ok_runs == 0) {
+        std::cout << "no run was stitched, " << output << " holds nothing but errors" << std::endl;
+        return -1;
+    }
+    return 0;
+}
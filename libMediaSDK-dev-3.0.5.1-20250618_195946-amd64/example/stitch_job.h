@@ -0,0 +1,486 @@
+#pragma once
+
+#include <ins_stitcher.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// co_await on a StitchJob is available when the compiler implements C++20 coroutines
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define STITCH_JOB_COROUTINES 1
+#endif
+
+enum class StitchJobStatus {
+    kPending,            // queued until the runner has a free slot
+    kRunning,
+    kSucceeded,
+    kFailed,             // the SDK reported an error
+    kCancelled,
+    kDeadlineExceeded
+};
+
+inline const char* StitchJobStatusName(StitchJobStatus status) {
+    switch (status) {
+    case StitchJobStatus::kPending: return "pending";
+    case StitchJobStatus::kRunning: return "running";
+    case StitchJobStatus::kSucceeded: return "succeeded";
+    case StitchJobStatus::kFailed: return "failed";
+    case StitchJobStatus::kCancelled: return "cancelled";
+    case StitchJobStatus::kDeadlineExceeded: return "deadline exceeded";
+    }
+    return "unknown";
+}
+
+struct StitchJobResult {
+    StitchJobStatus status = StitchJobStatus::kPending;
+    int error_code = 0;      // of SetStitchStateCallback, 0 unless kFailed
+    std::string message;
+    double seconds = 0;      // from StartStitch to the end, 0 if the job never started
+    double queue_seconds = 0;            // from Submit to StartStitch, or to the end if the job never started
+    double first_progress_seconds = 0;   // from StartStitch to the first progress report: decoder, encoder and model setup
+
+    bool Ok() const {
+        return status == StitchJobStatus::kSucceeded;
+    }
+};
+
+struct StitchJobOptions {
+    // the job is cancelled with kDeadlineExceeded when it is not done by then, time in the queue included
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    // called from the SDK thread with the progress in percent
+    std::function<void(int progress)> progress_callback;
+};
+
+namespace stitch_job_detail {
+    using Continuation = std::function<void(const StitchJobResult& result)>;
+
+    struct RunnerCore;
+
+    struct JobState {
+        std::mutex mutex;
+        std::condition_variable cond;
+        StitchJobResult result;
+        std::vector<Continuation> continuations;
+        std::shared_ptr<ins::VideoStitcher> stitcher;
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point submit_time;
+        std::chrono::steady_clock::time_point start_time;
+        std::atomic<int> progress{ 0 };
+        std::weak_ptr<RunnerCore> runner;
+        // kCancelled or kDeadlineExceeded once the runner called CancelStitch, the SDK may report
+        // the cancel through the state callback before the runner completes the job
+        StitchJobStatus cancel_status = StitchJobStatus::kPending;
+    };
+
+    inline std::string CancelMessage(StitchJobStatus status) {
+        return status == StitchJobStatus::kCancelled ? "cancelled" : "deadline exceeded";
+    }
+
+    /**
+     * \brief what the runner thread works on, the jobs only point to it so a job handle may outlive the runner
+     */
+    struct RunnerCore {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<std::shared_ptr<JobState>> pending;
+        std::vector<std::shared_ptr<JobState>> running;
+        // done, the runner releases their stitcher
+        std::vector<std::shared_ptr<JobState>> finished;
+        std::vector<std::shared_ptr<JobState>> cancels;
+        bool stop = false;
+    };
+
+    inline bool IsDone(StitchJobStatus status) {
+        return status != StitchJobStatus::kPending && status != StitchJobStatus::kRunning;
+    }
+
+    /**
+     * \brief the first call sets the result, wakes the waiters and runs the continuations on this thread
+     * \return false if the job was already done
+     */
+    inline bool Complete(const std::shared_ptr<JobState>& state, StitchJobStatus status, int error_code, const std::string& message) {
+        std::vector<Continuation> continuations;
+        StitchJobResult result;
+        {
+            std::lock_guard<std::mutex> lck(state->mutex);
+            if (IsDone(state->result.status)) {
+                return false;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (state->result.status == StitchJobStatus::kRunning) {
+                state->result.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(now - state->start_time).count();
+            }
+            else {
+                state->result.queue_seconds = std::chrono::duration_cast<std::chrono::duration<double>>(now - state->submit_time).count();
+            }
+            state->result.status = status;
+            state->result.error_code = error_code;
+            state->result.message = message;
+            result = state->result;
+            continuations.swap(state->continuations);
+        }
+        state->cond.notify_all();
+        for (const auto& continuation : continuations) {
+            continuation(result);
+        }
+        auto runner = state->runner.lock();
+        if (runner) {
+            std::lock_guard<std::mutex> lck(runner->mutex);
+            runner->finished.push_back(state);
+            runner->cond.notify_one();
+        }
+        return true;
+    }
+}
+
+/**
+ * \class StitchJob
+ * \brief Handle of a VideoStitcher run by a StitchJobRunner. Copies share the job. The result can be
+ * waited for (Wait, WaitFor), polled (Done, Progress), continued with Then, or awaited with co_await
+ * in C++20. Continuations and resumed coroutines run on the thread that ends the job: an SDK thread,
+ * or the runner thread for a cancel or a deadline, so they should hand long work elsewhere.
+ */
+class StitchJob {
+public:
+    StitchJob() {
+    }
+
+    explicit StitchJob(const std::shared_ptr<stitch_job_detail::JobState>& state) : state_(state) {
+    }
+
+    bool Valid() const {
+        return state_ != nullptr;
+    }
+
+    StitchJobStatus Status() const {
+        std::lock_guard<std::mutex> lck(state_->mutex);
+        return state_->result.status;
+    }
+
+    bool Done() const {
+        return stitch_job_detail::IsDone(Status());
+    }
+
+    /**
+     * \brief last progress reported by the SDK, in percent
+     */
+    int Progress() const {
+        return state_->progress.load(std::memory_order_relaxed);
+    }
+
+    StitchJobResult Wait() const {
+        std::unique_lock<std::mutex> lck(state_->mutex);
+        state_->cond.wait(lck, [this]() { return stitch_job_detail::IsDone(state_->result.status); });
+        return state_->result;
+    }
+
+    /**
+     * \return false if the job is still pending or running after timeout
+     */
+    template <typename Rep, typename Period>
+    bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) const {
+        std::unique_lock<std::mutex> lck(state_->mutex);
+        return state_->cond.wait_for(lck, timeout, [this]() { return stitch_job_detail::IsDone(state_->result.status); });
+    }
+
+    /**
+     * \brief the result so far, status kPending or kRunning until the job is done
+     */
+    StitchJobResult Result() const {
+        std::lock_guard<std::mutex> lck(state_->mutex);
+        return state_->result;
+    }
+
+    /**
+     * \brief asynchronous, the job ends with kCancelled unless it ends otherwise first
+     */
+    void Cancel() const {
+        auto runner = state_->runner.lock();
+        if (!runner) {
+            stitch_job_detail::Complete(state_, StitchJobStatus::kCancelled, 0, "cancelled");
+            return;
+        }
+        std::lock_guard<std::mutex> lck(runner->mutex);
+        runner->cancels.push_back(state_);
+        runner->cond.notify_one();
+    }
+
+    /**
+     * \brief run continuation with the result when the job is done, right away on this thread if it already is
+     */
+    void Then(const std::function<void(const StitchJobResult& result)>& continuation) const {
+        std::unique_lock<std::mutex> lck(state_->mutex);
+        if (!stitch_job_detail::IsDone(state_->result.status)) {
+            state_->continuations.push_back(continuation);
+            return;
+        }
+        const StitchJobResult result = state_->result;
+        lck.unlock();
+        continuation(result);
+    }
+
+#ifdef STITCH_JOB_COROUTINES
+    struct Awaiter {
+        std::shared_ptr<stitch_job_detail::JobState> state;
+
+        bool await_ready() const {
+            std::lock_guard<std::mutex> lck(state->mutex);
+            return stitch_job_detail::IsDone(state->result.status);
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lck(state->mutex);
+            if (stitch_job_detail::IsDone(state->result.status)) {
+                return false;
+            }
+            state->continuations.push_back([handle](const StitchJobResult&) { handle.resume(); });
+            return true;
+        }
+
+        StitchJobResult await_resume() const {
+            std::lock_guard<std::mutex> lck(state->mutex);
+            return state->result;
+        }
+    };
+
+    Awaiter operator co_await() const {
+        return Awaiter{ state_ };
+    }
+#endif
+
+private:
+    std::shared_ptr<stitch_job_detail::JobState> state_;
+};
+
+/**
+ * \class StitchJobRunner
+ * \brief Runs VideoStitcher jobs without a blocked thread per job: the SDK drives every job from its own
+ * callbacks, and one runner thread starts queued jobs when a slot frees up, enforces deadlines, cancels,
+ * and releases the stitchers of finished jobs. Destroying the runner cancels the jobs that are not done.
+ */
+class StitchJobRunner {
+public:
+    /**
+     * \param max_running jobs stitched at the same time, 0 for no limit
+     */
+    explicit StitchJobRunner(int max_running = 0)
+        : max_running_(std::max(0, max_running)), core_(std::make_shared<stitch_job_detail::RunnerCore>()) {
+        thread_ = std::thread([this]() { Loop(); });
+    }
+
+    StitchJobRunner(const StitchJobRunner&) = delete;
+    StitchJobRunner& operator=(const StitchJobRunner&) = delete;
+
+    ~StitchJobRunner() {
+        {
+            std::lock_guard<std::mutex> lck(core_->mutex);
+            core_->stop = true;
+            core_->cancels.insert(core_->cancels.end(), core_->pending.begin(), core_->pending.end());
+            core_->cancels.insert(core_->cancels.end(), core_->running.begin(), core_->running.end());
+        }
+        core_->cond.notify_one();
+        thread_.join();
+    }
+
+    /**
+     * \param stitcher fully configured, the runner sets its progress and state callbacks and starts it
+     */
+    StitchJob Submit(const std::shared_ptr<ins::VideoStitcher>& stitcher, const StitchJobOptions& options = StitchJobOptions()) {
+        auto state = std::make_shared<stitch_job_detail::JobState>();
+        state->stitcher = stitcher;
+        state->deadline = options.deadline;
+        state->submit_time = std::chrono::steady_clock::now();
+        state->runner = core_;
+        // the callbacks hold the job weakly, the stitcher is owned by the job
+        std::weak_ptr<stitch_job_detail::JobState> weak_state = state;
+        const auto progress_callback = options.progress_callback;
+        stitcher->SetStitchProgressCallback([weak_state, progress_callback](int process, int error) {
+            auto state = weak_state.lock();
+            if (!state) {
+                return;
+            }
+            if (state->progress.exchange(process, std::memory_order_relaxed) == 0 && process > 0) {
+                std::lock_guard<std::mutex> lck(state->mutex);
+                if (state->result.status == StitchJobStatus::kRunning) {
+                    state->result.first_progress_seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                        std::chrono::steady_clock::now() - state->start_time).count();
+                }
+            }
+            if (progress_callback) {
+                progress_callback(process);
+            }
+            if (process == 100) {
+                stitch_job_detail::Complete(state, StitchJobStatus::kSucceeded, 0, std::string());
+            }
+        });
+        stitcher->SetStitchStateCallback([weak_state](int error, const char* err_info) {
+            auto state = weak_state.lock();
+            if (!state) {
+                return;
+            }
+            StitchJobStatus cancel_status;
+            {
+                std::lock_guard<std::mutex> lck(state->mutex);
+                cancel_status = state->cancel_status;
+            }
+            if (cancel_status != StitchJobStatus::kPending) {
+                stitch_job_detail::Complete(state, cancel_status, error, stitch_job_detail::CancelMessage(cancel_status));
+            }
+            else {
+                stitch_job_detail::Complete(state, StitchJobStatus::kFailed, error, err_info ? err_info : "unknown error");
+            }
+        });
+
+        std::unique_lock<std::mutex> lck(core_->mutex);
+        if (core_->stop) {
+            lck.unlock();
+            stitch_job_detail::Complete(state, StitchJobStatus::kCancelled, 0, "runner stopped");
+            return StitchJob(state);
+        }
+        core_->pending.push_back(state);
+        core_->cond.notify_one();
+        return StitchJob(state);
+    }
+
+    /**
+     * \brief jobs submitted and not done yet
+     */
+    size_t Outstanding() const {
+        std::lock_guard<std::mutex> lck(core_->mutex);
+        return core_->pending.size() + core_->running.size();
+    }
+
+private:
+    using JobStatePtr = std::shared_ptr<stitch_job_detail::JobState>;
+
+    static void Erase(std::vector<JobStatePtr>& jobs, const JobStatePtr& job) {
+        jobs.erase(std::remove(jobs.begin(), jobs.end(), job), jobs.end());
+    }
+
+    /**
+     * \brief A pass handles finished jobs, then cancels and deadlines, then starts queued jobs, and sleeps
+     * until the next deadline or a change. The lists are scanned linearly, a few hundred jobs cost
+     * microseconds per pass.
+     */
+    void Loop() {
+        using namespace stitch_job_detail;
+        std::unique_lock<std::mutex> lck(core_->mutex);
+        while (true) {
+            std::vector<JobStatePtr> finished;
+            finished.swap(core_->finished);
+            for (const auto& job : finished) {
+                Erase(core_->running, job);
+                core_->pending.erase(std::remove(core_->pending.begin(), core_->pending.end(), job), core_->pending.end());
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            std::vector<std::pair<JobStatePtr, StitchJobStatus>> to_cancel;
+            for (const auto& job : core_->cancels) {
+                to_cancel.push_back(std::make_pair(job, StitchJobStatus::kCancelled));
+            }
+            core_->cancels.clear();
+            for (const auto& job : core_->running) {
+                if (job->deadline <= now) {
+                    to_cancel.push_back(std::make_pair(job, StitchJobStatus::kDeadlineExceeded));
+                }
+            }
+            for (const auto& job : core_->pending) {
+                if (job->deadline <= now) {
+                    to_cancel.push_back(std::make_pair(job, StitchJobStatus::kDeadlineExceeded));
+                }
+            }
+            // a cancelled pending job never starts
+            for (const auto& cancel : to_cancel) {
+                core_->pending.erase(std::remove(core_->pending.begin(), core_->pending.end(), cancel.first), core_->pending.end());
+            }
+
+            std::vector<JobStatePtr> to_start;
+            while (!core_->pending.empty() && (max_running_ == 0 || static_cast<int>(core_->running.size()) < max_running_)) {
+                to_start.push_back(core_->pending.front());
+                core_->running.push_back(core_->pending.front());
+                core_->pending.pop_front();
+            }
+
+            // the SDK may call back from inside StartStitch and CancelStitch, so they run without the lock
+            lck.unlock();
+            for (const auto& job : finished) {
+                std::shared_ptr<ins::VideoStitcher> stitcher;
+                {
+                    std::lock_guard<std::mutex> job_lck(job->mutex);
+                    stitcher.swap(job->stitcher);
+                }
+                stitcher.reset();
+            }
+            for (const auto& cancel : to_cancel) {
+                const auto& job = cancel.first;
+                std::shared_ptr<ins::VideoStitcher> stitcher;
+                {
+                    std::lock_guard<std::mutex> job_lck(job->mutex);
+                    if (IsDone(job->result.status)) {
+                        continue;
+                    }
+                    if (job->result.status == StitchJobStatus::kRunning) {
+                        stitcher = job->stitcher;
+                    }
+                    job->cancel_status = cancel.second;
+                }
+                if (stitcher) {
+                    stitcher->CancelStitch();
+                }
+                Complete(job, cancel.second, 0, CancelMessage(cancel.second));
+            }
+            for (const auto& job : to_start) {
+                std::shared_ptr<ins::VideoStitcher> stitcher;
+                {
+                    std::lock_guard<std::mutex> job_lck(job->mutex);
+                    if (IsDone(job->result.status)) {
+                        continue;
+                    }
+                    job->result.status = StitchJobStatus::kRunning;
+                    job->start_time = std::chrono::steady_clock::now();
+                    job->result.queue_seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                        job->start_time - job->submit_time).count();
+                    stitcher = job->stitcher;
+                }
+                stitcher->StartStitch();
+            }
+            lck.lock();
+
+            if (core_->stop && core_->pending.empty() && core_->running.empty() && core_->finished.empty() && core_->cancels.empty()) {
+                break;
+            }
+            auto deadline = std::chrono::steady_clock::time_point::max();
+            for (const auto& job : core_->running) {
+                deadline = std::min(deadline, job->deadline);
+            }
+            for (const auto& job : core_->pending) {
+                deadline = std::min(deadline, job->deadline);
+            }
+            auto ready = [this]() {
+                return core_->stop || !core_->finished.empty() || !core_->cancels.empty() ||
+                    (!core_->pending.empty() && (max_running_ == 0 || static_cast<int>(core_->running.size()) < max_running_));
+            };
+            if (deadline == std::chrono::steady_clock::time_point::max()) {
+                core_->cond.wait(lck, ready);
+            }
+            else {
+                core_->cond.wait_until(lck, deadline, ready);
+            }
+        }
+    }
+
+    int max_running_;
+    std::shared_ptr<stitch_job_detail::RunnerCore> core_;
+    std::thread thread_;
+};
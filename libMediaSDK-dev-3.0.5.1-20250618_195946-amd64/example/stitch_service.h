@@ -0,0 +1,553 @@
+#pragma once
+
+#include <ins_stitcher.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "stitch_job.h"
+
+/**
+ * \brief one STITCH request of the service protocol
+ */
+struct StitchServiceJob {
+    std::string id;
+    std::vector<std::string> inputs;
+    std::string output;               // video output, or
+    std::string image_sequence_dir;   // image sequence output
+    int output_width = 0;             // 0 keeps the service default
+    int output_height = 0;
+    std::string stitch_type;          // empty keeps the service default
+    std::string ai_stitching_model;   // empty keeps the service default
+    std::vector<uint64_t> export_frames;
+    bool progress = false;            // send PROGRESS lines
+};
+
+namespace stitch_service_detail {
+    inline std::vector<std::string> Split(const std::string& text, char delimiter) {
+        std::vector<std::string> tokens;
+        std::string token;
+        std::istringstream stream(text);
+        while (std::getline(stream, token, delimiter)) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+    /**
+     * \brief SDK messages may hold tabs or newlines, which delimit the protocol
+     */
+    inline std::string Sanitize(const std::string& text) {
+        std::string result = text;
+        std::replace(result.begin(), result.end(), '\t', ' ');
+        std::replace(result.begin(), result.end(), '\n', ' ');
+        std::replace(result.begin(), result.end(), '\r', ' ');
+        return result;
+    }
+
+    inline bool ParseJob(const std::vector<std::string>& fields, StitchServiceJob& job, std::string& error) {
+        if (fields.size() < 2 || fields[1].empty()) {
+            error = "missing job id";
+            return false;
+        }
+        job.id = fields[1];
+        for (size_t i = 2; i < fields.size(); i++) {
+            const auto equal = fields[i].find('=');
+            if (equal == std::string::npos) {
+                error = "expected key=value: " + fields[i];
+                return false;
+            }
+            const std::string key = fields[i].substr(0, equal);
+            const std::string value = fields[i].substr(equal + 1);
+            if (key == "inputs") {
+                job.inputs = Split(value, '|');
+            }
+            else if (key == "output") {
+                job.output = value;
+            }
+            else if (key == "image_sequence_dir") {
+                job.image_sequence_dir = value;
+            }
+            else if (key == "output_size") {
+                const auto size = Split(value, 'x');
+                if (size.size() != 2 || atoi(size[0].c_str()) <= 0 || atoi(size[1].c_str()) <= 0) {
+                    error = "bad output_size: " + value;
+                    return false;
+                }
+                job.output_width = atoi(size[0].c_str());
+                job.output_height = atoi(size[1].c_str());
+            }
+            else if (key == "stitch_type") {
+                job.stitch_type = value;
+            }
+            else if (key == "ai_stitching_model") {
+                job.ai_stitching_model = value;
+            }
+            else if (key == "export_frame_index") {
+                for (const auto& frame : Split(value, '-')) {
+                    job.export_frames.push_back(strtoull(frame.c_str(), nullptr, 10));
+                }
+            }
+            else if (key == "progress") {
+                job.progress = value == "1";
+            }
+            else {
+                error = "unknown key: " + key;
+                return false;
+            }
+        }
+        if (job.inputs.empty()) {
+            error = "missing inputs";
+            return false;
+        }
+        if (job.output.empty() == job.image_sequence_dir.empty()) {
+            error = "exactly one of output and image_sequence_dir is needed";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief time since the process was started, so the startup cost includes loading the shared libraries
+     * \return 0 where it can not be read
+     */
+    inline double ProcessAgeMs() {
+#if defined(__linux__)
+        FILE* fp = fopen("/proc/self/stat", "r");
+        if (!fp) {
+            return 0;
+        }
+        char buffer[1024];
+        const size_t size = fread(buffer, 1, sizeof(buffer) - 1, fp);
+        fclose(fp);
+        buffer[size] = 0;
+        // the command name may hold spaces, fields are counted from its closing parenthesis
+        const char* field = strrchr(buffer, ')');
+        unsigned long long start_ticks = 0;
+        for (int i = 2; field && i < 22; i++) {
+            field = strchr(field + 1, ' ');
+        }
+        if (!field || sscanf(field + 1, "%llu", &start_ticks) != 1) {
+            return 0;
+        }
+        fp = fopen("/proc/uptime", "r");
+        double uptime = 0;
+        if (!fp || fscanf(fp, "%lf", &uptime) != 1) {
+            if (fp) {
+                fclose(fp);
+            }
+            return 0;
+        }
+        fclose(fp);
+        return std::max(0.0, (uptime - static_cast<double>(start_ticks) / sysconf(_SC_CLK_TCK)) * 1000);
+#else
+        return 0;
+#endif
+    }
+}
+
+/**
+ * \class StitchService
+ * \brief A resident stitch process: the libraries are loaded and InitEnv runs once, instead of once per
+ * file in a new process. Every job still gets a new VideoStitcher built from model paths, so the stitcher
+ * setup (CUDA, model parsing) is paid by each job and shows in its setup_ms. Jobs come as lines of tab
+ * separated fields on stdin or on a Unix socket, and run on a StitchJobRunner:
+ *
+ *     STITCH <id> inputs=<a.insv>[|<b.insv>] output=<out.mp4> | image_sequence_dir=<dir> [output_size=WxH]
+ *            [stitch_type=template|dynamicstitch|optflow|aistitch] [ai_stitching_model=<path>]
+ *            [export_frame_index=<n-n-...>] [progress=1]
+ *     CANCEL <id>
+ *     STATS
+ *     QUIT         close this connection (end of input on stdin)
+ *     SHUTDOWN     stop accepting connections, finish the jobs and exit
+ *
+ * Replies are QUEUED <id>, PROGRESS <id> <percent>, DONE <id> <status> key=value..., STATS key=value...
+ * and ERROR <id> <message>. DONE reports the time the job waited in the queue, the time to its first
+ * progress report, the stitch time, and the startup cost it did not pay: the process startup and InitEnv
+ * measured when the service came up, 0 for the first job, which paid it.
+ */
+class StitchService {
+public:
+    /**
+     * \brief applies the service settings and the job to a new stitcher
+     * \return false with error if the job can not be run
+     */
+    using ConfigureCallback = std::function<bool(ins::VideoStitcher& stitcher, const StitchServiceJob& job, std::string& error)>;
+    using Writer = std::function<void(const std::string& line)>;
+
+    struct Stats {
+        uint64_t submitted;
+        uint64_t succeeded;
+        uint64_t failed;       // SDK errors and deadlines
+        uint64_t cancelled;
+        uint64_t running;      // queued or stitching
+        double queue_ms;       // sum over the finished jobs
+        double startup_saved_ms;
+    };
+
+    /**
+     * \param max_running jobs stitched at the same time, 0 for no limit
+     * \param startup_ms cost of a cold start of the process, up to the first job
+     */
+    StitchService(int max_running, double startup_ms, const ConfigureCallback& configure)
+        : startup_ms_(startup_ms), configure_(configure), runner_(new StitchJobRunner(max_running)) {
+    }
+
+    ~StitchService() {
+        // cancels what is left, the continuations still see the service
+        runner_.reset();
+    }
+
+    /**
+     * \return false if the line closes the connection (QUIT, SHUTDOWN)
+     */
+    bool HandleLine(const std::string& line, const Writer& writer) {
+        using namespace stitch_service_detail;
+        const std::string trimmed = line.substr(0, line.find_last_not_of("\r\n") + 1);
+        if (trimmed.empty() || trimmed[0] == '#') {
+            return true;
+        }
+        const auto fields = Split(trimmed, '\t');
+        const std::string& command = fields[0];
+        if (command == "STITCH") {
+            Submit(fields, writer);
+        }
+        else if (command == "CANCEL") {
+            const std::string id = fields.size() > 1 ? fields[1] : std::string();
+            std::unique_lock<std::mutex> lck(mutex_);
+            const auto it = active_.find(id);
+            if (it == active_.end()) {
+                lck.unlock();
+                writer("ERROR\t" + id + "\tno such job");
+            }
+            else if (!it->second.Valid()) {
+                lck.unlock();
+                writer("ERROR\t" + id + "\tjob is being queued");
+            }
+            else {
+                const StitchJob job = it->second;
+                lck.unlock();
+                job.Cancel();
+            }
+        }
+        else if (command == "STATS") {
+            writer(FormatStats());
+        }
+        else if (command == "QUIT") {
+            return false;
+        }
+        else if (command == "SHUTDOWN") {
+            std::lock_guard<std::mutex> lck(mutex_);
+            shutdown_ = true;
+            return false;
+        }
+        else {
+            writer("ERROR\t\tunknown command " + Sanitize(command));
+        }
+        return true;
+    }
+
+    /**
+     * \brief block until every submitted job is done
+     */
+    void Drain() {
+        std::unique_lock<std::mutex> lck(mutex_);
+        drained_.wait(lck, [this]() { return active_.empty(); });
+    }
+
+    bool ShutdownRequested() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return shutdown_;
+    }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> lck(mutex_);
+        Stats stats = stats_;
+        stats.running = active_.size();
+        return stats;
+    }
+
+    std::string FormatStats() const {
+        const Stats stats = GetStats();
+        std::ostringstream text;
+        text << "STATS\tsubmitted=" << stats.submitted << "\tsucceeded=" << stats.succeeded << "\tfailed=" << stats.failed
+            << "\tcancelled=" << stats.cancelled << "\trunning=" << stats.running << "\tstartup_ms=" << startup_ms_
+            << "\tqueue_ms=" << stats.queue_ms << "\tstartup_saved_ms=" << stats.startup_saved_ms;
+        return text.str();
+    }
+
+    /**
+     * \brief serve one client on in/out until QUIT, SHUTDOWN or the end of in, then finish the jobs
+     */
+    void ServeStream(std::istream& in, std::ostream& out) {
+        std::mutex out_mutex;
+        const Writer writer = [&out, &out_mutex](const std::string& line) {
+            std::lock_guard<std::mutex> lck(out_mutex);
+            out << line << std::endl;
+        };
+        std::string line;
+        while (std::getline(in, line) && HandleLine(line, writer)) {
+        }
+        Drain();
+        writer(FormatStats());
+    }
+
+#ifndef WIN32
+    /**
+     * \brief serve clients of a Unix stream socket at path, one reader thread per connection, until SHUTDOWN.
+     * An existing path is only replaced if it is a stale socket: any other file, or a socket another
+     * service still accepts on, is an error.
+     */
+    bool ServeUnixSocket(const std::string& path, std::string& error) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        if (path.size() >= sizeof(address.sun_path)) {
+            error = "socket path too long";
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size());
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                error = path + " exists and is not a socket";
+                return false;
+            }
+            const int probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            const bool serving = probe_fd >= 0 && connect(probe_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+            if (probe_fd >= 0) {
+                close(probe_fd);
+            }
+            if (serving) {
+                error = "already serving on " + path;
+                return false;
+            }
+            // nobody accepts on it, left behind by a service that did not shut down
+            unlink(path.c_str());
+        }
+        const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            error = "socket failed";
+            return false;
+        }
+        if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd, 16) != 0) {
+            error = "can not listen on " + path;
+            close(listen_fd);
+            return false;
+        }
+        // a client that goes away must not kill the service
+        signal(SIGPIPE, SIG_IGN);
+
+        std::vector<std::shared_ptr<Connection>> connections;
+        while (!ShutdownRequested()) {
+            // join the readers of closed connections
+            for (auto it = connections.begin(); it != connections.end();) {
+                if ((*it)->closed) {
+                    (*it)->reader.join();
+                    it = connections.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            pollfd poll_fd = { listen_fd, POLLIN, 0 };
+            if (poll(&poll_fd, 1, 200) <= 0) {
+                continue;
+            }
+            const int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            auto connection = std::make_shared<Connection>(fd);
+            connections.push_back(connection);
+            connection->reader = std::thread([this, connection]() { ServeConnection(connection); });
+        }
+        close(listen_fd);
+        unlink(path.c_str());
+
+        Drain();
+        for (const auto& connection : connections) {
+            shutdown(connection->fd, SHUT_RDWR);
+            connection->reader.join();
+        }
+        return true;
+    }
+#endif
+
+private:
+#ifndef WIN32
+    /**
+     * \brief the descriptor is closed with the last reference, so a late reply never reaches a reused descriptor
+     */
+    struct Connection {
+        explicit Connection(int fd) : fd(fd) {
+        }
+
+        ~Connection() {
+            close(fd);
+        }
+
+        const int fd;
+        std::mutex write_mutex;
+        std::thread reader;
+        std::atomic<bool> closed{ false };
+    };
+
+    void ServeConnection(const std::shared_ptr<Connection>& connection) {
+        const Writer writer = [connection](const std::string& line) {
+            const std::string data = line + "\n";
+            std::lock_guard<std::mutex> lck(connection->write_mutex);
+            size_t sent = 0;
+            while (sent < data.size()) {
+                const ssize_t count = send(connection->fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (count <= 0) {
+                    return;
+                }
+                sent += static_cast<size_t>(count);
+            }
+        };
+        std::string buffer;
+        char chunk[4096];
+        while (true) {
+            const ssize_t count = recv(connection->fd, chunk, sizeof(chunk), 0);
+            if (count <= 0) {
+                connection->closed = true;
+                return;
+            }
+            buffer.append(chunk, static_cast<size_t>(count));
+            size_t newline;
+            while ((newline = buffer.find('\n')) != std::string::npos) {
+                const std::string line = buffer.substr(0, newline);
+                buffer.erase(0, newline + 1);
+                if (!HandleLine(line, writer)) {
+                    shutdown(connection->fd, SHUT_RD);
+                    connection->closed = true;
+                    return;
+                }
+            }
+        }
+    }
+#endif
+
+    void Submit(const std::vector<std::string>& fields, const Writer& writer) {
+        using namespace stitch_service_detail;
+        StitchServiceJob job;
+        std::string error;
+        if (!ParseJob(fields, job, error)) {
+            writer("ERROR\t" + job.id + "\t" + Sanitize(error));
+            return;
+        }
+        auto stitcher = std::make_shared<ins::VideoStitcher>();
+        if (!configure_(*stitcher, job, error)) {
+            writer("ERROR\t" + job.id + "\t" + Sanitize(error));
+            return;
+        }
+
+        StitchJobOptions options;
+        if (job.progress) {
+            const std::string id = job.id;
+            auto last_progress = std::make_shared<int>(-1);
+            options.progress_callback = [writer, id, last_progress](int process) {
+                // one SDK thread reports the progress of a job
+                if (process != *last_progress) {
+                    *last_progress = process;
+                    writer("PROGRESS\t" + id + "\t" + std::to_string(process));
+                }
+            };
+        }
+
+        bool id_in_use = false;
+        {
+            // reserve the id, the job is set below
+            std::lock_guard<std::mutex> lck(mutex_);
+            id_in_use = active_.count(job.id) != 0;
+            if (!id_in_use) {
+                active_[job.id] = StitchJob();
+                stats_.submitted++;
+            }
+        }
+        if (id_in_use) {
+            writer("ERROR\t" + job.id + "\tjob id in use");
+            return;
+        }
+        // QUEUED is sent before the job can end
+        writer("QUEUED\t" + job.id);
+        const StitchJob stitch_job = runner_->Submit(stitcher, options);
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            active_[job.id] = stitch_job;
+        }
+        const std::string id = job.id;
+        stitch_job.Then([this, writer, id](const StitchJobResult& result) {
+            OnDone(id, result, writer);
+        });
+    }
+
+    void OnDone(const std::string& id, const StitchJobResult& result, const Writer& writer) {
+        double saved_ms = 0;
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            if (result.Ok()) {
+                // the first job paid the process startup
+                saved_ms = first_job_done_ ? startup_ms_ : 0;
+                first_job_done_ = true;
+            }
+            switch (result.status) {
+            case StitchJobStatus::kSucceeded: stats_.succeeded++; break;
+            case StitchJobStatus::kCancelled: stats_.cancelled++; break;
+            default: stats_.failed++; break;
+            }
+            stats_.queue_ms += result.queue_seconds * 1000;
+            stats_.startup_saved_ms += saved_ms;
+        }
+
+        std::ostringstream text;
+        text << "DONE\t" << id << "\t" << StitchJobStatusName(result.status)
+            << "\tqueue_ms=" << result.queue_seconds * 1000 << "\tsetup_ms=" << result.first_progress_seconds * 1000
+            << "\tstitch_ms=" << result.seconds * 1000 << "\tstartup_saved_ms=" << saved_ms;
+        if (!result.message.empty()) {
+            text << "\tmessage=" << stitch_service_detail::Sanitize(result.message);
+        }
+        writer(text.str());
+
+        std::lock_guard<std::mutex> lck(mutex_);
+        active_.erase(id);
+        if (active_.empty()) {
+            drained_.notify_all();
+        }
+    }
+
+    double startup_ms_;
+    ConfigureCallback configure_;
+    mutable std::mutex mutex_;
+    std::condition_variable drained_;
+    std::map<std::string, StitchJob> active_;
+    Stats stats_ = Stats();
+    bool first_job_done_ = false;
+    bool shutdown_ = false;
+    // last, so it is destroyed first while the rest of the service is alive
+    std::unique_ptr<StitchJobRunner> runner_;
+};
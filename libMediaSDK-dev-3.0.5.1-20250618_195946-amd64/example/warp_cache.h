@@ -0,0 +1,438 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#include <Windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cpu_remap.h"
+
+/**
+ * \brief read the two lenses from a calibration string of Camera::GetCameraOffset(), PreviewParam::offset
+ * or the file metadata: <version>_<radius>_<center x>_<center y>_<angle x>_<angle y>_<angle z> for each lens,
+ * optionally followed by the width and height of the calibration image, further fields are ignored.
+ * Centers and radii are scaled from the calibration image to src_width x src_height, angle z is used as yaw,
+ * angle x as pitch and angle y as roll.
+ */
+inline bool ParseCameraOffset(const std::string& offset, int src_width, int src_height, double fov, FisheyeLens lenses[2]) {
+    std::vector<double> fields;
+    std::istringstream stream(offset);
+    std::string field;
+    while (std::getline(stream, field, '_')) {
+        char* end = nullptr;
+        const double value = strtod(field.c_str(), &end);
+        if (field.empty() || *end != '\0') {
+            return false;
+        }
+        fields.push_back(value);
+    }
+    if (fields.size() < 13) {
+        return false;
+    }
+
+    double scale_x = 1;
+    double scale_y = 1;
+    if (fields.size() >= 15 && fields[13] > 0 && fields[14] > 0) {
+        scale_x = src_width / fields[13];
+        scale_y = src_height / fields[14];
+    }
+    for (int i = 0; i < 2; i++) {
+        const double* lens = &fields[1 + i * 6];
+        lenses[i].radius = lens[0] * scale_x;
+        lenses[i].center_x = lens[1] * scale_x;
+        lenses[i].center_y = lens[2] * scale_y;
+        lenses[i].pitch = lens[3];
+        lenses[i].roll = lens[4];
+        lenses[i].yaw = lens[5];
+        lenses[i].fov = fov;
+        if (lenses[i].radius <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief everything the template lookup tables depend on
+ */
+struct WarpCacheKey {
+    std::string offset;
+    int lens_type = 0;        // ins_camera::CameraLensType
+    int accessory_type = 0;   // ins::CameraAccessoryType
+    int width = 0;            // equirect output
+    int height = 0;
+    int src_width = 0;        // dual fisheye input
+    int src_height = 0;
+    double fov = 200;
+    double blend_width = 10;
+
+    std::string ToString() const {
+        std::ostringstream stream;
+        stream << offset << "|lens=" << lens_type << "|accessory=" << accessory_type
+            << "|out=" << width << "x" << height << "|src=" << src_width << "x" << src_height
+            << "|fov=" << fov << "|blend=" << blend_width;
+        return stream.str();
+    }
+
+    // FNV-1a of ToString(), names the cache file
+    uint64_t Hash() const {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const char c : ToString()) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+namespace warp_cache_detail {
+    const char kMagic[8] = { 'I', 'N', 'S', 'W', 'A', 'R', 'P', '1' };
+    const uint32_t kByteOrderMark = 0x01020304;
+    const uint64_t kSectionAlignment = 64;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t key_size;
+        int32_t width;
+        int32_t height;
+        int32_t src_width;
+        int32_t src_height;
+        uint64_t blend_count;
+        uint64_t span_count;
+        uint64_t file_size;
+    };
+
+    // every table starts on a 64 byte boundary so the kernels can read the mapping in place
+    struct Layout {
+        uint64_t map_x;
+        uint64_t map_y;
+        uint64_t blend_x;
+        uint64_t blend_y;
+        uint64_t blend_alpha;
+        uint64_t spans;
+        uint64_t row_spans;
+        uint64_t end;
+    };
+
+    inline uint64_t Align(uint64_t offset) {
+        return (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+    }
+
+    inline Layout ComputeLayout(const FileHeader& header) {
+        const uint64_t pixels = static_cast<uint64_t>(header.width) * header.height;
+        Layout layout;
+        layout.map_x = Align(sizeof(FileHeader) + header.key_size);
+        layout.map_y = Align(layout.map_x + pixels * sizeof(float));
+        layout.blend_x = Align(layout.map_y + pixels * sizeof(float));
+        layout.blend_y = Align(layout.blend_x + header.blend_count * sizeof(float));
+        layout.blend_alpha = Align(layout.blend_y + header.blend_count * sizeof(float));
+        layout.spans = Align(layout.blend_alpha + header.blend_count);
+        layout.row_spans = Align(layout.spans + header.span_count * sizeof(WarpSpan));
+        layout.end = layout.row_spans + (static_cast<uint64_t>(header.height) + 1) * sizeof(uint32_t);
+        return layout;
+    }
+
+    /**
+     * \brief the span tables of a mapped file stay inside the output rows and the blend tables, so a
+     * corrupt file is rejected instead of making StitchDualFisheyeRows read out of bounds
+     */
+    inline bool ValidSpans(const FileHeader& header, const WarpSpan* spans, const uint32_t* row_spans) {
+        for (int32_t y = 0; y < header.height; y++) {
+            if (row_spans[y] > row_spans[y + 1]) {
+                return false;
+            }
+        }
+        if (row_spans[header.height] > header.span_count) {
+            return false;
+        }
+        for (uint64_t s = 0; s < header.span_count; s++) {
+            const WarpSpan& span = spans[s];
+            if (span.begin < 0 || span.begin >= span.end || span.end > header.width ||
+                static_cast<uint64_t>(span.blend_offset) + (span.end - span.begin) > header.blend_count) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline bool WriteAt(FILE* fp, uint64_t& position, uint64_t offset, const void* data, size_t size) {
+        static const char zeros[kSectionAlignment] = {};
+        if (offset > position && fwrite(zeros, 1, static_cast<size_t>(offset - position), fp) != offset - position) {
+            return false;
+        }
+        position = offset + size;
+        return size == 0 || fwrite(data, 1, size, fp) == size;
+    }
+
+    inline bool WriteWarpFile(const std::string& path, const std::string& key, const DualFisheyeWarp& warp) {
+        FileHeader header{};
+        memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.byte_order = kByteOrderMark;
+        header.key_size = static_cast<uint32_t>(key.size());
+        header.width = warp.width;
+        header.height = warp.height;
+        header.src_width = warp.src_width;
+        header.src_height = warp.src_height;
+        header.blend_count = warp.blend_alpha.size();
+        header.span_count = warp.spans.size();
+        const Layout layout = ComputeLayout(header);
+        header.file_size = layout.end;
+
+#ifdef WIN32
+        FILE* fp = nullptr;
+        if (fopen_s(&fp, path.c_str(), "wb") != 0) {
+            fp = nullptr;
+        }
+#else
+        FILE* fp = fopen(path.c_str(), "wb");
+#endif
+        if (!fp) {
+            return false;
+        }
+        uint64_t position = 0;
+        const bool ok = WriteAt(fp, position, 0, &header, sizeof(header)) &&
+            WriteAt(fp, position, sizeof(header), key.data(), key.size()) &&
+            WriteAt(fp, position, layout.map_x, warp.map_x.data(), warp.map_x.size() * sizeof(float)) &&
+            WriteAt(fp, position, layout.map_y, warp.map_y.data(), warp.map_y.size() * sizeof(float)) &&
+            WriteAt(fp, position, layout.blend_x, warp.blend_x.data(), warp.blend_x.size() * sizeof(float)) &&
+            WriteAt(fp, position, layout.blend_y, warp.blend_y.data(), warp.blend_y.size() * sizeof(float)) &&
+            WriteAt(fp, position, layout.blend_alpha, warp.blend_alpha.data(), warp.blend_alpha.size()) &&
+            WriteAt(fp, position, layout.spans, warp.spans.data(), warp.spans.size() * sizeof(WarpSpan)) &&
+            WriteAt(fp, position, layout.row_spans, warp.row_spans.data(), warp.row_spans.size() * sizeof(uint32_t));
+        return fclose(fp) == 0 && ok;
+    }
+}
+
+/**
+ * \class WarpCacheEntry
+ * \brief lookup tables of one key, either a read-only mapping of the cache file (shared through the
+ * page cache with every other process using the same file) or tables built in this process.
+ */
+class WarpCacheEntry {
+public:
+    WarpCacheEntry() = default;
+    WarpCacheEntry(const WarpCacheEntry&) = delete;
+    WarpCacheEntry& operator=(const WarpCacheEntry&) = delete;
+
+    ~WarpCacheEntry() {
+#ifdef WIN32
+        if (mapping_) {
+            UnmapViewOfFile(mapping_);
+        }
+#else
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+        }
+#endif
+    }
+
+    const DualFisheyeWarpView& View() const {
+        return view_;
+    }
+
+    bool IsMapped() const {
+        return mapping_ != nullptr;
+    }
+
+    /**
+     * \brief map a cache file, fails if it is truncated, from another byte order, for another key or if
+     * its span tables point outside of the file
+     */
+    static std::shared_ptr<WarpCacheEntry> Map(const std::string& path, const std::string& key) {
+        using namespace warp_cache_detail;
+        std::shared_ptr<WarpCacheEntry> entry(new WarpCacheEntry());
+#ifdef WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return nullptr;
+        }
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart >= static_cast<LONGLONG>(sizeof(FileHeader))) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (!mapping) {
+            return nullptr;
+        }
+        entry->mapping_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        entry->mapping_size_ = static_cast<size_t>(size.QuadPart);
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        void* mapping = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(FileHeader))) {
+            mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return nullptr;
+        }
+#ifdef MADV_WILLNEED
+        // start reading ahead now, the first frame touches every page
+        madvise(mapping, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+#endif
+        entry->mapping_ = mapping;
+        entry->mapping_size_ = static_cast<size_t>(st.st_size);
+#endif
+        if (!entry->mapping_) {
+            return nullptr;
+        }
+
+        const uint8_t* base = static_cast<const uint8_t*>(entry->mapping_);
+        FileHeader header;
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.byte_order != kByteOrderMark ||
+            header.file_size != entry->mapping_size_ || sizeof(header) + header.key_size > entry->mapping_size_ ||
+            key.compare(0, std::string::npos, reinterpret_cast<const char*>(base + sizeof(header)), header.key_size) != 0 ||
+            header.width <= 0 || header.height <= 0 || header.src_width < 2 || header.src_height < 2) {
+            return nullptr;
+        }
+        // bound the counts by the file first, so the layout can not wrap around to the right size
+        const uint64_t pixels = static_cast<uint64_t>(header.width) * header.height;
+        if (pixels > header.file_size / (2 * sizeof(float)) || header.blend_count > header.file_size / (2 * sizeof(float)) ||
+            header.span_count > header.file_size / sizeof(WarpSpan)) {
+            return nullptr;
+        }
+        const Layout layout = ComputeLayout(header);
+        if (layout.end != header.file_size || !ValidSpans(header, reinterpret_cast<const WarpSpan*>(base + layout.spans),
+            reinterpret_cast<const uint32_t*>(base + layout.row_spans))) {
+            return nullptr;
+        }
+
+        DualFisheyeWarpView& view = entry->view_;
+        view.width = header.width;
+        view.height = header.height;
+        view.src_width = header.src_width;
+        view.src_height = header.src_height;
+        view.map_x = reinterpret_cast<const float*>(base + layout.map_x);
+        view.map_y = reinterpret_cast<const float*>(base + layout.map_y);
+        view.blend_x = reinterpret_cast<const float*>(base + layout.blend_x);
+        view.blend_y = reinterpret_cast<const float*>(base + layout.blend_y);
+        view.blend_alpha = base + layout.blend_alpha;
+        view.spans = reinterpret_cast<const WarpSpan*>(base + layout.spans);
+        view.row_spans = reinterpret_cast<const uint32_t*>(base + layout.row_spans);
+        return entry;
+    }
+
+    /**
+     * \brief keep tables built in this process, used when the cache directory is not writable
+     */
+    static std::shared_ptr<WarpCacheEntry> Own(std::unique_ptr<DualFisheyeWarp> warp) {
+        std::shared_ptr<WarpCacheEntry> entry(new WarpCacheEntry());
+        entry->view_ = ViewOf(*warp);
+        entry->owned_ = std::move(warp);
+        return entry;
+    }
+
+private:
+    DualFisheyeWarpView view_{};
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    std::unique_ptr<DualFisheyeWarp> owned_;
+};
+
+/**
+ * \class WarpCache
+ * \brief Template lookup tables of the cpu_remap.h experiment persisted in a directory, one <hash>.warp
+ * file per WarpCacheKey. The first cpu_remap_bench run with a new calibration builds and stores the tables,
+ * every later one (in any process) maps the file read-only instead of building them again.
+ */
+class WarpCache {
+public:
+    enum class Source {
+        Memory,   // already used by this process
+        Disk,     // mapped from the cache directory
+        Built     // built now
+    };
+
+    explicit WarpCache(const std::string& dir) : dir_(dir) {
+    }
+
+    std::string PathOf(const WarpCacheKey& key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.warp", static_cast<unsigned long long>(key.Hash()));
+        const bool has_separator = !dir_.empty() && (dir_.back() == '/' || dir_.back() == '\\');
+        return dir_.empty() ? std::string(name) : dir_ + (has_separator ? "" : "/") + name;
+    }
+
+    /**
+     * \return nullptr if the offset string can not be parsed
+     */
+    std::shared_ptr<const WarpCacheEntry> Get(const WarpCacheKey& key, Source* source = nullptr) {
+        const std::string key_string = key.ToString();
+        std::lock_guard<std::mutex> lck(mutex_);
+        auto it = entries_.find(key_string);
+        if (it != entries_.end()) {
+            if (auto entry = it->second.lock()) {
+                if (source) {
+                    *source = Source::Memory;
+                }
+                return entry;
+            }
+        }
+
+        const std::string path = PathOf(key);
+        std::shared_ptr<const WarpCacheEntry> entry = WarpCacheEntry::Map(path, key_string);
+        if (entry) {
+            if (source) {
+                *source = Source::Disk;
+            }
+            entries_[key_string] = entry;
+            return entry;
+        }
+
+        FisheyeLens lenses[2];
+        if (!ParseCameraOffset(key.offset, key.src_width, key.src_height, key.fov, lenses)) {
+            return nullptr;
+        }
+        std::unique_ptr<DualFisheyeWarp> warp(new DualFisheyeWarp());
+        BuildDualFisheyeWarp(lenses, key.src_width, key.src_height, key.width, key.height, key.blend_width, *warp);
+
+        // a per-process temporary name, so concurrent builders never write into the same file
+#ifdef WIN32
+        const std::string tmp_path = path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+        const std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+        if (!warp_cache_detail::WriteWarpFile(tmp_path, key_string, *warp) || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            remove(tmp_path.c_str());
+        }
+        // if another process stored the same key first its file is used, it holds the same tables
+        entry = WarpCacheEntry::Map(path, key_string);
+        if (!entry) {
+            entry = WarpCacheEntry::Own(std::move(warp));
+        }
+        if (source) {
+            *source = Source::Built;
+        }
+        entries_[key_string] = entry;
+        return entry;
+    }
+
+private:
+    std::string dir_;
+    std::mutex mutex_;
+    std::map<std::string, std::weak_ptr<const WarpCacheEntry>> entries_;
+};